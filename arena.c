@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "arena.h"
+#include "gen.h"
+#include "mem.h"
 
 struct arena {
 	void **used_blocks;
@@ -19,7 +21,9 @@ struct arena {
 
 #define DEFAULT_STORAGE_SIZE 8
 
-static arena *current_arena;
+//each thread has its own current arena so that independent instances can
+//translate code concurrently
+static __thread arena *current_arena;
 
 arena *get_current_arena()
 {
@@ -87,3 +91,44 @@ void *try_alloc_arena()
 	track_block(ret);
 	return ret;
 }
+
+void free_arena(arena *a)
+{
+	if (!a) {
+		return;
+	}
+	//all blocks tracked by an arena are code buffers of CODE_ALLOC_SIZE bytes
+	for (size_t i = 0; i < a->used_count; i++)
+	{
+		free_code(a->used_blocks[i], CODE_ALLOC_SIZE);
+	}
+	for (size_t i = 0; i < a->free_count; i++)
+	{
+		free_code(a->free_blocks[i], CODE_ALLOC_SIZE);
+	}
+	free(a->used_blocks);
+	free(a->free_blocks);
+	free(a);
+}
+
+arena *new_arena()
+{
+	return calloc(1, sizeof(arena));
+}
+
+//allocates a code buffer from a specific arena rather than the current one, reusing a block
+//released by mark_arena_free if there is one
+void *alloc_arena_code(arena *a, size_t *size)
+{
+	arena *tmp = set_current_arena(a);
+	void *ret = alloc_code(size);
+	set_current_arena(tmp);
+	return ret;
+}
+
+void mark_arena_free(arena *a)
+{
+	arena *tmp = set_current_arena(a);
+	mark_all_free();
+	set_current_arena(tmp);
+}
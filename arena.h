@@ -6,6 +6,8 @@
 #ifndef ARENA_H_
 #define ARENA_H_
 
+#include <stddef.h>
+
 typedef struct arena arena;
 
 arena *get_current_arena();
@@ -14,5 +16,9 @@ arena *start_new_arena();
 void track_block(void *block);
 void mark_all_free();
 void *try_alloc_arena();
+void free_arena(arena *a);
+arena *new_arena();
+void *alloc_arena_code(arena *a, size_t *size);
+void mark_arena_free(arena *a);
 
 #endif //ARENA_H_
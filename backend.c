@@ -4,7 +4,14 @@
  BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
 */
 #include "backend.h"
+#include "arena.h"
+#ifndef NEW_CORE
+#include "code_store.h"
+#endif
+#include "mem.h"
+#include "util.h"
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef NEW_CORE
 deferred_addr * defer_address(deferred_addr * old_head, uint32_t address, uint8_t *dest)
@@ -34,7 +41,7 @@ void process_deferred(deferred_addr ** head_ptr, void * context, native_addr_fun
 		code_ptr native = get_native(context, cur->address);//get_native_address(opts->native_code_map, cur->address);
 		if (native) {
 			int32_t disp = native - (cur->dest + 4);
-			code_ptr out = cur->dest;
+			code_ptr out = code_writable(cur->dest);
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
@@ -51,6 +58,85 @@ void process_deferred(deferred_addr ** head_ptr, void * context, native_addr_fun
 		}
 	}
 }
+
+//the block comes from the arena of the code cache so it is thrown away with the rest
+void code_cache_alloc_cold(cpu_options *opts)
+{
+	size_t size = CODE_ALLOC_SIZE;
+	opts->cold_code.cur = alloc_arena_code(opts->code.blocks, &size);
+	if (!opts->cold_code.cur) {
+		fatal_error("Failed to allocate memory for generated code\n");
+	}
+	opts->cold_code.last = opts->cold_code.cur + size/sizeof(code_word) - RESERVE_WORDS;
+	opts->cold_code.stack_off = 0;
+	opts->cold_code.blocks = opts->code.blocks;
+}
+
+//called once a CPU core has generated its fixed helper code, everything translated after this point
+//lives in the code cache and is thrown away by code_cache_flush
+void code_cache_init(cpu_options *opts)
+{
+	check_code_prologue(&opts->code);
+	opts->code.blocks = new_arena();
+	if (opts->split_cold) {
+		code_cache_alloc_cold(opts);
+	}
+	//measure the check at the start of each instruction so a CPU stopped there can be resumed at the
+	//same offset in a retranslated copy
+	code_info tmp = opts->code, cold = opts->cold_code;
+	check_cycles_int(opts, 0);
+	opts->prologue_size = opts->code.cur - tmp.cur;
+	opts->code = tmp;
+	opts->cold_code = cold;
+	opts->cache_start = opts->code;
+}
+
+void code_cache_count(cpu_options *opts, uint32_t bytes)
+{
+	opts->cache.used += bytes;
+	opts->cache.translated_bytes += bytes;
+}
+
+void code_cache_count_cold(cpu_options *opts, uint32_t bytes)
+{
+	code_cache_count(opts, bytes);
+	opts->cache.cold_bytes += bytes;
+}
+
+uint8_t code_cache_full(cpu_options *opts)
+{
+	return opts->cache.budget && opts->cache.used >= opts->cache.budget;
+}
+
+//discards all translated code, nothing may be executing from the cache when this is called
+void code_cache_flush(cpu_options *opts, uint32_t map_chunks)
+{
+	for (uint32_t chunk = 0; chunk < map_chunks; chunk++)
+	{
+		if (opts->native_code_map[chunk].base) {
+			free(opts->native_code_map[chunk].offsets);
+			opts->native_code_map[chunk].base = NULL;
+			opts->native_code_map[chunk].offsets = NULL;
+		}
+	}
+	uint32_t ram_inst_slots = ram_size(opts) / 1024;
+	for (uint32_t i = 0; i < ram_inst_slots; i++)
+	{
+		free(opts->ram_inst_sizes[i]);
+		opts->ram_inst_sizes[i] = NULL;
+	}
+	remove_deferred_until(&opts->deferred, NULL);
+	if (opts->store) {
+		code_store_reset(opts->store);
+	}
+	opts->code = opts->cache_start;
+	mark_arena_free(opts->code.blocks);
+	if (opts->split_cold) {
+		code_cache_alloc_cold(opts);
+	}
+	opts->cache.used = 0;
+	opts->cache.flushes++;
+}
 #endif
 
 memmap_chunk const *find_map_chunk(uint32_t address, cpu_options *opts, uint16_t flags, uint32_t *size_sum)
@@ -283,3 +369,121 @@ uint32_t ram_size(cpu_options *opts)
 	}
 	return size;
 }
+
+#ifndef NEW_CORE
+//returns the index of the bit in the dirty page bitmap that covers address, which must be in an MMAP_CODE chunk
+uint32_t ram_dirty_page(cpu_options *opts, uint32_t address)
+{
+	uint32_t meta_off;
+	memmap_chunk const *chunk = find_map_chunk(address, opts, MMAP_CODE, &meta_off);
+	return (((address - chunk->start) & chunk->mask) + meta_off) >> RAM_DIRTY_SHIFT;
+}
+
+//for RAM writes that don't go through the generated memory access functions
+void mark_ram_dirty(cpu_options *opts, void *context, uint32_t address)
+{
+	uint32_t page = ram_dirty_page(opts, address);
+	uint8_t *dirty = (uint8_t *)context + opts->ram_dirty_off;
+	dirty[page >> 3] |= 1 << (page & 7);
+}
+
+//writes in a single frame that switch a page to checked mode
+#define HOT_CODE_WRITES 256
+//frames a checked page has to keep the same contents before it switches back, doubled each time it does
+#define QUIET_FRAMES 60
+#define MAX_COOLDOWN_SHIFT 4
+
+void code_pages_init(cpu_options *opts)
+{
+	opts->code_pages = calloc(ram_size(opts) >> opts->ram_flags_shift, sizeof(code_page));
+	code_page *page = opts->code_pages;
+	for (uint32_t i = 0; i < opts->memmap_chunks; i++)
+	{
+		memmap_chunk const *chunk = opts->memmap + i;
+		if (chunk->flags & MMAP_CODE) {
+			for (uint32_t offset = 0; offset < chunk_size(opts, chunk); offset += 1 << opts->ram_flags_shift)
+			{
+				(page++)->address = chunk->start + offset;
+			}
+		}
+	}
+}
+
+void code_pages_free(cpu_options *opts)
+{
+	uint32_t num_pages = ram_size(opts) >> opts->ram_flags_shift;
+	for (uint32_t i = 0; i < num_pages; i++)
+	{
+		free(opts->code_pages[i].contents);
+	}
+	free(opts->code_pages);
+}
+
+code_page *code_page_at(cpu_options *opts, uint32_t address)
+{
+	uint32_t meta_off;
+	memmap_chunk const *chunk = find_map_chunk(address, opts, MMAP_CODE, &meta_off);
+	if (!chunk || !(chunk->flags & MMAP_CODE)) {
+		return NULL;
+	}
+	return opts->code_pages + ((((address - chunk->start) & chunk->mask) + meta_off) >> opts->ram_flags_shift);
+}
+
+uint8_t code_is_checked(cpu_options *opts, uint32_t address, uint32_t size)
+{
+	code_page *first = code_page_at(opts, address);
+	if (first && first->checked) {
+		return 1;
+	}
+	code_page *last = code_page_at(opts, address + size - 1);
+	return last && last->checked;
+}
+
+code_page *code_page_write(cpu_options *opts, uint32_t address)
+{
+	code_page *page = code_page_at(opts, address);
+	if (!page || page->checked || ++page->code_writes < HOT_CODE_WRITES) {
+		return NULL;
+	}
+	memmap_chunk const *chunk = find_map_chunk(address, opts, 0, NULL);
+	//checked code compares itself with memory at a fixed host address
+	if (!chunk->buffer || (chunk->flags & (MMAP_PTR_IDX | MMAP_ONLY_ODD | MMAP_ONLY_EVEN))) {
+		page->code_writes = 0;
+		return NULL;
+	}
+	uint32_t page_size = 1 << opts->ram_flags_shift;
+	uint32_t offset = ((address - chunk->start) & chunk->mask) & ~(page_size - 1);
+	page->checked = 1;
+	page->quiet_frames = 0;
+	page->host = (uint8_t *)chunk->buffer + offset;
+	page->contents = malloc(page_size);
+	memcpy(page->contents, page->host, page_size);
+	opts->cache.checked_pages++;
+	return page;
+}
+
+void code_pages_frame(cpu_options *opts, void *context, code_page_func leave)
+{
+	uint32_t page_size = 1 << opts->ram_flags_shift;
+	uint32_t num_pages = ram_size(opts) >> opts->ram_flags_shift;
+	for (uint32_t i = 0; i < num_pages; i++)
+	{
+		code_page *page = opts->code_pages + i;
+		page->code_writes = 0;
+		if (!page->checked) {
+			continue;
+		}
+		if (memcmp(page->contents, page->host, page_size)) {
+			memcpy(page->contents, page->host, page_size);
+			page->quiet_frames = 0;
+		} else if (++page->quiet_frames >= QUIET_FRAMES << (page->cooldowns < MAX_COOLDOWN_SHIFT ? page->cooldowns : MAX_COOLDOWN_SHIFT)) {
+			page->checked = 0;
+			page->cooldowns++;
+			free(page->contents);
+			page->contents = NULL;
+			opts->cache.checked_pages--;
+			leave(context, page);
+		}
+	}
+}
+#endif
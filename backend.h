@@ -22,6 +22,8 @@ typedef struct {
 #define INVALID_OFFSET 0xFFFFFFFF
 #define EXTENSION_WORD 0xFFFFFFFE
 #define CYCLE_NEVER 0xFFFFFFFF
+//writes to memory covered by ram_code_flags are also recorded in a dirty page bitmap at this granularity
+#define RAM_DIRTY_SHIFT 8
 
 #if defined(X86_32) || defined(X86_64)
 typedef struct {
@@ -49,6 +51,43 @@ typedef struct deferred_addr {
 	uint32_t             address;
 } deferred_addr;
 
+//counters for the translated code of one CPU
+typedef struct {
+	uint64_t translated_bytes; //total since the CPU was created, including cold_bytes
+	uint64_t translated_insts; //instructions translated since the CPU was created
+	uint64_t cold_bytes;       //total placed in cold_code instead of the code of the instructions
+	uint32_t used;             //bytes translated since the cache was last flushed
+	uint32_t budget;           //cache is flushed at the next safe point once used reaches this, 0 for no limit
+	uint32_t flushes;
+	uint64_t loaded_bytes;     //total loaded from a code store instead of being translated
+	uint64_t indirect_hits;    //jumps to computed addresses resolved by the target cache
+	uint64_t indirect_misses;  //jumps to computed addresses that needed a native code map lookup
+	uint64_t chained_jumps;    //jumps left out because the code of their destination was placed after them
+	uint64_t skipped_flags;    //flag updates left out because a later instruction overwrites the flag first
+	uint64_t batched_checks;   //instruction cycle checks covered by a single check for a block of instructions
+	uint64_t idle_loops;       //branches back to the start of a Z80 idle loop that skip passes through it
+	uint64_t retranslations;   //instructions in RAM translated again because the code they came from changed
+	uint32_t checked_pages;    //pages of RAM currently in checked mode, see code_page
+} code_cache_stats;
+
+//A page of RAM that can hold code, the area covered by one bit of ram_code_flags. Writes to a page with
+//translated code normally invalidate the instructions they hit. Once a page takes too many of those in a
+//frame it switches to checked mode instead: its ram_code_flags bit stays clear so writes go through
+//untouched and each instruction translated from it compares its own code with what it was translated from
+//before running. It switches back once its contents stay the same for a while.
+typedef struct {
+	uint8_t  *contents;        //copy of a checked page taken at the end of the last frame it changed in
+	uint8_t  *host;            //where the page is in host memory while it's checked
+	uint32_t address;          //lowest CPU address of the first byte of the page
+	uint32_t retranslations;   //instructions in the page translated again because their code changed
+	uint16_t code_writes;      //writes that had to look for translated code in the page this frame
+	uint16_t quiet_frames;     //frames in a row a checked page kept the same contents
+	uint8_t  checked;
+	uint8_t  cooldowns;        //times the page left checked mode, each one doubles the wait for the next
+} code_page;
+
+typedef struct code_store code_store;
+
 #include "memmap.h"
 #include "system.h"
 
@@ -58,7 +97,14 @@ typedef struct {
 	native_map_slot    *native_code_map;
 	deferred_addr      *deferred;
 	code_info          code;
+	//paths translated code rarely takes, like the call to handle_cycle_limit_int in every instruction,
+	//are placed here so the code that normally runs stays dense, they stay inline while cur is NULL
+	code_info          cold_code;
+	code_info          cache_start;
 	uint8_t            **ram_inst_sizes;
+	code_page          *code_pages;
+	code_cache_stats   cache;
+	code_store         *store;
 #endif	
 	memmap_chunk const *memmap;
 #ifndef NEW_CORE
@@ -81,7 +127,12 @@ typedef struct {
 	uint32_t           move_pc_size;
 	int32_t            mem_ptr_off;
 	int32_t            ram_flags_off;
+	int32_t            ram_dirty_off;
+	uint32_t           batch_cycles;  //cycles of the instructions translated since batching was set
 	uint8_t            ram_flags_shift;
+	uint8_t            prologue_size;
+	uint8_t            batching;      //cycles() adds to batch_cycles instead of emitting code
+	uint8_t            split_cold;    //set before code_cache_init to give the code cache a cold_code area
 #endif
 	uint8_t            address_size;
 	uint8_t            byte_swap;
@@ -109,7 +160,22 @@ void check_code_prologue(code_info *code);
 void log_address(cpu_options *opts, uint32_t address, char * format);
 
 void retranslate_calc(cpu_options *opts);
+//emits a check that the size bytes of the instruction at address, which are at host, are still what they
+//were when it was translated, jumps to handler with address in scratch1 if they aren't
+void check_code_unchanged(cpu_options *opts, uint32_t address, uint8_t const *host, uint32_t size, code_ptr handler);
 void patch_for_retranslate(cpu_options *opts, code_ptr native_address, code_ptr handler);
+//returns where the jump at pc goes, NULL if there is no cold code or no jump at pc. A cold path that
+//stopped the CPU returns to the code it came from through such a jump
+code_ptr cold_code_return(cpu_options *opts, code_ptr pc);
+
+void code_cache_init(cpu_options *opts);
+//gives cold_code a fresh block, needed again whenever the blocks of the code cache are freed
+void code_cache_alloc_cold(cpu_options *opts);
+void code_cache_count(cpu_options *opts, uint32_t bytes);
+//counts code placed in cold_code, it is part of translated_bytes and the budget too
+void code_cache_count_cold(cpu_options *opts, uint32_t bytes);
+uint8_t code_cache_full(cpu_options *opts);
+void code_cache_flush(cpu_options *opts, uint32_t map_chunks);
 
 code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t num_chunks, ftype fun_type, code_ptr *after_inc);
 #endif
@@ -122,6 +188,23 @@ void write_byte(uint32_t address, uint8_t value, void **mem_pointers, cpu_option
 memmap_chunk const *find_map_chunk(uint32_t address, cpu_options *opts, uint16_t flags, uint32_t *size_sum);
 uint32_t chunk_size(cpu_options *opts, memmap_chunk const *chunk);
 uint32_t ram_size(cpu_options *opts);
+#ifndef NEW_CORE
+uint32_t ram_dirty_page(cpu_options *opts, uint32_t address);
+void mark_ram_dirty(cpu_options *opts, void *context, uint32_t address);
+
+typedef void (*code_page_func)(void *context, code_page *page);
+
+void code_pages_init(cpu_options *opts);
+void code_pages_free(cpu_options *opts);
+//returns the page of RAM address is in, NULL if it's not in a chunk that can hold code
+code_page *code_page_at(cpu_options *opts, uint32_t address);
+//returns 1 if the instruction at address of size bytes has to check its own code
+uint8_t code_is_checked(cpu_options *opts, uint32_t address, uint32_t size);
+//counts a write that had to look for translated code, returns the page if this switched it to checked mode
+code_page *code_page_write(cpu_options *opts, uint32_t address);
+//called once per frame, leave is called for each page that should switch back from checked mode
+void code_pages_frame(cpu_options *opts, void *context, code_page_func leave);
+#endif
 
 #endif //BACKEND_H_
 
@@ -1,9 +1,14 @@
 #include "backend.h"
 #include "gen_x86.h"
+#include "mem.h"
 #include <string.h>
 
 void cycles(cpu_options *opts, uint32_t num)
 {
+	if (opts->batching) {
+		opts->batch_cycles += num;
+		return;
+	}
 	if (opts->limit < 0) {
 		sub_ir(&opts->code, num*opts->clock_divider, opts->cycles, SZ_D);
 	} else {
@@ -22,11 +27,66 @@ void check_cycles_int(cpu_options *opts, uint32_t address)
 		cmp_rr(code, opts->cycles, opts->limit, SZ_D);
 		cc = CC_A;
 	}
+	if (opts->cold_code.cur) {
+		//the call is placed in cold_code and jumps back to the rest of the instruction, the jump to it
+		//for the opposite of cc always has a 32-bit displacement so the check has the same size wherever
+		//the call ends up
+		code_info *cold = &opts->cold_code;
+		check_alloc_code(cold, 2*MAX_INST_LEN);
+		code_ptr stub = cold->cur;
+		jcc(code, cc ^ 1, code->cur + 512);
+		int32_t disp = stub - code->cur;
+		memcpy(code_writable(code->cur - sizeof(disp)), &disp, sizeof(disp));
+		cold->stack_off = code->stack_off;
+		mov_ir(cold, address, opts->scratch1, SZ_D);
+		call(cold, opts->handle_cycle_limit_int);
+		jmp(cold, code->cur);
+		code_cache_count_cold(opts, cold->cur - stub);
+		return;
+	}
 	code_ptr jmp_off = code->cur+1;
 	jcc(code, cc, jmp_off+1);
 	mov_ir(code, address, opts->scratch1, SZ_D);
 	call(code, opts->handle_cycle_limit_int);
-	*jmp_off = code->cur - (jmp_off+1);
+	*code_writable(jmp_off) = code->cur - (jmp_off+1);
+}
+
+void check_code_unchanged(cpu_options *opts, uint32_t address, uint8_t const *host, uint32_t size, code_ptr handler)
+{
+	code_info *code = &opts->code;
+	//the compares are short jumps away from the code for a changed instruction
+	check_alloc_code(code, 16 + size / 2 * 9 + 12);
+	code_ptr changed[8];
+	uint32_t num_changed = 0;
+	mov_ir(code, (intptr_t)host, opts->scratch1, SZ_PTR);
+	for (uint32_t offset = 0; offset < size;)
+	{
+		uint32_t value;
+		uint8_t cmp_size;
+		if (size - offset >= 4) {
+			value = host[offset] | host[offset + 1] << 8 | host[offset + 2] << 16 | (uint32_t)host[offset + 3] << 24;
+			cmp_size = SZ_D;
+		} else if (size - offset >= 2) {
+			value = host[offset] | host[offset + 1] << 8;
+			cmp_size = SZ_W;
+		} else {
+			value = host[offset];
+			cmp_size = SZ_B;
+		}
+		cmp_irdisp(code, value, opts->scratch1, offset, cmp_size);
+		changed[num_changed++] = code->cur + 1;
+		jcc(code, CC_NZ, code->cur + 2);
+		offset += cmp_size == SZ_D ? 4 : cmp_size == SZ_W ? 2 : 1;
+	}
+	code_ptr unchanged = code->cur + 1;
+	jmp(code, code->cur + 2);
+	for (uint32_t i = 0; i < num_changed; i++)
+	{
+		*code_writable(changed[i]) = code->cur - (changed[i] + 1);
+	}
+	mov_ir(code, address, opts->scratch1, SZ_D);
+	jmp(code, handler);
+	*code_writable(unchanged) = code->cur - (unchanged + 1);
 }
 
 void retranslate_calc(cpu_options *opts)
@@ -50,10 +110,30 @@ void retranslate_calc(cpu_options *opts)
 
 void patch_for_retranslate(cpu_options *opts, code_ptr native_address, code_ptr handler)
 {
+	if (opts->cold_code.cur) {
+		//the check at the start is too short for the patch, the call in its cold code is replaced with a
+		//jump to the handler instead and the check with a jump there, which a breakpoint may have done already
+		code_ptr stub = branch_target(native_address);
+		if (!stub) {
+			stub = branch_target(native_address + opts->prologue_size - 6);
+		}
+		code_info tmp = {
+			.cur = stub + opts->move_pc_size,
+			.last = stub + 256,
+			.stack_off = 0
+		};
+		jmp(&tmp, handler);
+		tmp.cur = native_address;
+		tmp.last = native_address + 256;
+		jmp(&tmp, stub);
+		return;
+	}
 	if (!is_mov_ir(native_address)) {
 		//instruction is not already patched for either retranslation or a breakpoint
 		//copy original mov_ir instruction containing PC to beginning of native code area
-		memmove(native_address, native_address + opts->move_pc_off, opts->move_pc_size);
+		//both sides go through the writable view so that memmove sees that they overlap
+		code_ptr writable = code_writable(native_address);
+		memmove(writable, writable + opts->move_pc_off, opts->move_pc_size);
 	}
 	//jump to the retranslation handler
 	code_info tmp = {
@@ -64,6 +144,11 @@ void patch_for_retranslate(cpu_options *opts, code_ptr native_address, code_ptr
 	jmp(&tmp, handler);
 }
 
+code_ptr cold_code_return(cpu_options *opts, code_ptr pc)
+{
+	return opts->cold_code.cur ? branch_target(pc) : NULL;
+}
+
 void check_cycles(cpu_options * opts)
 {
 	code_info *code = &opts->code;
@@ -79,7 +164,7 @@ void check_cycles(cpu_options * opts)
 	code_ptr jmp_off = code->cur+1;
 	jcc(code, cc, jmp_off+1);
 	call(code, opts->handle_cycle_limit);
-	*jmp_off = code->cur - (jmp_off+1);
+	*code_writable(jmp_off) = code->cur - (jmp_off+1);
 }
 
 void log_address(cpu_options *opts, uint32_t address, char * format)
@@ -125,6 +210,7 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 	code_ptr lb_jcc = NULL, ub_jcc = NULL;
 	uint16_t access_flag = is_write ? MMAP_WRITE : MMAP_READ;
 	uint32_t ram_flags_off = opts->ram_flags_off;
+	uint32_t ram_dirty_off = opts->ram_dirty_off;
 	uint32_t min_address = 0;
 	uint32_t max_address = opts->max_address;
 	for (uint32_t chunk = 0; chunk < num_chunks; chunk++)
@@ -183,7 +269,7 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 					}
 					jmp(code, opts->load_context);
 
-					*not_null = code->cur - (not_null + 1);
+					*code_writable(not_null) = code->cur - (not_null + 1);
 				}
 				if ((opts->byte_swap || memmap[chunk].flags & MMAP_BYTESWAP) && size == SZ_B) {
 					xor_ir(code, 1, adr_reg, opts->address_size);
@@ -214,7 +300,7 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 							mov_ir(code, 0xFF, opts->scratch1, SZ_B);
 						}
 						retn(code);
-						*good_addr = code->cur - (good_addr + 1);
+						*code_writable(good_addr) = code->cur - (good_addr + 1);
 						shr_ir(code, 1, adr_reg, opts->address_size);
 					} else if (opts->byte_swap || memmap[chunk].flags & MMAP_BYTESWAP) {
 						xor_ir(code, 1, adr_reg, opts->address_size);
@@ -264,6 +350,9 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 				}
 			}
 			if (is_write && (memmap[chunk].flags & MMAP_CODE)) {
+				mov_rr(code, opts->scratch2, opts->scratch1, opts->address_size);
+				shr_ir(code, RAM_DIRTY_SHIFT, opts->scratch1, opts->address_size);
+				bts_rrdisp(code, opts->scratch1, opts->context_reg, ram_dirty_off, opts->address_size);
 				mov_rr(code, opts->scratch2, opts->scratch1, opts->address_size);
 				shr_ir(code, opts->ram_flags_shift, opts->scratch1, opts->address_size);
 				bt_rrdisp(code, opts->scratch1, opts->context_reg, ram_flags_off, opts->address_size);
@@ -276,7 +365,7 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 				call_args(code, opts->handle_code_write, 2, opts->scratch2, opts->context_reg);
 				mov_rr(code, RAX, opts->context_reg, SZ_PTR);
 				jmp(code, opts->load_context);
-				*not_code = code->cur - (not_code+1);
+				*code_writable(not_code) = code->cur - (not_code+1);
 			}
 			retn(code);
 		} else if (cfun) {
@@ -301,16 +390,18 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 		if (memmap[chunk].flags & MMAP_CODE) {
 			if (memmap[chunk].mask == opts->address_mask) {
 				ram_flags_off += (memmap[chunk].end - memmap[chunk].start) / (1 << opts->ram_flags_shift) / 8; ;
+				ram_dirty_off += (memmap[chunk].end - memmap[chunk].start) >> (RAM_DIRTY_SHIFT + 3);
 			} else {
 				ram_flags_off += (memmap[chunk].mask + 1) /  (1 << opts->ram_flags_shift) / 8;;
+				ram_dirty_off += (memmap[chunk].mask + 1) >> (RAM_DIRTY_SHIFT + 3);
 			}
 		}
 		if (lb_jcc) {
-			*lb_jcc = code->cur - (lb_jcc+1);
+			*code_writable(lb_jcc) = code->cur - (lb_jcc+1);
 			lb_jcc = NULL;
 		}
 		if (ub_jcc) {
-			*ub_jcc = code->cur - (ub_jcc+1);
+			*code_writable(ub_jcc) = code->cur - (ub_jcc+1);
 			ub_jcc = NULL;
 		}
 	}
@@ -0,0 +1,292 @@
+/*
+ Headless throughput benchmark. Runs a ROM, or a built-in test ROM when none is given, for a fixed
+ number of frames through the libblastem instance API without output or frame pacing and prints the
+ frame rate, translated code stats and the host time spent in each emulated component as JSON. Run it
+ with -h for the options. The frame rate comes from an unprofiled run, the component split from a
+ second, profiled run of the same frames.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "util.h"
+#include "test_rom.h"
+
+#define DEFAULT_FRAMES 3000
+
+//how the Z80 is emulated in this build
+#ifdef NEW_CORE
+#define Z80_CORE "interpreter, " CPU_DSL_DISPATCH " dispatch"
+#else
+#define Z80_CORE "dynarec"
+#endif
+
+static const char usage[] =
+	"Usage: %s [-n FRAMES] [-f] [-m] [-i] [-d] [-l] [-s] [-v] [-c | -z | ROM]\n"
+	"  -n FRAMES  number of frames to run, default 3000\n"
+	"  -c         built-in ROM that keeps the 68K busy\n"
+	"  -z         built-in ROM whose Z80 runs a program shaped like a sound driver\n"
+	"  -f         keep the default 68K register mapping\n"
+	"  -m         send all 68K memory accesses through the memory handlers\n"
+	"  -i         keep interrupt checks and traps inline in translated 68K code\n"
+	"  -d         leave out 68K flag updates a later instruction overwrites, which can change the SR\n"
+	"             an interrupt handler sees\n"
+	"  -l         run every pass through Z80 idle loops\n"
+	"  -s         render sound on a separate thread, the ym2612 component is then the time spent on the\n"
+	"             YM2612 timers, queueing sound chip writes and waiting for the sound thread\n"
+	"  -v         draw the VDP output on a separate thread, the vdp component is then the time spent on\n"
+	"             VDP timing, recording accesses and waiting for each frame\n";
+
+typedef struct {
+	char     *rom_path;
+	uint32_t frames;
+	uint8_t  cpu_rom;
+	uint8_t  z80_rom;
+	uint8_t  register_allocation;
+	uint8_t  direct_memory;
+	uint8_t  cold_code;
+	uint8_t  dead_flags;
+	uint8_t  idle_skip;
+	uint8_t  sound_thread;
+	uint8_t  render_thread;
+} bench_options;
+
+static const char *component_names[BLASTEM_PROFILE_COMPONENTS] = {
+	"m68k", "z80", "vdp", "ym2612", "psg"
+};
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	return frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	return 0;
+}
+
+//starts rom with the optimizations in opts, ran is set to the ones the build actually has
+static blastem_instance *start_instance(uint8_t *rom, size_t rom_size, bench_options const *opts, bench_options *ran)
+{
+	blastem_instance *inst = blastem_instance_create();
+	*ran = *opts;
+	ran->register_allocation = blastem_instance_set_register_allocation(inst, opts->register_allocation) && opts->register_allocation;
+	ran->direct_memory = blastem_instance_set_direct_memory(inst, opts->direct_memory) && opts->direct_memory;
+	ran->cold_code = blastem_instance_set_cold_code(inst, opts->cold_code) && opts->cold_code;
+	ran->dead_flags = blastem_instance_set_dead_flags(inst, opts->dead_flags) && opts->dead_flags;
+	ran->idle_skip = blastem_instance_set_idle_skip(inst, opts->idle_skip) && opts->idle_skip;
+	ran->sound_thread = blastem_instance_set_sound_thread(inst, opts->sound_thread) && opts->sound_thread;
+	ran->render_thread = blastem_instance_set_render_thread(inst, opts->render_thread) && opts->render_thread;
+	blastem_instance_set_environment(inst, environment);
+	blastem_instance_set_video_refresh(inst, video_refresh);
+	blastem_instance_set_audio_sample_batch(inst, audio_sample_batch);
+	blastem_instance_set_input_poll(inst, input_poll);
+	blastem_instance_set_input_state(inst, input_state);
+	struct retro_game_info info = {
+		.data = rom,
+		.size = rom_size
+	};
+	if (!blastem_instance_load_game(inst, &info)) {
+		fputs("Failed to load ROM\n", stderr);
+		exit(1);
+	}
+	struct retro_system_av_info av;
+	blastem_instance_get_system_av_info(inst, &av);
+	return inst;
+}
+
+static void parse_options(int argc, char **argv, bench_options *opts)
+{
+	*opts = (bench_options){
+		.frames = DEFAULT_FRAMES,
+		.register_allocation = 1,
+		.direct_memory = 1,
+		.cold_code = 1,
+		.idle_skip = 1
+	};
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			opts->frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-c")) {
+			opts->cpu_rom = 1;
+		} else if (!strcmp(argv[i], "-z")) {
+			opts->z80_rom = 1;
+		} else if (!strcmp(argv[i], "-f")) {
+			opts->register_allocation = 0;
+		} else if (!strcmp(argv[i], "-m")) {
+			opts->direct_memory = 0;
+		} else if (!strcmp(argv[i], "-i")) {
+			opts->cold_code = 0;
+		} else if (!strcmp(argv[i], "-d")) {
+			opts->dead_flags = 1;
+		} else if (!strcmp(argv[i], "-l")) {
+			opts->idle_skip = 0;
+		} else if (!strcmp(argv[i], "-s")) {
+			opts->sound_thread = 1;
+		} else if (!strcmp(argv[i], "-v")) {
+			opts->render_thread = 1;
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, usage, argv[0]);
+			exit(1);
+		} else {
+			opts->rom_path = argv[i];
+		}
+	}
+	if (!opts->frames) {
+		fputs("Frame count must be greater than zero\n", stderr);
+		exit(1);
+	}
+	if (opts->rom_path) {
+		opts->cpu_rom = opts->z80_rom = 0;
+	} else if (opts->cpu_rom) {
+		opts->z80_rom = 0;
+	}
+}
+
+static uint64_t run_frames(blastem_instance *inst, uint32_t frames)
+{
+	uint64_t start = get_time_ns();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		blastem_instance_run(inst);
+	}
+	return get_time_ns() - start;
+}
+
+static void print_json_string(char const *str)
+{
+	putchar('"');
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\') {
+			printf("\\%c", *str);
+		} else if ((unsigned char)*str < ' ') {
+			printf("\\u%04X", *str);
+		} else {
+			putchar(*str);
+		}
+	}
+	putchar('"');
+}
+
+static const char *json_bool(uint8_t value)
+{
+	return value ? "true" : "false";
+}
+
+int main(int argc, char **argv)
+{
+	bench_options opts, ran;
+	parse_options(argc, argv, &opts);
+	uint32_t frames = opts.frames;
+	uint8_t *rom;
+	size_t rom_size;
+	if (opts.rom_path) {
+		FILE *f = fopen(opts.rom_path, "rb");
+		if (!f) {
+			fprintf(stderr, "Failed to open %s\n", opts.rom_path);
+			return 1;
+		}
+		rom_size = file_size(f);
+		rom = malloc(rom_size);
+		if (fread(rom, 1, rom_size, f) != rom_size) {
+			fprintf(stderr, "Failed to read %s\n", opts.rom_path);
+			return 1;
+		}
+		fclose(f);
+	} else {
+		rom = opts.cpu_rom ? build_cpu_test_rom() : opts.z80_rom ? build_z80_test_rom() : build_test_rom();
+		rom_size = TEST_ROM_SIZE;
+	}
+	//the JSON report is the only thing that should end up on stdout
+	disable_stdout_messages();
+
+	blastem_instance *inst = start_instance(rom, rom_size, &opts, &ran);
+	uint64_t elapsed = run_frames(inst, frames);
+	blastem_code_cache_stats m68k_code, z80_code;
+	uint8_t has_code_stats = blastem_instance_get_code_cache_stats(inst, &m68k_code, &z80_code);
+	blastem_instance_destroy(inst);
+
+	inst = start_instance(rom, rom_size, &opts, &ran);
+	uint64_t profile[BLASTEM_PROFILE_COMPONENTS];
+	uint8_t has_profile = blastem_instance_set_profiling(inst, 1);
+	uint64_t profiled_elapsed = run_frames(inst, frames);
+	has_profile = has_profile && blastem_instance_get_profile(inst, profile);
+	blastem_instance_destroy(inst);
+	free(rom);
+
+	struct retro_system_info info;
+	retro_get_system_info(&info);
+	printf("{\n\t\"version\": ");
+	print_json_string(info.library_version);
+	printf(",\n\t\"rom\": ");
+	if (opts.rom_path) {
+		print_json_string(opts.rom_path);
+	} else {
+		printf("null");
+	}
+	printf(",\n\t\"z80_core\": \"%s\"", Z80_CORE);
+	printf(",\n\t\"cpu_rom\": %s", json_bool(ran.cpu_rom));
+	printf(",\n\t\"z80_rom\": %s", json_bool(ran.z80_rom));
+	printf(",\n\t\"register_allocation\": %s", json_bool(ran.register_allocation));
+	printf(",\n\t\"direct_memory\": %s", json_bool(ran.direct_memory));
+	printf(",\n\t\"cold_code\": %s", json_bool(ran.cold_code));
+	printf(",\n\t\"dead_flags\": %s", json_bool(ran.dead_flags));
+	printf(",\n\t\"z80_idle_skip\": %s", json_bool(ran.idle_skip));
+	printf(",\n\t\"sound_thread\": %s", json_bool(ran.sound_thread));
+	printf(",\n\t\"render_thread\": %s", json_bool(ran.render_thread));
+	printf(",\n\t\"frames\": %u", frames);
+	printf(",\n\t\"seconds\": %.6f", elapsed / 1e9);
+	printf(",\n\t\"fps\": %.2f", frames * 1e9 / elapsed);
+	if (has_code_stats) {
+		uint64_t lookups = m68k_code.indirect_hits + m68k_code.indirect_misses;
+		printf(",\n\t\"m68k_code\": {");
+		printf("\"translated_bytes\": %llu", (unsigned long long)m68k_code.translated_bytes);
+		printf(", \"indirect_jumps\": %llu", (unsigned long long)lookups);
+		printf(", \"indirect_hit_rate\": %.4f", lookups ? (double)m68k_code.indirect_hits / lookups : 0.0);
+		printf(", \"chained_jumps\": %llu", (unsigned long long)m68k_code.chained_jumps);
+		printf(", \"skipped_flags\": %llu", (unsigned long long)m68k_code.skipped_flags);
+		printf(", \"batched_checks\": %llu}", (unsigned long long)m68k_code.batched_checks);
+		uint64_t insts = m68k_code.translated_insts, hot = m68k_code.translated_bytes - m68k_code.cold_bytes;
+		printf(",\n\t\"m68k_density\": {");
+		printf("\"instructions\": %llu", (unsigned long long)insts);
+		printf(", \"bytes_per_instruction\": %.2f", insts ? (double)m68k_code.translated_bytes / insts : 0.0);
+		printf(", \"hot_bytes_per_instruction\": %.2f", insts ? (double)hot / insts : 0.0);
+		printf(", \"cold_bytes_per_instruction\": %.2f}", insts ? (double)m68k_code.cold_bytes / insts : 0.0);
+		printf(",\n\t\"z80_code\": {");
+		printf("\"translated_bytes\": %llu", (unsigned long long)z80_code.translated_bytes);
+		printf(", \"idle_loops\": %llu}", (unsigned long long)z80_code.idle_loops);
+	}
+	if (has_profile) {
+		uint64_t total = 0;
+		for (int i = 0; i < BLASTEM_PROFILE_COMPONENTS; i++)
+		{
+			total += profile[i];
+		}
+		printf(",\n\t\"profiled_fps\": %.2f", frames * 1e9 / profiled_elapsed);
+		printf(",\n\t\"components\": {");
+		for (int i = 0; i < BLASTEM_PROFILE_COMPONENTS; i++)
+		{
+			printf("%s\n\t\t\"%s\": {\"seconds\": %.6f, \"percent\": %.2f}", i ? "," : "", component_names[i],
+				profile[i] / 1e9, total ? profile[i] * 100.0 / total : 0.0);
+		}
+		printf("\n\t}");
+	}
+	printf("\n}\n");
+	return 0;
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Builds blastem-bench with each way of emulating the Z80 (the x86 dynarec and the interpreter
+# generated by cpu_dsl.py with call and goto dispatch) and runs every build on the same ROMs.
+# Arguments are ROM paths, -z, -c or nothing for the built-in test ROMs, -n sets the frame count.
+# The tree is cleaned before each build since the generated cores depend on the dispatch.
+import json
+import os
+import shutil
+import subprocess
+from argparse import ArgumentParser
+
+builds = (
+	('dynarec', []),
+	('call', ['NEW_CORE=1', 'DISPATCH=call']),
+	('goto', ['NEW_CORE=1', 'DISPATCH=goto'])
+)
+
+def build(name, flags, jobs):
+	subprocess.check_call(['make', 'clean'], stdout=subprocess.DEVNULL)
+	subprocess.check_call(['make', '-j' + str(jobs), 'NOLTO=1', 'blastem-bench'] + flags, stdout=subprocess.DEVNULL)
+	path = 'blastem-bench-' + name
+	shutil.move('blastem-bench', path)
+	return path
+
+def main():
+	argParser = ArgumentParser(description='Compare the Z80 cores on the same ROMs')
+	argParser.add_argument('-n', '--frames', type=int, default=3000)
+	argParser.add_argument('-j', '--jobs', type=int, default=os.cpu_count())
+	argParser.add_argument('roms', nargs='*', help='ROM files, -z or -c for the built-in ones, the default is the built-in test ROM and -z')
+	args,extra = argParser.parse_known_args()
+	roms = args.roms + extra
+	if not roms:
+		roms = ['', '-z']
+	results = {}
+	for name,flags in builds:
+		path = build(name, flags, args.jobs)
+		for rom in roms:
+			cmd = ['./' + path, '-n', str(args.frames)]
+			if rom:
+				cmd.append(rom)
+			results[(name, rom)] = json.loads(subprocess.check_output(cmd))
+		os.remove(path)
+	print('{0:24} {1:8} {2:>10} {3:>10}'.format('rom', 'core', 'fps', 'z80 s'))
+	for rom in roms:
+		for name,_ in builds:
+			res = results[(name, rom)]
+			z80 = res.get('components', {}).get('z80', {}).get('seconds', 0.0)
+			print('{0:24} {1:8} {2:10.2f} {3:10.3f}'.format(rom or 'test ROM', name, res['fps'], z80))
+
+if __name__ == '__main__':
+	main()
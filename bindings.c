@@ -41,7 +41,8 @@ typedef enum {
 	UI_PLANE_DEBUG,
 	UI_VRAM_DEBUG,
 	UI_CRAM_DEBUG,
-	UI_COMPOSITE_DEBUG
+	UI_COMPOSITE_DEBUG,
+	UI_REWIND
 } ui_action;
 
 typedef struct {
@@ -209,6 +210,10 @@ void handle_binding_down(keybinding * binding)
 	{
 		current_system->mouse_down(current_system, binding->subtype_a, binding->subtype_b);
 	}
+	else if (binding->bind_type == BIND_UI && binding->subtype_a == UI_REWIND && content_binds_enabled)
+	{
+		current_system->rewinding = 1;
+	}
 }
 
 static uint8_t keyboard_captured;
@@ -325,6 +330,11 @@ void handle_binding_up(keybinding * binding)
 				current_system->save_state = QUICK_SAVE_SLOT+1;
 			}
 			break;
+		case UI_REWIND:
+			if (current_system) {
+				current_system->rewinding = 0;
+			}
+			break;
 		case UI_NEXT_SPEED:
 			if (allow_content_binds) {
 				current_speed++;
@@ -663,6 +673,8 @@ int parse_binding_target(int device_num, char * target, tern_node * padbuttons,
 			*subtype_a = UI_CRAM_DEBUG;
 		} else if (!strcmp(target + 3, "compositing_debug")) {
 			*subtype_a = UI_COMPOSITE_DEBUG;
+		} else if (!strcmp(target + 3, "rewind")) {
+			*subtype_a = UI_REWIND;
 		} else {
 			warning("Unreconized UI binding type %s\n", target);
 			return 0;
@@ -0,0 +1,859 @@
+#ifdef __linux__
+//needed for dl_iterate_phdr
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "code_store.h"
+#include "arena.h"
+#include "mem.h"
+
+#if defined(X86_64) && defined(__linux__)
+#define STORE_SUPPORTED
+#include "gen_x86.h"
+#include <link.h>
+#include <elf.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define STORE_VERSION 1
+//the code for the instruction continues into whatever comes after it
+#define RECORD_FALLS_THROUGH 1
+//the code for the instruction was split between two code blocks
+#define RECORD_INVALID       2
+//code placed in cold_code while the instruction was translated, its entry point is in another record
+#define RECORD_COLD          4
+//small enough that a group always fits in a fresh code block when it is loaded
+#define MAX_GROUP_SIZE (CODE_ALLOC_SIZE / 4)
+
+enum {
+	TARGET_GROUP,  //offset from the start of a stored group
+	TARGET_PREFIX, //offset from the end of the helper code in front of the code cache
+	TARGET_IMAGE   //offset from the load address of the emulator binary
+};
+
+//The file consists of a store_header followed by the store_group, stored_record and stored_reloc
+//tables and then the code of all groups starting at a page aligned offset. All offsets are relative
+//to the start of the file unless noted otherwise.
+typedef struct {
+	store_key key;
+	uint32_t  num_groups;
+	uint32_t  num_records;
+	uint32_t  num_relocs;
+	uint32_t  code_size;
+	uint32_t  code_offset;
+	uint32_t  checksum; //of everything after the header
+} store_header;
+
+//code for a run of instructions that is contiguous in the code cache, this is the unit that is
+//copied back into the code cache when a store is loaded
+typedef struct {
+	uint32_t code_offset; //relative to the start of the code in the file
+	uint32_t code_size;
+	uint32_t first_record;
+	uint32_t num_records;
+	uint32_t first_reloc;
+	uint32_t num_relocs;
+} store_group;
+
+typedef struct {
+	uint32_t address;
+	uint32_t native_offset; //relative to the start of the group
+	uint32_t native_size;
+	uint8_t  size;
+	uint8_t  flags;
+	uint8_t  padding[2];
+} stored_record;
+
+typedef struct {
+	int64_t  offset;
+	uint32_t site;  //relative to the start of the group
+	uint32_t group; //only used for TARGET_GROUP
+	uint8_t  kind;
+	uint8_t  target;
+	uint8_t  padding[6];
+} stored_reloc;
+
+//a group while a store is being saved
+typedef struct {
+	code_ptr start;
+	uint32_t size;
+	uint32_t first_record;
+	uint32_t num_records;
+	uint32_t first_reloc;
+	uint32_t num_relocs;
+	uint32_t index;
+	uint8_t  dropped;
+} save_group;
+
+static uint32_t fnv32(uint32_t hash, void const *data, size_t size)
+{
+	//FNV-1a
+	uint8_t const *bytes = data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619;
+	}
+	return hash;
+}
+
+static uint32_t map_hash(cpu_options *opts, uint8_t const *rom, uint32_t rom_size)
+{
+	uint32_t hash = 2166136261U;
+	for (uint32_t i = 0; i < opts->memmap_chunks; i++)
+	{
+		memmap_chunk const *chunk = opts->memmap + i;
+		uint32_t layout[] = {
+			chunk->start, chunk->end, chunk->mask, chunk->aux_mask, chunk->ptr_index, chunk->flags,
+			//which handlers exist and where the buffer is affect the helper code, not their addresses
+			(chunk->read_16 != NULL) | (chunk->write_16 != NULL) << 1 | (chunk->read_8 != NULL) << 2
+				| (chunk->write_8 != NULL) << 3 | (chunk->buffer != NULL) << 4,
+			chunk->buffer >= (void const *)rom && chunk->buffer < (void const *)(rom + rom_size)
+				? (uint8_t const *)chunk->buffer - rom : UINT32_MAX
+		};
+		hash = fnv32(hash, layout, sizeof(layout));
+	}
+	return hash;
+}
+
+#ifdef STORE_SUPPORTED
+//the binary this file was linked into, code refering to it is stored relative to base
+static struct {
+	uint8_t   build_id[20];
+	uintptr_t base;
+	uintptr_t start;
+	uintptr_t end;
+	uint8_t   found;
+} image;
+static pthread_once_t image_once = PTHREAD_ONCE_INIT;
+
+static uint8_t find_build_id(struct dl_phdr_info *info, ElfW(Phdr) const *ph)
+{
+	uint8_t const *note = (uint8_t const *)(info->dlpi_addr + ph->p_vaddr);
+	uint8_t const *end = note + ph->p_memsz;
+	while (note + sizeof(ElfW(Nhdr)) <= end)
+	{
+		ElfW(Nhdr) const *header = (ElfW(Nhdr) const *)note;
+		uint8_t const *name = note + sizeof(ElfW(Nhdr));
+		uint8_t const *desc = name + ((header->n_namesz + 3) & ~3);
+		if (desc + header->n_descsz > end) {
+			break;
+		}
+		if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && !memcmp(name, "GNU", 4)) {
+			memcpy(image.build_id, desc, header->n_descsz < sizeof(image.build_id) ? header->n_descsz : sizeof(image.build_id));
+			return 1;
+		}
+		note = desc + ((header->n_descsz + 3) & ~3);
+	}
+	return 0;
+}
+
+static int find_image(struct dl_phdr_info *info, size_t size, void *data)
+{
+	uintptr_t self = (uintptr_t)data;
+	uintptr_t start = UINTPTR_MAX, end = 0;
+	for (int i = 0; i < info->dlpi_phnum; i++)
+	{
+		ElfW(Phdr) const *ph = info->dlpi_phdr + i;
+		if (ph->p_type == PT_LOAD) {
+			uintptr_t seg = info->dlpi_addr + ph->p_vaddr;
+			start = seg < start ? seg : start;
+			end = seg + ph->p_memsz > end ? seg + ph->p_memsz : end;
+		}
+	}
+	if (self < start || self >= end) {
+		return 0;
+	}
+	image.base = info->dlpi_addr;
+	image.start = start;
+	image.end = end;
+	for (int i = 0; i < info->dlpi_phnum; i++)
+	{
+		if (info->dlpi_phdr[i].p_type == PT_NOTE && find_build_id(info, info->dlpi_phdr + i)) {
+			image.found = 1;
+			return 1;
+		}
+	}
+	//no build ID from the linker, identify the build by its code instead
+	uint32_t hash = 2166136261U;
+	for (int i = 0; i < info->dlpi_phnum; i++)
+	{
+		ElfW(Phdr) const *ph = info->dlpi_phdr + i;
+		if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X)) {
+			hash = fnv32(hash, (void const *)(info->dlpi_addr + ph->p_vaddr), ph->p_filesz);
+			uint32_t seg_size = ph->p_filesz;
+			hash = fnv32(hash, &seg_size, sizeof(seg_size));
+		}
+	}
+	memcpy(image.build_id, "FNV-", 4);
+	memcpy(image.build_id + 4, &hash, sizeof(hash));
+	image.found = 1;
+	return 1;
+}
+
+static void init_image(void)
+{
+	dl_iterate_phdr(find_image, (void *)(uintptr_t)init_image);
+}
+
+static uint32_t reloc_width(uint8_t kind)
+{
+	switch (kind)
+	{
+	case RELOC_REL8:
+		return 1;
+	case RELOC_ABS64:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+static code_ptr reloc_target(code_ptr site, uint8_t kind)
+{
+	int32_t disp;
+	int64_t value;
+	switch (kind)
+	{
+	case RELOC_REL8:
+		return site + 1 + (int8_t)*site;
+	case RELOC_REL32:
+		memcpy(&disp, site, sizeof(disp));
+		return site + 4 + disp;
+	case RELOC_ABS32:
+		memcpy(&disp, site, sizeof(disp));
+		return (code_ptr)(intptr_t)disp;
+	default:
+		memcpy(&value, site, sizeof(value));
+		return (code_ptr)(intptr_t)value;
+	}
+}
+
+static uint8_t patch_reloc(code_ptr site, uint8_t kind, code_ptr target)
+{
+	int64_t value;
+	int32_t small;
+	switch (kind)
+	{
+	case RELOC_REL8:
+		//only used inside a group, so nothing changes when the group is moved
+		return 1;
+	case RELOC_REL32:
+		value = target - (site + 4);
+		break;
+	case RELOC_ABS32:
+		value = (intptr_t)target;
+		break;
+	default:
+		value = (intptr_t)target;
+		memcpy(code_writable(site), &value, sizeof(value));
+		return 1;
+	}
+	if (value > INT32_MAX || value < INT32_MIN) {
+		return 0;
+	}
+	small = value;
+	memcpy(code_writable(site), &small, sizeof(small));
+	return 1;
+}
+
+static void log_site(code_store *store, code_ptr site, uint8_t kind)
+{
+	reloc_log *prev = set_reloc_log(&store->relocs);
+	log_reloc(site, kind);
+	set_reloc_log(prev);
+}
+#endif
+
+code_store *code_store_new(cpu_options *opts, char const *path, uint32_t cpu, uint8_t const *rom_hash,
+	void const *rom, uint32_t rom_size, code_ptr prefix_start, void *context, native_addr_func get_native, store_map_func map)
+{
+#ifdef STORE_SUPPORTED
+	pthread_once(&image_once, init_image);
+	if (!image.found || prefix_start > opts->cache_start.cur || opts->cache_start.cur - prefix_start > CODE_ALLOC_SIZE) {
+		return NULL;
+	}
+	code_store *store = calloc(1, sizeof(code_store));
+	store->path = strdup(path);
+	store->context = context;
+	store->get_native = get_native;
+	store->map = map;
+	store->rom = rom;
+	store->rom_size = rom_size;
+	store->prefix_start = prefix_start;
+	memcpy(store->key.magic, "BECS", sizeof(store->key.magic));
+	store->key.version = STORE_VERSION;
+	memcpy(store->key.build_id, image.build_id, sizeof(store->key.build_id));
+	memcpy(store->key.rom_hash, rom_hash, sizeof(store->key.rom_hash));
+	store->key.cpu = cpu;
+	store->key.flags = opts->flags;
+	store->key.clock_divider = opts->clock_divider;
+	store->key.address_mask = opts->address_mask;
+	store->key.map_hash = map_hash(opts, rom, rom_size);
+	store->key.prefix_size = opts->cache_start.cur - prefix_start;
+	store->key.prologue_size = opts->prologue_size;
+	opts->store = store;
+	return store;
+#else
+	return NULL;
+#endif
+}
+
+void code_store_free(code_store *store)
+{
+	if (!store) {
+		return;
+	}
+	free(store->path);
+	free(store->records);
+	free(store->relocs.sites);
+	free(store);
+}
+
+void code_store_reset(code_store *store)
+{
+	store->num_records = 0;
+	store->relocs.num = 0;
+	store->new_records = 0;
+}
+
+reloc_log *code_store_begin(cpu_options *opts)
+{
+	return set_reloc_log(opts->store ? &opts->store->relocs : NULL);
+}
+
+void code_store_end(reloc_log *prev)
+{
+	set_reloc_log(prev);
+}
+
+static store_record *add_record(code_store *store)
+{
+	if (store->num_records == store->record_storage) {
+		store->record_storage = store->record_storage ? store->record_storage * 2 : 1024;
+		store->records = realloc(store->records, store->record_storage * sizeof(store_record));
+	}
+	return store->records + store->num_records++;
+}
+
+void code_store_record(cpu_options *opts, uint32_t address, uint8_t size, code_ptr start, code_ptr block_last, uint8_t terminal)
+{
+	code_store *store = opts->store;
+	if (!store) {
+		return;
+	}
+	*add_record(store) = (store_record){
+		.native = start,
+		.address = address,
+		.native_size = opts->code.cur - start,
+		.size = size,
+		.flags = (terminal ? 0 : RECORD_FALLS_THROUGH) | (opts->code.last != block_last ? RECORD_INVALID : 0),
+		.first_byte = *start
+	};
+	store->new_records++;
+}
+
+void code_store_record_cold(cpu_options *opts, uint32_t address, uint8_t size, code_ptr start, code_ptr block_last)
+{
+	code_store *store = opts->store;
+	if (!store) {
+		return;
+	}
+	*add_record(store) = (store_record){
+		.native = start,
+		.address = address,
+		.native_size = opts->cold_code.cur - start,
+		.size = size,
+		.flags = RECORD_COLD | (opts->cold_code.last != block_last ? RECORD_INVALID : 0),
+		.first_byte = *start
+	};
+	store->new_records++;
+}
+
+void code_store_extend(cpu_options *opts, code_ptr from)
+{
+	code_store *store = opts->store;
+	if (!store || !store->num_records) {
+		return;
+	}
+	store_record *rec = store->records + store->num_records - 1;
+	//a jump that ended up in a new code block is left out, the record still falls through then
+	if (rec->native + rec->native_size == from && opts->code.cur > from && opts->code.cur - from <= 5) {
+		rec->native_size = opts->code.cur - rec->native;
+		rec->flags &= ~RECORD_FALLS_THROUGH;
+	}
+}
+
+#ifdef STORE_SUPPORTED
+static int compare_records(void const *a, void const *b)
+{
+	code_ptr left = ((store_record const *)a)->native, right = ((store_record const *)b)->native;
+	return left < right ? -1 : left > right;
+}
+
+static int compare_sites(void const *a, void const *b)
+{
+	code_ptr left = ((reloc_site const *)a)->site, right = ((reloc_site const *)b)->site;
+	return left < right ? -1 : left > right;
+}
+
+//checks that the code for a record is still what was translated for ROM contents covered by the hash
+static uint8_t record_current(cpu_options *opts, code_store *store, store_record *rec)
+{
+	if (rec->flags & RECORD_INVALID) {
+		return 0;
+	}
+	memmap_chunk const *chunk = find_map_chunk(rec->address, opts, 0, NULL);
+	if (
+		!chunk || !chunk->buffer || !(chunk->flags & MMAP_READ)
+		|| (chunk->flags & (MMAP_WRITE | MMAP_CODE | MMAP_PTR_IDX))
+		|| (uint8_t const *)chunk->buffer < store->rom || (uint8_t const *)chunk->buffer >= store->rom + store->rom_size
+		|| (rec->address & opts->address_mask) + rec->size > chunk->end
+	) {
+		return 0;
+	}
+	if (rec->flags & RECORD_COLD) {
+		//dropped with the code of the instruction if that changed since it jumps back there
+		return 1;
+	}
+	//breakpoints are inserted by patching a mov, or a jump with cold code, in front of the code for an instruction
+	return store->get_native(store->context, rec->address) == rec->native && *rec->native == rec->first_byte
+		&& !is_mov_ir(rec->native) && !branch_target(rec->native);
+}
+
+static save_group *find_group(save_group *groups, uint32_t num_groups, code_ptr target)
+{
+	uint32_t low = 0, high = num_groups;
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (target < groups[mid].start) {
+			high = mid;
+		} else if (target >= groups[mid].start + groups[mid].size) {
+			low = mid + 1;
+		} else {
+			return groups + mid;
+		}
+	}
+	return NULL;
+}
+
+//fills in a stored_reloc for a site in group, returns 0 if the target can't be relocated
+static uint8_t classify_reloc(cpu_options *opts, code_store *store, save_group *groups, uint32_t num_groups,
+	save_group *group, reloc_site *site, stored_reloc *out)
+{
+	code_ptr target = reloc_target(site->site, site->kind);
+	memset(out, 0, sizeof(*out));
+	out->site = site->site - group->start;
+	out->kind = site->kind;
+	save_group *dest = find_group(groups, num_groups, target);
+	if (site->kind == RELOC_REL8 && dest != group) {
+		return 0;
+	}
+	if (dest) {
+		out->target = TARGET_GROUP;
+		out->group = dest - groups;
+		out->offset = target - dest->start;
+	} else if (target >= store->prefix_start && target < opts->cache_start.cur) {
+		out->target = TARGET_PREFIX;
+		out->offset = target - opts->cache_start.cur;
+	} else if ((uintptr_t)target >= image.start && (uintptr_t)target < image.end) {
+		out->target = TARGET_IMAGE;
+		out->offset = (uintptr_t)target - image.base;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static uint8_t write_store(code_store *store, uint8_t *data, size_t size)
+{
+	size_t path_len = strlen(store->path);
+	char *tmp_path = malloc(path_len + sizeof(".XXXXXX"));
+	memcpy(tmp_path, store->path, path_len);
+	memcpy(tmp_path + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+	//write to a temporary file first so a store that is being loaded is never partially written
+	int fd = mkstemp(tmp_path);
+	uint8_t ret = 0;
+	if (fd >= 0) {
+		size_t written = 0;
+		while (written < size)
+		{
+			ssize_t bytes = write(fd, data + written, size - written);
+			if (bytes <= 0) {
+				break;
+			}
+			written += bytes;
+		}
+		close(fd);
+		ret = written == size && !rename(tmp_path, store->path);
+		if (!ret) {
+			unlink(tmp_path);
+		}
+	}
+	free(tmp_path);
+	return ret;
+}
+#endif
+
+uint8_t code_store_save(cpu_options *opts)
+{
+#ifdef STORE_SUPPORTED
+	code_store *store = opts->store;
+	if (!store || !store->new_records) {
+		return 0;
+	}
+	reloc_log *relocs = &store->relocs;
+	qsort(relocs->sites, relocs->num, sizeof(reloc_site), compare_sites);
+	uint32_t num_sites = 0;
+	for (uint32_t i = 0; i < relocs->num; i++)
+	{
+		//code that was patched after translation logs the same site again
+		if (!num_sites || relocs->sites[num_sites-1].site != relocs->sites[i].site) {
+			relocs->sites[num_sites++] = relocs->sites[i];
+		} else {
+			relocs->sites[num_sites-1].kind = relocs->sites[i].kind;
+		}
+	}
+	relocs->num = num_sites;
+	uint32_t num_records = 0;
+	for (uint32_t i = 0; i < store->num_records; i++)
+	{
+		if (record_current(opts, store, store->records + i)) {
+			store->records[num_records++] = store->records[i];
+		}
+	}
+	store->num_records = num_records;
+	qsort(store->records, num_records, sizeof(store_record), compare_records);
+
+	save_group *groups = NULL;
+	uint32_t num_groups = 0, group_storage = 0;
+	for (uint32_t i = 0; i < num_records; i++)
+	{
+		store_record *rec = store->records + i;
+		save_group *cur = num_groups ? groups + num_groups - 1 : NULL;
+		if (
+			!cur || rec->native != cur->start + cur->size || (rec->flags & RECORD_COLD) != (rec[-1].flags & RECORD_COLD)
+			|| (cur->size + rec->native_size > MAX_GROUP_SIZE && !(rec[-1].flags & RECORD_FALLS_THROUGH))
+		) {
+			if (num_groups == group_storage) {
+				group_storage = group_storage ? group_storage * 2 : 256;
+				groups = realloc(groups, group_storage * sizeof(save_group));
+			}
+			cur = groups + num_groups++;
+			memset(cur, 0, sizeof(*cur));
+			cur->start = rec->native;
+			cur->first_record = i;
+		}
+		cur->size += rec->native_size;
+		cur->num_records++;
+	}
+
+	stored_reloc *stored = NULL;
+	uint32_t num_stored = 0, stored_storage = 0;
+	reloc_site *site = relocs->sites, *sites_end = relocs->sites + relocs->num;
+	for (uint32_t i = 0; i < num_groups; i++)
+	{
+		save_group *group = groups + i;
+		store_record *last = store->records + group->first_record + group->num_records - 1;
+		group->dropped = (last->flags & RECORD_FALLS_THROUGH) || group->size > MAX_GROUP_SIZE;
+		group->first_reloc = num_stored;
+		code_ptr end = group->start + group->size;
+		while (site < sites_end && site->site < group->start)
+		{
+			site++;
+		}
+		for (; !group->dropped && site < sites_end && site->site < end; site++)
+		{
+			if (num_stored == stored_storage) {
+				stored_storage = stored_storage ? stored_storage * 2 : 1024;
+				stored = realloc(stored, stored_storage * sizeof(stored_reloc));
+			}
+			if (
+				site->site + reloc_width(site->kind) > end
+				|| !classify_reloc(opts, store, groups, num_groups, group, site, stored + num_stored)
+			) {
+				group->dropped = 1;
+			} else {
+				num_stored++;
+			}
+		}
+		group->num_relocs = num_stored - group->first_reloc;
+	}
+	//anything that jumps into code that isn't stored can't be stored either
+	uint8_t changed;
+	do {
+		changed = 0;
+		for (uint32_t i = 0; i < num_groups; i++)
+		{
+			save_group *group = groups + i;
+			for (uint32_t j = 0; !group->dropped && j < group->num_relocs; j++)
+			{
+				stored_reloc *reloc = stored + group->first_reloc + j;
+				if (reloc->target == TARGET_GROUP && groups[reloc->group].dropped) {
+					group->dropped = changed = 1;
+				}
+			}
+		}
+	} while (changed);
+
+	store_header header;
+	memset(&header, 0, sizeof(header));
+	header.key = store->key;
+	for (uint32_t i = 0; i < num_groups; i++)
+	{
+		if (!groups[i].dropped) {
+			groups[i].index = header.num_groups++;
+			header.num_records += groups[i].num_records;
+			header.num_relocs += groups[i].num_relocs;
+			header.code_size += groups[i].size;
+		}
+	}
+	size_t tables = sizeof(store_header) + header.num_groups * sizeof(store_group)
+		+ header.num_records * sizeof(stored_record) + header.num_relocs * sizeof(stored_reloc);
+	header.code_offset = (tables + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+	size_t size = header.code_offset + header.code_size;
+	uint8_t *data = calloc(1, size);
+	store_group *out_group = (store_group *)(data + sizeof(store_header));
+	stored_record *out_record = (stored_record *)(out_group + header.num_groups);
+	stored_reloc *out_reloc = (stored_reloc *)(out_record + header.num_records);
+	uint8_t *out_code = data + header.code_offset;
+	uint32_t record_index = 0, reloc_index = 0, code_offset = 0;
+	for (uint32_t i = 0; i < num_groups; i++)
+	{
+		save_group *group = groups + i;
+		if (group->dropped) {
+			continue;
+		}
+		*(out_group++) = (store_group){
+			.code_offset = code_offset,
+			.code_size = group->size,
+			.first_record = record_index,
+			.num_records = group->num_records,
+			.first_reloc = reloc_index,
+			.num_relocs = group->num_relocs
+		};
+		for (uint32_t j = 0; j < group->num_records; j++)
+		{
+			store_record *rec = store->records + group->first_record + j;
+			*(out_record++) = (stored_record){
+				.address = rec->address,
+				.native_offset = rec->native - group->start,
+				.native_size = rec->native_size,
+				.size = rec->size,
+				.flags = rec->flags
+			};
+		}
+		for (uint32_t j = 0; j < group->num_relocs; j++)
+		{
+			stored_reloc reloc = stored[group->first_reloc + j];
+			if (reloc.target == TARGET_GROUP) {
+				reloc.group = groups[reloc.group].index;
+			}
+			*(out_reloc++) = reloc;
+		}
+		memcpy(out_code + code_offset, group->start, group->size);
+		record_index += group->num_records;
+		reloc_index += group->num_relocs;
+		code_offset += group->size;
+	}
+	header.checksum = fnv32(2166136261U, data + sizeof(store_header), size - sizeof(store_header));
+	memcpy(data, &header, sizeof(header));
+	uint8_t ret = header.num_groups && write_store(store, data, size);
+	if (ret) {
+		store->new_records = 0;
+	}
+	free(data);
+	free(stored);
+	free(groups);
+	return ret;
+#else
+	return 0;
+#endif
+}
+
+#ifdef STORE_SUPPORTED
+//checks that everything in a mapped store file is in bounds and refers to things that exist
+static uint8_t store_valid(code_store *store, uint8_t const *data, size_t size)
+{
+	store_header const *header = (store_header const *)data;
+	if (size < sizeof(store_header) || memcmp(&header->key, &store->key, sizeof(store_key))) {
+		return 0;
+	}
+	uint64_t tables = sizeof(store_header) + (uint64_t)header->num_groups * sizeof(store_group)
+		+ (uint64_t)header->num_records * sizeof(stored_record) + (uint64_t)header->num_relocs * sizeof(stored_reloc);
+	if (
+		tables > header->code_offset || (uint64_t)header->code_offset + header->code_size != size
+		|| fnv32(2166136261U, data + sizeof(store_header), size - sizeof(store_header)) != header->checksum
+	) {
+		return 0;
+	}
+	store_group const *groups = (store_group const *)(data + sizeof(store_header));
+	stored_record const *records = (stored_record const *)(groups + header->num_groups);
+	stored_reloc const *relocs = (stored_reloc const *)(records + header->num_records);
+	for (uint32_t i = 0; i < header->num_groups; i++)
+	{
+		store_group const *group = groups + i;
+		if (
+			!group->code_size || group->code_size > MAX_GROUP_SIZE
+			|| (uint64_t)group->code_offset + group->code_size > header->code_size
+			|| (uint64_t)group->first_record + group->num_records > header->num_records
+			|| (uint64_t)group->first_reloc + group->num_relocs > header->num_relocs
+		) {
+			return 0;
+		}
+		for (uint32_t j = 0; j < group->num_records; j++)
+		{
+			stored_record const *rec = records + group->first_record + j;
+			if (!rec->size || !rec->native_size || (uint64_t)rec->native_offset + rec->native_size > group->code_size) {
+				return 0;
+			}
+		}
+		for (uint32_t j = 0; j < group->num_relocs; j++)
+		{
+			stored_reloc const *reloc = relocs + group->first_reloc + j;
+			if (reloc->kind > RELOC_ABS32 || (uint64_t)reloc->site + reloc_width(reloc->kind) > group->code_size) {
+				return 0;
+			}
+			switch (reloc->target)
+			{
+			case TARGET_GROUP:
+				if (
+					reloc->group >= header->num_groups || reloc->offset < 0 || reloc->offset >= groups[reloc->group].code_size
+					|| (reloc->kind == RELOC_REL8 && reloc->group != i)
+				) {
+					return 0;
+				}
+				break;
+			case TARGET_PREFIX:
+				if (reloc->offset >= 0 || reloc->offset < -(int64_t)store->key.prefix_size) {
+					return 0;
+				}
+				break;
+			case TARGET_IMAGE:
+				if (reloc->offset < (int64_t)(image.start - image.base) || reloc->offset >= (int64_t)(image.end - image.base)) {
+					return 0;
+				}
+				break;
+			default:
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static uint32_t load_store(cpu_options *opts, code_store *store, uint8_t const *data)
+{
+	store_header const *header = (store_header const *)data;
+	store_group const *groups = (store_group const *)(data + sizeof(store_header));
+	stored_record const *records = (stored_record const *)(groups + header->num_groups);
+	stored_reloc const *relocs = (stored_reloc const *)(records + header->num_records);
+	uint8_t const *code = data + header->code_offset;
+	code_ptr *bases = malloc(header->num_groups * sizeof(code_ptr));
+	code_info orig = opts->code;
+	for (uint32_t i = 0; i < header->num_groups; i++)
+	{
+		//the records of a group are either all cold or none of them are
+		code_info *dest = (records[groups[i].first_record].flags & RECORD_COLD) && opts->cold_code.cur
+			? &opts->cold_code : &opts->code;
+		check_alloc_code(dest, groups[i].code_size);
+		bases[i] = dest->cur;
+		memcpy(code_writable(bases[i]), code + groups[i].code_offset, groups[i].code_size);
+		dest->cur += groups[i].code_size;
+	}
+	for (uint32_t i = 0; i < header->num_groups; i++)
+	{
+		for (uint32_t j = 0; j < groups[i].num_relocs; j++)
+		{
+			stored_reloc const *reloc = relocs + groups[i].first_reloc + j;
+			code_ptr target;
+			switch (reloc->target)
+			{
+			case TARGET_GROUP:
+				target = bases[reloc->group] + reloc->offset;
+				break;
+			case TARGET_PREFIX:
+				target = opts->cache_start.cur + reloc->offset;
+				break;
+			default:
+				target = (code_ptr)(image.base + reloc->offset);
+				break;
+			}
+			if (!patch_reloc(bases[i] + reloc->site, reloc->kind, target)) {
+				//a target moved out of range since the store was saved, translate everything instead
+				opts->code = orig;
+				mark_arena_free(opts->code.blocks);
+				if (opts->split_cold) {
+					code_cache_alloc_cold(opts);
+				}
+				free(bases);
+				return 0;
+			}
+		}
+	}
+	for (uint32_t i = 0; i < header->num_groups; i++)
+	{
+		for (uint32_t j = 0; j < groups[i].num_records; j++)
+		{
+			stored_record const *rec = records + groups[i].first_record + j;
+			code_ptr native = bases[i] + rec->native_offset;
+			if (!(rec->flags & RECORD_COLD)) {
+				store->map(store->context, rec->address, native, rec->size, rec->native_size);
+			}
+			*add_record(store) = (store_record){
+				.native = native,
+				.address = rec->address,
+				.native_size = rec->native_size,
+				.size = rec->size,
+				.flags = rec->flags,
+				.first_byte = *native
+			};
+		}
+		for (uint32_t j = 0; j < groups[i].num_relocs; j++)
+		{
+			stored_reloc const *reloc = relocs + groups[i].first_reloc + j;
+			log_site(store, bases[i] + reloc->site, reloc->kind);
+		}
+	}
+	free(bases);
+	opts->cache.used += header->code_size;
+	opts->cache.loaded_bytes += header->code_size;
+	return header->num_records;
+}
+#endif
+
+uint32_t code_store_load(cpu_options *opts)
+{
+#ifdef STORE_SUPPORTED
+	code_store *store = opts->store;
+	//stored code can only be placed in a cache that doesn't have any translations yet
+	if (!store || opts->code.cur != opts->cache_start.cur || store->num_records) {
+		return 0;
+	}
+	int fd = open(store->path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < sizeof(store_header) || st.st_size > UINT32_MAX) {
+		close(fd);
+		return 0;
+	}
+	uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+	uint32_t loaded = store_valid(store, data, st.st_size) ? load_store(opts, store, data) : 0;
+	munmap(data, st.st_size);
+	return loaded;
+#else
+	return 0;
+#endif
+}
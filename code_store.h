@@ -0,0 +1,76 @@
+#ifndef CODE_STORE_H_
+#define CODE_STORE_H_
+
+#include "backend.h"
+
+//Translated code for instructions in ROM is saved to a file when a system is freed and loaded back
+//into the code cache the next time the same ROM is run with the same build of the emulator. Only
+//code that can be relocated is saved, anything referring to something other than the fixed helper
+//code of the CPU core, other saved code or the emulator binary itself is translated again
+
+enum {
+	STORE_CPU_68K = 1,
+	STORE_CPU_Z80
+};
+
+typedef void (*store_map_func)(void *context, uint32_t address, code_ptr native, uint8_t size, uint32_t native_size);
+
+typedef struct {
+	code_ptr native;
+	uint32_t address;
+	uint32_t native_size;
+	uint8_t  size;
+	uint8_t  flags;
+	uint8_t  first_byte; //a breakpoint or retranslation patch changes this
+} store_record;
+
+typedef struct {
+	char     magic[4];
+	uint32_t version;
+	uint8_t  build_id[20];
+	uint8_t  rom_hash[20];
+	uint32_t cpu;
+	uint32_t flags;
+	uint32_t clock_divider;
+	uint32_t address_mask;
+	uint32_t map_hash;
+	uint32_t prefix_size;
+	uint32_t prologue_size;
+} store_key;
+
+struct code_store {
+	char             *path;
+	void             *context;
+	native_addr_func get_native;
+	store_map_func   map;
+	uint8_t const    *rom;
+	code_ptr         prefix_start;
+	store_record     *records;
+	reloc_log        relocs;
+	store_key        key;
+	uint32_t         rom_size;
+	uint32_t         num_records;
+	uint32_t         record_storage;
+	//number of records added since the store was loaded or saved, nothing is written if this is 0
+	uint32_t         new_records;
+};
+
+//returns NULL if the code store is not supported on this host
+code_store *code_store_new(cpu_options *opts, char const *path, uint32_t cpu, uint8_t const *rom_hash,
+	void const *rom, uint32_t rom_size, code_ptr prefix_start, void *context, native_addr_func get_native, store_map_func map);
+void code_store_free(code_store *store);
+//loads stored code into an empty code cache, returns the number of instructions loaded
+uint32_t code_store_load(cpu_options *opts);
+uint8_t code_store_save(cpu_options *opts);
+//starts recording the code translated on this thread, returns the previous reloc log for code_store_end
+reloc_log *code_store_begin(cpu_options *opts);
+void code_store_end(reloc_log *prev);
+//called for each translated instruction, block_last is code.last from before it was translated
+void code_store_record(cpu_options *opts, uint32_t address, uint8_t size, code_ptr start, code_ptr block_last, uint8_t terminal);
+//called for the code placed in cold_code while an instruction was translated, before code_store_record
+void code_store_record_cold(cpu_options *opts, uint32_t address, uint8_t size, code_ptr start, code_ptr block_last);
+//called after a jump to already translated code is emitted at from right after an instruction
+void code_store_extend(cpu_options *opts, code_ptr from);
+void code_store_reset(code_store *store);
+
+#endif //CODE_STORE_H_
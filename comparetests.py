@@ -5,8 +5,12 @@ from sys import exit,argv
 
 prefixes = []
 skip = set()
+trans_args = []
 for i in range(1, len(argv)):
-	if '.' in argv[i]:
+	if argv[i] == '-b':
+		#batch the cycle checks of the translated code, the results have to match musashi either way
+		trans_args.append('-b')
+	elif '.' in argv[i]:
 		f = open(argv[i])
 		for line in f:
 			parts = line.split()
@@ -74,7 +78,7 @@ for path in glob('generated_tests/*/*.bin'):
 		if not good:
 			continue
 	try:
-		b = subprocess.check_output(['./trans', path])
+		b = subprocess.check_output(['./trans'] + trans_args + [path])
 		try:
 			m = subprocess.check_output(['musashi/mustrans', path])
 			#_,_,b = b.partition('\n')
@@ -1,5 +1,8 @@
 #!/usr/bin/env python3
 
+#raised when an instruction can't be generated with fields that are only known when it runs
+class GenericUnsupported(Exception):
+	pass
 
 class Block:
 	def addOp(self, op):
@@ -146,7 +149,19 @@ class Instruction(Block):
 			funName += '_{0}_{1:0>{2}}'.format(name, bin(fieldVals[name])[2:], fieldBits[name])
 		return funName
 		
-	def generateBody(self, value, prog, otype):
+	#fields are read from the opcode when the generic version of an instruction runs
+	def genericFieldVals(self, opcode):
+		fieldVals = {}
+		for field in self.fields:
+			shift,bits = self.fields[field]
+			fieldVals[field] = '(({op} >> {shift}) & {mask})'.format(op = opcode, shift = shift, mask = (1 << bits) - 1)
+		return fieldVals
+	
+	def generateGenericName(self):
+		return self.name + '_generic'
+	
+	#generates a body that handles all values with fields taken from fieldVals instead of a single value
+	def generateBody(self, value, prog, otype, successors=None, fieldVals=None):
 		output = []
 		prog.meta = {}
 		prog.pushScope(self)
@@ -154,13 +169,17 @@ class Instruction(Block):
 		for var in self.locals:
 			output.append('\n\tuint{sz}_t {name};'.format(sz=self.locals[var], name=var))
 		self.newLocals = []
-		fieldVals,_ = self.getFieldVals(value)
+		if fieldVals is None:
+			fieldVals,_ = self.getFieldVals(value)
+			name = self.generateName(value)
+		else:
+			name = self.generateGenericName()
 		self.processOps(prog, fieldVals, output, otype, self.implementation)
 		
 		if prog.dispatch == 'call':
-			begin = '\nvoid ' + self.generateName(value) + '(' + prog.context_type + ' *context, uint32_t target_cycle)\n{'
+			begin = '\nvoid ' + name + '(' + prog.context_type + ' *context, uint32_t target_cycle)\n{'
 		elif prog.dispatch == 'goto':
-			begin = '\n' + self.generateName(value) + ': {'
+			begin = '\n' + name + ': {'
 		else:
 			raise Exception('Unsupported dispatch type ' + prog.dispatch)
 		if prog.needFlagCoalesce:
@@ -173,8 +192,15 @@ class Instruction(Block):
 			begin += '\n\tuint{sz}_t gen_tmp{sz}__;'.format(sz=size)
 		prog.popScope()
 		if prog.dispatch == 'goto':
-			output += prog.nextInstruction(otype)
+			output += prog.nextInstruction(otype, successors)
 		return begin + ''.join(output) + '\n}'
+	
+	#returns True if the instruction always continues in another dispatch table, like a prefix
+	def dispatchesFirst(self):
+		for op in self.implementation:
+			if isinstance(op, NormalOp) and op.op == 'dispatch':
+				return True
+		return False
 		
 	def __str__(self):
 		pieces = [self.name + ' ' + hex(self.value) + ' ' + str(self.fields)]
@@ -267,7 +293,7 @@ class Op:
 				b = params[1]
 			needsSizeAdjust = False
 			if len(params) > 3:
-				size = params[3]
+				size = prog.constParam(params[3])
 				if size == 0:
 					size = 8
 				elif size == 1:
@@ -328,7 +354,7 @@ class Op:
 			decl = ''
 			needsSizeAdjust = False
 			if len(params) > 2:
-				size = params[2]
+				size = prog.constParam(params[2])
 				if size == 0:
 					size = 8
 				elif size == 1:
@@ -411,10 +437,24 @@ def _dispatchCImpl(prog, params):
 		table = 'main'
 	else:
 		table = params[1]
+	output = ''
+	if prog.instrument:
+		output += '\n\tprofile_ops[{tbl}][{op}]++;'.format(tbl = prog.tableIndex(table), op = params[0])
+		if table == 'main':
+			output += '\n\tprofile_pairs[profile_last][{op}]++;\n\tprofile_last = {op};'.format(op = params[0])
+	if prog.dispatch == 'goto' and table in prog.genericTables:
+		#the generic handlers read their fields from the opcode
+		output += '\n\topcode__ = {op};'.format(op = params[0])
 	if prog.dispatch == 'call':
-		return '\n\timpl_{tbl}[{op}](context, target_cycle);'.format(tbl = table, op = params[0])
+		return output + '\n\timpl_{tbl}[{op}](context, target_cycle);'.format(tbl = table, op = params[0])
 	elif prog.dispatch == 'goto':
-		return '\n\tgoto *impl_{tbl}[{op}];'.format(tbl = table, op = params[0])
+		if table == 'main' and prog.successors:
+			#superinstructions, the likely next instructions are placed right here and reached with a
+			#compare and a direct jump instead of the indirect one
+			for value,body in prog.successors:
+				output += '\n\tif ({op} == {val}) {body}'.format(op = params[0], val = hex(value), body = body)
+			prog.successors = None
+		return output + '\n\tgoto *impl_{tbl}[{op}];'.format(tbl = table, op = params[0])
 	else:
 		raise Exception('Unsupported dispatch type ' + prog.dispatch)
 
@@ -583,7 +623,7 @@ def _cmpCImpl(prog, params, rawParams, flagUpdates):
 		scope.addLocal(tmpvar, size)
 	prog.lastDst = rawParams[1]
 	if len(params) > 2:
-		size = params[2]
+		size = prog.constParam(params[2])
 		if size == 0:
 			size = 8
 		elif size == 1:
@@ -621,7 +661,7 @@ def _sext(size, src):
 		return src | 0xFFFF0000 if src & 0x8000 else src & 0x7FFF
 
 def _sextCImpl(prog, params, rawParms):
-	if params[0] == 16:
+	if prog.constParam(params[0]) == 16:
 		fmt = '\n\t{dst} = {src} & 0x80 ? {src} | 0xFF00 : {src} & 0x7F;'
 	else:
 		fmt = '\n\t{dst} = {src} & 0x8000 ? {src} | 0xFFFF0000 : {src} & 0x7FFF;'
@@ -1021,6 +1061,7 @@ class Switch(ChildBlock):
 		else:
 			oldCond = prog.conditional
 			prog.conditional = True
+			metaBefore = dict(prog.meta)
 			output.append('\n\tswitch(' + param + ')')
 			output.append('\n\t{')
 			for case in self.cases:
@@ -1045,6 +1086,7 @@ class Switch(ChildBlock):
 				#prog.temp = temp
 			output.append('\n\t}')
 			prog.conditional = oldCond
+			prog.checkGenericMeta(metaBefore)
 		prog.popScope()
 	
 	def __str__(self):
@@ -1166,6 +1208,7 @@ class If(ChildBlock):
 					self._genConstParam(cond, prog, fieldVals, output, otype)
 				else:
 					#temp = prog.temp.copy()
+					metaBefore = dict(prog.meta)
 					output.append('\n\tif ({cond}) '.format(cond=cond) + '{')
 					oldCond = prog.conditional
 					prog.conditional = True
@@ -1178,6 +1221,7 @@ class If(ChildBlock):
 						#prog.temp = temp
 					output.append('\n\t}')
 					prog.conditional = oldCond
+					prog.checkGenericMeta(metaBefore)
 						
 	
 	def __str__(self):
@@ -1475,6 +1519,17 @@ class Program:
 		self.conditional = False
 		self.declares = []
 		self.lastSize = None
+		self.successors = None
+		self.pairs = []
+		self.instrument = None
+		#how often each opcode of each table ran in the profile, used to find the hot ones
+		self.opCounts = {}
+		self.hot = {}
+		self.coverage = None
+		self.owners = {}
+		self.genericTables = set()
+		#possible values of each field while a generic body is generated
+		self.genericFields = None
 		
 	def __str__(self):
 		pieces = []
@@ -1507,23 +1562,92 @@ class Program:
 		hFile.write('\n')
 		hFile.close()
 		
+	def _generateBody(self, inst, val, otype, successors=None, fieldVals=None):
+		self.meta = {}
+		self.temp = {}
+		self.needFlagCoalesce = False
+		self.needFlagDisperse = False
+		self.lastOp = None
+		return inst.generateBody(val, self, otype, successors, fieldVals)
+	
+	def _tableOwners(self, table):
+		if not table in self.owners:
+			opmap = [None] * (1 << self.opsize)
+			instmap = [None] * (1 << self.opsize)
+			if table in self.instructions:
+				instructions = self.instructions[table]
+				instructions.sort()
+				for inst in instructions:
+					for val in inst.allValues():
+						if opmap[val] is None:
+							opmap[val] = inst.generateName(val)
+							instmap[val] = inst
+			self.owners[table] = (opmap, instmap)
+		return self.owners[table]
+	
+	#returns the instructions of a table that get a generic body and the cold values each one handles
+	def _genericCandidates(self, table):
+		candidates = {}
+		if self.coverage is None or self.dispatch != 'goto':
+			return candidates
+		opmap,instmap = self._tableOwners(table)
+		hot = self.hot.get(table, set())
+		for val in range(0, len(opmap)):
+			inst = instmap[val]
+			if not inst is None and not val in hot and inst.fields and not inst.dispatchesFirst():
+				candidates.setdefault(inst, []).append(val)
+		#a single value gains nothing from sharing a body
+		return {inst: vals for inst,vals in candidates.items() if len(vals) > 1}
+	
+	def _generateGeneric(self, inst, values, otype):
+		self.genericFields = {}
+		for val in values:
+			fieldVals,_ = inst.getFieldVals(val)
+			for field in fieldVals:
+				self.genericFields.setdefault(field, set()).add(fieldVals[field])
+		self.genericExprs = {}
+		fieldVals = inst.genericFieldVals('opcode__')
+		for field in fieldVals:
+			self.genericExprs[fieldVals[field]] = field
+		depth = len(self.scopes)
+		conditional = self.conditional
+		try:
+			return self._generateBody(inst, values[0], otype, None, fieldVals)
+		except GenericUnsupported:
+			#the instruction keeps a specialized body for every value
+			del self.scopes[depth:]
+			self.currentScope = self.scopes[-1] if self.scopes else None
+			self.conditional = conditional
+			return None
+		finally:
+			self.genericFields = None
+	
 	def _buildTable(self, otype, table, body, lateBody):
 		pieces = []
-		opmap = [None] * (1 << self.opsize)
+		opmap,instmap = self._tableOwners(table)
+		opmap = list(opmap)
 		bodymap = {}
-		if table in self.instructions:
-			instructions = self.instructions[table]
-			instructions.sort()
-			for inst in instructions:
-				for val in inst.allValues():
-					if opmap[val] is None:
-						self.meta = {}
-						self.temp = {}
-						self.needFlagCoalesce = False
-						self.needFlagDisperse = False
-						self.lastOp = None
-						opmap[val] = inst.generateName(val)
-						bodymap[val] = inst.generateBody(val, self, otype)
+		genericBodies = []
+		for inst,values in self._genericCandidates(table).items():
+			generic = self._generateGeneric(inst, values, otype)
+			if generic:
+				genericBodies.append(generic)
+				for val in values:
+					opmap[val] = inst.generateGenericName()
+		for val in range(0, len(opmap)):
+			if not instmap[val] is None and opmap[val] == instmap[val].generateName(val):
+				bodymap[val] = self._generateBody(instmap[val], val, otype)
+		if self.dispatch == 'goto' and table == 'main' and self.pairs:
+			successors = {}
+			for first,second in self.pairs:
+				if not first in bodymap or not second in bodymap or instmap[first].dispatchesFirst():
+					continue
+				#the copy of the second instruction has no label of its own
+				label = '\n' + opmap[second] + ': {'
+				successors.setdefault(first, []).append((second, '\n{' + bodymap[second][len(label):]))
+			for first in successors:
+				bodymap[first] = self._generateBody(instmap[first], first, otype, successors[first])
+		lateBody.extend(genericBodies)
 		
 		if self.dispatch == 'call':
 			pieces.append('\nstatic impl_fun impl_{name}[{sz}] = {{'.format(name = table, sz=len(opmap)))
@@ -1543,34 +1667,165 @@ class Program:
 					body.append('\n\t\t&&unimplemented,')
 				else:
 					body.append('\n\t\t&&' + op + ',')
-					lateBody.append(bodymap[inst])
+					if inst in bodymap:
+						lateBody.append(bodymap[inst])
 			body.append('\n\t};')
 		else:
 			raise Exception("unimplmeneted dispatch type " + self.dispatch)
 		body.extend(pieces)
 		
-	def nextInstruction(self, otype):
+	def nextInstruction(self, otype, successors=None):
 		output = []
 		if self.dispatch == 'goto':
 			if self.interrupt in self.subroutines:
-				output.append('\n\tif (context->cycles >= context->sync_cycle) {')
-			output.append('\n\tif (context->cycles >= target_cycle) { return; }')
-			if self.interrupt in self.subroutines:
-				self.meta = {}
-				self.temp = {}
-				self.subroutines[self.interrupt].inline(self, [], output, otype, None)
-				output.append('\n\t}')
-			
+				#the interrupt check is shared by all instructions to keep them small, see checkSync
+				output.append('\n\tif (context->cycles >= context->sync_cycle) { goto check_sync__; }')
+			else:
+				output.append('\n\tif (context->cycles >= target_cycle) { return; }')
 			self.meta = {}
 			self.temp = {}
+			self.successors = successors
 			self.subroutines[self.body].inline(self, [], output, otype, None)
+			self.successors = None
 		return output
 	
+	def checkSync(self, otype):
+		output = ['\ncheck_sync__:']
+		output.append('\n\tif (context->cycles >= target_cycle) { return; }')
+		self.meta = {}
+		self.temp = {}
+		self.subroutines[self.interrupt].inline(self, [], output, otype, None)
+		self.meta = {}
+		self.temp = {}
+		self.subroutines[self.body].inline(self, [], output, otype, None)
+		return output
+	
+	def tableIndex(self, table):
+		return 0 if table == 'main' else self.extra_tables.index(table) + 1
+	
+	def profileCode(self):
+		#an instrumented build counts how often each opcode of each table ran and how often each instruction
+		#of the main table follows another one, the counts are added to the ones already in the profile
+		#when the program exits
+		size = 1 << self.opsize
+		tables = ['main'] + self.extra_tables
+		return '''
+static uint64_t profile_ops[{tables}][{size}];
+static uint64_t profile_pairs[{size}][{size}];
+static uint32_t profile_last;
+static uint8_t profile_registered;
+static const char *profile_tables[] = {{"{names}"}};
+
+static void write_profile(void)
+{{
+	char line[256], name[32];
+	unsigned first, second, table;
+	unsigned long long count;
+	FILE *f = fopen("{path}", "r");
+	if (f) {{
+		while (fgets(line, sizeof(line), f))
+		{{
+			if (sscanf(line, "op %31s %x %llu", name, &first, &count) == 3 && first < {size}) {{
+				for (table = 0; table < {tables}; table++)
+				{{
+					if (!strcmp(name, profile_tables[table])) {{
+						profile_ops[table][first] += count;
+					}}
+				}}
+			}} else if (sscanf(line, "%x %x %llu", &first, &second, &count) == 3 && first < {size} && second < {size}) {{
+				profile_pairs[first][second] += count;
+			}}
+		}}
+		fclose(f);
+	}}
+	f = fopen("{path}", "w");
+	if (!f) {{
+		return;
+	}}
+	fputs("#opcodes that ran: op table opcode count\\n", f);
+	for (table = 0; table < {tables}; table++)
+	{{
+		for (first = 0; first < {size}; first++)
+		{{
+			if (profile_ops[table][first]) {{
+				fprintf(f, "op %s %02X %llu\\n", profile_tables[table], first, (unsigned long long)profile_ops[table][first]);
+			}}
+		}}
+	}}
+	fputs("#pairs of main table opcodes that ran one after the other: first second count\\n", f);
+	for (first = 0; first < {size}; first++)
+	{{
+		for (second = 0; second < {size}; second++)
+		{{
+			if (profile_pairs[first][second]) {{
+				fprintf(f, "%02X %02X %llu\\n", first, second, (unsigned long long)profile_pairs[first][second]);
+			}}
+		}}
+	}}
+	fclose(f);
+}}
+'''.format(size = size, path = self.instrument, tables = len(tables), names = '", "'.join(tables))
+	
+	def profileEntry(self):
+		return '\n\tif (!profile_registered) {\n\t\tprofile_registered = 1;\n\t\tatexit(write_profile);\n\t}'
+	
+	def readProfile(self, f, count):
+		pairs = []
+		for line in f:
+			line,_,_ = line.partition('#')
+			parts = line.split()
+			if len(parts) == 4 and parts[0] == 'op':
+				self.opCounts.setdefault(parts[1], {})[int(parts[2], 16)] = int(parts[3])
+			elif len(parts) == 3:
+				pairs.append((int(parts[2]), int(parts[0], 16), int(parts[1], 16)))
+		pairs.sort(key = lambda pair: pair[0], reverse = True)
+		self.pairs = [(first, second) for _,first,second in pairs[:count]]
+	
+	#opcodes that together make up coverage of all the ones that ran in the profile are hot and keep a
+	#specialized body, the rest share a generic body with the other cold values of their instruction
+	def findHot(self, coverage):
+		self.coverage = coverage
+		self.hot = {}
+		counts = []
+		for table in self.opCounts:
+			for op,count in self.opCounts[table].items():
+				counts.append((count, table, op))
+		counts.sort(reverse = True)
+		total = sum(count for count,_,_ in counts)
+		covered = 0
+		for count,table,op in counts:
+			if covered >= total * coverage:
+				break
+			self.hot.setdefault(table, set()).add(op)
+			covered += count
+	
+	def constParam(self, param):
+		if not type(param) is int and not self.genericFields is None:
+			raise GenericUnsupported()
+		return param
+	
+	#metas are resolved when the code is generated, so they can't depend on a branch taken at runtime
+	def checkGenericMeta(self, before):
+		if not self.genericFields is None and self.meta != before:
+			raise GenericUnsupported()
+	
+	#accesses to a register array through a field are only allowed when the field can't select the
+	#flag register, which needs its flags gathered or spread out around the access
+	def checkGenericIndex(self, array, index):
+		regs = self.regs.regArrays[array][1]
+		if type(regs) is int or not self.flags or not self.flags.flagReg in regs:
+			return
+		field = self.genericExprs.get(index)
+		if field is None or regs.index(self.flags.flagReg) in self.genericFields[field]:
+			raise GenericUnsupported()
+	
 	def build(self, otype):
 		body = []
 		pieces = []
 		for include in self.includes:
 			body.append('#include "{0}"\n'.format(include))
+		if self.instrument:
+			body.append(self.profileCode())
 		if self.dispatch == 'call':
 			body.append('\nstatic void unimplemented({pre}context *context, uint32_t target_cycle)'.format(pre = self.prefix))
 			body.append('\n{')
@@ -1583,6 +1838,11 @@ class Program:
 		elif self.dispatch == 'goto':
 			body.append('\nvoid {pre}execute({type} *context, uint32_t target_cycle)'.format(pre = self.prefix, type = self.context_type))
 			body.append('\n{')
+			for table in ['main'] + self.extra_tables:
+				if self._genericCandidates(table):
+					self.genericTables.add(table)
+			if self.genericTables:
+				body.append('\n\tuint32_t opcode__;')
 			
 		for table in self.extra_tables:
 			self._buildTable(otype, table, body, pieces)
@@ -1590,6 +1850,8 @@ class Program:
 		if self.dispatch == 'call' and self.body in self.subroutines:
 			pieces.append('\nvoid {pre}execute({type} *context, uint32_t target_cycle)'.format(pre = self.prefix, type = self.context_type))
 			pieces.append('\n{')
+			if self.instrument:
+				pieces.append(self.profileEntry())
 			pieces.append('\n\t{sync}(context, target_cycle);'.format(sync=self.sync_cycle))
 			pieces.append('\n\twhile (context->cycles < target_cycle)')
 			pieces.append('\n\t{')
@@ -1609,8 +1871,12 @@ class Program:
 			pieces.append('\n\t}')
 			pieces.append('\n}')
 		elif self.dispatch == 'goto':
+			if self.instrument:
+				body.append(self.profileEntry())
 			body.append('\n\t{sync}(context, target_cycle);'.format(sync=self.sync_cycle))
 			body += self.nextInstruction(otype)
+			if self.interrupt in self.subroutines:
+				pieces += self.checkSync(otype)
 			pieces.append('\nunimplemented:')
 			pieces.append('\n\tfatal_error("Unimplemented instruction\\n");')
 			pieces.append('\n}')
@@ -1688,6 +1954,8 @@ class Program:
 				end = self.regs.arrayMemberIndex(end)
 				if arrayName != begin:
 					end = 'context->{0}[{1}]'.format(arrayName, end)
+			elif not type(end) is int and not self.genericFields is None:
+				self.checkGenericIndex(begin, end)
 			if self.regs.isNamedArray(begin):
 				regName = self.regs.arrayMemberName(begin, end)
 			else:
@@ -1844,6 +2112,14 @@ def parse(args):
 		p = Program(registers, instructions, subroutines, info, flags)
 		p.dispatch = args.dispatch
 		p.declares = declares
+		if args.instrument:
+			if p.opsize > 8:
+				raise Exception('Opcode pairs can only be counted with an opcode size of at most 8 bits')
+			p.instrument = args.instrument
+		if args.profile and p.dispatch == 'goto':
+			p.readProfile(args.profile, args.superinstructions)
+			if args.generic:
+				p.findHot(args.coverage)
 		p.booleans['dynarec'] = False
 		p.booleans['interp'] = True
 		if args.define:
@@ -1861,6 +2137,9 @@ def parse(args):
 			p.writeHeader('c', info['header'][0])
 		print('#include "util.h"')
 		print('#include <stdlib.h>')
+		if p.instrument:
+			print('#include <stdio.h>')
+			print('#include <string.h>')
 		print(p.build('c'))
 
 def main(argv):
@@ -1869,6 +2148,11 @@ def main(argv):
 	argParser.add_argument('source', type=FileType('r'))
 	argParser.add_argument('-D', '--define', action='append')
 	argParser.add_argument('-d', '--dispatch', choices=('call', 'switch', 'goto'), default='call')
+	argParser.add_argument('-p', '--profile', type=FileType('r'), help='opcode pair profile to pick the superinstructions of goto dispatch from')
+	argParser.add_argument('-s', '--superinstructions', type=int, default=32, help='number of the most frequent opcode pairs in the profile that get a superinstruction')
+	argParser.add_argument('-P', '--instrument', metavar='PROFILE', help='count opcodes and opcode pairs and add them to PROFILE at exit')
+	argParser.add_argument('-g', '--generic', action='store_true', help='give the instructions a single generic body for the opcodes that are cold in the profile')
+	argParser.add_argument('-c', '--coverage', type=float, default=0.999, help='share of the opcodes that ran in the profile that get specialized bodies with -g')
 	parse(argParser.parse_args(argv[1:]))
 
 if __name__ == '__main__':
@@ -585,6 +585,86 @@ z80_context * zdebugger(z80_context * context, uint16_t address)
 static uint32_t branch_t;
 static uint32_t branch_f;
 
+static void profile_command(genesis_context *gen, char *param)
+{
+	if (!param) {
+		genesis_print_profile(gen);
+	} else if (!strcmp(param, "on")) {
+		genesis_set_profiling(gen, 1);
+		puts("Profiling enabled");
+	} else if (!strcmp(param, "off")) {
+		genesis_set_profiling(gen, 0);
+		puts("Profiling disabled");
+	} else if (startswith(param, "dump")) {
+		char *path = find_param(param);
+		uint32_t frames = 60;
+		if (path) {
+			char *frames_param = find_param(path);
+			if (frames_param) {
+				frames_param[-1] = 0;
+				frames = atoi(frames_param);
+			}
+		}
+		if (!gen->profile) {
+			genesis_set_profiling(gen, 1);
+		}
+		if (!genesis_profile_dump(gen, path, frames)) {
+			fprintf(stderr, "Could not open %s for writing\n", path);
+		} else if (path) {
+			printf("Writing profile counters to %s every %d frames\n", path, frames ? frames : 1);
+		} else {
+			puts("Stopped writing profile counters");
+		}
+	} else {
+		fprintf(stderr, "Unrecognized profile command %s\n", param);
+	}
+}
+
+static void print_code_cache(char *name, code_cache_stats *stats)
+{
+	printf("%s: %llu bytes translated from %llu instructions, %llu of them cold, %u bytes in cache", name,
+		(unsigned long long)stats->translated_bytes, (unsigned long long)stats->translated_insts,
+		(unsigned long long)stats->cold_bytes, stats->used);
+	if (stats->budget) {
+		printf(" of %u", stats->budget);
+	}
+	printf(", %u flushes, %llu instructions retranslated, %u pages checked\n", stats->flushes,
+		(unsigned long long)stats->retranslations, stats->checked_pages);
+}
+
+#ifndef NEW_CORE
+//lists the pages of RAM with code that had to be translated again
+static void print_code_pages(char *name, cpu_options *opts)
+{
+	uint32_t num_pages = ram_size(opts) >> opts->ram_flags_shift;
+	for (uint32_t i = 0; i < num_pages; i++)
+	{
+		code_page *page = opts->code_pages + i;
+		if (page->retranslations || page->checked) {
+			printf("    %s page $%X: %u retranslations, %u code writes this frame%s\n", name, page->address,
+				page->retranslations, page->code_writes, page->checked ? ", checked" : "");
+		}
+	}
+}
+#endif
+
+static void code_cache_command(genesis_context *gen)
+{
+	code_cache_stats m68k, z80;
+	if (!genesis_code_cache_stats(gen, &m68k, &z80)) {
+		puts("CPU cores do not translate code");
+		return;
+	}
+	print_code_cache("68K", &m68k);
+	print_code_cache("Z80", &z80);
+#ifndef NEW_CORE
+	print_code_pages("68K", &gen->m68k->options->gen);
+#ifndef NO_Z80
+	print_code_pages("Z80", &gen->z80->Z80_OPTS->gen);
+#endif
+#endif
+}
+
 int run_debugger_command(m68k_context *context, uint32_t address, char *input_buf, m68kinst inst, uint32_t after)
 {
 	char * param;
@@ -599,6 +679,8 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 			{
 				puts("Continuing");
 				return 0;
+			} else if (!strcmp(input_buf, "cache")) {
+				code_cache_command(system);
 			} else if (input_buf[1] == 'o' && input_buf[2] == 'm') {
 				param = find_param(input_buf);
 				if (!param) {
@@ -642,7 +724,12 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 					uint8_t non_adr_count = 0;
 					do {
 						uint32_t bt_address = system->work_ram[stack/2] << 16 | system->work_ram[stack/2+1];
+#ifndef NEW_CORE
 						bt_address = get_instruction_start(context->options, bt_address - 2);
+#else
+						//calls are only found through the map of translated instructions
+						bt_address = 0;
+#endif
 						if (bt_address) {
 							stack += 4;
 							non_adr_count = 0;
@@ -726,6 +813,10 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 			}
 			break;
 		case 'p':
+			if (startswith(input_buf, "prof") && (!input_buf[4] || input_buf[4] == ' ')) {
+				profile_command(system, find_param(input_buf));
+				break;
+			}
 			format_char = 0;
 			for(int i = 1; input_buf[i] != 0 && input_buf[i] != ' '; i++) {
 				if (input_buf[i] == '/') {
@@ -882,6 +973,7 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 			}
 		case 'v': {
 			genesis_context * gen = context->system;
+			vdp_sync_render_thread(gen->vdp);
 			//VDP debug commands
 			switch(input_buf[1])
 			{
@@ -892,10 +984,15 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 				vdp_print_reg_explain(gen->vdp);
 				break;
 			}
+			//printing the registers reads the status
+			vdp_reload_render_thread(gen->vdp);
 			break;
 		}
 		case 'y': {
 			genesis_context * gen = context->system;
+			if (gen->sound) {
+				sound_thread_sync(gen->sound);
+			}
 			//YM-2612 debug commands
 			switch(input_buf[1])
 			{
@@ -980,6 +1077,11 @@ void print_m68k_help()
 	printf("    p[/(x|X|d|c)] VALUE  - Print a register or memory location\n");
 	printf("    di[/(x|X|d|c)] VALUE - Print a register or memory location each time\n");
 	printf("                           a breakpoint is hit\n");
+	printf("    prof [on|off]        - Print profile counters, or turn profiling on or off\n");
+	printf("    prof dump [FILE [N]] - Append profile counters to FILE every N frames\n");
+	printf("                           (60 by default), stops dumping without FILE\n");
+	printf("    cache                - Print translated code cache counters and the pages of\n");
+	printf("                           RAM whose code was retranslated\n");
 	printf("    vs                   - Print VDP sprite list\n");
 	printf("    vr                   - Print VDP register info\n");
 	printf("    yc [CHANNEL NUM]     - Print YM-2612 channel info\n");
@@ -197,9 +197,9 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 		uint32_t after = pc + (after_pc-pc_ptr)*2;
 
 		if (inst.op == M68K_RTS) {
-			after = (read_dma_value(context->aregs[7]/2) << 16) | read_dma_value(context->aregs[7]/2 + 1);
+			after = (read_dma_value(context->system, context->aregs[7]/2) << 16) | read_dma_value(context->system, context->aregs[7]/2 + 1);
 		} else if (inst.op == M68K_RTE || inst.op == M68K_RTR) {
-			after = (read_dma_value((context->aregs[7]+2)/2) << 16) | read_dma_value((context->aregs[7]+2)/2 + 1);
+			after = (read_dma_value(context->system, (context->aregs[7]+2)/2) << 16) | read_dma_value(context->system, (context->aregs[7]+2)/2 + 1);
 		} else if(m68k_is_branch(&inst)) {
 			if (inst.op == M68K_BCC && inst.extra.cond != COND_TRUE) {
 				branch_f = after;
@@ -425,9 +425,9 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 				uint32_t after = pc + (after_pc-pc_ptr)*2;
 
 				if (inst.op == M68K_RTS) {
-					after = (read_dma_value(context->aregs[7]/2) << 16) | read_dma_value(context->aregs[7]/2 + 1);
+					after = (read_dma_value(context->system, context->aregs[7]/2) << 16) | read_dma_value(context->system, context->aregs[7]/2 + 1);
 				} else if (inst.op == M68K_RTE || inst.op == M68K_RTR) {
-					after = (read_dma_value((context->aregs[7]+2)/2) << 16) | read_dma_value((context->aregs[7]+2)/2 + 1);
+					after = (read_dma_value(context->system, (context->aregs[7]+2)/2) << 16) | read_dma_value(context->system, (context->aregs[7]+2)/2 + 1);
 				} else if(m68k_is_branch(&inst)) {
 					if (inst.op == M68K_BCC && inst.extra.cond != COND_TRUE) {
 						branch_f = after;
@@ -13,4 +13,31 @@ void init_code_info(code_info *code)
 	}
 	code->last = code->cur + size/sizeof(code_word) - RESERVE_WORDS;
 	code->stack_off = 0;
+	code->blocks = NULL;
+}
+
+static __thread reloc_log *active_relocs;
+
+reloc_log *set_reloc_log(reloc_log *log)
+{
+	reloc_log *old = active_relocs;
+	active_relocs = log;
+	return old;
+}
+
+void log_reloc(code_ptr site, uint8_t kind)
+{
+	reloc_log *log = active_relocs;
+	if (!log) {
+		return;
+	}
+	if (log->num == log->storage) {
+		log->storage = log->storage ? log->storage * 2 : 1024;
+		log->sites = realloc(log->sites, log->storage * sizeof(reloc_site));
+	}
+	//emitters pass the address they write through
+	log->sites[log->num++] = (reloc_site){
+		.site = code_executable(site),
+		.kind = kind
+	};
 }
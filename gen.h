@@ -13,13 +13,39 @@ typedef code_word * code_ptr;
 #define CODE_ALLOC_SIZE (1024*1024)
 
 typedef struct {
-	code_ptr cur;
-	code_ptr last;
-	uint32_t stack_off;
+	code_ptr     cur;
+	code_ptr     last;
+	uint32_t     stack_off;
+	//if not NULL, blocks allocated when this code runs out of space come from and are tracked in this arena
+	struct arena *blocks;
 } code_info;
 
 void check_alloc_code(code_info *code, uint32_t inst_size);
 
+//parts of emitted instructions that depend on where the code or the thing it refers to is placed
+enum {
+	RELOC_REL8,  //8-bit branch displacement
+	RELOC_REL32, //32-bit branch or call displacement
+	RELOC_ABS64, //full size pointer immediate
+	RELOC_ABS32  //sign extended 32-bit immediate loaded into a pointer sized register
+};
+
+typedef struct {
+	code_ptr site;
+	uint8_t  kind;
+} reloc_site;
+
+typedef struct {
+	reloc_site *sites;
+	uint32_t   num;
+	uint32_t   storage;
+} reloc_log;
+
+//while a log is set, the location of every displacement and pointer immediate emitted on this
+//thread is appended to it, returns the previous log
+reloc_log *set_reloc_log(reloc_log *log);
+void log_reloc(code_ptr site, uint8_t kind);
+
 void init_code_info(code_info *code);
 void call(code_info *code, code_ptr fun);
 void jmp(code_info *code, code_ptr dest);
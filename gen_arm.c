@@ -5,6 +5,7 @@
 */
 #include "gen_arm.h"
 #include "mem.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -74,7 +75,7 @@ void check_alloc_code(code_info *code)
 {
 	if (code->cur == code->last) {
 		size_t size = CODE_ALLOC_SIZE;
-		uint32_t *next_code = alloc_code(&size);
+		uint32_t *next_code = code->blocks ? alloc_arena_code(code->blocks, &size) : alloc_code(&size);
 		if (!next_code) {
 			fatal_error("Failed to allocate memory for generated code\n");
 		}
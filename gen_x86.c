@@ -5,6 +5,7 @@
 */
 #include "gen_x86.h"
 #include "mem.h"
+#include "arena.h"
 #include "util.h"
 #include <stddef.h>
 #include <stdio.h>
@@ -178,15 +179,17 @@ char * x86_sizes[] = {
 
 void jmp_nocheck(code_info *code, code_ptr dest)
 {
-	code_ptr out = code->cur;
-	ptrdiff_t disp = dest-(out+2);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = dest-(code->cur+2);
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JMP_BYTE;
+		log_reloc(out, RELOC_REL8);
 		*(out++) = disp;
 	} else {
-		disp = dest-(out+5);
+		disp = dest-(code->cur+5);
 		if (CHECK_DISP(disp)) {
 			*(out++) = OP_JMP;
+			log_reloc(out, RELOC_REL32);
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
@@ -195,22 +198,22 @@ void jmp_nocheck(code_info *code, code_ptr dest)
 			disp >>= 8;
 			*(out++) = disp;
 		} else {
-			fatal_error("jmp: %p - %p = %l which is out of range of a 32-bit displacementX\n", dest, out + 6, (long)disp);
+			fatal_error("jmp: %p - %p = %l which is out of range of a 32-bit displacementX\n", dest, code->cur + 6, (long)disp);
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void check_alloc_code(code_info *code, uint32_t inst_size)
 {
 	if (code->cur + inst_size > code->last) {
 		size_t size = CODE_ALLOC_SIZE;
-		code_ptr next_code = alloc_code(&size);
+		code_ptr next_code = code->blocks ? alloc_arena_code(code->blocks, &size) : alloc_code(&size);
 		if (!next_code) {
 			fatal_error("Failed to allocate memory for generated code\n");
 		}
-		if (next_code != code->last + RESERVE_WORDS) {
-			//new chunk is not contiguous with the current one
+		if (next_code != code->last + RESERVE_WORDS || code_writable(next_code) != code_writable(code->last) + RESERVE_WORDS) {
+			//new chunk is not contiguous with the current one, in memory or in the writable view
 			jmp_nocheck(code, next_code);
 			code->cur = next_code;
 		}
@@ -221,7 +224,7 @@ void check_alloc_code(code_info *code, uint32_t inst_size)
 void x86_rr_sizedir(code_info *code, uint16_t opcode, uint8_t src, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t tmp;
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
@@ -271,13 +274,13 @@ void x86_rr_sizedir(code_info *code, uint16_t opcode, uint8_t src, uint8_t dst,
 		*(out++) = opcode;
 	}
 	*(out++) = MODE_REG_DIRECT | dst | (src << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_rrdisp_sizedir(code_info *code, uint16_t opcode, uint8_t reg, uint8_t base, int32_t disp, uint8_t size, uint8_t dir)
 {
 	check_alloc_code(code, 10);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	//TODO: Deal with the fact that AH, BH, CH and DH can only be in the R/M param when there's a REX prefix
 	uint8_t tmp;
 	if (size == SZ_W) {
@@ -334,13 +337,13 @@ void x86_rrdisp_sizedir(code_info *code, uint16_t opcode, uint8_t reg, uint8_t b
 	*(out++) = disp >> 16;
 	*(out++) = disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_rrind_sizedir(code_info *code, uint8_t opcode, uint8_t reg, uint8_t base, uint8_t size, uint8_t dir)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	//TODO: Deal with the fact that AH, BH, CH and DH can only be in the R/M param when there's a REX prefix
 	uint8_t tmp;
 	if (size == SZ_W) {
@@ -388,13 +391,13 @@ void x86_rrind_sizedir(code_info *code, uint8_t opcode, uint8_t reg, uint8_t bas
 		*(out++) = (RSP << 3) | RSP;
 	}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_rrindex_sizedir(code_info *code, uint8_t opcode, uint8_t reg, uint8_t base, uint8_t index, uint8_t scale, uint8_t size, uint8_t dir)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	//TODO: Deal with the fact that AH, BH, CH and DH can only be in the R/M param when there's a REX prefix
 	uint8_t tmp;
 	if (size == SZ_W) {
@@ -443,13 +446,13 @@ void x86_rrindex_sizedir(code_info *code, uint8_t opcode, uint8_t reg, uint8_t b
 		scale--;
 	}
 	*(out++) = scale << 6 | (index << 3) | base;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_r_size(code_info *code, uint8_t opcode, uint8_t opex, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 4);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t tmp;
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
@@ -481,13 +484,13 @@ void x86_r_size(code_info *code, uint8_t opcode, uint8_t opex, uint8_t dst, uint
 	}
 	*(out++) = opcode;
 	*(out++) = MODE_REG_DIRECT | dst | (opex << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_rdisp_size(code_info *code, uint8_t opcode, uint8_t opex, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 7);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t tmp;
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
@@ -521,13 +524,13 @@ void x86_rdisp_size(code_info *code, uint8_t opcode, uint8_t opex, uint8_t dst,
 		*(out++) = disp >> 16;
 		*(out++) = disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_ir(code_info *code, uint8_t opcode, uint8_t op_ex, uint8_t al_opcode, int32_t val, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 8);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t sign_extend = 0;
 	if (opcode != OP_NOT_NEG && (size == SZ_D || size == SZ_Q) && val <= 0x7F && val >= -0x80) {
 		sign_extend = 1;
@@ -584,13 +587,13 @@ void x86_ir(code_info *code, uint8_t opcode, uint8_t op_ex, uint8_t al_opcode, i
 			*(out++) = val;
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_irdisp(code_info *code, uint8_t opcode, uint8_t op_ex, int32_t val, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 12);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t sign_extend = 0;
 	if ((size == SZ_D || size == SZ_Q) && val <= 0x7F && val >= -0x80) {
 		sign_extend = 1;
@@ -643,13 +646,13 @@ void x86_irdisp(code_info *code, uint8_t opcode, uint8_t op_ex, int32_t val, uin
 			*(out++) = val;
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_shiftrot_ir(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -673,13 +676,13 @@ void x86_shiftrot_ir(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst, u
 	if (val != 1) {
 		*(out++) = val;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_shiftrot_irdisp(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 9);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -712,13 +715,13 @@ void x86_shiftrot_irdisp(code_info *code, uint8_t op_ex, uint8_t val, uint8_t ds
 	if (val != 1) {
 		*(out++) = val;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_shiftrot_clr(code_info *code, uint8_t op_ex, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 4);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -739,13 +742,13 @@ void x86_shiftrot_clr(code_info *code, uint8_t op_ex, uint8_t dst, uint8_t size)
 
 	*(out++) = OP_SHIFTROT_CL | (size == SZ_B ? 0 : BIT_SIZE);
 	*(out++) = MODE_REG_DIRECT | dst | (op_ex << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void x86_shiftrot_clrdisp(code_info *code, uint8_t op_ex, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 8);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -775,7 +778,7 @@ void x86_shiftrot_clrdisp(code_info *code, uint8_t op_ex, uint8_t dst, int32_t d
 		*(out++) = disp >> 16;
 		*(out++) = disp >> 24;
 }
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void rol_ir(code_info *code, uint8_t val, uint8_t dst, uint8_t size)
@@ -1259,7 +1262,7 @@ void mov_rindexr(code_info *code, uint8_t src_base, uint8_t src_index, uint8_t s
 void mov_ir(code_info *code, int64_t val, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 14);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	uint8_t sign_extend = 0;
 	if (size == SZ_Q && val <= ((int64_t)INT32_MAX) && val >= ((int64_t)INT32_MIN)) {
 		sign_extend = 1;
@@ -1289,6 +1292,9 @@ void mov_ir(code_info *code, int64_t val, uint8_t dst, uint8_t size)
 	} else {
 		*(out++) = OP_MOV_IR | dst;
 	}
+	if (size == SZ_Q) {
+		log_reloc(out, sign_extend ? RELOC_ABS32 : RELOC_ABS64);
+	}
 	*(out++) = val;
 	if (size != SZ_B) {
 		val >>= 8;
@@ -1310,7 +1316,7 @@ void mov_ir(code_info *code, int64_t val, uint8_t dst, uint8_t size)
 			}
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 uint8_t is_mov_ir(code_ptr inst)
@@ -1322,10 +1328,27 @@ uint8_t is_mov_ir(code_ptr inst)
 	return (*inst & 0xF8) == OP_MOV_I8R || (*inst & 0xF8) == OP_MOV_IR || (*inst & 0xFE) == OP_MOV_IEA;
 }
 
+code_ptr branch_target(code_ptr inst)
+{
+	if (*inst == OP_JMP_BYTE || (*inst & 0xF0) == OP_JCC) {
+		return inst + 2 + (int8_t)inst[1];
+	}
+	int32_t disp;
+	if (*inst == OP_JMP || *inst == OP_CALL) {
+		inst++;
+	} else if (*inst == PRE_2BYTE && (inst[1] & 0xF0) == OP2_JCC) {
+		inst += 2;
+	} else {
+		return NULL;
+	}
+	memcpy(&disp, inst, sizeof(disp));
+	return inst + sizeof(disp) + disp;
+}
+
 void mov_irdisp(code_info *code, int32_t val, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 12);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1366,13 +1389,13 @@ void mov_irdisp(code_info *code, int32_t val, uint8_t dst, int32_t disp, uint8_t
 			*(out++) = val;
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void mov_irind(code_info *code, int32_t val, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 8);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1404,13 +1427,13 @@ void mov_irind(code_info *code, int32_t val, uint8_t dst, uint8_t size)
 			*(out++) = val;
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void movsx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8_t size)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1436,13 +1459,13 @@ void movsx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8
 		*(out++) = OP2_MOVSX | (src_size == SZ_B ? 0 : BIT_SIZE);
 	}
 	*(out++) = MODE_REG_DIRECT | src | (dst << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void movsx_rdispr(code_info *code, uint8_t src, int32_t disp, uint8_t dst, uint8_t src_size, uint8_t size)
 {
 	check_alloc_code(code, 12);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1477,13 +1500,13 @@ void movsx_rdispr(code_info *code, uint8_t src, int32_t disp, uint8_t dst, uint8
 		*(out++) = disp >> 16;
 		*(out++) = disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void movzx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8_t size)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1505,13 +1528,13 @@ void movzx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8
 	*(out++) = PRE_2BYTE;
 	*(out++) = OP2_MOVZX | (src_size == SZ_B ? 0 : BIT_SIZE);
 	*(out++) = MODE_REG_DIRECT | src | (dst << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void movzx_rdispr(code_info *code, uint8_t src, int32_t disp, uint8_t dst, uint8_t src_size, uint8_t size)
 {
 	check_alloc_code(code, 9);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1542,13 +1565,13 @@ void movzx_rdispr(code_info *code, uint8_t src, int32_t disp, uint8_t dst, uint8
 		*(out++) = disp >> 16;
 		*(out++) = disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void xchg_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 4);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	//TODO: Use OP_XCHG_AX when one of the registers is AX, EAX or RAX
 	uint8_t tmp;
 	if (size == SZ_W) {
@@ -1587,35 +1610,35 @@ void xchg_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t size)
 	}
 	*(out++) = opcode;
 	*(out++) = MODE_REG_DIRECT | dst | (src << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void pushf(code_info *code)
 {
 	check_alloc_code(code, 1);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	*(out++) = OP_PUSHF;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void popf(code_info *code)
 {
 	check_alloc_code(code, 1);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	*(out++) = OP_POPF;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void push_r(code_info *code, uint8_t reg)
 {
 	check_alloc_code(code, 2);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (reg >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		reg -= R8 - X86_R8;
 	}
 	*(out++) = OP_PUSH | reg;
-	code->cur = out;
+	code->cur = code_executable(out);
 	code->stack_off += sizeof(void *);
 }
 
@@ -1630,34 +1653,34 @@ void push_rdisp(code_info *code, uint8_t base, int32_t disp)
 void pop_r(code_info *code, uint8_t reg)
 {
 	check_alloc_code(code, 2);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (reg >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		reg -= R8 - X86_R8;
 	}
 	*(out++) = OP_POP | reg;
-	code->cur = out;
+	code->cur = code_executable(out);
 	code->stack_off -= sizeof(void *);
 }
 
 void pop_rind(code_info *code, uint8_t reg)
 {
 	check_alloc_code(code, 3);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (reg >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		reg -= R8 - X86_R8;
 	}
 	*(out++) = PRE_XOP;
 	*(out++) = MODE_REG_INDIRECT | reg;
-	code->cur = out;
+	code->cur = code_executable(out);
 	code->stack_off -=  sizeof(void *);
 }
 
 void setcc_r(code_info *code, uint8_t cc, uint8_t dst)
 {
 	check_alloc_code(code, 4);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (dst >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		dst -= R8 - X86_R8;
@@ -1669,13 +1692,13 @@ void setcc_r(code_info *code, uint8_t cc, uint8_t dst)
 	*(out++) = PRE_2BYTE;
 	*(out++) = OP2_SETCC | cc;
 	*(out++) = MODE_REG_DIRECT | dst;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void setcc_rind(code_info *code, uint8_t cc, uint8_t dst)
 {
 	check_alloc_code(code, 4);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (dst >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		dst -= R8 - X86_R8;
@@ -1683,13 +1706,13 @@ void setcc_rind(code_info *code, uint8_t cc, uint8_t dst)
 	*(out++) = PRE_2BYTE;
 	*(out++) = OP2_SETCC | cc;
 	*(out++) = MODE_REG_INDIRECT | dst;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void setcc_rdisp(code_info *code, uint8_t cc, uint8_t dst, int32_t disp)
 {
 	check_alloc_code(code, 8);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (dst >= R8) {
 		*(out++) = PRE_REX | REX_RM_FIELD;
 		dst -= R8 - X86_R8;
@@ -1706,13 +1729,13 @@ void setcc_rdisp(code_info *code, uint8_t cc, uint8_t dst, int32_t disp)
 		*(out++) = disp >> 16;
 		*(out++) = disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void bit_rr(code_info *code, uint8_t op2, uint8_t src, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1734,13 +1757,13 @@ void bit_rr(code_info *code, uint8_t op2, uint8_t src, uint8_t dst, uint8_t size
 	*(out++) = PRE_2BYTE;
 	*(out++) = op2;
 	*(out++) = MODE_REG_DIRECT | dst | (src << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void bit_rrdisp(code_info *code, uint8_t op2, uint8_t src, uint8_t dst_base, int32_t dst_disp, uint8_t size)
 {
 	check_alloc_code(code, 9);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1771,13 +1794,13 @@ void bit_rrdisp(code_info *code, uint8_t op2, uint8_t src, uint8_t dst_base, int
 	*(out++) = dst_disp >> 16;
 	*(out++) = dst_disp >> 24;
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void bit_ir(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst, uint8_t size)
 {
 	check_alloc_code(code, 6);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1796,13 +1819,13 @@ void bit_ir(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst, uint8_t si
 	*(out++) = OP2_BTX_I;
 	*(out++) = MODE_REG_DIRECT | dst | (op_ex << 3);
 	*(out++) = val;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void bit_irdisp(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst_base, int32_t dst_disp, uint8_t size)
 {
 	check_alloc_code(code, 10);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (size == SZ_W) {
 		*(out++) = PRE_SIZE;
 	}
@@ -1830,7 +1853,7 @@ void bit_irdisp(code_info *code, uint8_t op_ex, uint8_t val, uint8_t dst_base, i
 		*(out++) = dst_disp >> 24;
 	}
 	*(out++) = val;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void bt_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t size)
@@ -1916,16 +1939,18 @@ void btc_irdisp(code_info *code, uint8_t val, uint8_t dst_base, int32_t dst_disp
 void jcc(code_info *code, uint8_t cc, code_ptr dest)
 {
 	check_alloc_code(code, 6);
-	code_ptr out = code->cur;
-	ptrdiff_t disp = dest-(out+2);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = dest-(code->cur+2);
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JCC | cc;
+		log_reloc(out, RELOC_REL8);
 		*(out++) = disp;
 	} else {
-		disp = dest-(out+6);
+		disp = dest-(code->cur+6);
 		if (CHECK_DISP(disp)) {
 			*(out++) = PRE_2BYTE;
 			*(out++) = OP2_JCC | cc;
+			log_reloc(out, RELOC_REL32);
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
@@ -1934,24 +1959,26 @@ void jcc(code_info *code, uint8_t cc, code_ptr dest)
 			disp >>= 8;
 			*(out++) = disp;
 		} else {
-			fatal_error("jcc: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, out + 6, (long)disp);
+			fatal_error("jcc: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, code->cur + 6, (long)disp);
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void jmp(code_info *code, code_ptr dest)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
-	ptrdiff_t disp = dest-(out+2);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = dest-(code->cur+2);
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JMP_BYTE;
+		log_reloc(out, RELOC_REL8);
 		*(out++) = disp;
 	} else {
-		disp = dest-(out+5);
+		disp = dest-(code->cur+5);
 		if (CHECK_DISP(disp)) {
 			*(out++) = OP_JMP;
+			log_reloc(out, RELOC_REL32);
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
@@ -1960,45 +1987,46 @@ void jmp(code_info *code, code_ptr dest)
 			disp >>= 8;
 			*(out++) = disp;
 		} else {
-			fatal_error("jmp: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, out + 6, (long)disp);
+			fatal_error("jmp: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, code->cur + 6, (long)disp);
 		}
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void jmp_r(code_info *code, uint8_t dst)
 {
 	check_alloc_code(code, 3);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (dst >= R8) {
 		dst -= R8 - X86_R8;
 		*(out++) = PRE_REX | REX_RM_FIELD;
 	}
 	*(out++) = OP_SINGLE_EA;
 	*(out++) = MODE_REG_DIRECT | dst | (OP_EX_JMP_EA << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void jmp_rind(code_info *code, uint8_t dst)
 {
 	check_alloc_code(code, 3);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	if (dst >= R8) {
 		dst -= R8 - X86_R8;
 		*(out++) = PRE_REX | REX_RM_FIELD;
 	}
 	*(out++) = OP_SINGLE_EA;
 	*(out++) = MODE_REG_INDIRECT | dst | (OP_EX_JMP_EA << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void call_noalign(code_info *code, code_ptr fun)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
-	ptrdiff_t disp = fun-(out+5);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = fun-(code->cur+5);
 	if (CHECK_DISP(disp)) {
 		*(out++) = OP_CALL;
+		log_reloc(out, RELOC_REL32);
 		*(out++) = disp;
 		disp >>= 8;
 		*(out++) = disp;
@@ -2008,9 +2036,9 @@ void call_noalign(code_info *code, code_ptr fun)
 		*(out++) = disp;
 	} else {
 		//TODO: Implement far call???
-		fatal_error("call: %p - %p = %lX which is out of range for a 32-bit displacement\n", fun, out + 5, (long)disp);
+		fatal_error("call: %p - %p = %lX which is out of range for a 32-bit displacement\n", fun, code->cur + 5, (long)disp);
 	}
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 volatile int foo;
@@ -2033,10 +2061,11 @@ void call(code_info *code, code_ptr fun)
 void call_raxfallback(code_info *code, code_ptr fun)
 {
 	check_alloc_code(code, 5);
-	code_ptr out = code->cur;
-	ptrdiff_t disp = fun-(out+5);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = fun-(code->cur+5);
 	if (CHECK_DISP(disp)) {
 		*(out++) = OP_CALL;
+		log_reloc(out, RELOC_REL32);
 		*(out++) = disp;
 		disp >>= 8;
 		*(out++) = disp;
@@ -2044,7 +2073,7 @@ void call_raxfallback(code_info *code, code_ptr fun)
 		*(out++) = disp;
 		disp >>= 8;
 		*(out++) = disp;
-		code->cur = out;
+		code->cur = code_executable(out);
 	} else {
 		mov_ir(code, (int64_t)fun, RAX, SZ_PTR);
 		call_r(code, RAX);
@@ -2061,10 +2090,10 @@ void call_r(code_info *code, uint8_t dst)
 		sub_ir(code, adjust, RSP, SZ_PTR);
 	}
 	check_alloc_code(code, 2);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	*(out++) = OP_SINGLE_EA;
 	*(out++) = MODE_REG_DIRECT | dst | (OP_EX_CALL_EA << 3);
-	code->cur = out;
+	code->cur = code_executable(out);
 	if (adjust) {
 		add_ir(code, adjust, RSP, SZ_PTR);
 	}
@@ -2074,9 +2103,9 @@ void call_r(code_info *code, uint8_t dst)
 void retn(code_info *code)
 {
 	check_alloc_code(code, 1);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	*(out++) = OP_RETN;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void rts(code_info *code)
@@ -2087,19 +2116,20 @@ void rts(code_info *code)
 void cdq(code_info *code)
 {
 	check_alloc_code(code, 1);
-	code_ptr out = code->cur;
+	code_ptr out = code_writable(code->cur);
 	*(out++) = OP_CDQ;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 void loop(code_info *code, code_ptr dst)
 {
 	check_alloc_code(code, 2);
-	code_ptr out = code->cur;
-	ptrdiff_t disp = dst-(out+2);
+	code_ptr out = code_writable(code->cur);
+	ptrdiff_t disp = dst-(code->cur+2);
 	*(out++) = OP_LOOP;
+	log_reloc(out, RELOC_REL8);
 	*(out++) = disp;
-	code->cur = out;
+	code->cur = code_executable(out);
 }
 
 uint32_t prep_args(code_info *code, uint32_t num_args, va_list args)
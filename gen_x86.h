@@ -224,6 +224,8 @@ void retn(code_info *code);
 void cdq(code_info *code);
 void loop(code_info *code, code_ptr dst);
 uint8_t is_mov_ir(code_ptr inst);
+//returns where the direct jump, conditional jump or call at inst goes, NULL if inst is something else
+code_ptr branch_target(code_ptr inst);
 
 #endif //GEN_X86_H_
 
@@ -10,6 +10,9 @@
 #include <ctype.h>
 #include <time.h>
 #include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "render.h"
 #include "gst.h"
 #include "util.h"
@@ -20,6 +23,9 @@
 #include "jcart.h"
 #include "config.h"
 #include "event_log.h"
+#ifndef NEW_CORE
+#include "code_store.h"
+#endif
 #define MCLKS_NTSC 53693175
 #define MCLKS_PAL  53203395
 
@@ -56,12 +62,14 @@ uint32_t MCLKS_PER_68K;
 #ifdef REFRESH_EMULATION
 #define REFRESH_INTERVAL 128
 #define REFRESH_DELAY 2
-uint32_t last_sync_cycle = 0;
-uint32_t refresh_counter = 0;
 #endif
 
 void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc, uint8_t all)
 {
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
+	vdp_sync_render_thread(gen->vdp);
 	start_section(buf, SECTION_METADATA);
 	save_int32(buf, SAVESTATE_VERSION);
 	end_section(buf);
@@ -122,8 +130,8 @@ void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68
 
 	start_section(buf, SECTION_TOP);
 #ifdef REFRESH_EMULATION
-	save_int32(buf, last_sync_cycle);
-	save_int32(buf, refresh_counter);
+	save_int32(buf, gen->last_sync_cycle);
+	save_int32(buf, gen->refresh_counter);
 #else
 	save_int32(buf, 0);
 	save_int32(buf, 0);
@@ -199,11 +207,12 @@ static void bus_arbiter_deserialize(deserialize_buffer *buf, void *vgen)
 	gen->z80_bank_reg = load_int16(buf) & 0x1FF;
 }
 
-static void top_deserialize(deserialize_buffer *buf, void* nop)
+static void top_deserialize(deserialize_buffer *buf, void *vgen)
 {
 #ifdef REFRESH_EMULATION
-	last_sync_cycle = load_int32(buf);
-	refresh_counter = load_int32(buf);
+	genesis_context *gen = vgen;
+	gen->last_sync_cycle = load_int32(buf);
+	gen->refresh_counter = load_int32(buf);
 #endif
 }
 
@@ -214,6 +223,10 @@ static void metadata_deserialize(deserialize_buffer *buf, void *nop) {
 static void adjust_int_cycle(m68k_context * context, vdp_context * v_context);
 void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
 {
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
+	vdp_sync_render_thread(gen->vdp);
 	register_section_handler(buf, (section_handler){.fun = m68k_deserialize, .data = gen->m68k}, SECTION_68000);
 	register_section_handler(buf, (section_handler){.fun = z80_deserialize, .data = gen->z80}, SECTION_Z80);
 	register_section_handler(buf, (section_handler){.fun = vdp_deserialize, .data = gen->vdp}, SECTION_VDP);
@@ -237,6 +250,10 @@ void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
 	adjust_int_cycle(gen->m68k, gen->vdp);
 	free(buf->handlers);
 	buf->handlers = NULL;
+	if (gen->sound) {
+		sound_thread_reload(gen->sound);
+	}
+	vdp_reload_render_thread(gen->vdp);
 }
 
 #include "m68k_internal.h" //needed for get_native_address_trans, should be eliminated once handling of PC is cleaned up
@@ -249,12 +266,514 @@ static void deserialize(system_header *sys, uint8_t *data, size_t size)
 #ifndef NEW_CORE
 	//HACK: Fix this once PC/IR is represented in a better way in 68K core
 	gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->last_prefetch_address);
+	gen->m68k->resume_address = gen->m68k->last_prefetch_address;
+	//memory was replaced without going through the dirty tracking so delta snapshots need a new base
+	gen->snapshot_base = 0;
 #endif
 }
 
-uint16_t read_dma_value(uint32_t address)
+#ifndef NEW_CORE
+//Snapshots are raw copies of the emulated state intended for rollback and rewind. Unlike save states
+//they are only valid for the context that produced them and only at the frame boundaries where
+//the 68K has returned to the frontend, but saving and restoring one is just a handful of memcpys.
+//Taking or restoring a full snapshot makes it the base for delta snapshots, which only hold the
+//pages of work RAM, Z80 RAM and VRAM that were written since then and so are much smaller
+#define SNAPSHOT_MAPPER_BYTES 512
+#define RAM_PAGE_WORDS ((1 << RAM_DIRTY_SHIFT) / 2)
+#define RAM_PAGES ((RAM_WORDS) / RAM_PAGE_WORDS)
+#define ZRAM_PAGES ((Z80_RAM_BYTES) >> RAM_DIRTY_SHIFT)
+#define VRAM_PAGES (VRAM_SIZE >> VRAM_DIRTY_SHIFT)
+typedef struct {
+	uint32_t     size;
+	//for a full snapshot this identifies the snapshot, for a delta it identifies the base
+	uint32_t     serial;
+	uint32_t     mapper_size;
+	uint32_t     frame_end;
+	uint32_t     reset_cycle;
+	uint32_t     last_frame;
+	uint32_t     last_flush_cycle;
+	uint32_t     last_sync_cycle;
+	uint32_t     refresh_counter;
+	//translated code the CPU contexts point into is only valid until the code cache is flushed
+	uint32_t     m68k_flushes;
+	uint32_t     z80_flushes;
+	int32_t      m68k_resume_offset;
+	int32_t      z80_resume_offset;
+	uint16_t     z80_bank_reg;
+	uint16_t     tmss_lock[2];
+	uint8_t      bus_busy;
+	uint8_t      reset_requested;
+	uint8_t      delta;
+	sega_io      io;
+	eeprom_state eeprom;
+	nor_state    nor;
+	//pages stored in a delta, in this order after the save RAM
+	uint8_t      ram_pages[RAM_PAGES / 8];
+	uint8_t      zram_pages[ZRAM_PAGES / 8];
+	uint8_t      vram_pages[VRAM_PAGES / 8];
+	uint8_t      mapper[SNAPSHOT_MAPPER_BYTES];
+} snapshot_header;
+
+#define SNAPSHOT_ALIGN(size) (((size) + 15) & ~(size_t)15)
+#define SNAPSHOT_M68K SNAPSHOT_ALIGN(sizeof(snapshot_header))
+#define SNAPSHOT_Z80 (SNAPSHOT_M68K + SNAPSHOT_ALIGN(sizeof(m68k_context)))
+#define SNAPSHOT_YM (SNAPSHOT_Z80 + SNAPSHOT_ALIGN(Z80_SNAPSHOT_SIZE))
+#define SNAPSHOT_PSG (SNAPSHOT_YM + SNAPSHOT_ALIGN(sizeof(ym2612_context)))
+#define SNAPSHOT_VDP (SNAPSHOT_PSG + SNAPSHOT_ALIGN(sizeof(psg_context)))
+#define SNAPSHOT_SAVE (SNAPSHOT_VDP + SNAPSHOT_ALIGN(sizeof(vdp_context)))
+//a full snapshot has all of work RAM, Z80 RAM and VRAM here, a delta only the dirty pages
+#define SNAPSHOT_MEMORY(gen) (SNAPSHOT_SAVE + SNAPSHOT_ALIGN((gen)->save_size))
+#define SNAPSHOT_ZRAM(gen) (SNAPSHOT_MEMORY(gen) + (RAM_WORDS) * sizeof(uint16_t))
+#define SNAPSHOT_VRAM(gen) (SNAPSHOT_ZRAM(gen) + (Z80_RAM_BYTES))
+
+//mirrors the check done by the memory write handlers generated in backend_x86.c
+static uint8_t ram_has_code(uint8_t *ram_code_flags, cpu_options *opts, uint32_t address)
+{
+	uint32_t meta_off;
+	memmap_chunk const *chunk = find_map_chunk(address, opts, MMAP_CODE, &meta_off);
+	if (!chunk || !(chunk->flags & MMAP_CODE)) {
+		return 0;
+	}
+	uint32_t final_off = ((address - chunk->start) & chunk->mask) + meta_off;
+	return ram_code_flags[final_off >> (opts->ram_flags_shift + 3)] & (1 << ((final_off >> opts->ram_flags_shift) & 7));
+}
+
+static uint8_t page_bit(uint8_t const *bits, uint32_t page)
+{
+	return bits[page >> 3] >> (page & 7) & 1;
+}
+
+static void set_page_bit(uint8_t *bits, uint32_t page, uint8_t value)
+{
+	bits[page >> 3] = (bits[page >> 3] & ~(1 << (page & 7))) | value << (page & 7);
+}
+
+static uint8_t *m68k_dirty_pages(genesis_context *gen, uint32_t *first)
+{
+	cpu_options *opts = &gen->m68k->options->gen;
+	*first = ram_dirty_page(opts, 0xFF0000);
+	return (uint8_t *)gen->m68k + opts->ram_dirty_off;
+}
+
+static uint8_t *z80_dirty_pages(genesis_context *gen, uint32_t *first)
+{
+	cpu_options *opts = &gen->z80->Z80_OPTS->gen;
+	*first = ram_dirty_page(opts, 0);
+	return (uint8_t *)gen->z80 + opts->ram_dirty_off;
+}
+
+static void clear_dirty_pages(genesis_context *gen)
+{
+	uint32_t first;
+	uint8_t *dirty = m68k_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < RAM_PAGES; page++)
+	{
+		set_page_bit(dirty, first + page, 0);
+	}
+	dirty = z80_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < ZRAM_PAGES; page++)
+	{
+		set_page_bit(dirty, first + page, 0);
+	}
+	memset(gen->vdp->vram_dirty, 0, sizeof(gen->vdp->vram_dirty));
+}
+
+static void snapshot_mapper(genesis_context *gen)
+{
+	gen->mapper_snapshot.size = 0;
+	if (gen->mapper_type != MAPPER_NONE) {
+		if (!gen->mapper_snapshot.data) {
+			gen->mapper_snapshot.storage = SNAPSHOT_MAPPER_BYTES;
+			gen->mapper_snapshot.data = malloc(SNAPSHOT_MAPPER_BYTES);
+		}
+		cart_serialize(&gen->header, &gen->mapper_snapshot);
+	}
+}
+
+//a delta is never larger than a full snapshot
+static size_t snapshot_size(system_header *sys)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	return SNAPSHOT_VRAM(gen) + VRAM_SIZE;
+}
+
+//saves everything except work RAM, Z80 RAM and VRAM
+static uint8_t snapshot_state(genesis_context *gen, void *dst)
+{
+	if (!gen->m68k->resume_pc || gen->vdp->fb) {
+		//not stopped at a frame boundary
+		return 0;
+	}
+	snapshot_mapper(gen);
+	if (gen->mapper_snapshot.size > SNAPSHOT_MAPPER_BYTES) {
+		warning("Mapper state is too large for a snapshot\n");
+		return 0;
+	}
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
+	vdp_sync_render_thread(gen->vdp);
+	uint8_t *base = dst;
+	snapshot_header *header = dst;
+	header->mapper_size = gen->mapper_snapshot.size;
+	header->frame_end = gen->frame_end;
+	header->reset_cycle = gen->reset_cycle;
+	header->last_frame = gen->last_frame;
+	header->last_flush_cycle = gen->last_flush_cycle;
+	header->last_sync_cycle = gen->last_sync_cycle;
+	header->refresh_counter = gen->refresh_counter;
+	header->m68k_flushes = gen->m68k->options->gen.cache.flushes;
+	header->z80_flushes = gen->z80->Z80_OPTS->gen.cache.flushes;
+	header->m68k_resume_offset = m68k_resume_offset(gen->m68k);
+	header->z80_resume_offset = z80_resume_offset(gen->z80);
+	header->z80_bank_reg = gen->z80_bank_reg;
+	memcpy(header->tmss_lock, gen->tmss_lock, sizeof(gen->tmss_lock));
+	header->bus_busy = gen->bus_busy;
+	header->reset_requested = gen->reset_requested;
+	header->io = gen->io;
+	header->eeprom = gen->eeprom;
+	header->nor = gen->nor;
+	memcpy(header->mapper, gen->mapper_snapshot.data, gen->mapper_snapshot.size);
+	memcpy(base + SNAPSHOT_M68K, gen->m68k, sizeof(m68k_context));
+	z80_snapshot(gen->z80, base + SNAPSHOT_Z80);
+	memcpy(base + SNAPSHOT_YM, gen->ym, sizeof(ym2612_context));
+	memcpy(base + SNAPSHOT_PSG, gen->psg, sizeof(psg_context));
+	memcpy(base + SNAPSHOT_VDP, gen->vdp, sizeof(vdp_context));
+	memcpy(base + SNAPSHOT_SAVE, gen->save_storage, gen->save_size);
+	return 1;
+}
+
+//fills in the header of a full snapshot and makes it the new base for deltas
+static void full_snapshot_header(genesis_context *gen, snapshot_header *header)
+{
+	header->size = snapshot_size(&gen->header);
+	header->delta = 0;
+	if (!++gen->snapshot_serial) {
+		gen->snapshot_serial = 1;
+	}
+	header->serial = gen->snapshot_base = gen->snapshot_serial;
+	memset(header->ram_pages, 0, sizeof(header->ram_pages));
+	memset(header->zram_pages, 0, sizeof(header->zram_pages));
+	memset(header->vram_pages, 0, sizeof(header->vram_pages));
+}
+
+static void snapshot_memory(genesis_context *gen, uint8_t *base)
+{
+	memcpy(base + SNAPSHOT_MEMORY(gen), gen->work_ram, RAM_WORDS * sizeof(uint16_t));
+	memcpy(base + SNAPSHOT_ZRAM(gen), gen->zram, Z80_RAM_BYTES);
+	memcpy(base + SNAPSHOT_VRAM(gen), gen->vdp->vdpmem, VRAM_SIZE);
+	clear_dirty_pages(gen);
+}
+
+static uint8_t snapshot(system_header *sys, void *dst)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	if (!snapshot_state(gen, dst)) {
+		return 0;
+	}
+	full_snapshot_header(gen, dst);
+	snapshot_memory(gen, dst);
+	return 1;
+}
+
+//adds the dirty pages to ranges, merging neighbours, and returns the new number of ranges
+static uint32_t dirty_ranges(uint8_t const *dirty, uint32_t first, uint32_t pages, uint8_t shift, uint8_t const *mem, size_t offset, rewind_range *ranges, uint32_t count)
+{
+	for (uint32_t page = 0; page < pages; page++)
+	{
+		if (!page_bit(dirty, first + page)) {
+			continue;
+		}
+		size_t page_offset = offset + (page << shift);
+		if (count && ranges[count - 1].offset + ranges[count - 1].size == page_offset) {
+			ranges[count - 1].size += 1 << shift;
+		} else {
+			ranges[count++] = (rewind_range){
+				.data = mem + (page << shift),
+				.offset = page_offset,
+				.size = 1 << shift
+			};
+		}
+	}
+	return count;
+}
+
+//records the current frame in the rewind history after prefix_size bytes of frontend state
+//as long as memory hasn't been replaced since the newest recorded state, only the pages
+//written since then are compared against it instead of the whole of RAM and VRAM
+static void rewind_record(system_header *sys, uint8_t *prefix, size_t prefix_size)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	rewind_buffer *rw = sys->rewind;
+	size_t size = prefix_size + snapshot_size(sys);
+	size_t newest_size;
+	uint8_t const *newest = rewind_newest(rw, &newest_size);
+	uint8_t tracked = newest && newest_size == size && gen->snapshot_base
+		&& ((snapshot_header const *)(newest + prefix_size))->serial == gen->snapshot_base;
+	uint8_t *state = rewind_scratch(rw, size);
+	if (!snapshot_state(gen, state + prefix_size)) {
+		return;
+	}
+	if (prefix_size) {
+		memcpy(state, prefix, prefix_size);
+	}
+	full_snapshot_header(gen, (snapshot_header *)(state + prefix_size));
+	if (tracked) {
+		rewind_range ranges[1 + RAM_PAGES + ZRAM_PAGES + VRAM_PAGES];
+		ranges[0] = (rewind_range){.data = state, .offset = 0, .size = prefix_size + SNAPSHOT_MEMORY(gen)};
+		uint32_t count = 1, first;
+		uint8_t *dirty = m68k_dirty_pages(gen, &first);
+		count = dirty_ranges(dirty, first, RAM_PAGES, RAM_DIRTY_SHIFT, (uint8_t *)gen->work_ram, prefix_size + SNAPSHOT_MEMORY(gen), ranges, count);
+		dirty = z80_dirty_pages(gen, &first);
+		count = dirty_ranges(dirty, first, ZRAM_PAGES, RAM_DIRTY_SHIFT, gen->zram, prefix_size + SNAPSHOT_ZRAM(gen), ranges, count);
+		count = dirty_ranges(gen->vdp->vram_dirty, 0, VRAM_PAGES, VRAM_DIRTY_SHIFT, gen->vdp->vdpmem, prefix_size + SNAPSHOT_VRAM(gen), ranges, count);
+		clear_dirty_pages(gen);
+		rewind_push_ranges(rw, size, ranges, count);
+	} else {
+		snapshot_memory(gen, state + prefix_size);
+		rewind_push(rw, state, size);
+	}
+}
+
+//returns the number of bytes used or 0 if there is no base snapshot to build on
+static size_t snapshot_delta(system_header *sys, void *dst)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	if (!gen->snapshot_base || !snapshot_state(gen, dst)) {
+		return 0;
+	}
+	uint8_t *base = dst;
+	snapshot_header *header = dst;
+	header->delta = 1;
+	header->serial = gen->snapshot_base;
+	uint8_t *cur = base + SNAPSHOT_MEMORY(gen);
+	uint32_t first;
+	uint8_t *dirty = m68k_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < RAM_PAGES; page++)
+	{
+		uint8_t is_dirty = page_bit(dirty, first + page);
+		set_page_bit(header->ram_pages, page, is_dirty);
+		if (is_dirty) {
+			memcpy(cur, gen->work_ram + page * RAM_PAGE_WORDS, RAM_PAGE_WORDS * sizeof(uint16_t));
+			cur += RAM_PAGE_WORDS * sizeof(uint16_t);
+		}
+	}
+	dirty = z80_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < ZRAM_PAGES; page++)
+	{
+		uint8_t is_dirty = page_bit(dirty, first + page);
+		set_page_bit(header->zram_pages, page, is_dirty);
+		if (is_dirty) {
+			memcpy(cur, gen->zram + (page << RAM_DIRTY_SHIFT), 1 << RAM_DIRTY_SHIFT);
+			cur += 1 << RAM_DIRTY_SHIFT;
+		}
+	}
+	memcpy(header->vram_pages, gen->vdp->vram_dirty, sizeof(header->vram_pages));
+	for (uint32_t page = 0; page < VRAM_PAGES; page++)
+	{
+		if (page_bit(header->vram_pages, page)) {
+			memcpy(cur, gen->vdp->vdpmem + (page << VRAM_DIRTY_SHIFT), 1 << VRAM_DIRTY_SHIFT);
+			cur += 1 << VRAM_DIRTY_SHIFT;
+		}
+	}
+	header->size = cur - base;
+	return header->size;
+}
+
+//RAM is copied directly rather than through the normal write path so code translated from
+//RAM that is about to change needs to be invalidated explicitly
+static void restore_ram_page(genesis_context *gen, uint32_t page, uint16_t const *src)
+{
+	uint16_t *ram = gen->work_ram + page * RAM_PAGE_WORDS;
+	if (!memcmp(ram, src, RAM_PAGE_WORDS * sizeof(uint16_t))) {
+		return;
+	}
+	for (uint32_t word = 0; word < RAM_PAGE_WORDS; word++)
+	{
+		if (ram[word] != src[word]) {
+			ram[word] = src[word];
+			uint32_t address = 0xFF0000 + (page * RAM_PAGE_WORDS + word) * 2;
+			if (ram_has_code(gen->m68k->ram_code_flags, &gen->m68k->options->gen, address)) {
+				m68k_handle_code_write(address, gen->m68k);
+			}
+		}
+	}
+}
+
+static void restore_zram_page(genesis_context *gen, uint32_t page, uint8_t const *src)
+{
+	uint8_t *zram = gen->zram + (page << RAM_DIRTY_SHIFT);
+	if (!memcmp(zram, src, 1 << RAM_DIRTY_SHIFT)) {
+		return;
+	}
+	for (uint32_t offset = 0; offset < 1 << RAM_DIRTY_SHIFT; offset++)
+	{
+		if (zram[offset] != src[offset]) {
+			zram[offset] = src[offset];
+			uint32_t address = (page << RAM_DIRTY_SHIFT) + offset;
+			if (ram_has_code(gen->z80->ram_code_flags, &gen->z80->Z80_OPTS->gen, address)) {
+				z80_handle_code_write(address, gen->z80);
+			}
+		}
+	}
+}
+
+//restores the memory from full and, if not NULL, the pages and everything else from delta
+static void restore_snapshot(genesis_context *gen, void const *full, void const *delta)
+{
+	uint8_t const *base = delta ? delta : full;
+	snapshot_header const *header = (snapshot_header const *)base;
+	if (gen->vdp->fb) {
+		vdp_release_framebuffer(gen->vdp);
+	}
+	uint8_t const *full_ram = (uint8_t const *)full + SNAPSHOT_MEMORY(gen);
+	uint8_t const *full_zram = (uint8_t const *)full + SNAPSHOT_ZRAM(gen);
+	uint8_t const *full_vram = (uint8_t const *)full + SNAPSHOT_VRAM(gen);
+	uint8_t const *cur = base + SNAPSHOT_MEMORY(gen);
+	uint32_t first;
+	uint8_t *dirty = m68k_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < RAM_PAGES; page++)
+	{
+		uint8_t const *src = full_ram + page * RAM_PAGE_WORDS * sizeof(uint16_t);
+		uint8_t in_delta = delta && page_bit(header->ram_pages, page);
+		if (in_delta) {
+			src = cur;
+			cur += RAM_PAGE_WORDS * sizeof(uint16_t);
+		}
+		restore_ram_page(gen, page, (uint16_t const *)src);
+		set_page_bit(dirty, first + page, in_delta);
+	}
+	dirty = z80_dirty_pages(gen, &first);
+	for (uint32_t page = 0; page < ZRAM_PAGES; page++)
+	{
+		uint8_t const *src = full_zram + (page << RAM_DIRTY_SHIFT);
+		uint8_t in_delta = delta && page_bit(header->zram_pages, page);
+		if (in_delta) {
+			src = cur;
+			cur += 1 << RAM_DIRTY_SHIFT;
+		}
+		restore_zram_page(gen, page, src);
+		set_page_bit(dirty, first + page, in_delta);
+	}
+	//VRAM needs to be copied before the VDP context so the dirty bits in the context survive
+	for (uint32_t page = 0; page < VRAM_PAGES; page++)
+	{
+		uint8_t const *src = full_vram + (page << VRAM_DIRTY_SHIFT);
+		if (delta && page_bit(header->vram_pages, page)) {
+			src = cur;
+			cur += 1 << VRAM_DIRTY_SHIFT;
+		}
+		memcpy(gen->vdp->vdpmem + (page << VRAM_DIRTY_SHIFT), src, 1 << VRAM_DIRTY_SHIFT);
+	}
+	m68k_restore(gen->m68k, (m68k_context const *)(base + SNAPSHOT_M68K));
+	z80_restore(gen->z80, base + SNAPSHOT_Z80);
+	if (header->m68k_flushes != gen->m68k->options->gen.cache.flushes) {
+		m68k_rebase_resume(gen->m68k, header->m68k_resume_offset);
+	}
+	if (header->z80_flushes != gen->z80->Z80_OPTS->gen.cache.flushes) {
+		z80_rebase_resume(gen->z80, header->z80_resume_offset);
+	}
+	if (gen->sound) {
+		sound_thread_wait(gen->sound);
+	}
+	ym_restore(gen->ym, (ym2612_context const *)(base + SNAPSHOT_YM));
+	psg_restore(gen->psg, (psg_context const *)(base + SNAPSHOT_PSG));
+	if (gen->sound) {
+		sound_thread_reload(gen->sound);
+	}
+	vdp_restore(gen->vdp, (vdp_context const *)(base + SNAPSHOT_VDP));
+	memcpy(gen->vdp->vram_dirty, header->vram_pages, sizeof(gen->vdp->vram_dirty));
+	vdp_reload_render_thread(gen->vdp);
+	memcpy(gen->save_storage, base + SNAPSHOT_SAVE, gen->save_size);
+
+	gen->frame_end = header->frame_end;
+	gen->reset_cycle = header->reset_cycle;
+	gen->last_frame = header->last_frame;
+	gen->last_flush_cycle = header->last_flush_cycle;
+	gen->last_sync_cycle = header->last_sync_cycle;
+	gen->refresh_counter = header->refresh_counter;
+	memcpy(gen->tmss_lock, header->tmss_lock, sizeof(gen->tmss_lock));
+	gen->bus_busy = header->bus_busy;
+	gen->reset_requested = header->reset_requested;
+	gen->io = header->io;
+	gen->eeprom = header->eeprom;
+	gen->nor = header->nor;
+	if (gen->z80_bank_reg != header->z80_bank_reg) {
+		gen->z80_bank_reg = header->z80_bank_reg;
+		uint8_t *bank_pointer = gen->z80->mem_pointers[1];
+		update_z80_bank_pointer(gen);
+		//the Z80 context was restored with the right bank pointer already
+		gen->z80->mem_pointers[1] = bank_pointer;
+	}
+	//mapper registers have side effects on the memory map, only go through the slow path when they changed
+	snapshot_mapper(gen);
+	if (header->mapper_size != gen->mapper_snapshot.size || memcmp(header->mapper, gen->mapper_snapshot.data, header->mapper_size)) {
+		deserialize_buffer buffer;
+		init_deserialize(&buffer, (uint8_t *)header->mapper, header->mapper_size);
+		register_section_handler(&buffer, (section_handler){.fun = cart_deserialize, .data = gen}, SECTION_MAPPER);
+		while (buffer.cur_pos < buffer.size)
+		{
+			if (!load_section(&buffer))
+				break;
+		}
+		free(buffer.handlers);
+	}
+	gen->snapshot_base = ((snapshot_header const *)full)->serial;
+}
+
+//a snapshot taken before a code cache flush can only be restored if the CPUs it holds were
+//stopped somewhere that can be found again in the retranslated code
+static uint8_t snapshot_code_valid(genesis_context *gen, snapshot_header const *header)
+{
+	return (header->m68k_flushes == gen->m68k->options->gen.cache.flushes || header->m68k_resume_offset >= 0)
+		&& (header->z80_flushes == gen->z80->Z80_OPTS->gen.cache.flushes || header->z80_resume_offset >= 0);
+}
+
+static uint8_t restore(system_header *sys, void const *src)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	snapshot_header const *header = src;
+	if (header->size != snapshot_size(sys) || header->delta || !snapshot_code_valid(gen, header)) {
+		return 0;
+	}
+	restore_snapshot(gen, src, NULL);
+	return 1;
+}
+
+static uint8_t restore_delta(system_header *sys, void const *full, void const *delta)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	snapshot_header const *full_header = full;
+	snapshot_header const *delta_header = delta;
+	if (full_header->size != snapshot_size(sys) || full_header->delta
+		|| !delta_header->delta || delta_header->size > snapshot_size(sys) || delta_header->serial != full_header->serial
+		|| !snapshot_code_valid(gen, delta_header)
+	) {
+		return 0;
+	}
+	restore_snapshot(gen, full, delta);
+	return 1;
+}
+
+//called at a frame boundary to record the current frame or, while rewinding, step back one frame
+static void rewind_step(genesis_context *gen)
 {
-	genesis_context *genesis = (genesis_context *)current_system;
+	rewind_buffer *rw = gen->header.rewind;
+	if (gen->header.rewinding) {
+		size_t size;
+		uint8_t *state = rewind_pop(rw, &size);
+		if (state && snapshot_code_valid(gen, (snapshot_header const *)state)) {
+			restore_snapshot(gen, state, NULL);
+		}
+	} else {
+		rewind_record(&gen->header, NULL, 0);
+	}
+}
+#endif
+
+uint16_t read_dma_value(system_header *system, uint32_t address)
+{
+	genesis_context *genesis = (genesis_context *)system;
 	//TODO: Figure out what happens when you try to DMA from weird adresses like IO or banked Z80 area
 	if ((address >= 0xA00000 && address < 0xB00000) || (address >= 0xC00000 && address <= 0xE00000)) {
 		return 0;
@@ -268,10 +787,10 @@ static uint16_t get_open_bus_value(system_header *system)
 {
 	genesis_context *genesis = (genesis_context *)system;
 #ifndef NEW_CORE
-	return read_dma_value(genesis->m68k->last_prefetch_address/2);
+	return read_dma_value(system, genesis->m68k->last_prefetch_address/2);
 #else
 	m68000_base_device *device = (m68000_base_device *)genesis->m68k;
-	return read_dma_value(device->pref_addr/2);
+	return read_dma_value(system, device->pref_addr/2);
 #endif
 }
 
@@ -281,6 +800,9 @@ static void adjust_int_cycle(m68k_context * context, vdp_context * v_context)
 	genesis_context *gen = context->system;
 	if (context->sync_cycle - context->current_cycle > gen->max_cycles) {
 		context->sync_cycle = context->current_cycle + gen->max_cycles;
+		if (gen->profile) {
+			gen->profile->frame.paths[GEN_PROF_PATH_MAX_CYCLES]++;
+		}
 	}
 	context->int_cycle = CYCLE_NEVER;
 	if ((context->status & 0x7) < 6) {
@@ -326,12 +848,19 @@ static void adjust_int_cycle(m68k_context * context, vdp_context * v_context)
 		//Currently delays from Z80 access and refresh are applied only when we sync
 		//this can cause extra latency when it comes to interrupts
 		//to prevent this code forces some extra synchronization in the period immediately before an interrupt
+		uint8_t path;
 		if ((context->target_cycle - context->current_cycle) > gen->int_latency_prev1) {
 			context->target_cycle = context->sync_cycle = context->int_cycle - gen->int_latency_prev1;
+			path = GEN_PROF_PATH_INT_PREV1;
 		} else if ((context->target_cycle - context->current_cycle) > gen->int_latency_prev2) {
 			context->target_cycle = context->sync_cycle = context->int_cycle - gen->int_latency_prev2;
+			path = GEN_PROF_PATH_INT_PREV2;
 		} else {
 			context->target_cycle = context->sync_cycle = context->current_cycle;
+			path = GEN_PROF_PATH_INT_NOW;
+		}
+		if (gen->profile) {
+			gen->profile->frame.paths[path]++;
 		}
 
 	}
@@ -364,6 +893,237 @@ static void z80_next_int_pulse(z80_context * z_context)
 #endif
 }
 
+//components are switched several times per sync, which makes the clock read the main cost of profiling
+//reading the timestamp counter is cheaper than clock_gettime where there is one
+static uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return get_time_ns();
+#endif
+}
+
+//switches the component that host time is attributed to and returns the previous one
+static uint8_t profile_enter(genesis_context *gen, uint8_t component)
+{
+	genesis_profile *prof = gen->profile;
+	if (!prof || prof->current == component) {
+		return component;
+	}
+	uint64_t now = profile_ticks();
+	prof->ticks[prof->current] += now - prof->last;
+	prof->last = now;
+	uint8_t prev = prof->current;
+	prof->current = component;
+	return prev;
+}
+
+//time spent in the frontend between runs is not attributed to any component
+static void profile_resume(genesis_context *gen)
+{
+	if (gen->profile) {
+		gen->profile->last = profile_ticks();
+		gen->profile->current = GEN_PROF_M68K;
+		gen->profile->last_cycle = gen->m68k->current_cycle;
+	}
+}
+
+static void profile_add(genesis_profile_counters *dst, genesis_profile_counters const *src)
+{
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		dst->ns[i] += src->ns[i];
+	}
+	for (int i = 0; i < GEN_PROF_PATHS; i++)
+	{
+		dst->paths[i] += src->paths[i];
+	}
+	dst->mclks += src->mclks;
+	dst->syncs += src->syncs;
+	dst->frames += src->frames;
+}
+
+static const char *profile_component_names[GEN_PROF_COMPONENTS] = {
+	"m68k", "z80", "vdp", "ym2612", "psg"
+};
+static const char *profile_path_names[GEN_PROF_PATHS] = {
+	"max_cycles", "int_prev1", "int_prev2", "int_now", "rebase"
+};
+
+static void profile_dump_header(FILE *f)
+{
+	fputs("frames,syncs,mclks", f);
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		fprintf(f, ",%s_ns", profile_component_names[i]);
+	}
+	for (int i = 0; i < GEN_PROF_PATHS; i++)
+	{
+		fprintf(f, ",%s", profile_path_names[i]);
+	}
+	fputc('\n', f);
+}
+
+static void profile_dump_line(FILE *f, genesis_profile_counters const *counters)
+{
+	fprintf(f, "%u,%u,%llu", counters->frames, counters->syncs, (unsigned long long)counters->mclks);
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		fprintf(f, ",%llu", (unsigned long long)counters->ns[i]);
+	}
+	for (int i = 0; i < GEN_PROF_PATHS; i++)
+	{
+		fprintf(f, ",%u", counters->paths[i]);
+	}
+	fputc('\n', f);
+	fflush(f);
+}
+
+static void profile_frame_end(genesis_context *gen)
+{
+	genesis_profile *prof = gen->profile;
+	uint64_t ticks = profile_ticks() - prof->start_ticks;
+	double ns_per_tick = ticks ? (double)(get_time_ns() - prof->start_ns) / ticks : 1.0;
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		prof->frame.ns[i] = prof->ticks[i] * ns_per_tick;
+		prof->ticks[i] = 0;
+	}
+	prof->frame.frames = 1;
+	profile_add(&prof->total, &prof->frame);
+	profile_add(&prof->interval, &prof->frame);
+	prof->last_frame = prof->frame;
+	memset(&prof->frame, 0, sizeof(prof->frame));
+	if (prof->dump && prof->interval.frames >= prof->dump_frames) {
+		profile_dump_line(prof->dump, &prof->interval);
+		memset(&prof->interval, 0, sizeof(prof->interval));
+	}
+}
+
+void genesis_set_profiling(genesis_context *gen, uint8_t enabled)
+{
+	if (gen->profile) {
+		if (gen->profile->dump) {
+			fclose(gen->profile->dump);
+		}
+		free(gen->profile);
+	}
+	gen->profile = enabled ? calloc(1, sizeof(genesis_profile)) : NULL;
+	if (gen->profile) {
+		gen->profile->start_ticks = profile_ticks();
+		gen->profile->start_ns = get_time_ns();
+	}
+	profile_resume(gen);
+}
+
+uint8_t genesis_profile_dump(genesis_context *gen, char *path, uint32_t frames)
+{
+	genesis_profile *prof = gen->profile;
+	if (!prof) {
+		return 0;
+	}
+	if (prof->dump) {
+		fclose(prof->dump);
+		prof->dump = NULL;
+	}
+	if (!path) {
+		return 1;
+	}
+	prof->dump = fopen(path, "a");
+	if (!prof->dump) {
+		return 0;
+	}
+	if (!ftell(prof->dump)) {
+		profile_dump_header(prof->dump);
+	}
+	prof->dump_frames = frames ? frames : 1;
+	memset(&prof->interval, 0, sizeof(prof->interval));
+	return 1;
+}
+
+static void print_profile_counters(char const *label, genesis_profile_counters const *counters)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		total += counters->ns[i];
+	}
+	uint32_t frames = counters->frames ? counters->frames : 1;
+	printf("%s: %u frames, %.3f ms per frame, %u syncs per frame, %.1f mclks per sync\n", label, counters->frames,
+		total / 1000000.0 / frames, counters->syncs / frames, counters->syncs ? (double)counters->mclks / counters->syncs : 0.0);
+	for (int i = 0; i < GEN_PROF_COMPONENTS; i++)
+	{
+		printf("    %-10s %9.3f ms per frame %5.1f%%\n", profile_component_names[i], counters->ns[i] / 1000000.0 / frames,
+			total ? counters->ns[i] * 100.0 / total : 0.0);
+	}
+	printf("    paths per frame:");
+	for (int i = 0; i < GEN_PROF_PATHS; i++)
+	{
+		printf(" %s %.1f", profile_path_names[i], (double)counters->paths[i] / frames);
+	}
+	putchar('\n');
+}
+
+void genesis_print_profile(genesis_context *gen)
+{
+	if (!gen->profile) {
+		puts("Profiling is not enabled");
+		return;
+	}
+	print_profile_counters("Last frame", &gen->profile->last_frame);
+	print_profile_counters("Since enabled", &gen->profile->total);
+}
+
+void genesis_set_code_cache_budget(genesis_context *gen, uint32_t budget)
+{
+#ifndef NEW_CORE
+	gen->m68k->options->gen.cache.budget = budget;
+#ifndef NO_Z80
+	gen->z80->Z80_OPTS->gen.cache.budget = budget;
+#endif
+#endif
+}
+
+//Z80 code on the Genesis runs from RAM or the banked ROM window, so only 68K code is stored
+uint8_t genesis_enable_code_store(genesis_context *gen, char const *dir)
+{
+#ifdef NEW_CORE
+	return 0;
+#else
+	m68k_options *opts = gen->m68k->options;
+	//the hash only covers the main ROM and the address log needs every instruction to be translated
+	if (gen->lock_on || opts->address_log || opts->gen.store || !ensure_dir_exists(dir)) {
+		return 0;
+	}
+	char hash[41];
+	bin_to_hex((uint8_t *)hash, gen->header.info.hash, sizeof(gen->header.info.hash));
+	char const *parts[] = {dir, PATH_SEP, hash, ".m68k"};
+	char *path = alloc_concat_m(4, parts);
+	uint32_t loaded = m68k_enable_code_store(gen->m68k, path, gen->header.info.hash, gen->header.info.rom, gen->header.info.rom_size);
+	if (opts->gen.store) {
+		debug_message("Loaded %u stored 68K instructions from %s\n", loaded, path);
+	}
+	free(path);
+	return opts->gen.store != NULL;
+#endif
+}
+
+uint8_t genesis_code_cache_stats(genesis_context *gen, code_cache_stats *m68k, code_cache_stats *z80)
+{
+#ifdef NEW_CORE
+	return 0;
+#else
+	m68k_code_cache_stats(gen->m68k, m68k);
+#ifdef NO_Z80
+	memset(z80, 0, sizeof(*z80));
+#else
+	*z80 = gen->z80->Z80_OPTS->gen.cache;
+#endif
+	return 1;
+#endif
+}
+
 static void sync_z80(z80_context * z_context, uint32_t mclks)
 {
 #ifndef NO_Z80
@@ -373,7 +1133,10 @@ static void sync_z80(z80_context * z_context, uint32_t mclks)
 			z80_next_int_pulse(z_context);
 		}
 #endif
+		genesis_context *gen = z_context->system;
+		uint8_t prev = profile_enter(gen, GEN_PROF_Z80);
 		z80_run(z_context, mclks);
+		profile_enter(gen, prev);
 	} else
 #endif
 	{
@@ -381,22 +1144,113 @@ static void sync_z80(z80_context * z_context, uint32_t mclks)
 	}
 }
 
-static void sync_sound(genesis_context * gen, uint32_t target)
+static void run_sound(genesis_context * gen, uint32_t target)
 {
 	//printf("YM | Cycle: %d, bpos: %d, PSG | Cycle: %d, bpos: %d\n", gen->ym->current_cycle, gen->ym->buffer_pos, gen->psg->cycles, gen->psg->buffer_pos * 2);
+	//the PSG runs last so that sync_components, which enters the PSG before this, doesn't switch back
+	uint8_t prev = profile_enter(gen, GEN_PROF_YM);
 	while (target > gen->psg->cycles && target - gen->psg->cycles > MAX_SOUND_CYCLES) {
 		uint32_t cur_target = gen->psg->cycles + MAX_SOUND_CYCLES;
-		//printf("Running PSG to cycle %d\n", cur_target);
-		psg_run(gen->psg, cur_target);
 		//printf("Running YM-2612 to cycle %d\n", cur_target);
 		ym_run(gen->ym, cur_target);
+		//printf("Running PSG to cycle %d\n", cur_target);
+		profile_enter(gen, GEN_PROF_PSG);
+		psg_run(gen->psg, cur_target);
+		profile_enter(gen, GEN_PROF_YM);
 	}
-	psg_run(gen->psg, target);
 	ym_run(gen->ym, target);
+	profile_enter(gen, GEN_PROF_PSG);
+	psg_run(gen->psg, target);
+	profile_enter(gen, prev);
 
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
+static void sync_sound(genesis_context * gen, uint32_t target)
+{
+	if (gen->sound) {
+		uint8_t prev = profile_enter(gen, GEN_PROF_YM);
+		ym_run_status(gen->ym, target);
+		sound_thread_run(gen->sound, target);
+		profile_enter(gen, prev);
+	} else {
+		run_sound(gen, target);
+	}
+}
+
+static void write_psg(genesis_context *gen, uint32_t cycle, uint8_t value)
+{
+	if (gen->sound) {
+		sound_thread_write(gen->sound, cycle, SOUND_PSG, value);
+	} else {
+		psg_write(gen->psg, value);
+	}
+}
+
+static void write_ym(genesis_context *gen, uint32_t cycle, uint32_t location, uint8_t value)
+{
+	uint8_t port;
+	if (location & 1) {
+		ym_data_write(gen->ym, value);
+		port = SOUND_YM_DATA;
+	} else if (location & 2) {
+		ym_address_write_part2(gen->ym, value);
+		port = SOUND_YM_ADDRESS2;
+	} else {
+		ym_address_write_part1(gen->ym, value);
+		port = SOUND_YM_ADDRESS1;
+	}
+	if (gen->sound) {
+		sound_thread_write(gen->sound, cycle, port, value);
+	}
+}
+
+static void reset_ym(genesis_context *gen)
+{
+	ym_reset(gen->ym);
+	if (gen->sound) {
+		sound_thread_ym_reset(gen->sound);
+	}
+}
+
+static void run_vdp(genesis_context *gen, uint32_t target)
+{
+	uint8_t prev = profile_enter(gen, GEN_PROF_VDP);
+	vdp_run_context(gen->vdp, target);
+	profile_enter(gen, prev);
+}
+
+static void run_vdp_full(genesis_context *gen, uint32_t target)
+{
+	uint8_t prev = profile_enter(gen, GEN_PROF_VDP);
+	vdp_run_context_full(gen->vdp, target);
+	profile_enter(gen, prev);
+}
+
+static void run_vdp_dma_done(genesis_context *gen, uint32_t target)
+{
+	uint8_t prev = profile_enter(gen, GEN_PROF_VDP);
+	vdp_run_dma_done(gen->vdp, target);
+	profile_enter(gen, prev);
+}
+
+#ifndef NEW_CORE
+//a debugger shows the flags after every instruction, so flag updates stop being left out once one is
+//attached. Code that was translated without them is thrown away right away if the 68K isn't running
+//yet, otherwise once it stops
+static void attach_debugger(genesis_context *gen, uint8_t stopped)
+{
+	m68k_options *opts = gen->m68k->options;
+	if (opts->gen.flags & M68K_OPT_DEAD_FLAGS) {
+		opts->gen.flags &= ~M68K_OPT_DEAD_FLAGS;
+		gen->m68k_flush_pending = !stopped || !m68k_flush_code_cache(gen->m68k);
+		if (gen->m68k_flush_pending) {
+			gen->m68k->should_return = 1;
+		}
+	}
+}
+#endif
+
 #include <limits.h>
 #define ADJUST_BUFFER (8*MCLKS_LINE*313)
 #define MAX_NO_ADJUST (UINT_MAX-ADJUST_BUFFER)
@@ -407,20 +1261,32 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 	vdp_context * v_context = gen->vdp;
 	z80_context * z_context = gen->z80;
 #ifdef REFRESH_EMULATION
-	if (context->current_cycle != last_sync_cycle) {
+	if (context->current_cycle != gen->last_sync_cycle) {
 		//lame estimation of refresh cycle delay
-		refresh_counter += context->current_cycle - last_sync_cycle;
+		gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
 		if (!gen->bus_busy) {
-			context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+			context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
 		}
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 	}
 #endif
 
 	uint32_t mclks = context->current_cycle;
+	if (gen->profile) {
+		gen->profile->frame.syncs++;
+		if (mclks > gen->profile->last_cycle) {
+			gen->profile->frame.mclks += mclks - gen->profile->last_cycle;
+		}
+		gen->profile->last_cycle = mclks;
+	}
+	//switching straight from one component to the next saves the clock reads of going back to the 68K
+	uint8_t prev = profile_enter(gen, GEN_PROF_Z80);
 	sync_z80(z_context, mclks);
+	profile_enter(gen, gen->sound ? GEN_PROF_YM : GEN_PROF_PSG);
 	sync_sound(gen, mclks);
-	vdp_run_context(v_context, mclks);
+	profile_enter(gen, GEN_PROF_VDP);
+	run_vdp(gen, mclks);
+	profile_enter(gen, prev);
 	if (mclks >= gen->reset_cycle) {
 		gen->reset_requested = 1;
 		context->should_return = 1;
@@ -431,6 +1297,24 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		gen->last_frame = v_context->frame;
 		event_flush(mclks);
 		gen->last_flush_cycle = mclks;
+#ifndef NEW_CORE
+		m68k_code_pages_frame(context);
+#ifndef NO_Z80
+		z80_code_pages_frame(gen->z80);
+#endif
+#endif
+#ifndef NEW_CORE
+		if (gen->m68k_flush_pending) {
+			context->should_return = 1;
+		}
+#endif
+#if !defined(IS_LIB) && !defined(NEW_CORE)
+		if (gen->header.rewind) {
+			//the lib records or steps back between runs instead, which are already frame boundaries
+			gen->rewind_pending = 1;
+			context->should_return = 1;
+		}
+#endif
 
 		if(exit_after){
 			--exit_after;
@@ -453,12 +1337,23 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			if (gen->ym->vgm) {
 				vgm_adjust_cycles(gen->ym->vgm, deduction);
 			}
-			gen->psg->cycles -= deduction;
+			if (gen->sound) {
+				sound_thread_adjust_cycles(gen->sound, deduction);
+			} else {
+				gen->psg->cycles -= deduction;
+			}
 			if (gen->reset_cycle != CYCLE_NEVER) {
 				gen->reset_cycle -= deduction;
 			}
 			event_cycle_adjust(mclks, deduction);
 			gen->last_flush_cycle -= deduction;
+			if (gen->profile) {
+				gen->profile->frame.paths[GEN_PROF_PATH_REBASE]++;
+				gen->profile->last_cycle -= deduction;
+			}
+		}
+		if (gen->profile) {
+			profile_frame_end(gen);
 		}
 	} else if (mclks - gen->last_flush_cycle > gen->soft_flush_cycles) {
 		event_soft_flush(mclks);
@@ -483,6 +1378,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 #ifndef NEW_CORE
 		if (gen->header.enter_debugger) {
 			gen->header.enter_debugger = 0;
+			attach_debugger(gen, 0);
 			debugger(context, address);
 		}
 #endif
@@ -534,7 +1430,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		}
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -546,17 +1442,17 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 	}
 	vdp_port &= 0x1F;
 	//printf("vdp_port write: %X, value: %X, cycle: %d\n", vdp_port, value, context->current_cycle);
+	genesis_context * gen = context->system;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-	if (context->current_cycle - 4*MCLKS_PER_68K > last_sync_cycle) {
-		refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-		last_sync_cycle = context->current_cycle;
+	if (context->current_cycle - 4*MCLKS_PER_68K > gen->last_sync_cycle) {
+		gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->last_sync_cycle = context->current_cycle;
 	}
 #endif
 	sync_components(context, 0);
-	genesis_context * gen = context->system;
 	vdp_context *v_context = gen->vdp;
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
@@ -564,7 +1460,7 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 		if (vdp_port < 4) {
 			while (vdp_data_port_write(v_context, value) < 0) {
 				while(v_context->flags & FLAG_DMA_RUN) {
-					vdp_run_dma_done(v_context, gen->frame_end);
+					run_vdp_dma_done(gen, gen->frame_end);
 					if (v_context->cycles >= gen->frame_end) {
 						uint32_t cycle_diff = v_context->cycles - context->current_cycle;
 						uint32_t m68k_cycle_diff = (cycle_diff / MCLKS_PER_68K) * MCLKS_PER_68K;
@@ -580,13 +1476,13 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 				//context->current_cycle = v_context->cycles;
 			}
 		} else if(vdp_port < 8) {
-			vdp_run_context_full(v_context, context->current_cycle);
+			run_vdp_full(gen, context->current_cycle);
 			before_cycle = v_context->cycles;
 			blocked = vdp_control_port_write(v_context, value);
 			if (blocked) {
 				while (blocked) {
 					while(v_context->flags & FLAG_DMA_RUN) {
-						vdp_run_dma_done(v_context, gen->frame_end);
+						run_vdp_dma_done(gen, gen->frame_end);
 						if (v_context->cycles >= gen->frame_end) {
 							uint32_t cycle_diff = v_context->cycles - context->current_cycle;
 							uint32_t m68k_cycle_diff = (cycle_diff / MCLKS_PER_68K) * MCLKS_PER_68K;
@@ -628,21 +1524,21 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 			gen->bus_busy = 0;
 		}
 	} else if (vdp_port < 0x18) {
-		psg_write(gen->psg, value);
+		write_psg(gen, context->current_cycle, value);
 	} else {
 		vdp_test_port_write(gen->vdp, value);
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4 * MCLKS_PER_68K;
+	gen->last_sync_cycle -= 4 * MCLKS_PER_68K;
 	//refresh may have happened while we were waiting on the VDP,
 	//so advance refresh_counter but don't add any delays
 	if (vdp_port >= 4 && vdp_port < 8 && v_context->cycles != before_cycle) {
-		refresh_counter = 0;
+		gen->refresh_counter = 0;
 	} else {
-		refresh_counter += (context->current_cycle - last_sync_cycle);
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 	}
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -663,17 +1559,17 @@ static void * z80_vdp_port_write(uint32_t vdp_port, void * vcontext, uint8_t val
 	if (vdp_port < 0x10) {
 		//These probably won't currently interact well with the 68K accessing the VDP
 		if (vdp_port < 4) {
-			vdp_run_context(gen->vdp, context->Z80_CYCLE);
+			run_vdp(gen, context->Z80_CYCLE);
 			vdp_data_port_write(gen->vdp, value << 8 | value);
 		} else if (vdp_port < 8) {
-			vdp_run_context_full(gen->vdp, context->Z80_CYCLE);
+			run_vdp_full(gen, context->Z80_CYCLE);
 			vdp_control_port_write(gen->vdp, value << 8 | value);
 		} else {
 			fatal_error("Illegal write to HV Counter port %X\n", vdp_port);
 		}
 	} else if (vdp_port < 0x18) {
 		sync_sound(gen, context->Z80_CYCLE);
-		psg_write(gen->psg, value);
+		write_psg(gen, context->Z80_CYCLE, value);
 	} else {
 		vdp_test_port_write(gen->vdp, value);
 	}
@@ -687,17 +1583,17 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 	}
 	vdp_port &= 0x1F;
 	uint16_t value;
+	genesis_context *gen = context->system;
 #ifdef REFRESH_EMULATION
-	if (context->current_cycle - 4*MCLKS_PER_68K > last_sync_cycle) {
+	if (context->current_cycle - 4*MCLKS_PER_68K > gen->last_sync_cycle) {
 		//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-		refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-		last_sync_cycle = context->current_cycle;
+		gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->last_sync_cycle = context->current_cycle;
 	}
 #endif
 	sync_components(context, 0);
-	genesis_context *gen = context->system;
 	vdp_context * v_context = gen->vdp;
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
@@ -718,18 +1614,17 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 		//printf("68K paused for %d (%d) cycles at cycle %d (%d) for read\n", v_context->cycles - context->current_cycle, v_context->cycles - before_cycle, context->current_cycle, before_cycle);
 		context->current_cycle = v_context->cycles;
 		//Lock the Z80 out of the bus until the VDP access is complete
-		genesis_context *gen = context->system;
 		gen->bus_busy = 1;
 		sync_z80(gen->z80, v_context->cycles);
 		gen->bus_busy = 0;
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4 * MCLKS_PER_68K;
+	gen->last_sync_cycle -= 4 * MCLKS_PER_68K;
 	//refresh may have happened while we were waiting on the VDP,
 	//so advance refresh_counter but don't add any delays
-	refresh_counter += (context->current_cycle - last_sync_cycle);
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return value;
 }
@@ -764,7 +1659,7 @@ static uint8_t z80_vdp_port_read(uint32_t vdp_port, void * vcontext)
 	uint16_t ret;
 	if (vdp_port < 0x10) {
 		//These probably won't currently interact well with the 68K accessing the VDP
-		vdp_run_context(gen->vdp, context->Z80_CYCLE);
+		run_vdp(gen, context->Z80_CYCLE);
 		if (vdp_port < 4) {
 			ret = vdp_data_port_read(gen->vdp);
 		} else if (vdp_port < 8) {
@@ -786,12 +1681,12 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 {
 	genesis_context * gen = context->system;
 #ifdef REFRESH_EMULATION
-	if (context->current_cycle - 4*MCLKS_PER_68K > last_sync_cycle) {
+	if (context->current_cycle - 4*MCLKS_PER_68K > gen->last_sync_cycle) {
 		//do refresh check here so we can avoid adding a penalty for a refresh that happens during an IO area access
-		refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-		last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
+		gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
 	}
 #endif
 	if (location < 0x10000) {
@@ -802,17 +1697,14 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 			if (location < 0x4000) {
 				gen->zram[location & 0x1FFF] = value;
 #ifndef NO_Z80
+#ifndef NEW_CORE
+				mark_ram_dirty(&gen->z80->Z80_OPTS->gen, gen->z80, location & 0x1FFF);
+#endif
 				z80_handle_code_write(location & 0x1FFF, gen->z80);
 #endif
 			} else if (location < 0x6000) {
 				sync_sound(gen, context->current_cycle);
-				if (location & 1) {
-					ym_data_write(gen->ym, value);
-				} else if(location & 2) {
-					ym_address_write_part2(gen->ym, value);
-				} else {
-					ym_address_write_part1(gen->ym, value);
-				}
+				write_ym(gen, context->current_cycle, location, value);
 			} else if (location == 0x6000) {
 				gen->z80_bank_reg = (gen->z80_bank_reg >> 1 | value << 8) & 0x1FF;
 				if (gen->z80_bank_reg < 0x80) {
@@ -911,7 +1803,7 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 					} else {
 						gen->z80->reset = 1;
 					}
-					ym_reset(gen->ym);
+					reset_ym(gen);
 				}
 			} else if (masked != 0x11300 && masked != 0x11000) {
 				fatal_error("Machine freeze due to unmapped write to address %X\n", location | 0xA00000);
@@ -920,8 +1812,8 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 	}
 #ifdef REFRESH_EMULATION
 	//no refresh delays during IO access
-	refresh_counter += context->current_cycle - last_sync_cycle;
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 #endif
 	return context;
 }
@@ -947,12 +1839,12 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 	uint8_t value;
 	genesis_context *gen = context->system;
 #ifdef REFRESH_EMULATION
-	if (context->current_cycle - 4*MCLKS_PER_68K > last_sync_cycle) {
+	if (context->current_cycle - 4*MCLKS_PER_68K > gen->last_sync_cycle) {
 		//do refresh check here so we can avoid adding a penalty for a refresh that happens during an IO area access
-		refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-		last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
+		gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
 	}
 #endif
 	if (location < 0x10000) {
@@ -1052,8 +1944,8 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 	}
 #ifdef REFRESH_EMULATION
 	//no refresh delays during IO access
-	refresh_counter += context->current_cycle - last_sync_cycle;
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 #endif
 	return value;
 }
@@ -1076,13 +1968,7 @@ static void * z80_write_ym(uint32_t location, void * vcontext, uint8_t value)
 	z80_context * context = vcontext;
 	genesis_context * gen = context->system;
 	sync_sound(gen, context->Z80_CYCLE);
-	if (location & 1) {
-		ym_data_write(gen->ym, value);
-	} else if (location & 2) {
-		ym_address_write_part2(gen->ym, value);
-	} else {
-		ym_address_write_part1(gen->ym, value);
-	}
+	write_ym(gen, context->Z80_CYCLE, location, value);
 	return context;
 }
 
@@ -1144,6 +2030,9 @@ static void *z80_write_bank(uint32_t location, void * vcontext, uint8_t value)
 	if (address >= 0xE00000) {
 		address &= 0xFFFF;
 		((uint8_t *)gen->work_ram)[address ^ 1] = value;
+#ifndef NEW_CORE
+		mark_ram_dirty(&gen->m68k->options->gen, gen->m68k, 0xFF0000 | address);
+#endif
 	} else if (address >= 0xC00000) {
 		z80_vdp_port_write(location & 0xFF, context, value);
 	} else {
@@ -1246,11 +2135,17 @@ static void set_speed_percent(system_header * system, uint32_t percent)
 	genesis_context *context = (genesis_context *)system;
 	uint32_t old_clock = context->master_clock;
 	context->master_clock = ((uint64_t)context->normal_clock * (uint64_t)percent) / 100;
+	if (context->sound) {
+		sound_thread_sync(context->sound);
+	}
 	while (context->ym->current_cycle != context->psg->cycles) {
-		sync_sound(context, context->psg->cycles + MCLKS_PER_PSG);
+		run_sound(context, context->psg->cycles + MCLKS_PER_PSG);
 	}
 	ym_adjust_master_clock(context->ym, context->master_clock);
 	psg_adjust_master_clock(context->psg, context->master_clock);
+	if (context->sound) {
+		sound_thread_reload(context->sound);
+	}
 }
 
 void set_region(genesis_context *gen, rom_info *info, uint8_t region)
@@ -1316,6 +2211,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 #ifndef NEW_CORE
 	if (ret) {
 		gen->m68k->resume_pc = get_native_address_trans(gen->m68k, pc);
+		gen->m68k->resume_address = pc;
 	}
 #endif
 done:
@@ -1325,14 +2221,14 @@ done:
 
 static void handle_reset_requests(genesis_context *gen)
 {
-	while (gen->reset_requested || gen->header.delayed_load_slot)
+	while (gen->reset_requested || gen->header.delayed_load_slot || gen->rewind_pending || gen->m68k_flush_pending)
 	{
 		if (gen->reset_requested) {
 			gen->reset_requested = 0;
 			gen->m68k->should_return = 0;
 			z80_assert_reset(gen->z80, gen->m68k->current_cycle);
 			z80_clear_busreq(gen->z80, gen->m68k->current_cycle);
-			ym_reset(gen->ym);
+			reset_ym(gen);
 			//Is there any sort of VDP reset?
 			m68k_reset(gen->m68k);
 		}
@@ -1341,6 +2237,20 @@ static void handle_reset_requests(genesis_context *gen)
 			gen->header.delayed_load_slot = 0;
 			resume_68k(gen->m68k);
 		}
+		if (gen->rewind_pending) {
+			gen->rewind_pending = 0;
+#ifndef NEW_CORE
+			rewind_step(gen);
+#endif
+			resume_68k(gen->m68k);
+		}
+		if (gen->m68k_flush_pending) {
+#ifndef NEW_CORE
+			//tried again at the next frame boundary if the 68K isn't at the start of an instruction
+			gen->m68k_flush_pending = !m68k_flush_code_cache(gen->m68k);
+#endif
+			resume_68k(gen->m68k);
+		}
 	}
 	if (gen->header.force_release || render_should_release_on_exit()) {
 		bindings_release_capture();
@@ -1350,9 +2260,21 @@ static void handle_reset_requests(genesis_context *gen)
 	}
 }
 
+//samples are rendered for everything that was queued before returning so a run produces the same audio
+//with and without the sound thread
+static void finish_sound(genesis_context *gen)
+{
+	if (gen->sound) {
+		uint8_t prev = profile_enter(gen, GEN_PROF_YM);
+		sound_thread_wait(gen->sound);
+		profile_enter(gen, prev);
+	}
+}
+
 static void start_genesis(system_header *system, char *statefile)
 {
 	genesis_context *gen = (genesis_context *)system;
+	profile_resume(gen);
 	if (statefile) {
 		//first try loading as a native format savestate
 		deserialize_buffer state;
@@ -1376,6 +2298,7 @@ static void start_genesis(system_header *system, char *statefile)
 #ifndef NEW_CORE
 		if (gen->header.enter_debugger) {
 			gen->header.enter_debugger = 0;
+			attach_debugger(gen, 1);
 			insert_breakpoint(gen->m68k, pc, gen->header.debugger_type == DEBUGGER_NATIVE ? debugger : gdb_debug_enter);
 		}
 #endif
@@ -1385,6 +2308,7 @@ static void start_genesis(system_header *system, char *statefile)
 #ifndef NEW_CORE
 		if (gen->header.enter_debugger) {
 			gen->header.enter_debugger = 0;
+			attach_debugger(gen, 1);
 			uint32_t address = gen->cart[2] << 16 | gen->cart[3];
 			insert_breakpoint(gen->m68k, address, gen->header.debugger_type == DEBUGGER_NATIVE ? debugger : gdb_debug_enter);
 		}
@@ -1392,9 +2316,27 @@ static void start_genesis(system_header *system, char *statefile)
 		m68k_reset(gen->m68k);
 	}
 	handle_reset_requests(gen);
+	finish_sound(gen);
+	profile_enter(gen, GEN_PROF_M68K);
 	return;
 }
 
+#ifndef NEW_CORE
+//the translated code can only be thrown away while the CPUs are stopped at a frame boundary, a flush
+//that has to wait for a CPU to get to the start of an instruction is retried at the next one
+static void check_code_caches(genesis_context *gen)
+{
+	if (code_cache_full(&gen->m68k->options->gen)) {
+		m68k_flush_code_cache(gen->m68k);
+	}
+#ifndef NO_Z80
+	if (code_cache_full(&gen->z80->Z80_OPTS->gen)) {
+		z80_flush_code_cache(gen->z80);
+	}
+#endif
+}
+#endif
+
 static void resume_genesis(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
@@ -1406,8 +2348,14 @@ static void resume_genesis(system_header *system)
 		render_resume_source(gen->ym->audio);
 		render_resume_source(gen->psg->audio);
 	}
+	profile_resume(gen);
+#ifndef NEW_CORE
+	check_code_caches(gen);
+#endif
 	resume_68k(gen->m68k);
 	handle_reset_requests(gen);
+	finish_sound(gen);
+	profile_enter(gen, GEN_PROF_M68K);
 }
 
 static void inc_debug_mode(system_header *system)
@@ -1476,8 +2424,12 @@ static void soft_reset(system_header *system)
 static void free_genesis(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
+	vdp_stop_render_thread(gen->vdp);
 	vdp_free(gen->vdp);
 	memmap_chunk *map = (memmap_chunk *)gen->m68k->options->gen.memmap;
+#ifndef NEW_CORE
+	code_store_save(&gen->m68k->options->gen);
+#endif
 	m68k_options_free(gen->m68k->options);
 	free(gen->cart);
 	free(gen->m68k);
@@ -1485,11 +2437,17 @@ static void free_genesis(system_header *system)
 	z80_options_free(gen->z80->Z80_OPTS);
 	free(gen->z80);
 	free(gen->zram);
+	if (gen->sound) {
+		sound_thread_stop(gen->sound);
+	}
 	ym_free(gen->ym);
 	psg_free(gen->psg);
 	free(gen->header.save_dir);
 	free_rom_info(&gen->header.info);
 	free(gen->lock_on);
+	free(gen->mapper_snapshot.data);
+	genesis_set_profiling(gen, 0);
+	rewind_free(gen->header.rewind);
 	free(gen);
 }
 
@@ -1563,7 +2521,13 @@ static void config_updated(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
 	setup_io_devices(config, &system->info, &gen->io);
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
 	set_audio_config(gen);
+	if (gen->sound) {
+		sound_thread_reload(gen->sound);
+	}
 }
 
 static void start_vgm_log(system_header *system, char *filename)
@@ -1572,6 +2536,11 @@ static void start_vgm_log(system_header *system, char *filename)
 	vgm_writer *vgm = vgm_write_open(filename, gen->version_reg & HZ50 ? 50 : 60, gen->master_clock, gen->m68k->current_cycle);
 	if (vgm) {
 		printf("Started logging VGM to %s\n", filename);
+		if (gen->sound) {
+			//PSG writes are logged by the thread that applies them
+			sound_thread_stop(gen->sound);
+			gen->sound = NULL;
+		}
 		sync_sound(gen, vgm->last_cycle);
 		ym_vgm_log(gen->ym, gen->master_clock, vgm);
 		psg_vgm_log(gen->psg, gen->master_clock, vgm);
@@ -1592,7 +2561,7 @@ static void stop_vgm_log(system_header *system)
 
 genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on, uint32_t system_opts, uint8_t force_region)
 {
-	static memmap_chunk z80_map[] = {
+	static const memmap_chunk base_z80_map[] = {
 		{ 0x0000, 0x4000,  0x1FFF, 0, 0, MMAP_READ | MMAP_WRITE | MMAP_CODE, NULL, NULL, NULL, NULL,              NULL },
 		{ 0x8000, 0x10000, 0x7FFF, 0, 0, 0,                                  NULL, NULL, NULL, z80_read_bank,     z80_write_bank},
 		{ 0x4000, 0x6000,  0x0003, 0, 0, 0,                                  NULL, NULL, NULL, z80_read_ym,       z80_write_ym},
@@ -1622,6 +2591,14 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	gen->header.config_updated = config_updated;
 	gen->header.serialize = serialize;
 	gen->header.deserialize = deserialize;
+#ifndef NEW_CORE
+	gen->header.snapshot_size = snapshot_size;
+	gen->header.snapshot = snapshot;
+	gen->header.restore = restore;
+	gen->header.snapshot_delta = snapshot_delta;
+	gen->header.restore_delta = restore_delta;
+	gen->header.rewind_record = rewind_record;
+#endif
 	gen->header.start_vgm_log = start_vgm_log;
 	gen->header.stop_vgm_log = stop_vgm_log;
 	gen->header.type = SYSTEM_GENESIS;
@@ -1656,11 +2633,31 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	psg_init(gen->psg, gen->master_clock, MCLKS_PER_PSG);
 
 	set_audio_config(gen);
+#ifdef IS_LIB
+	//a standalone frontend paces emulation by blocking in render_do_audio_ready, which has to happen
+	//on the emulation thread
+	if (
+		(system_opts & OPT_SOUND_THREAD)
+		|| !strcmp(tern_find_path_default(config, "system\0sound_thread\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")
+	) {
+		gen->sound = sound_thread_start(gen->ym, gen->psg, MAX_SOUND_CYCLES);
+	}
+#endif
 
-	z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
+	//each context gets its own copy of the map since the RAM buffer is filled in per instance
+	memcpy(gen->z80_map, base_z80_map, sizeof(base_z80_map));
+	gen->z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
 #ifndef NO_Z80
 	z80_options *z_opts = malloc(sizeof(z80_options));
-	init_z80_opts(z_opts, z80_map, 5, NULL, 0, MCLKS_PER_Z80, 0xFFFF);
+	init_z80_opts(z_opts, gen->z80_map, sizeof(base_z80_map)/sizeof(base_z80_map[0]), NULL, 0, MCLKS_PER_Z80, 0xFFFF);
+#ifndef NEW_CORE
+	if (
+		(system_opts & OPT_NO_IDLE_SKIP)
+		|| !strcmp(tern_find_path_default(config, "system\0z80_idle_skip\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval, "off")
+	) {
+		z_opts->flags &= ~Z80_OPT_IDLE_SKIP;
+	}
+#endif
 	gen->z80 = init_z80_context(z_opts);
 #ifndef NEW_CORE
 	gen->z80->next_int_pulse = z80_next_int_pulse;
@@ -1705,6 +2702,25 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 			gen->vdp->vsram[i] = rand();
 		}
 	}
+#ifdef IS_LIB
+	//debug views and the event log of a standalone frontend are fed from the context of the emulation
+	//thread, which no longer draws anything once the render thread is running
+	if (
+		(system_opts & OPT_RENDER_THREAD)
+		|| !strcmp(tern_find_path_default(config, "system\0render_thread\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")
+	) {
+		vdp_start_render_thread(gen->vdp);
+	}
+#endif
+	uint32_t rewind_budget = atoi(tern_find_path_default(config, "system\0rewind_budget\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval);
+	if (rewind_budget) {
+#ifdef NEW_CORE
+		warning("Rewind is not supported with the new CPU cores, ignoring rewind_budget\n");
+#else
+		gen->header.rewind = rewind_new((size_t)rewind_budget * 1024 * 1024, REWIND_DEFAULT_KEYFRAME_INTERVAL);
+#endif
+	}
+
 	setup_io_devices(config, rom, &gen->io);
 	gen->header.has_keyboard = io_has_keyboard(&gen->io);
 
@@ -1736,12 +2752,45 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	}
 
 	m68k_options *opts = malloc(sizeof(m68k_options));
-	init_m68k_opts(opts, rom->map, rom->map_chunks, MCLKS_PER_68K);
+	uint32_t m68k_flags = 0;
 	if (!strcmp(tern_find_ptr_default(model, "tas", "broken"), "broken")) {
-		opts->gen.flags |= M68K_OPT_BROKEN_READ_MODIFY;
-	}
+		m68k_flags |= M68K_OPT_BROKEN_READ_MODIFY;
+	}
+	if (
+		(system_opts & OPT_BATCH_CYCLES)
+		|| !strcmp(tern_find_path_default(config, "system\0cycle_batching\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")
+	) {
+		m68k_flags |= M68K_OPT_BATCH_CYCLES;
+	}
+	if (
+		!(system_opts & OPT_FIXED_REGISTERS)
+		&& strcmp(tern_find_path_default(config, "system\0register_allocation\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval, "off")
+	) {
+		m68k_flags |= M68K_OPT_ALLOC_REGS;
+	}
+	if (
+		!(system_opts & OPT_NO_DIRECT_MEMORY)
+		&& strcmp(tern_find_path_default(config, "system\0direct_memory\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval, "off")
+	) {
+		m68k_flags |= M68K_OPT_DIRECT_MEM;
+	}
+	if (
+		!(system_opts & OPT_NO_COLD_CODE)
+		&& strcmp(tern_find_path_default(config, "system\0cold_code\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval, "off")
+	) {
+		m68k_flags |= M68K_OPT_COLD_CODE;
+	}
+	if (
+		(system_opts & OPT_DEAD_FLAGS)
+		|| !strcmp(tern_find_path_default(config, "system\0dead_flags\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")
+	) {
+		m68k_flags |= M68K_OPT_DEAD_FLAGS;
+	}
+	init_m68k_opts(opts, rom->map, rom->map_chunks, MCLKS_PER_68K, m68k_flags);
 	gen->m68k = init_68k_context(opts, NULL);
 	gen->m68k->system = gen;
+	uint32_t code_cache_budget = atoi(tern_find_path_default(config, "system\0code_cache_budget\0", (tern_val){.ptrval = "64"}, TVAL_PTR).ptrval);
+	genesis_set_code_cache_budget(gen, code_cache_budget * 1024 * 1024);
 	opts->address_log = (system_opts & OPT_ADDRESS_LOG) ? fopen("address.log", "w") : NULL;
 
 	//This must happen after the 68K context has been allocated
@@ -1761,6 +2810,14 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	}
 	gen->reset_cycle = CYCLE_NEVER;
 
+	char const *userdata = get_userdata_dir();
+	if (userdata && !strcmp(tern_find_path_default(config, "system\0code_store\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")) {
+		char const *parts[] = {userdata, PATH_SEP "blastem" PATH_SEP "code_store"};
+		char *dir = alloc_concat_m(2, parts);
+		genesis_enable_code_store(gen, dir);
+		free(dir);
+	}
+
 	return gen;
 }
 
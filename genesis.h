@@ -7,6 +7,7 @@
 #define GENESIS_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include "system.h"
 #include "m68k_core.h"
 #ifndef NEW_CORE
@@ -17,6 +18,7 @@
 #include "ym2612.h"
 #include "vdp.h"
 #include "psg.h"
+#include "sound_thread.h"
 #include "io.h"
 #include "romdb.h"
 #include "arena.h"
@@ -24,6 +26,53 @@
 
 typedef struct genesis_context genesis_context;
 
+enum {
+	GEN_PROF_M68K,
+	GEN_PROF_Z80,
+	GEN_PROF_VDP,
+	GEN_PROF_YM,
+	GEN_PROF_PSG,
+	GEN_PROF_COMPONENTS
+};
+
+//ways adjust_int_cycle and sync_components can pull in or rebase the 68K's cycle targets
+enum {
+	GEN_PROF_PATH_MAX_CYCLES,  //sync cycle clamped to max_cycles
+	GEN_PROF_PATH_INT_PREV1,   //extra sync int_latency_prev1 cycles before an interrupt
+	GEN_PROF_PATH_INT_PREV2,   //extra sync int_latency_prev2 cycles before an interrupt
+	GEN_PROF_PATH_INT_NOW,     //sync immediately because an interrupt is imminent
+	GEN_PROF_PATH_REBASE,      //cycle counters of all components reduced at a frame end
+	GEN_PROF_PATHS
+};
+
+typedef struct {
+	uint64_t ns[GEN_PROF_COMPONENTS];
+	uint64_t mclks;
+	uint32_t syncs;
+	uint32_t frames;
+	uint32_t paths[GEN_PROF_PATHS];
+} genesis_profile_counters;
+
+//host time spent in each component while profiling is enabled, anything that
+//isn't attributed to one of the other components is counted as 68K time
+typedef struct {
+	genesis_profile_counters total;
+	genesis_profile_counters frame;
+	genesis_profile_counters last_frame;
+	//frames accumulated since the last line written to dump
+	genesis_profile_counters interval;
+	FILE     *dump;
+	//time is counted in timestamp counter ticks during a frame and converted to nanoseconds at its end
+	//using the rate measured since profiling was enabled
+	uint64_t ticks[GEN_PROF_COMPONENTS];
+	uint64_t start_ticks;
+	uint64_t start_ns;
+	uint64_t last;
+	uint32_t dump_frames;
+	uint32_t last_cycle;
+	uint8_t  current;
+} genesis_profile;
+
 struct genesis_context {
 	system_header   header;
 	m68k_context    *m68k;
@@ -31,6 +80,8 @@ struct genesis_context {
 	vdp_context     *vdp;
 	ym2612_context  *ym;
 	psg_context     *psg;
+	//renders ym and psg while set, ym only runs its timers on the emulation thread then
+	sound_thread    *sound;
 	uint16_t        *cart;
 	uint16_t        *lock_on;
 	uint16_t        *work_ram;
@@ -54,6 +105,8 @@ struct genesis_context {
 	uint32_t        last_frame;
 	uint32_t        last_flush_cycle;
 	uint32_t        soft_flush_cycles;
+	uint32_t        last_sync_cycle;
+	uint32_t        refresh_counter;
 	uint8_t         bank_regs[8];
 	uint16_t        z80_bank_reg;
 	uint16_t        tmss_lock[2];
@@ -67,6 +120,15 @@ struct genesis_context {
 	uint8_t         tmss;
 	eeprom_state    eeprom;
 	nor_state       nor;
+	memmap_chunk    z80_map[5];
+	serialize_buffer mapper_snapshot;
+	uint32_t        snapshot_serial;
+	//serial of the snapshot that the RAM and VRAM dirty bits are relative to, 0 if there is none
+	uint32_t        snapshot_base;
+	genesis_profile *profile;
+	uint8_t         rewind_pending;
+	//translated 68K code has to be thrown away once the CPU stops at a frame boundary
+	uint8_t         m68k_flush_pending;
 };
 
 #define RAM_WORDS 32 * 1024
@@ -76,6 +138,18 @@ m68k_context * sync_components(m68k_context *context, uint32_t address);
 genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, uint32_t system_opts, uint8_t force_region);
 void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc, uint8_t all);
 void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen);
+//enabling profiling starts with fresh counters, disabling it frees them
+void genesis_set_profiling(genesis_context *gen, uint8_t enabled);
+//appends a line of counters to path every frames frames while profiling, NULL stops dumping
+uint8_t genesis_profile_dump(genesis_context *gen, char *path, uint32_t frames);
+void genesis_print_profile(genesis_context *gen);
+//each CPU's translated code is flushed at the next frame boundary once it holds budget bytes, 0 for no limit
+void genesis_set_code_cache_budget(genesis_context *gen, uint32_t budget);
+//only affects 68K code translated after the call, the Z80 runs from RAM that can always be written
+//returns 0 if the CPU cores don't translate code
+uint8_t genesis_code_cache_stats(genesis_context *gen, code_cache_stats *m68k, code_cache_stats *z80);
+//loads translated 68K code stored in dir for this ROM and saves it there again when gen is freed
+uint8_t genesis_enable_code_store(genesis_context *gen, char const *dir);
 
 #endif //GENESIS_H_
 
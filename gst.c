@@ -434,12 +434,20 @@ uint32_t load_gst(genesis_context * gen, char * fname)
 		goto error_close;
 	}
 	
+	vdp_sync_render_thread(gen->vdp);
 	if (!vdp_load_gst(gen->vdp, gstfile)) {
 		goto error_close;
 	}
+	vdp_reload_render_thread(gen->vdp);
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
 	if (!ym_load_gst(gen->ym, gstfile)) {
 		goto error_close;
 	}
+	if (gen->sound) {
+		sound_thread_reload(gen->sound);
+	}
 	if (!z80_load_gst(gen->z80, gstfile)) {
 		goto error_close;
 	}
@@ -488,9 +496,13 @@ uint8_t save_gst(genesis_context * gen, char *fname, uint32_t m68k_pc)
 	if (!z80_save_gst(gen->z80, gstfile)) {
 		goto error_close;
 	}
+	vdp_sync_render_thread(gen->vdp);
 	if (!vdp_save_gst(gen->vdp, gstfile)) {
 		goto error_close;
 	}
+	if (gen->sound) {
+		sound_thread_sync(gen->sound);
+	}
 	if (!ym_save_gst(gen->ym, gstfile)) {
 		goto error_close;
 	}
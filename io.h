@@ -77,6 +77,7 @@ typedef struct {
 	uint8_t  input[3];
 	uint8_t  input4[4][3]; // Same as input but for multi-tap
 	uint32_t slow_rise_start[8];
+	uint32_t last_poll_cycle;
 	uint8_t  serial_out;
 	uint8_t  serial_in;
 	uint8_t  serial_ctrl;
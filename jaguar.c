@@ -519,7 +519,7 @@ jaguar_context *init_jaguar(uint16_t *bios, uint32_t bios_size, uint16_t *cart,
 		jag_m68k_map[index].write_8 = rom0_write_m68k_b;
 	}
 	m68k_options *opts = malloc(sizeof(m68k_options));
-	init_m68k_opts(opts, jag_m68k_map, 8, 2);
+	init_m68k_opts(opts, jag_m68k_map, 8, 2, 0);
 	system->m68k = init_68k_context(opts, handle_m68k_reset);
 	system->m68k->sync_cycle = system->max_cycles;
 	system->m68k->system = system;
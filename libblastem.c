@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "libretro.h"
+#include "libblastem.h"
 #include "system.h"
 #include "util.h"
 #include "vdp.h"
@@ -8,11 +10,82 @@
 #include "io.h"
 #include "genesis.h"
 #include "sms.h"
+#include "arena.h"
 
-static retro_environment_t retro_environment;
-RETRO_API void retro_set_environment(retro_environment_t re)
+#define MAX_PLAYER 12
+
+struct blastem_instance {
+	retro_environment_t        environment;
+	retro_video_refresh_t      video_refresh;
+	retro_audio_sample_batch_t audio_sample_batch;
+	retro_input_poll_t         input_poll;
+	retro_input_state_t        input_state;
+	void                       *userdata;
+	system_header              *system;
+	system_media               media;
+	system_type                stype;
+	render_audio_context       *audio;
+	arena                      *arena;
+	//samples mixed during a run, they can come from a sound thread so they are handed over at its end
+	int16_t                    *audio_out;
+	size_t                     audio_out_frames;
+	size_t                     audio_out_storage;
+	vid_std                    video_standard;
+	uint32_t                   last_width;
+	uint32_t                   last_height;
+	uint32_t                   overscan_top;
+	uint32_t                   overscan_bot;
+	uint32_t                   overscan_left;
+	uint32_t                   overscan_right;
+	int32_t                    sample_rate;
+	uint32_t                   system_opts;
+	uint8_t                    started;
+	uint8_t                    last_fb;
+	int16_t                    prev_state[MAX_PLAYER][RETRO_DEVICE_ID_JOYPAD_L2];
+	uint32_t                   fb[LINEBUF_SIZE * 294 * 2];
+};
+
+//used by the retro_* entry points, its audio context and arena are the process defaults
+static blastem_instance default_instance;
+//instance whose system is currently executing on this thread, the render backend
+//functions below are called from the emulation core without any context so they use this
+static __thread blastem_instance *active;
+//system allocation touches process-wide lazily initialized state (ROM DB, config, lookup tables)
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	blastem_instance     *instance;
+	render_audio_context *audio;
+	arena                *arena;
+} instance_scope;
+
+static instance_scope enter_instance(blastem_instance *inst)
+{
+	instance_scope prev = {
+		.instance = active,
+		.audio = render_audio_set_context(inst->audio),
+		.arena = set_current_arena(inst->arena)
+	};
+	active = inst;
+	return prev;
+}
+
+static void leave_instance(blastem_instance *inst, instance_scope prev)
 {
-	retro_environment = re;
+	inst->arena = set_current_arena(prev.arena);
+	render_audio_set_context(prev.audio);
+	active = prev.instance;
+}
+
+int headless = 0;
+int exit_after = 0;
+int z80_enabled = 1;
+char *save_filename;
+tern_node *config;
+uint8_t use_native_states = 1;
+//only referenced by the event log, which is never started by the lib build
+system_header *current_system;
+
 #	define input_descriptor_macro(pad_num) \
 		{ pad_num, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_LEFT,  "D-Pad Left" }, \
 		{ pad_num, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP,    "D-Pad Up" }, \
@@ -27,66 +100,121 @@ RETRO_API void retro_set_environment(retro_environment_t re)
 		{ pad_num, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_SELECT,    "Mode" }, \
 		{ pad_num, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_START,    "Start" }, \
 
-	static const struct retro_input_descriptor desc[] = {
-		input_descriptor_macro(0)
-		input_descriptor_macro(1)
-		input_descriptor_macro(2)
-		input_descriptor_macro(3)
-		input_descriptor_macro(4)
-		input_descriptor_macro(5)
-		input_descriptor_macro(6)
-		input_descriptor_macro(7)
-		{ 0 },
-	};
+static const struct retro_input_descriptor input_desc[] = {
+	input_descriptor_macro(0)
+	input_descriptor_macro(1)
+	input_descriptor_macro(2)
+	input_descriptor_macro(3)
+	input_descriptor_macro(4)
+	input_descriptor_macro(5)
+	input_descriptor_macro(6)
+	input_descriptor_macro(7)
+	{ 0 },
+};
+
+RETRO_API blastem_instance *blastem_instance_create(void)
+{
+	blastem_instance *inst = calloc(1, sizeof(blastem_instance));
+	inst->audio = render_audio_context_new();
+	instance_scope prev = enter_instance(inst);
+		render_audio_set_userdata(inst);
+		render_audio_initialized(RENDER_AUDIO_S16, 53693175 / (7 * 6 * 4), 2, 4, sizeof(int16_t));
+	leave_instance(inst, prev);
+	return inst;
+}
+
+RETRO_API void blastem_instance_destroy(blastem_instance *inst)
+{
+	if (inst->system) {
+		blastem_instance_unload_game(inst);
+	}
+	render_audio_context_free(inst->audio);
+	free_arena(inst->arena);
+	free(inst->audio_out);
+	free(inst);
+}
+
+RETRO_API blastem_instance *blastem_instance_active(void)
+{
+	return active;
+}
+
+RETRO_API void blastem_instance_set_userdata(blastem_instance *inst, void *userdata)
+{
+	inst->userdata = userdata;
+}
+
+RETRO_API void *blastem_instance_get_userdata(blastem_instance *inst)
+{
+	return inst->userdata;
+}
+
+RETRO_API void blastem_instance_set_environment(blastem_instance *inst, retro_environment_t re)
+{
+	inst->environment = re;
+	instance_scope prev = enter_instance(inst);
+		re(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, (void *)input_desc);
+	leave_instance(inst, prev);
+}
+
+RETRO_API void blastem_instance_set_video_refresh(blastem_instance *inst, retro_video_refresh_t rvf)
+{
+	inst->video_refresh = rvf;
+}
+
+RETRO_API void blastem_instance_set_audio_sample_batch(blastem_instance *inst, retro_audio_sample_batch_t rasb)
+{
+	inst->audio_sample_batch = rasb;
+}
 
-	re(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, (void *)desc);
+RETRO_API void blastem_instance_set_input_poll(blastem_instance *inst, retro_input_poll_t rip)
+{
+	inst->input_poll = rip;
+}
+
+RETRO_API void blastem_instance_set_input_state(blastem_instance *inst, retro_input_state_t ris)
+{
+	inst->input_state = ris;
+}
+
+RETRO_API void retro_set_environment(retro_environment_t re)
+{
+	blastem_instance_set_environment(&default_instance, re);
 }
 
-static retro_video_refresh_t retro_video_refresh;
 RETRO_API void retro_set_video_refresh(retro_video_refresh_t rvf)
 {
-	retro_video_refresh = rvf;
+	blastem_instance_set_video_refresh(&default_instance, rvf);
 }
 
 RETRO_API void retro_set_audio_sample(retro_audio_sample_t ras)
 {
 }
 
-static retro_audio_sample_batch_t retro_audio_sample_batch;
 RETRO_API void retro_set_audio_sample_batch(retro_audio_sample_batch_t rasb)
 {
-	retro_audio_sample_batch = rasb;
+	blastem_instance_set_audio_sample_batch(&default_instance, rasb);
 }
 
-static retro_input_poll_t retro_input_poll;
 RETRO_API void retro_set_input_poll(retro_input_poll_t rip)
 {
-	retro_input_poll = rip;
+	blastem_instance_set_input_poll(&default_instance, rip);
 }
 
-static retro_input_state_t retro_input_state;
 RETRO_API void retro_set_input_state(retro_input_state_t ris)
 {
-	retro_input_state = ris;
+	blastem_instance_set_input_state(&default_instance, ris);
 }
 
-int headless = 0;
-int exit_after = 0;
-int z80_enabled = 1;
-char *save_filename;
-tern_node *config;
-uint8_t use_native_states = 1;
-system_header *current_system;
-system_media media;
-
 RETRO_API void retro_init(void)
 {
+	render_audio_set_userdata(&default_instance);
 	render_audio_initialized(RENDER_AUDIO_S16, 53693175 / (7 * 6 * 4), 2, 4, sizeof(int16_t));
 }
 
 RETRO_API void retro_deinit(void)
 {
-	if (current_system) {
+	if (default_instance.system) {
 		retro_unload_game();
 	}
 }
@@ -105,57 +233,107 @@ RETRO_API void retro_get_system_info(struct retro_system_info *info)
 	info->block_extract = 0;
 }
 
-static vid_std video_standard;
-static uint32_t last_width, last_height;
-static uint32_t overscan_top, overscan_bot, overscan_left, overscan_right;
-static void update_overscan(void)
+static void update_overscan(blastem_instance *inst)
 {
 	uint8_t overscan;
-	if (retro_environment(RETRO_ENVIRONMENT_GET_OVERSCAN, &overscan) && overscan) {
-		overscan_top = overscan_bot = overscan_left = overscan_right = 0;
+	if (inst->environment(RETRO_ENVIRONMENT_GET_OVERSCAN, &overscan) && overscan) {
+		inst->overscan_top = inst->overscan_bot = inst->overscan_left = inst->overscan_right = 0;
 	} else {
-		if (video_standard == VID_NTSC) {
-			overscan_top = 11;
-			overscan_bot = 8;
-			overscan_left = 13;
-			overscan_right = 14;
+		if (inst->video_standard == VID_NTSC) {
+			inst->overscan_top = 11;
+			inst->overscan_bot = 8;
+			inst->overscan_left = 13;
+			inst->overscan_right = 14;
 		} else {
-			overscan_top = 30;
-			overscan_bot = 24;
-			overscan_left = 13;
-			overscan_right = 14;
+			inst->overscan_top = 30;
+			inst->overscan_bot = 24;
+			inst->overscan_left = 13;
+			inst->overscan_right = 14;
 		}
 	}
 }
 
-static int32_t sample_rate;
-RETRO_API void retro_get_system_av_info(struct retro_system_av_info *info)
+RETRO_API void blastem_instance_get_system_av_info(blastem_instance *inst, struct retro_system_av_info *info)
 {
-	update_overscan();
-	last_width = LINEBUF_SIZE;
-	info->geometry.base_width = info->geometry.max_width = LINEBUF_SIZE - (overscan_left + overscan_right);
-	info->geometry.base_height = (video_standard == VID_NTSC ? 243 : 294) - (overscan_top + overscan_bot);
-	last_height = info->geometry.base_height;
+	instance_scope prev = enter_instance(inst);
+	update_overscan(inst);
+	inst->last_width = LINEBUF_SIZE;
+	info->geometry.base_width = info->geometry.max_width = LINEBUF_SIZE - (inst->overscan_left + inst->overscan_right);
+	info->geometry.base_height = (inst->video_standard == VID_NTSC ? 243 : 294) - (inst->overscan_top + inst->overscan_bot);
+	inst->last_height = info->geometry.base_height;
 	info->geometry.max_height = info->geometry.base_height * 2;
 	info->geometry.aspect_ratio = 0;
-	double master_clock = video_standard == VID_NTSC ? 53693175 : 53203395;
-	double lines = video_standard == VID_NTSC ? 262 : 313;
+	double master_clock = inst->video_standard == VID_NTSC ? 53693175 : 53203395;
+	double lines = inst->video_standard == VID_NTSC ? 262 : 313;
 	info->timing.fps = master_clock / (3420.0 * lines);
 	info->timing.sample_rate = master_clock / (7 * 6 * 24); //sample rate of YM2612
-	sample_rate = info->timing.sample_rate;
+	inst->sample_rate = info->timing.sample_rate;
 	render_audio_initialized(RENDER_AUDIO_S16, info->timing.sample_rate, 2, 4, sizeof(int16_t));
 	//force adjustment of resampling parameters since target sample rate may have changed slightly
-	current_system->set_speed_percent(current_system, 100);
+	inst->system->set_speed_percent(inst->system, 100);
+	leave_instance(inst, prev);
+}
+
+RETRO_API void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+	blastem_instance_get_system_av_info(&default_instance, info);
 }
 
 RETRO_API void retro_set_controller_port_device(unsigned port, unsigned device)
 {
 }
 
+RETRO_API void blastem_instance_reset(blastem_instance *inst)
+{
+	instance_scope prev = enter_instance(inst);
+		inst->system->soft_reset(inst->system);
+	leave_instance(inst, prev);
+}
+
 /* Resets the current game. */
 RETRO_API void retro_reset(void)
 {
-	current_system->soft_reset(current_system);
+	blastem_instance_reset(&default_instance);
+}
+
+//snapshots start with the input state last reported to the system so that a restore
+//doesn't leave process_events out of sync with what the emulated controllers see
+#define SNAPSHOT_INPUT_SIZE ((sizeof(((blastem_instance *)NULL)->prev_state) + 15) & ~(size_t)15)
+
+//records the frame that is about to run or, while rewinding, steps back to the newest recorded one
+static void rewind_step(blastem_instance *inst)
+{
+	rewind_buffer *rw = inst->system->rewind;
+	if (inst->system->rewinding) {
+		size_t size;
+		uint8_t *state = rewind_pop(rw, &size);
+		if (state) {
+			blastem_instance_restore(inst, state);
+		}
+	} else if (inst->system->rewind_record) {
+		uint8_t input[SNAPSHOT_INPUT_SIZE] = {0};
+		memcpy(input, inst->prev_state, sizeof(inst->prev_state));
+		inst->system->rewind_record(inst->system, input, sizeof(input));
+	}
+}
+
+RETRO_API void blastem_instance_run(blastem_instance *inst)
+{
+	instance_scope prev = enter_instance(inst);
+	if (inst->started) {
+		if (inst->system->rewind) {
+			rewind_step(inst);
+		}
+		inst->system->resume_context(inst->system);
+	} else {
+		inst->system->start_context(inst->system, NULL);
+		inst->started = 1;
+	}
+	if (inst->audio_out_frames) {
+		inst->audio_sample_batch(inst->audio_out, inst->audio_out_frames);
+		inst->audio_out_frames = 0;
+	}
+	leave_instance(inst, prev);
 }
 
 /* Runs the game for one video frame.
@@ -166,15 +344,14 @@ RETRO_API void retro_reset(void)
  * a frame if GET_CAN_DUPE returns true.
  * In this case, the video callback can take a NULL argument for data.
  */
-static uint8_t started;
 RETRO_API void retro_run(void)
 {
-	if (started) {
-		current_system->resume_context(current_system);
-	} else {
-		current_system->start_context(current_system, NULL);
-		started = 1;
-	}
+	blastem_instance_run(&default_instance);
+}
+
+RETRO_API size_t blastem_instance_serialize_size(blastem_instance *inst)
+{
+	return SERIALIZE_DEFAULT_SIZE;
 }
 
 /* Returns the amount of data the implementation requires to serialize
@@ -185,15 +362,15 @@ RETRO_API void retro_run(void)
  */
 RETRO_API size_t retro_serialize_size(void)
 {
-	return SERIALIZE_DEFAULT_SIZE;
+	return blastem_instance_serialize_size(&default_instance);
 }
 
-/* Serializes internal state. If failed, or size is lower than
- * retro_serialize_size(), it should return false, true otherwise. */
-RETRO_API bool retro_serialize(void *data, size_t size)
+RETRO_API bool blastem_instance_serialize(blastem_instance *inst, void *data, size_t size)
 {
 	size_t actual_size;
-	uint8_t *tmp = current_system->serialize(current_system, &actual_size);
+	instance_scope prev = enter_instance(inst);
+		uint8_t *tmp = inst->system->serialize(inst->system, &actual_size);
+	leave_instance(inst, prev);
 	if (actual_size > size) {
 		free(tmp);
 		return 0;
@@ -203,12 +380,298 @@ RETRO_API bool retro_serialize(void *data, size_t size)
 	return 1;
 }
 
+/* Serializes internal state. If failed, or size is lower than
+ * retro_serialize_size(), it should return false, true otherwise. */
+RETRO_API bool retro_serialize(void *data, size_t size)
+{
+	return blastem_instance_serialize(&default_instance, data, size);
+}
+
+RETRO_API bool blastem_instance_unserialize(blastem_instance *inst, const void *data, size_t size)
+{
+	instance_scope prev = enter_instance(inst);
+		inst->system->deserialize(inst->system, (uint8_t *)data, size);
+	leave_instance(inst, prev);
+	return 1;
+}
+
 RETRO_API bool retro_unserialize(const void *data, size_t size)
 {
-	current_system->deserialize(current_system, (uint8_t *)data, size);
+	return blastem_instance_unserialize(&default_instance, data, size);
+}
+
+RETRO_API size_t blastem_instance_snapshot_size(blastem_instance *inst)
+{
+	if (!inst->system || !inst->system->snapshot_size) {
+		return 0;
+	}
+	return SNAPSHOT_INPUT_SIZE + inst->system->snapshot_size(inst->system);
+}
+
+RETRO_API bool blastem_instance_snapshot(blastem_instance *inst, void *slot)
+{
+	if (!inst->system || !inst->system->snapshot || !inst->started) {
+		return 0;
+	}
+	memcpy(slot, inst->prev_state, sizeof(inst->prev_state));
+	return inst->system->snapshot(inst->system, (uint8_t *)slot + SNAPSHOT_INPUT_SIZE);
+}
+
+RETRO_API bool blastem_instance_restore(blastem_instance *inst, const void *slot)
+{
+	if (!inst->system || !inst->system->restore || !inst->started) {
+		return 0;
+	}
+	instance_scope prev = enter_instance(inst);
+		uint8_t ret = inst->system->restore(inst->system, (uint8_t const *)slot + SNAPSHOT_INPUT_SIZE);
+	leave_instance(inst, prev);
+	if (ret) {
+		memcpy(inst->prev_state, slot, sizeof(inst->prev_state));
+	}
+	return ret;
+}
+
+RETRO_API size_t blastem_instance_snapshot_delta(blastem_instance *inst, void *slot)
+{
+	if (!inst->system || !inst->system->snapshot_delta || !inst->started) {
+		return 0;
+	}
+	memcpy(slot, inst->prev_state, sizeof(inst->prev_state));
+	size_t size = inst->system->snapshot_delta(inst->system, (uint8_t *)slot + SNAPSHOT_INPUT_SIZE);
+	return size ? SNAPSHOT_INPUT_SIZE + size : 0;
+}
+
+RETRO_API bool blastem_instance_restore_delta(blastem_instance *inst, const void *base, const void *delta)
+{
+	if (!inst->system || !inst->system->restore_delta || !inst->started) {
+		return 0;
+	}
+	instance_scope prev = enter_instance(inst);
+		uint8_t ret = inst->system->restore_delta(inst->system, (uint8_t const *)base + SNAPSHOT_INPUT_SIZE,
+			(uint8_t const *)delta + SNAPSHOT_INPUT_SIZE);
+	leave_instance(inst, prev);
+	if (ret) {
+		memcpy(inst->prev_state, delta, sizeof(inst->prev_state));
+	}
+	return ret;
+}
+
+RETRO_API void blastem_instance_set_rewind_budget(blastem_instance *inst, size_t budget)
+{
+	if (!inst->system) {
+		return;
+	}
+	rewind_free(inst->system->rewind);
+	inst->system->rewind = budget ? rewind_new(budget, REWIND_DEFAULT_KEYFRAME_INTERVAL) : NULL;
+}
+
+RETRO_API void blastem_instance_set_rewinding(blastem_instance *inst, bool rewinding)
+{
+	if (inst->system) {
+		inst->system->rewinding = rewinding;
+	}
+}
+
+RETRO_API unsigned blastem_instance_rewind_frames(blastem_instance *inst)
+{
+	return inst->system && inst->system->rewind ? rewind_frames(inst->system->rewind) : 0;
+}
+
+RETRO_API size_t blastem_instance_rewind_memory(blastem_instance *inst)
+{
+	if (!inst->system || !inst->system->rewind) {
+		return 0;
+	}
+	rewind_stats stats;
+	rewind_get_stats(inst->system->rewind, &stats);
+	return stats.memory;
+}
+
+RETRO_API bool blastem_instance_set_profiling(blastem_instance *inst, bool enabled)
+{
+	if (!inst->system || inst->system->type != SYSTEM_GENESIS) {
+		return 0;
+	}
+	genesis_set_profiling((genesis_context *)inst->system, enabled);
+	return 1;
+}
+
+RETRO_API bool blastem_instance_get_profile(blastem_instance *inst, uint64_t *ns)
+{
+	if (!inst->system || inst->system->type != SYSTEM_GENESIS || !((genesis_context *)inst->system)->profile) {
+		return 0;
+	}
+	genesis_profile *prof = ((genesis_context *)inst->system)->profile;
+	//blastem_profile_component uses the same order as the GEN_PROF_* components
+	for (int i = 0; i < BLASTEM_PROFILE_COMPONENTS; i++)
+	{
+		ns[i] = prof->total.ns[i] + prof->frame.ns[i];
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_code_cache_budget(blastem_instance *inst, size_t budget)
+{
+	if (!inst->system || inst->system->type != SYSTEM_GENESIS) {
+		return 0;
+	}
+	genesis_set_code_cache_budget((genesis_context *)inst->system, budget > UINT32_MAX ? UINT32_MAX : budget);
+	return 1;
+}
+
+//the 68K and Z80 translators and their optimizations only exist in builds without the new cores
+#ifdef NEW_CORE
+#define HAS_TRANSLATORS 0
+#else
+#define HAS_TRANSLATORS 1
+#endif
+
+RETRO_API bool blastem_instance_set_cycle_batching(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts |= OPT_BATCH_CYCLES;
+	} else {
+		inst->system_opts &= ~OPT_BATCH_CYCLES;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_register_allocation(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts &= ~OPT_FIXED_REGISTERS;
+	} else {
+		inst->system_opts |= OPT_FIXED_REGISTERS;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_direct_memory(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts &= ~OPT_NO_DIRECT_MEMORY;
+	} else {
+		inst->system_opts |= OPT_NO_DIRECT_MEMORY;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_cold_code(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts &= ~OPT_NO_COLD_CODE;
+	} else {
+		inst->system_opts |= OPT_NO_COLD_CODE;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_dead_flags(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts |= OPT_DEAD_FLAGS;
+	} else {
+		inst->system_opts &= ~OPT_DEAD_FLAGS;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_idle_skip(blastem_instance *inst, bool enabled)
+{
+	if (inst->system || !HAS_TRANSLATORS) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts &= ~OPT_NO_IDLE_SKIP;
+	} else {
+		inst->system_opts |= OPT_NO_IDLE_SKIP;
+	}
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_sound_thread(blastem_instance *inst, bool enabled)
+{
+	if (inst->system) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts |= OPT_SOUND_THREAD;
+	} else {
+		inst->system_opts &= ~OPT_SOUND_THREAD;
+	}
 	return 1;
 }
 
+RETRO_API bool blastem_instance_set_render_thread(blastem_instance *inst, bool enabled)
+{
+	if (inst->system) {
+		return 0;
+	}
+	if (enabled) {
+		inst->system_opts |= OPT_RENDER_THREAD;
+	} else {
+		inst->system_opts &= ~OPT_RENDER_THREAD;
+	}
+	return 1;
+}
+
+static void copy_code_cache_stats(blastem_code_cache_stats *dst, code_cache_stats const *src)
+{
+	dst->translated_bytes = src->translated_bytes;
+	dst->translated_insts = src->translated_insts;
+	dst->cold_bytes = src->cold_bytes;
+	dst->cached_bytes = src->used;
+	dst->flushes = src->flushes;
+	dst->loaded_bytes = src->loaded_bytes;
+	dst->indirect_hits = src->indirect_hits;
+	dst->indirect_misses = src->indirect_misses;
+	dst->chained_jumps = src->chained_jumps;
+	dst->skipped_flags = src->skipped_flags;
+	dst->batched_checks = src->batched_checks;
+	dst->idle_loops = src->idle_loops;
+	dst->retranslations = src->retranslations;
+	dst->checked_pages = src->checked_pages;
+}
+
+RETRO_API bool blastem_instance_get_code_cache_stats(blastem_instance *inst, blastem_code_cache_stats *m68k, blastem_code_cache_stats *z80)
+{
+	code_cache_stats m68k_stats, z80_stats;
+	if (!inst->system || inst->system->type != SYSTEM_GENESIS
+		|| !genesis_code_cache_stats((genesis_context *)inst->system, &m68k_stats, &z80_stats)
+	) {
+		return 0;
+	}
+	copy_code_cache_stats(m68k, &m68k_stats);
+	copy_code_cache_stats(z80, &z80_stats);
+	return 1;
+}
+
+RETRO_API bool blastem_instance_set_code_store(blastem_instance *inst, const char *dir)
+{
+	if (!inst->system || inst->system->type != SYSTEM_GENESIS) {
+		return 0;
+	}
+	instance_scope prev = enter_instance(inst);
+		uint8_t ret = genesis_enable_code_store((genesis_context *)inst->system, dir);
+	leave_instance(inst, prev);
+	return ret;
+}
+
 RETRO_API void retro_cheat_reset(void)
 {
 }
@@ -217,25 +680,34 @@ RETRO_API void retro_cheat_set(unsigned index, bool enabled, const char *code)
 {
 }
 
-/* Loads a game. */
-static system_type stype;
-RETRO_API bool retro_load_game(const struct retro_game_info *game)
+RETRO_API bool blastem_instance_load_game(blastem_instance *inst, const struct retro_game_info *game)
 {
 	if (game->path) {
-		media.dir = path_dirname(game->path);
-		media.name = basename_no_extension(game->path);
-		media.extension = path_extension(game->path);
+		inst->media.dir = path_dirname(game->path);
+		inst->media.name = basename_no_extension(game->path);
+		inst->media.extension = path_extension(game->path);
 	}
-	media.buffer = malloc(nearest_pow2(game->size));
-	memcpy(media.buffer, game->data, game->size);
-	media.size = game->size;
-	stype = detect_system_type(&media);
-	current_system = alloc_config_system(stype, &media, 0, 0);
-	
-	unsigned format = RETRO_PIXEL_FORMAT_XRGB8888;
-	retro_environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
-	
-	return current_system != NULL;
+	inst->media.buffer = malloc(nearest_pow2(game->size));
+	memcpy(inst->media.buffer, game->data, game->size);
+	inst->media.size = game->size;
+	inst->stype = detect_system_type(&inst->media);
+	inst->started = 0;
+	instance_scope prev = enter_instance(inst);
+		pthread_mutex_lock(&load_lock);
+			inst->system = alloc_config_system(inst->stype, &inst->media, inst->system_opts, 0);
+		pthread_mutex_unlock(&load_lock);
+
+		unsigned format = RETRO_PIXEL_FORMAT_XRGB8888;
+		inst->environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+	leave_instance(inst, prev);
+
+	return inst->system != NULL;
+}
+
+/* Loads a game. */
+RETRO_API bool retro_load_game(const struct retro_game_info *game)
+{
+	return blastem_instance_load_game(&default_instance, game);
 }
 
 /* Loads a "special" kind of game. Should not be used,
@@ -245,46 +717,64 @@ RETRO_API bool retro_load_game_special(unsigned game_type, const struct retro_ga
 	return retro_load_game(info);
 }
 
+RETRO_API void blastem_instance_unload_game(blastem_instance *inst)
+{
+	free(inst->media.dir);
+	free(inst->media.name);
+	free(inst->media.extension);
+	inst->media.dir = inst->media.name = inst->media.extension = NULL;
+	//buffer is freed by the context
+	inst->media.buffer = NULL;
+	//the rewind history may have been set up through this API for a system that doesn't know about it
+	rewind_free(inst->system->rewind);
+	inst->system->rewind = NULL;
+	instance_scope prev = enter_instance(inst);
+		pthread_mutex_lock(&load_lock);
+			inst->system->free_context(inst->system);
+		pthread_mutex_unlock(&load_lock);
+		//translated code from the old system is dead, let the next one reuse its pages
+		mark_all_free();
+	leave_instance(inst, prev);
+	inst->system = NULL;
+}
+
 /* Unloads a currently loaded game. */
 RETRO_API void retro_unload_game(void)
 {
-	free(media.dir);
-	free(media.name);
-	free(media.extension);
-	media.dir = media.name = media.extension = NULL;
-	//buffer is freed by the context
-	media.buffer = NULL;
-	current_system->free_context(current_system);
-	current_system = NULL;
+	blastem_instance_unload_game(&default_instance);
+}
+
+RETRO_API unsigned blastem_instance_get_region(blastem_instance *inst)
+{
+	return inst->video_standard == VID_NTSC ? RETRO_REGION_NTSC : RETRO_REGION_PAL;
 }
 
 /* Gets region of game. */
 RETRO_API unsigned retro_get_region(void)
 {
-	return video_standard == VID_NTSC ? RETRO_REGION_NTSC : RETRO_REGION_PAL;
+	return blastem_instance_get_region(&default_instance);
 }
 
-/* Gets region of memory. */
-RETRO_API void *retro_get_memory_data(unsigned id)
+RETRO_API void *blastem_instance_get_memory_data(blastem_instance *inst, unsigned id)
 {
 	switch (id) {
 	case RETRO_MEMORY_SYSTEM_RAM:
-		switch (stype) {
+		switch (inst->stype) {
 		case SYSTEM_GENESIS: {
-			genesis_context *gen = (genesis_context *)current_system;
+			genesis_context *gen = (genesis_context *)inst->system;
 			return (uint8_t *)gen->work_ram;
 		}
 #ifndef NO_Z80
 		case SYSTEM_SMS: {
-			sms_context *sms = (sms_context *)current_system;
+			sms_context *sms = (sms_context *)inst->system;
 			return sms->ram;
 		}
 #endif
 		}
 		break;
 	case RETRO_MEMORY_SAVE_RAM:
-		if (stype == SYSTEM_GENESIS) {
-			genesis_context *gen = (genesis_context *)current_system;
+		if (inst->stype == SYSTEM_GENESIS) {
+			genesis_context *gen = (genesis_context *)inst->system;
 			if (gen->save_type != SAVE_NONE)
 				return gen->save_storage;
 		}
@@ -295,11 +785,17 @@ RETRO_API void *retro_get_memory_data(unsigned id)
 	return NULL;
 }
 
-RETRO_API size_t retro_get_memory_size(unsigned id)
+/* Gets region of memory. */
+RETRO_API void *retro_get_memory_data(unsigned id)
+{
+	return blastem_instance_get_memory_data(&default_instance, id);
+}
+
+RETRO_API size_t blastem_instance_get_memory_size(blastem_instance *inst, unsigned id)
 {
 	switch (id) {
 	case RETRO_MEMORY_SYSTEM_RAM:
-		switch (stype) {
+		switch (inst->stype) {
 		case SYSTEM_GENESIS:
 			return RAM_WORDS * sizeof(uint16_t);
 #ifndef NO_Z80
@@ -309,8 +805,8 @@ RETRO_API size_t retro_get_memory_size(unsigned id)
 		}
 		break;
 	case RETRO_MEMORY_SAVE_RAM:
-		if (stype == SYSTEM_GENESIS) {
-			genesis_context *gen = (genesis_context *)current_system;
+		if (inst->stype == SYSTEM_GENESIS) {
+			genesis_context *gen = (genesis_context *)inst->system;
 			if (gen->save_type != SAVE_NONE)
 				return gen->save_size;
 		}
@@ -321,6 +817,11 @@ RETRO_API size_t retro_get_memory_size(unsigned id)
 	return 0;
 }
 
+RETRO_API size_t retro_get_memory_size(unsigned id)
+{
+	return blastem_instance_get_memory_size(&default_instance, id);
+}
+
 //blastem render backend API implementation
 uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
 {
@@ -338,32 +839,31 @@ void render_destroy_window(uint8_t which)
 	//not supported in lib build
 }
 
-static uint32_t fb[LINEBUF_SIZE * 294 * 2];
-static uint8_t last_fb;
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
 	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
-	if (which != last_fb) {
+	if (which != active->last_fb) {
 		*pitch = *pitch * 2;
 	}
 
 	if (which) {
-		return fb + LINEBUF_SIZE;
+		return active->fb + LINEBUF_SIZE;
 	} else {
-		return fb;
+		return active->fb;
 	}
 }
 
 void render_framebuffer_updated(uint8_t which, int width)
 {
-	unsigned height = (video_standard == VID_NTSC ? 243 : 294) - (overscan_top + overscan_bot);
-	width -= (overscan_left + overscan_right);
+	blastem_instance *inst = active;
+	unsigned height = (inst->video_standard == VID_NTSC ? 243 : 294) - (inst->overscan_top + inst->overscan_bot);
+	width -= (inst->overscan_left + inst->overscan_right);
 	unsigned base_height = height;
-	if (which != last_fb) {
+	if (which != inst->last_fb) {
 		height *= 2;
-		last_fb = which;
+		inst->last_fb = which;
 	}
-	if (width != last_width || height != last_height) {
+	if (width != inst->last_width || height != inst->last_height) {
 		struct retro_game_geometry geometry = {
 			.base_width = width,
 			.base_height = height,
@@ -371,12 +871,12 @@ void render_framebuffer_updated(uint8_t which, int width)
 			.max_height = height * 2,
 			.aspect_ratio = (float)LINEBUF_SIZE / base_height
 		};
-		retro_environment(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
-		last_width = width;
-		last_height = height;
+		inst->environment(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
+		inst->last_width = width;
+		inst->last_height = height;
 	}
-	retro_video_refresh(fb + overscan_left + LINEBUF_SIZE * overscan_top, width, height, LINEBUF_SIZE * sizeof(uint32_t));
-	system_request_exit(current_system, 0);
+	inst->video_refresh(inst->fb + inst->overscan_left + LINEBUF_SIZE * inst->overscan_top, width, height, LINEBUF_SIZE * sizeof(uint32_t));
+	system_request_exit(inst->system, 0);
 }
 
 uint8_t render_get_active_framebuffer(void)
@@ -386,7 +886,7 @@ uint8_t render_get_active_framebuffer(void)
 
 void render_set_video_standard(vid_std std)
 {
-	video_standard = std;
+	active->video_standard = std;
 }
 
 int render_fullscreen(void)
@@ -396,37 +896,36 @@ int render_fullscreen(void)
 
 uint32_t render_overscan_top()
 {
-	return overscan_top;
+	return active->overscan_top;
 }
 
 uint32_t render_overscan_bot()
 {
-	return overscan_bot;
+	return active->overscan_bot;
 }
 
 void process_events()
 {
-#define MAX_PLAYER 12
-	static int16_t prev_state[MAX_PLAYER][RETRO_DEVICE_ID_JOYPAD_L2];
 	static const uint8_t map[] = {
 		BUTTON_A, BUTTON_X, BUTTON_MODE, BUTTON_START, DPAD_UP, DPAD_DOWN,
 		DPAD_LEFT, DPAD_RIGHT, BUTTON_B, BUTTON_Y, BUTTON_Z, BUTTON_C
 	};
+	blastem_instance *inst = active;
 	//TODO: handle other input device types
 	//TODO: handle more than 2 ports when appropriate
-	retro_input_poll();
+	inst->input_poll();
 	for (int port = 0; port < MAX_PLAYER; port++)
 	{
 		for (int id = RETRO_DEVICE_ID_JOYPAD_B; id < RETRO_DEVICE_ID_JOYPAD_L2; id++)
 		{
-			int16_t new_state = retro_input_state(port, RETRO_DEVICE_JOYPAD, 0, id);
-			if (new_state != prev_state[port][id]) {
+			int16_t new_state = inst->input_state(port, RETRO_DEVICE_JOYPAD, 0, id);
+			if (new_state != inst->prev_state[port][id]) {
 				if (new_state) {
-					current_system->gamepad_down(current_system, port + 1, map[id]);
+					inst->system->gamepad_down(inst->system, port + 1, map[id]);
 				} else {
-					current_system->gamepad_up(current_system, port + 1, map[id]);
+					inst->system->gamepad_up(inst->system, port + 1, map[id]);
 				}
-				prev_state[port][id] = new_state;
+				inst->prev_state[port][id] = new_state;
 			}
 		}
 	}
@@ -490,6 +989,9 @@ void render_audio_created(audio_source *src)
 {
 }
 
+//stereo frames mixed each time all sources are ready, matches the buffer size passed to render_audio_initialized
+#define AUDIO_OUT_FRAMES 4
+
 void render_do_audio_ready(audio_source *src)
 {
 	int16_t *tmp = src->front;
@@ -498,10 +1000,15 @@ void render_do_audio_ready(audio_source *src)
 	src->front_populated = 1;
 	src->buffer_pos = 0;
 	if (all_sources_ready()) {
-		int16_t buffer[8];
+		//active is not set on a sound thread
+		blastem_instance *inst = render_audio_get_userdata();
+		if (inst->audio_out_frames + AUDIO_OUT_FRAMES > inst->audio_out_storage) {
+			inst->audio_out_storage = inst->audio_out_storage ? inst->audio_out_storage * 2 : 1024;
+			inst->audio_out = realloc(inst->audio_out, inst->audio_out_storage * 2 * sizeof(int16_t));
+		}
 		int min_remaining_out;
-		mix_and_convert((uint8_t *)buffer, sizeof(buffer), &min_remaining_out);
-		retro_audio_sample_batch(buffer, sizeof(buffer)/(2*sizeof(*buffer)));
+		mix_and_convert((uint8_t *)(inst->audio_out + inst->audio_out_frames * 2), AUDIO_OUT_FRAMES * 2 * sizeof(int16_t), &min_remaining_out);
+		inst->audio_out_frames += AUDIO_OUT_FRAMES;
 	}
 }
 
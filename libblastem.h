@@ -0,0 +1,135 @@
+#ifndef LIBBLASTEM_H_
+#define LIBBLASTEM_H_
+
+#include "libretro.h"
+
+//Instance API for hosting several independent emulated systems in one process.
+//Each instance owns its system, media, framebuffer, audio mixer and frontend callbacks.
+//Different instances can be driven concurrently from different threads, but a single
+//instance must only be used by one thread at a time. The retro_* entry points operate
+//on a built-in default instance.
+typedef struct blastem_instance blastem_instance;
+
+RETRO_API blastem_instance *blastem_instance_create(void);
+RETRO_API void blastem_instance_destroy(blastem_instance *inst);
+//returns the instance currently executing on the calling thread, intended for use from callbacks
+RETRO_API blastem_instance *blastem_instance_active(void);
+RETRO_API void blastem_instance_set_userdata(blastem_instance *inst, void *userdata);
+RETRO_API void *blastem_instance_get_userdata(blastem_instance *inst);
+
+RETRO_API void blastem_instance_set_environment(blastem_instance *inst, retro_environment_t re);
+RETRO_API void blastem_instance_set_video_refresh(blastem_instance *inst, retro_video_refresh_t rvf);
+RETRO_API void blastem_instance_set_audio_sample_batch(blastem_instance *inst, retro_audio_sample_batch_t rasb);
+RETRO_API void blastem_instance_set_input_poll(blastem_instance *inst, retro_input_poll_t rip);
+RETRO_API void blastem_instance_set_input_state(blastem_instance *inst, retro_input_state_t ris);
+
+RETRO_API bool blastem_instance_load_game(blastem_instance *inst, const struct retro_game_info *game);
+RETRO_API void blastem_instance_unload_game(blastem_instance *inst);
+RETRO_API void blastem_instance_get_system_av_info(blastem_instance *inst, struct retro_system_av_info *info);
+RETRO_API void blastem_instance_reset(blastem_instance *inst);
+RETRO_API void blastem_instance_run(blastem_instance *inst);
+RETRO_API size_t blastem_instance_serialize_size(blastem_instance *inst);
+RETRO_API bool blastem_instance_serialize(blastem_instance *inst, void *data, size_t size);
+RETRO_API bool blastem_instance_unserialize(blastem_instance *inst, const void *data, size_t size);
+//Snapshots are raw copies of the emulated state meant for rollback netplay and rewind, they are
+//much cheaper to take and restore than a serialized state. A snapshot is only valid for the
+//instance that took it and only between calls to blastem_instance_run. Slots must be at least
+//blastem_instance_snapshot_size bytes and pointer aligned, the caller owns them so a ring of
+//slots can be allocated once up front. Not every system supports snapshots, in which case
+//blastem_instance_snapshot_size returns 0.
+RETRO_API size_t blastem_instance_snapshot_size(blastem_instance *inst);
+RETRO_API bool blastem_instance_snapshot(blastem_instance *inst, void *slot);
+RETRO_API bool blastem_instance_restore(blastem_instance *inst, const void *slot);
+//Taking or restoring a full snapshot also makes it the base for delta snapshots. A delta only
+//holds the RAM and VRAM pages written since its base was taken or restored and is restored
+//together with that base. Deltas are written to slots of blastem_instance_snapshot_size bytes,
+//but only the returned number of bytes is used so they can be copied out to compact storage.
+//blastem_instance_snapshot_delta returns 0 if there is no base, e.g. after a state was loaded.
+RETRO_API size_t blastem_instance_snapshot_delta(blastem_instance *inst, void *slot);
+RETRO_API bool blastem_instance_restore_delta(blastem_instance *inst, const void *base, const void *delta);
+//Rewind records a compressed history of snapshots of the loaded game in a memory budget of
+//budget bytes, 0 turns recording off. While rewinding is set every blastem_instance_run replays
+//the newest recorded frame and drops it from the history, stopping at the oldest one. Every recorded
+//frame becomes the base for delta snapshots, so they need a new base while recording is enabled.
+RETRO_API void blastem_instance_set_rewind_budget(blastem_instance *inst, size_t budget);
+RETRO_API void blastem_instance_set_rewinding(blastem_instance *inst, bool rewinding);
+RETRO_API unsigned blastem_instance_rewind_frames(blastem_instance *inst);
+RETRO_API size_t blastem_instance_rewind_memory(blastem_instance *inst);
+//Profiling measures the host time spent in each emulated component, currently only for Genesis
+//games. Enabling it starts from zero, blastem_instance_get_profile fills ns with the nanoseconds
+//spent in each blastem_profile_component since then and fails if profiling is not enabled.
+//Each sync of the components reads the timestamp counter about five times. With blastem-bench's
+//default ROM that made emulation about 20% slower on a host where a read takes 60ns, and that cost
+//is included in the times it reports.
+typedef enum {
+	BLASTEM_PROFILE_M68K,
+	BLASTEM_PROFILE_Z80,
+	BLASTEM_PROFILE_VDP,
+	BLASTEM_PROFILE_YM2612,
+	BLASTEM_PROFILE_PSG,
+	BLASTEM_PROFILE_COMPONENTS
+} blastem_profile_component;
+RETRO_API bool blastem_instance_set_profiling(blastem_instance *inst, bool enabled);
+RETRO_API bool blastem_instance_get_profile(blastem_instance *inst, uint64_t *ns);
+//The code translated for the 68K and Z80 of a Genesis game is thrown away at the next frame once it
+//exceeds budget bytes per CPU, 0 lets it grow without limit. Snapshots taken before a flush can
+//still be restored unless a CPU was stopped in the middle of an instruction when they were taken.
+typedef struct {
+	//translated_bytes includes the cold_bytes placed away from the code that normally runs, like
+	//interrupt checks and traps, translated_insts is the number of instructions they were translated from
+	uint64_t translated_bytes;
+	uint64_t translated_insts;
+	uint64_t cold_bytes;
+	uint32_t cached_bytes;
+	uint32_t flushes;
+	uint64_t loaded_bytes;
+	//jumps to computed addresses (RTS, JMP (An) and the like) found in the target cache or not, and
+	//jumps left out because the code of their destination was translated right after them
+	uint64_t indirect_hits;
+	uint64_t indirect_misses;
+	uint64_t chained_jumps;
+	//flag updates left out of translated code because a later instruction overwrites the flag first
+	uint64_t skipped_flags;
+	//instruction cycle checks covered by the single check of a batch of instructions
+	uint64_t batched_checks;
+	//branches back to the start of a Z80 loop that waits for an interrupt or the 68K and skips whole
+	//passes through it
+	uint64_t idle_loops;
+	//instructions in RAM translated again because their code changed, and pages of RAM written so often
+	//that their code checks itself for changes instead of writes to them retranslating it
+	uint64_t retranslations;
+	uint32_t checked_pages;
+} blastem_code_cache_stats;
+RETRO_API bool blastem_instance_set_code_cache_budget(blastem_instance *inst, size_t budget);
+//Switches for speed optimizations, none of which change what is emulated except dead flags, which is
+//off by default. They have to be called before blastem_instance_load_game and fail after it.
+//The ones for the 68K and Z80 translators also fail in builds with the new cores, which don't have them.
+//straight runs of at least 4 68K register instructions in ROM get a second copy sharing one cycle check,
+//checks at block ends and memory accesses are left as they are, so it saves few checks in most code
+RETRO_API bool blastem_instance_set_cycle_batching(blastem_instance *inst, bool enabled);
+//the 68K registers kept in host registers are the ones the code in the ROM uses the most
+RETRO_API bool blastem_instance_set_register_allocation(blastem_instance *inst, bool enabled);
+//translated 68K code reads and writes ROM and work RAM without calling the memory handlers
+RETRO_API bool blastem_instance_set_direct_memory(blastem_instance *inst, bool enabled);
+//interrupt checks and traps in translated 68K code are placed away from the code that normally runs
+RETRO_API bool blastem_instance_set_cold_code(blastem_instance *inst, bool enabled);
+//translated 68K code leaves out flag updates a later instruction overwrites before anything reads them,
+//an interrupt taken in between saves a stale value for those flags in the SR its handler sees
+RETRO_API bool blastem_instance_set_dead_flags(blastem_instance *inst, bool enabled);
+//translated Z80 code skips whole passes through loops that only wait for an interrupt or the 68K
+RETRO_API bool blastem_instance_set_idle_skip(blastem_instance *inst, bool enabled);
+//the YM2612 and PSG are rendered on their own thread, the audio callback still gets the same samples
+RETRO_API bool blastem_instance_set_sound_thread(blastem_instance *inst, bool enabled);
+//the VDP output is drawn on its own thread, the same frames are still passed from the emulation thread
+RETRO_API bool blastem_instance_set_render_thread(blastem_instance *inst, bool enabled);
+RETRO_API bool blastem_instance_get_code_cache_stats(blastem_instance *inst, blastem_code_cache_stats *m68k, blastem_code_cache_stats *z80);
+//68K code translated from the ROM is saved to a file in dir named after the SHA-1 of the ROM when the
+//game is unloaded. Called before the first blastem_instance_run, a file left there by an earlier run
+//with the same build is loaded so that code doesn't have to be translated again, which is reported
+//in loaded_bytes. Files for other ROMs or builds or that fail validation are ignored.
+RETRO_API bool blastem_instance_set_code_store(blastem_instance *inst, const char *dir);
+RETRO_API unsigned blastem_instance_get_region(blastem_instance *inst);
+RETRO_API void *blastem_instance_get_memory_data(blastem_instance *inst, unsigned id);
+RETRO_API size_t blastem_instance_get_memory_size(blastem_instance *inst, unsigned id);
+
+#endif //LIBBLASTEM_H_
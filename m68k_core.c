@@ -11,6 +11,7 @@
 #include "backend.h"
 #ifndef NEW_CORE
 #include "gen.h"
+#include "code_store.h"
 #endif
 #include "util.h"
 #include "serialize.h"
@@ -64,6 +65,9 @@ void m68k_print_regs(m68k_context * context)
 #ifndef NEW_CORE
 void m68k_read_size(m68k_options *opts, uint8_t size)
 {
+	if (m68k_direct_read(opts, size)) {
+		return;
+	}
 	switch (size)
 	{
 	case OPSIZE_BYTE:
@@ -80,6 +84,9 @@ void m68k_read_size(m68k_options *opts, uint8_t size)
 
 void m68k_write_size(m68k_options *opts, uint8_t size, uint8_t lowfirst)
 {
+	if (m68k_direct_write(opts, size, lowfirst)) {
+		return;
+	}
 	switch (size)
 	{
 	case OPSIZE_BYTE:
@@ -207,6 +214,19 @@ void jump_m68k_abs(m68k_options * opts, uint32_t address)
 	//since instruction retranslation patches the original native instruction location
 }
 
+//for the jump of a terminal instruction, while translate_m68k_stream is running the jump to code
+//that isn't translated yet is left out and the destination is translated right after it instead
+void jump_m68k_chain(m68k_options * opts, uint32_t address)
+{
+	if (opts->chain_jumps && !(address & 1) && !get_native_address(opts, address)) {
+		opts->chain_address = address;
+		opts->chain_pending = 1;
+		opts->gen.cache.chained_jumps++;
+		return;
+	}
+	jump_m68k_abs(opts, address);
+}
+
 static void translate_m68k_bsr(m68k_options * opts, m68kinst * inst)
 {
 	code_info *code = &opts->gen.code;
@@ -261,7 +281,11 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 		if (is_jsr) {
 			push_const(opts, inst->address+4);
 		}
-		jump_m68k_abs(opts, inst->src.params.regs.displacement + inst->address + 2);
+		if (is_jsr) {
+			jump_m68k_abs(opts, inst->src.params.regs.displacement + inst->address + 2);
+		} else {
+			jump_m68k_chain(opts, inst->src.params.regs.displacement + inst->address + 2);
+		}
 		break;
 	case MODE_PC_INDEX_DISP8:
 		cycles(&opts->gen, BUS*3);//TODO: CHeck that this is correct
@@ -280,7 +304,11 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 		if (is_jsr) {
 			push_const(opts, inst->address + (inst->src.addr_mode == MODE_ABSOLUTE ? 6 : 4));
 		}
-		jump_m68k_abs(opts, inst->src.params.immed);
+		if (is_jsr) {
+			jump_m68k_abs(opts, inst->src.params.immed);
+		} else {
+			jump_m68k_chain(opts, inst->src.params.immed);
+		}
 		break;
 	default:
 		m68k_disasm(inst, disasm_buf);
@@ -716,7 +744,10 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 			uint32_t masked = (address - mem_chunk->start) & mem_chunk->mask;
 			uint32_t final_off = masked + meta_off;
 			uint32_t ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			//writes to checked pages don't need to look for translated code
+			if (!opts->gen.code_pages[final_off >> opts->gen.ram_flags_shift].checked) {
+				context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			}
 
 			uint32_t slot = final_off / 1024;
 			if (!opts->gen.ram_inst_sizes[slot]) {
@@ -728,7 +759,9 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 			masked = (address + size - 1) & mem_chunk->mask;
 			final_off = masked + meta_off;
 			ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			if (!opts->gen.code_pages[final_off >> opts->gen.ram_flags_shift].checked) {
+				context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			}
 		}
 		//calculate the lowest alias for this address
 		address = mem_chunk->start + ((address - mem_chunk->start) & mem_chunk->mask);
@@ -966,6 +999,411 @@ static impl_info m68k_impls[] = {
 	RAW_IMPL(M68K_TAS, translate_m68k_tas),
 };
 
+//number of instructions after one that are checked for writes that make its flags dead
+#define FLAG_WINDOW 4
+//instructions decoded at once by translate_m68k_stream for the flag liveness pass
+#define FLAG_BLOCK_SIZE 32
+#define ALL_FLAGS (X|N|Z|V|C)
+
+typedef struct {
+	m68kinst insts[FLAG_BLOCK_SIZE];
+	uint32_t count;
+	uint32_t pos;
+	uint8_t  complete; //decoding stopped at a terminal instruction or the end of the region
+} flag_block;
+
+//true if an access to op can cause an address error
+static uint8_t may_fault(m68kinst *inst, m68k_op_info *op)
+{
+	switch (op->addr_mode)
+	{
+	case MODE_REG:
+	case MODE_AREG:
+	case MODE_IMMEDIATE:
+	case MODE_IMMEDIATE_WORD:
+	case MODE_UNUSED:
+		return 0;
+	case MODE_ABSOLUTE:
+	case MODE_ABSOLUTE_SHORT:
+		return inst->extra.size != OPSIZE_BYTE && (op->params.immed & 1);
+	case MODE_PC_DISPLACE:
+		return inst->extra.size != OPSIZE_BYTE && (op->params.regs.displacement & 1);
+	default:
+		return inst->extra.size != OPSIZE_BYTE;
+	}
+}
+
+//sets the flags an instruction reads and the flags it always overwrites, returns 1 if the flags can
+//be observed before it completes through an exception, or if it can leave straight line code
+static uint8_t flag_effects(m68kinst *inst, uint32_t *uses, uint32_t *defs)
+{
+	*uses = *defs = 0;
+	switch (inst->op)
+	{
+	case M68K_ADD:
+	case M68K_SUB:
+	case M68K_NEG:
+	case M68K_MOVE:
+		if (inst->dst.addr_mode != MODE_AREG) {
+			*defs = inst->op == M68K_MOVE ? N|Z|V|C : ALL_FLAGS;
+		}
+		break;
+	case M68K_ADDX:
+	case M68K_SUBX:
+	case M68K_NEGX:
+		//Z is only ever cleared
+		*uses = X|Z;
+		*defs = X|N|V|C;
+		break;
+	case M68K_ABCD:
+	case M68K_SBCD:
+	case M68K_NBCD:
+		*uses = X|Z;
+		*defs = X|C;
+		break;
+	case M68K_AND:
+	case M68K_OR:
+	case M68K_EOR:
+	case M68K_NOT:
+	case M68K_TST:
+	case M68K_CLR:
+	case M68K_SWAP:
+	case M68K_EXT:
+	case M68K_MULU:
+	case M68K_MULS:
+	case M68K_TAS:
+	case M68K_CMP:
+	case M68K_ROL:
+	case M68K_ROR:
+		*defs = N|Z|V|C;
+		break;
+	case M68K_BTST:
+	case M68K_BCHG:
+	case M68K_BCLR:
+	case M68K_BSET:
+		*defs = Z;
+		break;
+	case M68K_ASL:
+	case M68K_ASR:
+	case M68K_LSL:
+	case M68K_LSR:
+		//X is left alone when a count in a register is 0
+		*defs = inst->src.addr_mode == MODE_REG ? N|Z|V|C : ALL_FLAGS;
+		break;
+	case M68K_ROXL:
+	case M68K_ROXR:
+		*uses = X;
+		*defs = inst->src.addr_mode == MODE_REG ? N|Z|V|C : ALL_FLAGS;
+		break;
+	case M68K_SCC:
+		*uses = N|Z|V|C;
+		break;
+	case M68K_MOVE_CCR:
+		*defs = ALL_FLAGS;
+		break;
+	case M68K_MOVE_FROM_SR:
+		*uses = ALL_FLAGS;
+		break;
+	case M68K_ANDI_CCR:
+	case M68K_ORI_CCR:
+	case M68K_EORI_CCR:
+		*uses = *defs = ALL_FLAGS;
+		break;
+	case M68K_LEA:
+	case M68K_MOVEP:
+	case M68K_EXG:
+	case M68K_NOP:
+		return 0;
+	default:
+		//branches, traps, privileged instructions and anything using the stack
+		return 1;
+	}
+	return may_fault(inst, &inst->src) || may_fault(inst, &inst->dst);
+}
+
+//flags insts[0] writes that one of the next count - 1 instructions overwrites before they can be read.
+//Interrupts are only taken between instructions and RTE restores the flags, so an interrupt handler
+//can see a stale value for one of these in the saved SR, but the interrupted code can't
+static uint32_t dead_flags(m68kinst *insts, uint32_t count)
+{
+	uint32_t uses, defs;
+	if (!count || flag_effects(insts, &uses, &defs)) {
+		return 0;
+	}
+	uint32_t undecided = ALL_FLAGS, dead = 0;
+	for (uint32_t i = 1; i < count && undecided; i++)
+	{
+		if (flag_effects(insts + i, &uses, &defs)) {
+			break;
+		}
+		undecided &= ~uses;
+		dead |= defs & undecided;
+		undecided &= ~defs;
+	}
+	return dead;
+}
+
+static uint8_t is_rom_chunk(memmap_chunk const *chunk)
+{
+	return chunk && chunk->buffer && (chunk->flags & MMAP_READ) && !(chunk->flags & (MMAP_WRITE | MMAP_CODE | MMAP_PTR_IDX));
+}
+
+//decodes up to max instructions starting at address for the passes that look past the instruction being
+//translated. Only code in ROM is looked at, code that can change could invalidate what they decided without
+//the instruction being retranslated, and a block never crosses a 64KB boundary so a bank switch can't either
+static uint32_t decode_rom_block(m68k_context *context, uint32_t address, m68kinst *insts, uint32_t max)
+{
+	m68k_options *opts = context->options;
+	if ((address & 1) || context->num_breakpoints) {
+		return 0;
+	}
+	memmap_chunk const *chunk = find_map_chunk(address, &opts->gen, 0, NULL);
+	if (!is_rom_chunk(chunk)) {
+		return 0;
+	}
+	uint32_t region = address >> 16, count = 0;
+	while (count < max && address >> 16 == region && (address & opts->gen.address_mask) < chunk->end)
+	{
+		uint16_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+		if (!encoded) {
+			break;
+		}
+		uint16_t *next = m68k_decode(encoded, insts + count, address);
+		address += (next - encoded) * 2;
+		if (m68k_is_terminal(insts + count++)) {
+			break;
+		}
+	}
+	return count;
+}
+
+#define RANK_VECTORS 48
+#define RANK_MAX_INSTS 16384
+#define RANK_MAX_DEPTH 3
+
+typedef struct {
+	uint32_t address;
+	uint16_t regs; //bits 0-7 for d0-d7, bits 8-15 for a0-a7
+} ranked_inst;
+
+static uint16_t operand_regs(m68k_op_info *op)
+{
+	uint8_t index = (op->params.regs.sec & 0x10 ? 8 : 0) + (op->params.regs.sec >> 1 & 7);
+	switch (op->addr_mode)
+	{
+	case MODE_REG:
+		return 1 << (op->params.regs.pri & 7);
+	case MODE_AREG:
+	case MODE_AREG_INDIRECT:
+	case MODE_AREG_POSTINC:
+	case MODE_AREG_PREDEC:
+	case MODE_AREG_DISPLACE:
+		return 0x100 << (op->params.regs.pri & 7);
+	case MODE_AREG_INDEX_DISP8:
+		return 0x100 << (op->params.regs.pri & 7) | 1 << index;
+	case MODE_PC_INDEX_DISP8:
+		return 1 << index;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t has_static_target(m68kinst *inst)
+{
+	switch (inst->op)
+	{
+	case M68K_BCC:
+	case M68K_BSR:
+	case M68K_DBCC:
+		return 1;
+	case M68K_JMP:
+	case M68K_JSR:
+		return inst->src.addr_mode == MODE_PC_DISPLACE || inst->src.addr_mode == MODE_ABSOLUTE
+			|| inst->src.addr_mode == MODE_ABSOLUTE_SHORT;
+	default:
+		return 0;
+	}
+}
+
+static int compare_ranked(const void *a, const void *b)
+{
+	uint32_t left = ((ranked_inst const *)a)->address, right = ((ranked_inst const *)b)->address;
+	return left < right ? -1 : left > right;
+}
+
+//first instruction in the sorted insts at or after address
+static uint32_t ranked_index(ranked_inst *insts, uint32_t count, uint32_t address)
+{
+	uint32_t low = 0, high = count;
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (insts[mid].address < address) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+//fills weights with how heavily the code in ROM that can be reached from the vector table uses each of
+//d0-d7 and a0-a7 (in that order). Only branches with a fixed target are followed, every instruction a
+//backward branch jumps over counts 8 times as much per level of nesting up to RANK_MAX_DEPTH levels
+void m68k_rank_registers(m68k_options *opts, uint32_t *weights)
+{
+	memset(weights, 0, sizeof(uint32_t) * 16);
+	ranked_inst *insts = malloc(sizeof(ranked_inst) * RANK_MAX_INSTS);
+	uint32_t *loops = malloc(sizeof(uint32_t) * 2 * RANK_MAX_INSTS);
+	uint32_t *pending = malloc(sizeof(uint32_t) * (RANK_MAX_INSTS + RANK_VECTORS));
+	uint8_t *visited = calloc(1, (opts->gen.address_mask + 1) / 16);
+	uint32_t num_insts = 0, num_loops = 0, num_pending = 0;
+	for (uint32_t vector = 1; vector < RANK_VECTORS; vector++)
+	{
+		if (!is_rom_chunk(find_map_chunk(vector * 4, &opts->gen, 0, NULL))) {
+			break;
+		}
+		uint16_t *words = get_native_pointer(vector * 4, NULL, &opts->gen);
+		pending[num_pending++] = words[0] << 16 | words[1];
+	}
+	while (num_pending && num_insts < RANK_MAX_INSTS)
+	{
+		uint32_t address = pending[--num_pending] & opts->gen.address_mask;
+		while (num_insts < RANK_MAX_INSTS && !(address & 1) && !(visited[address >> 4] & 1 << (address >> 1 & 7)))
+		{
+			memmap_chunk const *chunk = find_map_chunk(address, &opts->gen, 0, NULL);
+			//the longest instruction is 10 bytes
+			if (!is_rom_chunk(chunk) || address + 10 > chunk->end) {
+				break;
+			}
+			visited[address >> 4] |= 1 << (address >> 1 & 7);
+			m68kinst inst;
+			uint16_t *encoded = get_native_pointer(address, NULL, &opts->gen);
+			uint16_t *next = m68k_decode(encoded, &inst, address);
+			if (!next || inst.op == M68K_INVALID) {
+				break;
+			}
+			//the register list of a MOVEM is the only register operand it can have
+			ranked_inst *ranked = insts + num_insts++;
+			ranked->address = address;
+			ranked->regs = 0;
+			if (inst.op != M68K_MOVEM || inst.src.addr_mode != MODE_REG) {
+				ranked->regs |= operand_regs(&inst.src);
+			}
+			if (inst.op != M68K_MOVEM || inst.dst.addr_mode != MODE_REG) {
+				ranked->regs |= operand_regs(&inst.dst);
+			}
+			if (has_static_target(&inst)) {
+				uint32_t target = m68k_branch_target(&inst, NULL, NULL) & opts->gen.address_mask;
+				if (target <= address && inst.op != M68K_BSR && inst.op != M68K_JSR) {
+					loops[num_loops * 2] = target;
+					loops[num_loops++ * 2 + 1] = address;
+				}
+				pending[num_pending++] = target;
+			}
+			if (m68k_is_terminal(&inst)) {
+				break;
+			}
+			address = (address + (next - encoded) * 2) & opts->gen.address_mask;
+		}
+	}
+	qsort(insts, num_insts, sizeof(ranked_inst), compare_ranked);
+	//depth changes at the start of each loop and right after its end
+	int32_t *depth = calloc(num_insts + 1, sizeof(int32_t));
+	for (uint32_t i = 0; i < num_loops; i++)
+	{
+		depth[ranked_index(insts, num_insts, loops[i * 2])]++;
+		depth[ranked_index(insts, num_insts, loops[i * 2 + 1] + 1)]--;
+	}
+	int32_t cur_depth = 0;
+	for (uint32_t i = 0; i < num_insts; i++)
+	{
+		cur_depth += depth[i];
+		uint32_t weight = 1 << 3 * (cur_depth < RANK_MAX_DEPTH ? cur_depth : RANK_MAX_DEPTH);
+		for (int reg = 0; reg < 16; reg++)
+		{
+			if (insts[i].regs & 1 << reg) {
+				weights[reg] += weight;
+			}
+		}
+	}
+	free(depth);
+	free(visited);
+	free(pending);
+	free(loops);
+	free(insts);
+}
+
+//only the emitters that set flags through update_flags at the end of an instruction skip dead ones
+static uint8_t skips_dead_flags(m68kinst *inst)
+{
+	switch (inst->op)
+	{
+	case M68K_MOVE:
+	case M68K_ADD:
+	case M68K_SUB:
+	case M68K_ADDX:
+	case M68K_SUBX:
+	case M68K_AND:
+	case M68K_OR:
+	case M68K_EOR:
+	case M68K_CMP:
+	case M68K_NEG:
+	case M68K_NOT:
+	case M68K_TST:
+	case M68K_SWAP:
+	case M68K_CLR:
+	case M68K_EXT:
+	case M68K_MULU:
+	case M68K_MULS:
+	case M68K_ASL:
+	case M68K_ASR:
+	case M68K_LSL:
+	case M68K_LSR:
+	case M68K_ROL:
+	case M68K_ROR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+//dead flags of inst using the instructions decoded after it in block, which is decoded again from
+//inst if that doesn't include a full window after it. The result only depends on the code after
+//inst so it is the same no matter where translation started
+static uint32_t block_dead_flags(m68k_context *context, m68kinst *inst, flag_block *block)
+{
+	if (!(context->options->gen.flags & M68K_OPT_DEAD_FLAGS) || !skips_dead_flags(inst)) {
+		return 0;
+	}
+	if (
+		block->pos >= block->count || block->insts[block->pos].address != inst->address
+		|| (!block->complete && block->pos + FLAG_WINDOW >= block->count)
+	) {
+		block->count = decode_rom_block(context, inst->address, block->insts, FLAG_BLOCK_SIZE);
+		block->complete = block->count < FLAG_BLOCK_SIZE;
+		block->pos = 0;
+		if (!block->count) {
+			return 0;
+		}
+	}
+	uint32_t window = block->count - block->pos;
+	if (window > FLAG_WINDOW + 1) {
+		window = FLAG_WINDOW + 1;
+	}
+	return dead_flags(block->insts + block->pos++, window);
+}
+
+//dead flags of a single instruction that is translated on its own
+static uint32_t inst_dead_flags(m68k_context *context, m68kinst *inst)
+{
+	if (!(context->options->gen.flags & M68K_OPT_DEAD_FLAGS) || !skips_dead_flags(inst)) {
+		return 0;
+	}
+	m68kinst insts[FLAG_WINDOW + 1];
+	return dead_flags(insts, decode_rom_block(context, inst->address, insts, FLAG_WINDOW + 1));
+}
+
 static void translate_m68k(m68k_context *context, m68kinst * inst)
 {
 	m68k_options * opts = context->options;
@@ -974,11 +1412,21 @@ static void translate_m68k(m68k_context *context, m68kinst * inst)
 		return;
 	}
 	code_ptr start = opts->gen.code.cur;
-	check_cycles_int(&opts->gen, inst->address);
-	
-	m68k_debug_handler bp;
-	if ((bp = find_breakpoint(context, inst->address))) {
-		m68k_breakpoint_patch(context, inst->address, bp, start);
+	//code in RAM is retranslated in place, which only leaves room for MAX_NATIVE_SIZE bytes
+	memmap_chunk const *chunk = find_map_chunk(inst->address, &opts->gen, 0, NULL);
+	opts->direct_mem = chunk && !(chunk->flags & MMAP_CODE);
+	//instructions in a batch share the check emitted by m68k_batch_check
+	if (!opts->gen.batching) {
+		check_cycles_int(&opts->gen, inst->address);
+		
+		m68k_debug_handler bp;
+		if ((bp = find_breakpoint(context, inst->address))) {
+			m68k_breakpoint_patch(context, inst->address, bp, start);
+		}
+	}
+	if (chunk && (chunk->flags & MMAP_CODE) && code_is_checked(&opts->gen, inst->address, inst->bytes)) {
+		check_code_unchanged(&opts->gen, inst->address, get_native_pointer(inst->address, (void **)context->mem_pointers, &opts->gen),
+			inst->bytes, opts->retrans_stub);
 	}
 	
 	//log_address(&opts->gen, inst->address, "M68K: %X @ %d\n");
@@ -1023,6 +1471,97 @@ static void translate_m68k(m68k_context *context, m68kinst * inst)
 	}
 }
 
+#define BATCH_MIN 4
+#define BATCH_MAX 32
+
+static uint8_t batch_operand(m68k_op_info *op)
+{
+	return op->addr_mode <= MODE_AREG || op->addr_mode >= MODE_IMMEDIATE;
+}
+
+//instructions that don't access memory and always take the same number of cycles, so nothing can
+//move the cycle limit while they run and their checks can be replaced by a single one
+static uint8_t batches_cycles(m68kinst *inst)
+{
+	if (!batch_operand(&inst->src) || !batch_operand(&inst->dst)) {
+		return 0;
+	}
+	switch (inst->op)
+	{
+	case M68K_MOVE:
+	case M68K_ADD:
+	case M68K_SUB:
+	case M68K_ADDX:
+	case M68K_SUBX:
+	case M68K_NEGX:
+	case M68K_AND:
+	case M68K_OR:
+	case M68K_EOR:
+	case M68K_CMP:
+	case M68K_NEG:
+	case M68K_NOT:
+	case M68K_TST:
+	case M68K_CLR:
+	case M68K_SWAP:
+	case M68K_EXT:
+	case M68K_EXG:
+	case M68K_NOP:
+		return 1;
+	case M68K_ASL:
+	case M68K_ASR:
+	case M68K_LSL:
+	case M68K_LSR:
+	case M68K_ROL:
+	case M68K_ROR:
+	case M68K_ROXL:
+	case M68K_ROXR:
+		//shifts by a register take 2 cycles for every bit shifted
+		return inst->src.addr_mode == MODE_IMMEDIATE;
+	default:
+		return 0;
+	}
+}
+
+//decodes the instructions starting at address that can be batched, returns 0 if there aren't enough
+//of them for a batch to be worth it
+static uint32_t decode_batch(m68k_context *context, uint32_t address, m68kinst *insts)
+{
+	if (!(context->options->gen.flags & M68K_OPT_BATCH_CYCLES)) {
+		return 0;
+	}
+	uint32_t count = decode_rom_block(context, address, insts, BATCH_MAX), batched = 0;
+	while (batched < count && batches_cycles(insts + batched))
+	{
+		batched++;
+	}
+	return batched >= BATCH_MIN ? batched : 0;
+}
+
+//The code for the first instruction of a batch starts with its usual cycle check followed by a check
+//that jumps past it to the rest of its regular code if the check of any instruction in the batch would
+//stop. Otherwise the whole batch runs from a copy without checks that adds up its cycles at the end and
+//jumps to the instruction after it. The regular code of each instruction is still used when execution
+//starts in the middle of a batch, and the check returned is patched once the regular code is placed
+static void translate_m68k_batch(m68k_context *context, m68kinst *insts, uint32_t count, batch_check *check)
+{
+	m68k_options *opts = context->options;
+	check_cycles_int(&opts->gen, insts->address);
+	m68k_batch_check(opts, check);
+	opts->gen.batching = 1;
+	opts->gen.batch_cycles = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		check->last_start = opts->gen.batch_cycles;
+		opts->dead_flags = inst_dead_flags(context, insts + i);
+		translate_m68k(context, insts + i);
+	}
+	opts->dead_flags = 0;
+	opts->gen.batching = 0;
+	cycles(&opts->gen, opts->gen.batch_cycles);
+	jump_m68k_abs(opts, insts[count - 1].address + insts[count - 1].bytes);
+	opts->gen.cache.batched_checks += count - 1;
+}
+
 void translate_m68k_stream(uint32_t address, m68k_context * context)
 {
 	m68kinst instbuf;
@@ -1031,12 +1570,19 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 	if(get_native_address(opts, address)) {
 		return;
 	}
+	reloc_log *prev_log = code_store_begin(&opts->gen);
 	uint16_t *encoded, *next;
+	flag_block flags = {.count = 0};
+	m68kinst batch[BATCH_MAX];
+	opts->chain_jumps = 1;
 	do {
 		if (opts->address_log) {
 			fprintf(opts->address_log, "%X\n", address);
 			fflush(opts->address_log);
 		}
+		uint8_t chained;
+		//instructions left in the current batch, they don't start one of their own
+		uint32_t batch_left = 0;
 		do {
 			encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 			if (!encoded) {
@@ -1044,11 +1590,14 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 				translate_out_of_bounds(opts, address);
 				code_ptr after = code->cur;
 				map_native_address(context, address, start, 2, after-start);
+				code_cache_count(&opts->gen, after-start);
 				break;
 			}
 			code_ptr existing = get_native_address(opts, address);
 			if (existing) {
+				code_ptr from = code->cur;
 				jmp(code, existing);
+				code_store_extend(&opts->gen, from);
 				break;
 			}
 			next = m68k_decode(encoded, &instbuf, address);
@@ -1063,16 +1612,52 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 
 			//make sure the beginning of the code for an instruction is contiguous
 			check_code_prologue(code);
-			code_ptr start = code->cur;
+			code_ptr start = code->cur, block_last = code->last;
+			code_ptr cold_start = opts->gen.cold_code.cur, cold_last = opts->gen.cold_code.last;
+			batch_check check;
+			uint32_t batched = batch_left ? 0 : decode_batch(context, instbuf.address, batch);
+			if (batched) {
+				translate_m68k_batch(context, batch, batched, &check);
+				check_code_prologue(code);
+				batch_left = batched;
+			}
+			code_ptr inst_start = code->cur;
+			opts->dead_flags = block_dead_flags(context, &instbuf, &flags);
 			translate_m68k(context, &instbuf);
+			opts->dead_flags = 0;
+			if (batched) {
+				//the regular code of the instruction without its cycle check
+				m68k_batch_patch(opts, &check, inst_start + opts->gen.prologue_size);
+			}
+			if (batch_left) {
+				batch_left--;
+			}
 			code_ptr after = code->cur;
 			map_native_address(context, instbuf.address, start, m68k_size, after-start);
-		} while(!m68k_is_terminal(&instbuf) && !(address & 1));
+			code_cache_count(&opts->gen, after-start);
+			opts->gen.cache.translated_insts++;
+			//a jump left out by jump_m68k_chain falls through to the code of its destination
+			chained = opts->chain_pending;
+			if (opts->gen.cold_code.cur != cold_start) {
+				code_store_record_cold(&opts->gen, instbuf.address, m68k_size, cold_start, cold_last);
+			}
+			code_store_record(&opts->gen, instbuf.address, m68k_size, start, block_last, m68k_is_terminal(&instbuf) && !chained);
+			if (chained) {
+				opts->chain_pending = 0;
+				address = opts->chain_address;
+				if (opts->address_log) {
+					fprintf(opts->address_log, "%X\n", address);
+					fflush(opts->address_log);
+				}
+			}
+		} while((chained || !m68k_is_terminal(&instbuf)) && !(address & 1));
 		process_deferred(&opts->gen.deferred, context, (native_addr_func)get_native_from_context);
 		if (opts->gen.deferred) {
 			address = opts->gen.deferred->address;
 		}
 	} while(opts->gen.deferred);
+	opts->chain_jumps = 0;
+	code_store_end(prev_log);
 }
 
 void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
@@ -1086,13 +1671,20 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 	uint16_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 	m68kinst instbuf;
 	after = m68k_decode(inst, &instbuf, orig);
+	code_page *page = code_page_at(&opts->gen, address);
+	if (page) {
+		page->retranslations++;
+	}
+	opts->gen.cache.retranslations++;
 	if (orig_size != MAX_NATIVE_SIZE) {
 		deferred_addr * orig_deferred = opts->gen.deferred;
 
 		//make sure we have enough code space for the max size instruction
 		check_alloc_code(code, MAX_NATIVE_SIZE);
 		code_ptr native_start = code->cur;
+		opts->dead_flags = inst_dead_flags(context, &instbuf);
 		translate_m68k(context, &instbuf);
+		opts->dead_flags = 0;
 		code_ptr native_end = code->cur;
 		/*uint8_t is_terminal = m68k_is_terminal(&instbuf);
 		if ((native_end - native_start) <= orig_size) {
@@ -1121,6 +1713,8 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 		}*/
 
 		map_native_address(context, instbuf.address, native_start, (after-inst)*2, MAX_NATIVE_SIZE);
+		code_cache_count(&opts->gen, MAX_NATIVE_SIZE);
+		opts->gen.cache.translated_insts++;
 
 		jmp(&orig_code, native_start);
 		if (!m68k_is_terminal(&instbuf)) {
@@ -1141,7 +1735,9 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 	} else {
 		code_info tmp = *code;
 		*code = orig_code;
+		opts->dead_flags = inst_dead_flags(context, &instbuf);
 		translate_m68k(context, &instbuf);
+		opts->dead_flags = 0;
 		orig_code = *code;
 		*code = tmp;
 		if (!m68k_is_terminal(&instbuf)) {
@@ -1161,6 +1757,107 @@ code_ptr get_native_address_trans(m68k_context * context, uint32_t address)
 	}
 	return ret;
 }
+
+//called by native_addr when the target cache doesn't have address
+code_ptr get_native_address_cached(m68k_context * context, uint32_t address)
+{
+	m68k_options *opts = context->options;
+	code_ptr ret = get_native_address_trans(context, address);
+	target_cache_entry *entry = opts->target_cache + (address >> 1) % TARGET_CACHE_SIZE;
+	opts->gen.cache.indirect_hits += entry->hits;
+	opts->gen.cache.indirect_misses++;
+	entry->address = address;
+	entry->hits = 0;
+	entry->native = ret;
+	return ret;
+}
+
+//translated code for an address only moves when the code cache is flushed, retranslated instructions
+//are patched to jump to their new location so older pointers to them still work
+void m68k_clear_target_cache(m68k_options *opts)
+{
+	for (uint32_t i = 0; i < TARGET_CACHE_SIZE; i++)
+	{
+		opts->gen.cache.indirect_hits += opts->target_cache[i].hits;
+		//an address that belongs in a different entry so nothing matches an empty one
+		opts->target_cache[i] = (target_cache_entry){
+			.address = (i ^ 1) << 1
+		};
+	}
+}
+
+void m68k_code_cache_stats(m68k_context *context, code_cache_stats *stats)
+{
+	m68k_options *opts = context->options;
+	*stats = opts->gen.cache;
+	for (uint32_t i = 0; i < TARGET_CACHE_SIZE; i++)
+	{
+		stats->indirect_hits += opts->target_cache[i].hits;
+	}
+}
+
+//offset of resume_pc from the start of the translated instruction it is in, -1 if the CPU was
+//stopped somewhere that can't be found again in a retranslated copy
+int32_t m68k_resume_offset(m68k_context *context)
+{
+	if (!context->resume_pc) {
+		return 0;
+	}
+	code_ptr native = get_native_address(context->options, context->resume_address);
+	if (context->resume_pc == native) {
+		return 0;
+	}
+	if (native) {
+		code_ptr body = native + context->options->gen.prologue_size;
+		//with cold code the check at the start returns to a jump back to the body
+		if (context->resume_pc == body || cold_code_return(&context->options->gen, context->resume_pc) == body) {
+			return context->options->gen.prologue_size;
+		}
+	}
+	return -1;
+}
+
+//points resume_pc at the current translation of resume_address after the code cache was flushed
+void m68k_rebase_resume(m68k_context *context, int32_t offset)
+{
+	if (context->resume_pc) {
+		context->resume_pc = get_native_address_trans(context, context->resume_address) + offset;
+	}
+}
+
+//throws away all translated code, returns 0 without doing anything if the CPU can't be resumed
+//in retranslated code
+uint8_t m68k_flush_code_cache(m68k_context *context)
+{
+	m68k_options *opts = context->options;
+	int32_t offset = m68k_resume_offset(context);
+	if (offset < 0) {
+		return 0;
+	}
+	//keep what was translated from ROM so far before it is thrown away
+	code_store_save(&opts->gen);
+	code_cache_flush(&opts->gen, NATIVE_MAP_CHUNKS);
+	m68k_clear_target_cache(opts);
+	memset(context->ram_code_flags, 0, ram_size(&opts->gen) / (1 << opts->gen.ram_flags_shift) / 8);
+	m68k_rebase_resume(context, offset);
+	return 1;
+}
+
+static void map_stored_code(void *context, uint32_t address, code_ptr native, uint8_t size, uint32_t native_size)
+{
+	map_native_address(context, address, native, size, native_size);
+}
+
+uint32_t m68k_enable_code_store(m68k_context *context, char const *path, uint8_t const *rom_hash, void const *rom, uint32_t rom_size)
+{
+	m68k_options *opts = context->options;
+	if (!code_store_new(&opts->gen, path, STORE_CPU_68K, rom_hash, rom, rom_size, opts->gen.save_context,
+		context, (native_addr_func)get_native_from_context, map_stored_code)
+	) {
+		return 0;
+	}
+	return code_store_load(&opts->gen);
+}
 #endif
 
 void remove_breakpoint(m68k_context * context, uint32_t address)
@@ -1252,15 +1949,19 @@ void m68k_options_free(m68k_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	code_pages_free(&opts->gen);
+	free_arena(opts->gen.code.blocks);
+	code_store_free(opts->gen.store);
 	free(opts->big_movem);
 #endif
 	free(opts);
 }
 
 #ifdef NEW_CORE
-void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider)
+void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider, uint32_t flags)
 {
 	memset(opts, 0, sizeof(*opts));
+	opts->gen.flags = flags;
 	opts->gen.memmap = memmap;
 	opts->gen.memmap_chunks = num_chunks;
 	opts->gen.address_mask = 0xFFFFFF;
@@ -1274,8 +1975,13 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 m68k_context * init_68k_context(m68k_options * opts, m68k_reset_handler reset_handler)
 {
 #ifndef NEW_CORE
-	m68k_context * context = calloc(1, sizeof(m68k_context) + ram_size(&opts->gen) / (1 << opts->gen.ram_flags_shift) / 8);
+	m68k_context * context = calloc(1, sizeof(m68k_context) + ram_size(&opts->gen) / (1 << opts->gen.ram_flags_shift) / 8
+		+ (ram_size(&opts->gen) >> (RAM_DIRTY_SHIFT + 3)));
 	context->options = opts;
+	for (int i = 0; i < opts->num_direct; i++)
+	{
+		context->direct_buffers[i] = opts->direct[i].buffer;
+	}
 #else
 	m68000_base_device *device = malloc(sizeof(m68000_base_device));;
 	memset(device, 0, sizeof(m68000_base_device));
@@ -1360,6 +2066,18 @@ void m68k_deserialize(deserialize_buffer *buf, void *vcontext)
 #endif
 }
 
+void m68k_restore(m68k_context *context, m68k_context const *snapshot)
+{
+	//breakpoints are debugger state rather than emulated state so they survive a restore
+	m68k_breakpoint *breakpoints = context->breakpoints;
+	uint32_t num_breakpoints = context->num_breakpoints;
+	uint32_t bp_storage = context->bp_storage;
+	memcpy(context, snapshot, sizeof(m68k_context));
+	context->breakpoints = breakpoints;
+	context->num_breakpoints = num_breakpoints;
+	context->bp_storage = bp_storage;
+}
+
 #ifdef NEW_CORE
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end)
 {
@@ -16,8 +16,20 @@ struct m68kinst;
 #define NATIVE_MAP_CHUNKS (64*1024)
 #define NATIVE_CHUNK_SIZE ((16 * 1024 * 1024 / NATIVE_MAP_CHUNKS))
 #define MAX_NATIVE_SIZE 255
+//number of memory map chunks translated code can access without calling a memory handler
+#define NUM_DIRECT_CHUNKS 2
 
 #define M68K_OPT_BROKEN_READ_MODIFY 1
+//straight runs of register instructions in ROM share a single cycle check
+#define M68K_OPT_BATCH_CYCLES 2
+//the 68K registers the code in ROM uses the most are kept in host registers
+#define M68K_OPT_ALLOC_REGS 4
+//translated code reads and writes ROM and work RAM without calling the memory handlers
+#define M68K_OPT_DIRECT_MEM 8
+//interrupt checks and traps are placed away from the code that normally runs
+#define M68K_OPT_COLD_CODE 16
+//flag updates a later instruction overwrites before anything reads them are left out
+#define M68K_OPT_DEAD_FLAGS 32
 
 #define INT_PENDING_SR_CHANGE 254
 #define INT_PENDING_NONE 255
@@ -26,6 +38,19 @@ struct m68kinst;
 
 typedef void (*start_fun)(uint8_t * addr, void * context);
 
+//a chunk with a plain buffer, usually ROM or work RAM, whose buffer pointer is copied to
+//direct_buffers in the context so translated code can reach it without a relocation
+typedef struct {
+	void     *buffer;
+	code_ptr code_write; //called with the offset of a write in scratch2 when it hits translated code
+	uint32_t start;
+	uint32_t end;
+	uint32_t mask;
+	uint32_t ram_flags_off;
+	uint32_t ram_dirty_off;
+	uint16_t flags;
+} direct_chunk;
+
 typedef struct {
 	code_ptr impl;
 	uint16_t reglist;
@@ -34,6 +59,16 @@ typedef struct {
 	int8_t   dir;
 } movem_fun;
 
+//number of entries in the cache of recent destinations of jumps to computed addresses
+#define TARGET_CACHE_SIZE 256
+
+//native_addr checks this before looking up the native code map, the 16 byte size is assumed there
+typedef struct {
+	uint32_t address;
+	uint32_t hits;
+	code_ptr native;
+} __attribute__((aligned(16))) target_cache_entry;
+
 typedef struct {
 	cpu_options     gen;
 #ifndef NEW_CORE
@@ -66,6 +101,14 @@ typedef struct {
 	uint32_t        num_movem;
 	uint32_t        movem_storage;
 	code_word       prologue_start;
+	target_cache_entry target_cache[TARGET_CACHE_SIZE];
+	uint32_t        chain_address; //destination of a jump left out by jump_m68k_chain
+	uint8_t         chain_jumps;   //set while translate_m68k_stream can place code after a jump
+	uint8_t         chain_pending;
+	uint32_t        dead_flags;    //flags in update_flags form the instruction being translated can skip
+	direct_chunk    direct[NUM_DIRECT_CHUNKS];
+	uint8_t         num_direct;
+	uint8_t         direct_mem;    //set while the instruction being translated can access direct chunks inline
 #endif
 } m68k_options;
 
@@ -90,8 +133,10 @@ struct m68k_context {
 	uint32_t        int_num;
 	uint32_t        last_prefetch_address;
 	uint16_t        *mem_pointers[NUM_MEM_AREAS];
+	void            *direct_buffers[NUM_DIRECT_CHUNKS];
 	code_ptr        resume_pc;
 	code_ptr        reset_handler;
+	uint32_t        resume_address; //68K address of the instruction resume_pc is in
 	m68k_options    *options;
 	void            *system;
 	m68k_breakpoint *breakpoints;
@@ -109,7 +154,7 @@ typedef m68k_context *(*m68k_reset_handler)(m68k_context *context);
 void translate_m68k_stream(uint32_t address, m68k_context * context);
 void start_68k_context(m68k_context * context, uint32_t address);
 void resume_68k(m68k_context *context);
-void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider);
+void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider, uint32_t flags);
 m68k_context * init_68k_context(m68k_options * opts, m68k_reset_handler reset_handler);
 void m68k_reset(m68k_context * context);
 void m68k_options_free(m68k_options *opts);
@@ -121,11 +166,19 @@ void m68k_print_regs(m68k_context * context);
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end);
 #ifndef NEW_CORE
 m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context);
+int32_t m68k_resume_offset(m68k_context *context);
+void m68k_rebase_resume(m68k_context *context, int32_t offset);
+uint8_t m68k_flush_code_cache(m68k_context *context);
+void m68k_code_cache_stats(m68k_context *context, code_cache_stats *stats);
+//called once per frame to switch pages of RAM code in and out of checked mode, see code_page
+void m68k_code_pages_frame(m68k_context *context);
+uint32_t m68k_enable_code_store(m68k_context *context, char const *path, uint8_t const *rom_hash, void const *rom, uint32_t rom_size);
 #else
 #define m68k_handle_code_write(A, M)
 #endif
 void m68k_serialize(m68k_context *context, uint32_t pc, serialize_buffer *buf);
 void m68k_deserialize(deserialize_buffer *buf, void *vcontext);
+void m68k_restore(m68k_context *context, m68k_context const *snapshot);
 
 #endif //M68K_CORE_H_
 
@@ -105,18 +105,33 @@ void flag_to_flag(m68k_options *opts, uint8_t flag1, uint8_t flag2)
 	}
 }
 
+//true if a later instruction overwrites flag before anything can read it, see dead_flags in m68k_core.c
+static uint8_t skip_flag(m68k_options *opts, uint8_t flag)
+{
+	if (opts->dead_flags & X << (flag*3)) {
+		opts->gen.cache.skipped_flags++;
+		return 1;
+	}
+	return 0;
+}
+
 void update_flags(m68k_options *opts, uint32_t update_mask)
 {
 	uint8_t native_flags[] = {0, CC_S, CC_Z, CC_O, CC_C};
+	//the C flag register can only be copied to X if it was set
+	uint8_t c_skipped = (update_mask & (C0|C1|C)) && (opts->dead_flags & C);
 	for (int8_t flag = FLAG_C; flag >= FLAG_X; --flag)
 	{
+		if (!(update_mask & (X0|X1|X) << (flag*3)) || skip_flag(opts, flag)) {
+			continue;
+		}
 		if (update_mask & X0 << (flag*3)) {
 			set_flag(opts, 0, flag);
 		} else if(update_mask & X1 << (flag*3)) {
 			set_flag(opts, 1, flag);
 		} else if(update_mask & X << (flag*3)) {
 			if (flag == FLAG_X) {
-				if (opts->flag_regs[FLAG_C] >= 0 || !(update_mask & (C0|C1|C))) {
+				if ((opts->flag_regs[FLAG_C] >= 0 && !c_skipped) || !(update_mask & (C0|C1|C))) {
 					flag_to_flag(opts, FLAG_C, FLAG_X);
 				} else if(update_mask & C0) {
 					set_flag(opts, 0, flag);
@@ -350,6 +365,51 @@ void calc_areg_index_disp8(m68k_options *opts, m68k_op_info *op, uint8_t native_
 	calc_index_disp8(opts, op, native_reg);
 }
 
+//A path translated code rarely takes, like a trap. With cold code it is emitted into cold_code and
+//jumped to when cc is true, otherwise it stays inline behind a short jump over it.
+typedef struct {
+	code_ptr  skip;
+	code_ptr  cold_start;
+	code_info hot;
+} cold_path;
+
+static void cold_path_start(m68k_options *opts, cold_path *path, uint8_t cc)
+{
+	code_info *code = &opts->gen.code;
+	if (!opts->gen.cold_code.cur) {
+		path->skip = code->cur + 1;
+		//flipping the low bit of a condition code negates it
+		jcc(code, cc ^ 1, code->cur + 2);
+		return;
+	}
+	code_info *cold = &opts->gen.cold_code;
+	//the paths are short, this keeps each one in a single block
+	check_alloc_code(cold, 8*MAX_INST_LEN);
+	jcc(code, cc, code->cur + 512);//force 32-bit displacement
+	int32_t disp = cold->cur - code->cur;
+	memcpy(code_writable(code->cur - sizeof(disp)), &disp, sizeof(disp));
+	cold->stack_off = code->stack_off;
+	path->cold_start = cold->cur;
+	path->hot = *code;
+	*code = *cold;
+}
+
+//rejoin is set for a path that continues with the code after it instead of ending with a jump
+static void cold_path_end(m68k_options *opts, cold_path *path, uint8_t rejoin)
+{
+	code_info *code = &opts->gen.code;
+	if (!opts->gen.cold_code.cur) {
+		*code_writable(path->skip) = code->cur - (path->skip + 1);
+		return;
+	}
+	if (rejoin) {
+		jmp(code, path->hot.cur);
+	}
+	code_cache_count_cold(&opts->gen, code->cur - path->cold_start);
+	opts->gen.cold_code = *code;
+	*code = path->hot;
+}
+
 void m68k_check_cycles_int_latch(m68k_options *opts)
 {
 	code_info *code = &opts->gen.code;
@@ -362,10 +422,285 @@ void m68k_check_cycles_int_latch(m68k_options *opts)
 		cmp_rr(code, opts->gen.cycles, opts->gen.limit, SZ_D);
 		cc = CC_A;
 	}
-	code_ptr jmp_off = code->cur+1;
-	jcc(code, cc, jmp_off+1);
+	cold_path latch;
+	//cc is true while the limit hasn't been reached
+	cold_path_start(opts, &latch, cc ^ 1);
 	call(code, opts->handle_int_latch);
-	*jmp_off = code->cur - (jmp_off+1);
+	cold_path_end(opts, &latch, 1);
+}
+
+//the check for a block of instructions translated without their own cycle checks, it jumps to the
+//destination given to m68k_batch_patch if the check of any of them would stop or breakpoints have
+//been set since the block was translated
+void m68k_batch_check(m68k_options *opts, batch_check *check)
+{
+	code_info *code = &opts->gen.code;
+	check_alloc_code(code, 6*MAX_INST_LEN);
+	cmp_irdisp(code, 0, opts->gen.context_reg, offsetof(m68k_context, num_breakpoints), SZ_D);
+	//dummy destinations to be replaced later, make sure they generate 4-byte displacements
+	jcc(code, CC_NZ, code->cur + 256);
+	check->bp_jump = code->cur - sizeof(int32_t);
+	mov_rr(code, opts->gen.cycles, opts->gen.scratch1, SZ_D);
+	uint8_t cc;
+	//last_start is filled in later too
+	if (opts->gen.limit < 0) {
+		sub_ir(code, INT32_MAX, opts->gen.scratch1, SZ_D);
+		check->cycles = code->cur - sizeof(int32_t);
+		cmp_ir(code, 1, opts->gen.scratch1, SZ_D);
+		cc = CC_S;
+	} else {
+		add_ir(code, INT32_MAX, opts->gen.scratch1, SZ_D);
+		check->cycles = code->cur - sizeof(int32_t);
+		cmp_rr(code, opts->gen.scratch1, opts->gen.limit, SZ_D);
+		cc = CC_BE;
+	}
+	jcc(code, cc, code->cur + 256);
+	check->limit_jump = code->cur - sizeof(int32_t);
+}
+
+void m68k_batch_patch(m68k_options *opts, batch_check *check, code_ptr slow)
+{
+	int32_t value = check->last_start * opts->gen.clock_divider;
+	memcpy(code_writable(check->cycles), &value, sizeof(value));
+	value = slow - (check->bp_jump + sizeof(int32_t));
+	memcpy(code_writable(check->bp_jump), &value, sizeof(value));
+	value = slow - (check->limit_jump + sizeof(int32_t));
+	memcpy(code_writable(check->limit_jump), &value, sizeof(value));
+}
+
+static uint32_t direct_chunks(m68k_options *opts, uint16_t access_flag)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < opts->num_direct; i++)
+	{
+		if (opts->direct[i].flags & access_flag) {
+			count++;
+		}
+	}
+	return count;
+}
+
+//forward jumps in inline memory accesses get 4-byte displacements that are filled in by patch_jump
+static code_ptr forward_jcc(code_info *code, uint8_t cc)
+{
+	jcc(code, cc, code->cur + 256);
+	return code->cur - sizeof(int32_t);
+}
+
+static code_ptr forward_jmp(code_info *code)
+{
+	jmp(code, code->cur + 256);
+	return code->cur - sizeof(int32_t);
+}
+
+static void patch_jump(code_ptr disp, code_ptr target)
+{
+	int32_t value = target - (disp + sizeof(int32_t));
+	memcpy(code_writable(disp), &value, sizeof(value));
+}
+
+//jumps to the placeholders it adds to fails when the address in reg can't be accessed in chunk with an
+//access of the given size, otherwise leaves the offset of the access in chunk in reg
+static uint32_t direct_guard(m68k_options *opts, direct_chunk *chunk, uint8_t reg, uint8_t size, code_ptr *fails)
+{
+	code_info *code = &opts->gen.code;
+	uint32_t num_fails = 0, bytes = size == OPSIZE_LONG ? 4 : size == OPSIZE_WORD ? 2 : 1;
+	if (chunk->start) {
+		cmp_ir(code, chunk->start, reg, SZ_D);
+		fails[num_fails++] = forward_jcc(code, CC_C);
+	}
+	if (chunk->end - bytes < opts->gen.address_mask) {
+		cmp_ir(code, chunk->end - bytes + 1, reg, SZ_D);
+		fails[num_fails++] = forward_jcc(code, CC_NC);
+	}
+	//the second word of a long access can wrap around to the start of a mirrored buffer, which only
+	//happens when all the bits of the mask other than the lowest are set in the address
+	if (size == OPSIZE_LONG && (
+		chunk->end - chunk->start > chunk->mask + 1 || (chunk->start | chunk->mask) + 3 <= chunk->end
+	)) {
+		not_r(code, reg, SZ_D);
+		test_ir(code, chunk->mask & ~1, reg, SZ_D);
+		not_r(code, reg, SZ_D);
+		fails[num_fails++] = forward_jcc(code, CC_Z);
+	}
+	and_ir(code, chunk->mask, reg, SZ_D);
+	if (size == OPSIZE_BYTE && (opts->gen.byte_swap || (chunk->flags & MMAP_BYTESWAP))) {
+		xor_ir(code, 1, reg, SZ_D);
+	}
+	return num_fails;
+}
+
+//emits a read of the size in inst->extra.size form from the address in scratch1 that loads straight from
+//the buffer of a direct chunk when the address is in one and calls the regular handler otherwise. The
+//cycle checks and bus cycles are the same as in the handler, returns 0 if nothing was emitted
+uint8_t m68k_direct_read(m68k_options *opts, uint8_t size)
+{
+	if (!opts->direct_mem) {
+		return 0;
+	}
+	code_info *code = &opts->gen.code;
+	uint8_t adr = opts->gen.scratch1, tmp = opts->gen.scratch2;
+	code_ptr slow[3 * NUM_DIRECT_CHUNKS + 1], access[NUM_DIRECT_CHUNKS];
+	uint32_t num_slow = 0, num_access = 0;
+	if (!direct_chunks(opts, MMAP_READ)) {
+		return 0;
+	}
+	check_alloc_code(code, 64 * MAX_INST_LEN);
+	if (size != OPSIZE_BYTE && opts->gen.align_error_mask) {
+		test_ir(code, opts->gen.align_error_mask, adr, SZ_D);
+		slow[num_slow++] = forward_jcc(code, CC_NZ);
+	}
+	and_ir(code, opts->gen.address_mask, adr, SZ_D);
+	for (uint32_t i = 0; i < opts->num_direct; i++)
+	{
+		direct_chunk *chunk = opts->direct + i;
+		if (!(chunk->flags & MMAP_READ)) {
+			continue;
+		}
+		code_ptr fails[3];
+		uint32_t num_fails = direct_guard(opts, chunk, adr, size, fails);
+		add_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, direct_buffers) + sizeof(void *) * i, adr, SZ_PTR);
+		access[num_access++] = forward_jmp(code);
+		for (uint32_t j = 0; j < num_fails; j++)
+		{
+			patch_jump(fails[j], code->cur);
+		}
+	}
+	for (uint32_t i = 0; i < num_slow; i++)
+	{
+		patch_jump(slow[i], code->cur);
+	}
+	call(code, size == OPSIZE_BYTE ? opts->read_8 : size == OPSIZE_WORD ? opts->read_16 : opts->read_32);
+	code_ptr done = forward_jmp(code);
+	for (uint32_t i = 0; i < num_access; i++)
+	{
+		patch_jump(access[i], code->cur);
+	}
+	if (size == OPSIZE_LONG) {
+		push_r(code, tmp);
+		mov_rr(code, adr, tmp, SZ_PTR);
+		check_cycles(&opts->gen);
+		cycles(&opts->gen, opts->gen.bus_cycles);
+		movzx_rdispr(code, tmp, 0, adr, SZ_W, SZ_D);
+		shl_ir(code, 16, adr, SZ_D);
+		check_cycles(&opts->gen);
+		cycles(&opts->gen, opts->gen.bus_cycles);
+		mov_rdispr(code, tmp, 2, adr, SZ_W);
+		pop_r(code, tmp);
+	} else {
+		check_cycles(&opts->gen);
+		cycles(&opts->gen, opts->gen.bus_cycles);
+		mov_rindr(code, adr, adr, size == OPSIZE_BYTE ? SZ_B : SZ_W);
+	}
+	patch_jump(done, code->cur);
+	return 1;
+}
+
+//stores the low byte or word of scratch1 at the offset in scratch2 of direct chunk i like the write
+//handler does, scratch1 is clobbered and scratch2 is left alone unless the write hits translated code
+static void direct_store(m68k_options *opts, uint32_t i, uint8_t size)
+{
+	code_info *code = &opts->gen.code;
+	direct_chunk *chunk = opts->direct + i;
+	uint32_t buffer_off = offsetof(m68k_context, direct_buffers) + sizeof(void *) * i;
+	check_cycles(&opts->gen);
+	cycles(&opts->gen, opts->gen.bus_cycles);
+	add_rdispr(code, opts->gen.context_reg, buffer_off, opts->gen.scratch2, SZ_PTR);
+	mov_rrind(code, opts->gen.scratch1, opts->gen.scratch2, size);
+	if (chunk->flags & MMAP_CODE) {
+		sub_rdispr(code, opts->gen.context_reg, buffer_off, opts->gen.scratch2, SZ_PTR);
+		mov_rr(code, opts->gen.scratch2, opts->gen.scratch1, SZ_D);
+		shr_ir(code, RAM_DIRTY_SHIFT, opts->gen.scratch1, SZ_D);
+		bts_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, chunk->ram_dirty_off, SZ_D);
+		mov_rr(code, opts->gen.scratch2, opts->gen.scratch1, SZ_D);
+		shr_ir(code, opts->gen.ram_flags_shift, opts->gen.scratch1, SZ_D);
+		bt_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, chunk->ram_flags_off, SZ_D);
+		code_ptr not_code = code->cur + 1;
+		jcc(code, CC_NC, code->cur + 2);
+		call(code, chunk->code_write);
+		*code_writable(not_code) = code->cur - (not_code + 1);
+	}
+}
+
+//the write counterpart of m68k_direct_read, the value is in scratch1 and the address in scratch2
+uint8_t m68k_direct_write(m68k_options *opts, uint8_t size, uint8_t lowfirst)
+{
+	if (!opts->direct_mem) {
+		return 0;
+	}
+	code_info *code = &opts->gen.code;
+	uint8_t adr = opts->gen.scratch2, value = opts->gen.scratch1;
+	code_ptr slow[3 * NUM_DIRECT_CHUNKS + 1], body[NUM_DIRECT_CHUNKS], done[NUM_DIRECT_CHUNKS + 1];
+	uint32_t chunks[NUM_DIRECT_CHUNKS];
+	uint32_t num_slow = 0, num_body = 0, num_done = 0;
+	if (!direct_chunks(opts, MMAP_WRITE)) {
+		return 0;
+	}
+	check_alloc_code(code, 128 * MAX_INST_LEN);
+	if (size != OPSIZE_BYTE && opts->gen.align_error_mask) {
+		test_ir(code, opts->gen.align_error_mask, adr, SZ_D);
+		slow[num_slow++] = forward_jcc(code, CC_NZ);
+	}
+	and_ir(code, opts->gen.address_mask, adr, SZ_D);
+	for (uint32_t i = 0; i < opts->num_direct; i++)
+	{
+		direct_chunk *chunk = opts->direct + i;
+		if (!(chunk->flags & MMAP_WRITE)) {
+			continue;
+		}
+		code_ptr fails[3];
+		uint32_t num_fails = direct_guard(opts, chunk, adr, size, fails);
+		chunks[num_body] = i;
+		body[num_body++] = forward_jmp(code);
+		for (uint32_t j = 0; j < num_fails; j++)
+		{
+			patch_jump(fails[j], code->cur);
+		}
+	}
+	for (uint32_t i = 0; i < num_slow; i++)
+	{
+		patch_jump(slow[i], code->cur);
+	}
+	if (size == OPSIZE_BYTE) {
+		call(code, opts->write_8);
+	} else if (size == OPSIZE_WORD) {
+		call(code, opts->write_16);
+	} else {
+		call(code, lowfirst ? opts->write_32_lowfirst : opts->write_32_highfirst);
+	}
+	for (uint32_t i = 0; i < num_body; i++)
+	{
+		done[num_done++] = forward_jmp(code);
+		patch_jump(body[i], code->cur);
+		if (size == OPSIZE_LONG) {
+			//same order of word writes as write_32_lowfirst and write_32_highfirst
+			push_r(code, adr);
+			push_r(code, value);
+			if (lowfirst) {
+				add_ir(code, 2, adr, SZ_D);
+			} else {
+				shr_ir(code, 16, value, SZ_D);
+			}
+			direct_store(opts, chunks[i], SZ_W);
+			mov_rdispr(code, RSP, sizeof(void *), adr, SZ_PTR);
+			mov_rdispr(code, RSP, 0, value, SZ_PTR);
+			if (lowfirst) {
+				shr_ir(code, 16, value, SZ_D);
+			} else {
+				add_ir(code, 2, adr, SZ_D);
+			}
+			direct_store(opts, chunks[i], SZ_W);
+			pop_r(code, value);
+			pop_r(code, adr);
+		} else {
+			direct_store(opts, chunks[i], size == OPSIZE_BYTE ? SZ_B : SZ_W);
+		}
+	}
+	for (uint32_t i = 0; i < num_done; i++)
+	{
+		patch_jump(done[i], code->cur);
+	}
+	return 1;
 }
 
 uint8_t translate_m68k_op(m68kinst * inst, host_ea * ea, m68k_options * opts, uint8_t dst)
@@ -559,7 +894,7 @@ void check_user_mode_swap_ssp_usp(m68k_options *opts)
 	code_ptr end_off = code->cur + 1;
 	jcc(code, CC_C, code->cur + 2);
 	swap_ssp_usp(opts);
-	*end_off = code->cur - (end_off + 1);
+	*code_writable(end_off) = code->cur - (end_off + 1);
 }
 
 void translate_m68k_move(m68k_options * opts, m68kinst * inst)
@@ -822,7 +1157,7 @@ void translate_m68k_bcc(m68k_options * opts, m68kinst * inst)
 	uint32_t after = inst->address + 2;
 	if (inst->extra.cond == COND_TRUE) {
 		cycles(&opts->gen, 10);
-		jump_m68k_abs(opts, after + disp);
+		jump_m68k_chain(opts, after + disp);
 	} else {
 		uint8_t cond = m68k_eval_cond(opts, inst->extra.cond);
 		code_ptr do_branch = code->cur + 1;
@@ -832,7 +1167,7 @@ void translate_m68k_bcc(m68k_options * opts, m68kinst * inst)
 		code_ptr done = code->cur + 1;
 		jmp(code, done);
 		
-		*do_branch = code->cur - (do_branch + 1);
+		*code_writable(do_branch) = code->cur - (do_branch + 1);
 		cycles(&opts->gen, 10);
 		code_ptr dest_addr = get_native_address(opts, after + disp);
 		if (!dest_addr) {
@@ -842,7 +1177,7 @@ void translate_m68k_bcc(m68k_options * opts, m68kinst * inst)
 		}
 		jmp(code, dest_addr);
 		
-		*done = code->cur - (done + 1);
+		*code_writable(done) = code->cur - (done + 1);
 	}
 }
 
@@ -877,14 +1212,14 @@ void translate_m68k_scc(m68k_options * opts, m68kinst * inst)
 		}
 		code_ptr end_off = code->cur+1;
 		jmp(code, code->cur+2);
-		*true_off = code->cur - (true_off+1);
+		*code_writable(true_off) = code->cur - (true_off+1);
 		cycles(&opts->gen, inst->dst.addr_mode == MODE_REG ? 6 : 4);
 		if (dst_op.mode == MODE_REG_DIRECT) {
 			mov_ir(code, 0xFF, dst_op.base, SZ_B);
 		} else {
 			mov_irdisp(code, 0xFF, dst_op.base, dst_op.disp, SZ_B);
 		}
-		*end_off = code->cur - (end_off+1);
+		*code_writable(end_off) = code->cur - (end_off+1);
 	}
 	m68k_save_result(inst, opts);
 }
@@ -914,10 +1249,10 @@ void translate_m68k_dbcc(m68k_options * opts, m68kinst * inst)
 	jcc(code, CC_Z, code->cur + 2);
 	uint32_t after = inst->address + 2;
 	jump_m68k_abs(opts, after + inst->src.params.immed);
-	*loop_end_loc = code->cur - (loop_end_loc+1);
+	*code_writable(loop_end_loc) = code->cur - (loop_end_loc+1);
 	if (skip_loc) {
 		cycles(&opts->gen, 2);
-		*skip_loc = code->cur - (skip_loc+1);
+		*code_writable(skip_loc) = code->cur - (skip_loc+1);
 		cycles(&opts->gen, 2);
 	} else {
 		cycles(&opts->gen, 4);
@@ -1031,6 +1366,10 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 	code_ptr end_off = NULL;
 	code_ptr nz_off = NULL;
 	code_ptr z_off = NULL;
+	if (!(opts->dead_flags & X)) {
+		//X is copied from the C flag register at the end
+		opts->dead_flags &= ~C;
+	}
 	if (inst->src.addr_mode == MODE_UNUSED) {
 		cycles(&opts->gen, BUS);
 		//Memory shift
@@ -1050,7 +1389,7 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 					code_ptr after_flag_set = code->cur + 1;
 					jcc(code, CC_NO, code->cur + 2);
 					set_flag(opts, 1, FLAG_V);
-					*after_flag_set = code->cur - (after_flag_set+1);
+					*code_writable(after_flag_set) = code->cur - (after_flag_set+1);
 				}
 			} else {
 				if (dst_op->mode == MODE_REG_DIRECT) {
@@ -1058,7 +1397,9 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 				} else {
 					shift_irdisp(code, src_op->disp, dst_op->base, dst_op->disp, inst->extra.size);
 				}
-				set_flag_cond(opts, CC_O, FLAG_V);
+				if (!skip_flag(opts, FLAG_V)) {
+					set_flag_cond(opts, CC_O, FLAG_V);
+				}
 			}
 		} else {
 			cycles(&opts->gen, inst->extra.size == OPSIZE_LONG ? 8 : 6);
@@ -1089,7 +1430,7 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 			}
 			z_off = code->cur + 1;
 			jmp(code, code->cur + 2);
-			*nz_off = code->cur - (nz_off + 1);
+			*code_writable(nz_off) = code->cur - (nz_off + 1);
 			//add 2 cycles for every bit shifted
 			mov_ir(code, 2 * opts->gen.clock_divider, opts->gen.scratch2, SZ_D);
 			imul_rr(code, RCX, opts->gen.scratch2, SZ_D);
@@ -1108,7 +1449,7 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 				code_ptr after_flag_set = code->cur + 1;
 				jcc(code, CC_NO, code->cur + 2);
 				set_flag(opts, 1, FLAG_V);
-				*after_flag_set = code->cur - (after_flag_set+1);
+				*code_writable(after_flag_set) = code->cur - (after_flag_set+1);
 				loop(code, loop_start);
 			} else {
 				//x86 shifts modulo 32 for operand sizes less than 64-bits
@@ -1132,11 +1473,11 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 						set_flag_cond(opts, CC_C, FLAG_C);
 						after_flag_set = code->cur + 1;
 						jmp(code, code->cur + 2);
-						*neq_32_off = code->cur - (neq_32_off+1);
+						*code_writable(neq_32_off) = code->cur - (neq_32_off+1);
 					}
 					set_flag(opts, 0, FLAG_C);
 					if (after_flag_set) {
-						*after_flag_set = code->cur - (after_flag_set+1);
+						*code_writable(after_flag_set) = code->cur - (after_flag_set+1);
 					}
 					set_flag(opts, 1, FLAG_Z);
 					set_flag(opts, 0, FLAG_N);
@@ -1157,7 +1498,7 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 				}
 				end_off = code->cur + 1;
 				jmp(code, code->cur + 2);
-				*norm_shift_off = code->cur - (norm_shift_off+1);
+				*code_writable(norm_shift_off) = code->cur - (norm_shift_off+1);
 				if (dst_op->mode == MODE_REG_DIRECT) {
 					shift_clr(code, dst_op->base, inst->extra.size);
 				} else {
@@ -1168,22 +1509,23 @@ void translate_shift(m68k_options * opts, m68kinst * inst, host_ea *src_op, host
 
 	}
 	if (!special && end_off) {
-		*end_off = code->cur - (end_off + 1);
+		*code_writable(end_off) = code->cur - (end_off + 1);
 	}
 	update_flags(opts, C|Z|N);
 	if (special && end_off) {
-		*end_off = code->cur - (end_off + 1);
+		*code_writable(end_off) = code->cur - (end_off + 1);
 	}
 	//set X flag to same as C flag
-	if (opts->flag_regs[FLAG_C] >= 0) {
+	if (skip_flag(opts, FLAG_X)) {
+	} else if (opts->flag_regs[FLAG_C] >= 0) {
 		flag_to_flag(opts, FLAG_C, FLAG_X);
 	} else {
 		set_flag_cond(opts, CC_C, FLAG_X);
 	}
 	if (z_off) {
-		*z_off = code->cur - (z_off + 1);
+		*code_writable(z_off) = code->cur - (z_off + 1);
 	}
-	if (inst->op != M68K_ASL) {
+	if (inst->op != M68K_ASL && !skip_flag(opts, FLAG_V)) {
 		set_flag(opts, 0, FLAG_V);
 	}
 	if (inst->src.addr_mode == MODE_UNUSED) {
@@ -1202,7 +1544,7 @@ void translate_m68k_reset(m68k_options *opts, m68kinst *inst)
 	call_args_r(code, opts->gen.scratch1, 1, opts->gen.context_reg);
 	mov_rr(code, RAX, opts->gen.context_reg, SZ_PTR);
 	call(code, opts->gen.load_context);
-	*no_reset_handler = code->cur - (no_reset_handler + 1);
+	*code_writable(no_reset_handler) = code->cur - (no_reset_handler + 1);
 	//RESET instructions take a long time to give peripherals time to reset themselves
 	cycles(&opts->gen, 132);
 }
@@ -1358,7 +1700,7 @@ void translate_m68k_arith(m68k_options *opts, m68kinst * inst, uint32_t flag_mas
 			code_ptr after_flag_set = code->cur + 1;
 			jcc(code, CC_Z, code->cur + 2);
 			set_flag(opts, 0, FLAG_Z);
-			*after_flag_set = code->cur - (after_flag_set+1);
+			*code_writable(after_flag_set) = code->cur - (after_flag_set+1);
 		}
 	}
 	if (inst->op != M68K_CMP) {
@@ -1532,9 +1874,9 @@ void translate_m68k_abcd_sbcd(m68k_options *opts, m68kinst *inst, host_ea *src_o
 	code_ptr after_adjust = code->cur+1;
 	jmp(code, after_adjust);
 
-	*no_adjust = code->cur - (no_adjust+1);
+	*code_writable(no_adjust) = code->cur - (no_adjust+1);
 	xor_rr(code, opts->gen.scratch1 + (AH-RAX), opts->gen.scratch1 + (AH-RAX), SZ_B);
-	*after_adjust = code->cur - (after_adjust+1);
+	*code_writable(after_adjust) = code->cur - (after_adjust+1);
 
 	//do op on full byte
 	flag_to_carry(opts, FLAG_X);
@@ -1555,10 +1897,10 @@ void translate_m68k_abcd_sbcd(m68k_options *opts, m68kinst *inst, host_ea *src_o
 		no_adjust = code->cur+1;
 		jcc(code, CC_B, no_adjust);
 	}
-	*def_adjust = code->cur - (def_adjust + 1);
+	*code_writable(def_adjust) = code->cur - (def_adjust + 1);
 	set_flag(opts, 1, FLAG_C);
 	or_ir(code, 0x60, opts->gen.scratch1 + (AH-RAX), SZ_B);
-	*no_adjust = code->cur - (no_adjust+1);
+	*code_writable(no_adjust) = code->cur - (no_adjust+1);
 	if (inst->op == M68K_ABCD) {
 		add_rr(code, opts->gen.scratch1 + (AH-RAX), opts->gen.scratch1, SZ_B);
 	} else {
@@ -1567,7 +1909,7 @@ void translate_m68k_abcd_sbcd(m68k_options *opts, m68kinst *inst, host_ea *src_o
 	code_ptr no_ensure_carry = code->cur+1;
 	jcc(code, CC_NC, no_ensure_carry);
 	set_flag(opts, 1, FLAG_C);
-	*no_ensure_carry = code->cur - (no_ensure_carry+1);
+	*code_writable(no_ensure_carry) = code->cur - (no_ensure_carry+1);
 	//restore RAX if necessary
 	if (opts->gen.scratch2 > RBX) {
 		mov_rr(code, opts->gen.scratch2, RAX, SZ_D);
@@ -1583,7 +1925,7 @@ void translate_m68k_abcd_sbcd(m68k_options *opts, m68kinst *inst, host_ea *src_o
 	code_ptr no_setz = code->cur+1;
 	jcc(code, CC_Z, no_setz);
 	set_flag(opts, 0, FLAG_Z);
-	*no_setz = code->cur - (no_setz + 1);
+	*code_writable(no_setz) = code->cur - (no_setz + 1);
 	if (dst_op->base != opts->gen.scratch1) {
 		if (dst_op->mode == MODE_REG_DIRECT) {
 			mov_rr(code, opts->gen.scratch1, dst_op->base, SZ_B);
@@ -1719,13 +2061,13 @@ void translate_m68k_chk(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 	}
 	//make sure we won't start a new chunk in the middle of these branches
 	check_alloc_code(code, MAX_INST_LEN * 11);
-	code_ptr passed = code->cur + 1;
-	jcc(code, CC_GE, code->cur + 2);
+	cold_path trap;
+	cold_path_start(opts, &trap, CC_L);
 	set_flag(opts, 1, FLAG_N);
 	mov_ir(code, VECTOR_CHK, opts->gen.scratch2, SZ_D);
 	mov_ir(code, inst->address+isize, opts->gen.scratch1, SZ_D);
 	jmp(code, opts->trap);
-	*passed = code->cur - (passed+1);
+	cold_path_end(opts, &trap, 0);
 	if (dst_op->mode == MODE_REG_DIRECT) {
 		if (src_op->mode == MODE_REG_DIRECT) {
 			cmp_rr(code, src_op->base, dst_op->base, inst->extra.size);
@@ -1741,13 +2083,12 @@ void translate_m68k_chk(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 			cmp_irdisp(code, src_op->disp, dst_op->base, dst_op->disp, inst->extra.size);
 		}
 	}
-	passed = code->cur + 1;
-	jcc(code, CC_LE, code->cur + 2);
+	cold_path_start(opts, &trap, CC_G);
 	set_flag(opts, 0, FLAG_N);
 	mov_ir(code, VECTOR_CHK, opts->gen.scratch2, SZ_D);
 	mov_ir(code, inst->address+isize, opts->gen.scratch1, SZ_D);
 	jmp(code, opts->trap);
-	*passed = code->cur - (passed+1);
+	cold_path_end(opts, &trap, 0);
 	cycles(&opts->gen, 4);
 }
 
@@ -1892,8 +2233,8 @@ void translate_m68k_div(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 		shl_ir(code, 16, opts->gen.scratch1, SZ_D);
 	}
 	cmp_ir(code, 0, opts->gen.scratch1, SZ_D);
-	code_ptr not_zero = code->cur+1;
-	jcc(code, CC_NZ, not_zero);
+	cold_path zero;
+	cold_path_start(opts, &zero, CC_Z);
 	
 	//TODO: Check that opts->trap includes the cycles conumed by the first trap0 microinstruction
 	cycles(&opts->gen, 4);
@@ -1917,8 +2258,8 @@ void translate_m68k_div(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 	mov_ir(code, VECTOR_INT_DIV_ZERO, opts->gen.scratch2, SZ_D);
 	mov_ir(code, inst->address+isize, opts->gen.scratch1, SZ_D);
 	jmp(code, opts->trap);
+	cold_path_end(opts, &zero, 0);
 	
-	*not_zero = code->cur - (not_zero + 1);
 	code_ptr end = NULL;
 	if (inst->op == M68K_DIVU) {
 		//initial overflow check needs to be done in the C code for divs
@@ -1933,7 +2274,7 @@ void translate_m68k_div(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 		end = code->cur+1;
 		jmp(code, end);
 		
-		*not_overflow = code->cur - (not_overflow + 1);
+		*code_writable(not_overflow) = code->cur - (not_overflow + 1);
 	}
 	call(code, opts->gen.save_context);
 	push_r(code, opts->gen.context_reg);
@@ -1955,7 +2296,7 @@ void translate_m68k_div(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 		mov_rrdisp(code, opts->gen.scratch1, dst_op->base, dst_op->disp, SZ_D);
 	}
 	if (end) {
-		*end = code->cur - (end + 1);
+		*code_writable(end) = code->cur - (end + 1);
 	}
 }
 
@@ -2101,7 +2442,7 @@ void translate_m68k_negx(m68k_options *opts, m68kinst *inst, host_ea *src_op, ho
 	code_ptr after_flag_set = code->cur + 1;
 	jcc(code, CC_Z, code->cur + 2);
 	set_flag(opts, 0, FLAG_Z);
-	*after_flag_set = code->cur - (after_flag_set+1);
+	*code_writable(after_flag_set) = code->cur - (after_flag_set+1);
 	set_flag_cond(opts, CC_S, FLAG_N);
 	set_flag_cond(opts, CC_O, FLAG_V);
 	if (opts->flag_regs[FLAG_C] >= 0) {
@@ -2177,10 +2518,10 @@ void translate_m68k_rot(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 			if (inst->op == M68K_ROXR || inst->op == M68K_ROXL) {
 				set_flag_cond(opts, CC_C, FLAG_X);
 				sub_ir(code, 32, opts->gen.scratch1, SZ_B);
-				*norm_off = code->cur - (norm_off+1);
+				*code_writable(norm_off) = code->cur - (norm_off+1);
 				flag_to_carry(opts, FLAG_X);
 			} else {
-				*norm_off = code->cur - (norm_off+1);
+				*code_writable(norm_off) = code->cur - (norm_off+1);
 			}
 			if (dst_op->mode == MODE_REG_DIRECT) {
 				op_r(code, inst, dst_op->base, inst->extra.size);
@@ -2190,14 +2531,14 @@ void translate_m68k_rot(m68k_options *opts, m68kinst *inst, host_ea *src_op, hos
 			update_flags(opts, init_flags);
 			code_ptr end_off = code->cur + 1;
 			jmp(code, code->cur + 2);
-			*zero_off = code->cur - (zero_off+1);
+			*code_writable(zero_off) = code->cur - (zero_off+1);
 			if (inst->op == M68K_ROXR || inst->op == M68K_ROXL) {
 				//Carry flag is set to X flag when count is 0, this is different from ROR/ROL
 				flag_to_flag(opts, FLAG_X, FLAG_C);
 			} else {
 				set_flag(opts, 0, FLAG_C);
 			}
-			*end_off = code->cur - (end_off+1);
+			*code_writable(end_off) = code->cur - (end_off+1);
 		}
 		if (dst_op->mode == MODE_REG_DIRECT) {
 			cmp_ir(code, 0, dst_op->base, inst->extra.size);
@@ -2215,14 +2556,14 @@ void m68k_trap_if_not_supervisor(m68k_options *opts, m68kinst *inst)
 	code_info *code = &opts->gen.code;
 	//check supervisor bit in SR and trap if not in supervisor mode
 	bt_irdisp(code, BIT_SUPERVISOR, opts->gen.context_reg, offsetof(m68k_context, status), SZ_B);
-	code_ptr in_sup_mode = code->cur + 1;
-	jcc(code, CC_C, code->cur + 2);
+	cold_path trap;
+	cold_path_start(opts, &trap, CC_NC);
 	
 	ldi_native(opts, VECTOR_PRIV_VIOLATION, opts->gen.scratch2);
 	ldi_native(opts, inst->address, opts->gen.scratch1);
 	jmp(code, opts->trap);
 	
-	*in_sup_mode = code->cur - (in_sup_mode + 1);
+	cold_path_end(opts, &trap, 0);
 }
 
 void translate_m68k_andi_ori_ccr_sr(m68k_options *opts, m68kinst *inst)
@@ -2367,9 +2708,9 @@ void translate_m68k_stop(m68k_options *opts, m68kinst *inst)
 			cycles(&opts->gen, BUS);
 			code_ptr after_cycle_up = code->cur + 1;
 			jmp(code, code->cur + 2);
-		*normal_cycle_up = code->cur - (normal_cycle_up + 1);
+		*code_writable(normal_cycle_up) = code->cur - (normal_cycle_up + 1);
 			mov_rr(code, opts->gen.limit, opts->gen.cycles, SZ_D);
-		*after_cycle_up = code->cur - (after_cycle_up+1);
+		*code_writable(after_cycle_up) = code->cur - (after_cycle_up+1);
 		cmp_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, int_cycle), opts->gen.cycles, SZ_D);
 	jcc(code, CC_C, loop_top);
 	//set int pending flag so interrupt fires immediately after stop is done
@@ -2381,12 +2722,12 @@ void translate_m68k_trapv(m68k_options *opts, m68kinst *inst)
 	code_info *code = &opts->gen.code;
 	cycles(&opts->gen, BUS);
 	flag_to_carry(opts, FLAG_V);
-	code_ptr no_trap = code->cur + 1;
-	jcc(code, CC_NC, no_trap);
+	cold_path trap;
+	cold_path_start(opts, &trap, CC_C);
 	ldi_native(opts, VECTOR_TRAPV, opts->gen.scratch2);
 	ldi_native(opts, inst->address+2, opts->gen.scratch1);
 	jmp(code, opts->trap);
-	*no_trap = code->cur - (no_trap + 1);
+	cold_path_end(opts, &trap, 0);
 }
 
 void translate_m68k_odd(m68k_options *opts, m68kinst *inst)
@@ -2482,7 +2823,7 @@ void nop_fill_or_jmp_next(code_info *code, code_ptr old_end, code_ptr next_inst)
 {
 	if (next_inst == old_end && next_inst - code->cur < 2) {
 		while (code->cur < old_end) {
-			*(code->cur++) = 0x90; //NOP
+			*code_writable(code->cur++) = 0x90; //NOP
 		}
 	} else {
 		jmp(code, next_inst);
@@ -2491,9 +2832,30 @@ void nop_fill_or_jmp_next(code_info *code, code_ptr old_end, code_ptr next_inst)
 
 #define M68K_MAX_INST_SIZE (2*(1+2+2))
 
+//an instruction that starts this far before a page can still have code in it
+#define M68K_PAGE_OVERLAP (M68K_MAX_INST_SIZE - 2)
+
+static void invalidate_page(m68k_context *context, code_page *page)
+{
+	cpu_options *opts = &context->options->gen;
+	uint32_t start = page->address - M68K_PAGE_OVERLAP;
+	if (find_map_chunk(start, opts, 0, NULL) != find_map_chunk(page->address, opts, 0, NULL)) {
+		start = page->address;
+	}
+	m68k_invalidate_code_range(context, start, page->address + (1 << opts->ram_flags_shift) - 1);
+}
+
 m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context)
 {
 	m68k_options * options = context->options;
+	code_page *page = code_page_write(&options->gen, address);
+	if (page) {
+		//the code in the page is translated again with checks, until then writes can go through
+		uint32_t index = page - options->gen.code_pages;
+		context->ram_code_flags[index / 8] &= ~(1 << (index % 8));
+		invalidate_page(context, page);
+		return context;
+	}
 	uint32_t inst_start = get_instruction_start(options, address);
 	while (inst_start && (address - inst_start) < M68K_MAX_INST_SIZE) {
 		code_ptr dst = get_native_address(context->options, inst_start);
@@ -2503,6 +2865,17 @@ m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context)
 	return context;
 }
 
+static void leave_checked_page(void *context, code_page *page)
+{
+	//translated again without checks, which sets the page's ram_code_flags bit again
+	invalidate_page(context, page);
+}
+
+void m68k_code_pages_frame(m68k_context *context)
+{
+	code_pages_frame(&context->options->gen, context, leave_checked_page);
+}
+
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end)
 {
 	m68k_options *opts = context->options;
@@ -2556,15 +2929,128 @@ void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_h
 	native.last = native.cur + 128;
 	native.stack_off = 0;
 	code_ptr start_native = native.cur;
+	if (opts->gen.cold_code.cur) {
+		//the check at the start is too short for the patch, it jumps to a copy of it in cold_code instead
+		code_info *cold = &opts->gen.cold_code;
+		check_alloc_code(cold, 3*MAX_INST_LEN);
+		code_ptr patch = cold->cur;
+		cold->stack_off = 0;
+		mov_ir(cold, address, opts->gen.scratch1, SZ_D);
+		call(cold, opts->bp_stub);
+		jmp(cold, start_native + opts->gen.prologue_size);
+		code_cache_count_cold(&opts->gen, cold->cur - patch);
+		jmp(&native, patch);
+		return;
+	}
 	mov_ir(&native, address, opts->gen.scratch1, SZ_D);
 	
 	
 	call(&native, opts->bp_stub);
 }
 
-void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider)
+//picks the chunks of the memory map that translated code accesses inline, they have to be plain buffers
+//that no earlier chunk overlaps since gen_mem_fun uses the first chunk an address is in. The offsets of
+//the code flags and dirty bits of chunks with MMAP_CODE are found the same way as in gen_mem_fun
+static void find_direct_chunks(m68k_options *opts, memmap_chunk const *memmap, uint32_t num_chunks)
+{
+	code_info *code = &opts->gen.code;
+	uint32_t ram_flags_off = opts->gen.ram_flags_off, ram_dirty_off = opts->gen.ram_dirty_off;
+	for (uint32_t i = 0; i < num_chunks && opts->num_direct < NUM_DIRECT_CHUNKS; i++)
+	{
+		memmap_chunk const *chunk = memmap + i;
+		uint8_t overlapped = 0;
+		for (uint32_t j = 0; j < i; j++)
+		{
+			if (memmap[j].start < chunk->end && memmap[j].end > chunk->start) {
+				overlapped = 1;
+			}
+		}
+		if (
+			!overlapped && chunk->buffer && chunk->start < chunk->end && (chunk->flags & (MMAP_READ | MMAP_WRITE))
+			&& !(chunk->flags & (MMAP_PTR_IDX | MMAP_ONLY_ODD | MMAP_ONLY_EVEN | MMAP_FUNC_NULL))
+		) {
+			direct_chunk *direct = opts->direct + opts->num_direct++;
+			direct->buffer = chunk->buffer;
+			direct->start = chunk->start;
+			direct->end = chunk->end;
+			direct->mask = chunk->mask;
+			direct->flags = chunk->flags;
+			direct->ram_flags_off = ram_flags_off;
+			direct->ram_dirty_off = ram_dirty_off;
+			if ((chunk->flags & (MMAP_WRITE | MMAP_CODE)) == (MMAP_WRITE | MMAP_CODE)) {
+				direct->code_write = code->cur;
+				if (chunk->mask != opts->gen.address_mask) {
+					or_ir(code, chunk->start, opts->gen.scratch2, SZ_D);
+				}
+				call(code, opts->gen.save_context);
+				call_args(code, opts->gen.handle_code_write, 2, opts->gen.scratch2, opts->gen.context_reg);
+				mov_rr(code, RAX, opts->gen.context_reg, SZ_PTR);
+				jmp(code, opts->gen.load_context);
+			}
+		}
+		if (chunk->flags & MMAP_CODE) {
+			if (chunk->mask == opts->gen.address_mask) {
+				ram_flags_off += (chunk->end - chunk->start) / (1 << opts->gen.ram_flags_shift) / 8;
+				ram_dirty_off += (chunk->end - chunk->start) >> (RAM_DIRTY_SHIFT + 3);
+			} else {
+				ram_flags_off += (chunk->mask + 1) / (1 << opts->gen.ram_flags_shift) / 8;
+				ram_dirty_off += (chunk->mask + 1) >> (RAM_DIRTY_SHIFT + 3);
+			}
+		}
+	}
+}
+
+#ifdef X86_64
+//hands the host registers of the default mapping to the 7 registers other than a7 that the code in ROM
+//uses the most. A register that keeps one keeps the same one so a ROM without a clear preference, or
+//one that isn't in ROM at all, ends up with the default mapping
+static void allocate_m68k_regs(m68k_options *opts)
+{
+	uint32_t weights[16];
+	m68k_rank_registers(opts, weights);
+	int8_t *regs[15];
+	uint8_t chosen[15] = {0};
+	for (int i = 0; i < 15; i++)
+	{
+		regs[i] = i < 8 ? opts->dregs + i : opts->aregs + i - 8;
+	}
+	for (int num_chosen = 0; num_chosen < 7; num_chosen++)
+	{
+		int best = -1;
+		for (int i = 0; i < 15; i++)
+		{
+			if (!chosen[i] && (
+				best < 0 || weights[i] > weights[best]
+				|| (weights[i] == weights[best] && *regs[i] >= 0 && *regs[best] < 0)
+			)) {
+				best = i;
+			}
+		}
+		chosen[best] = 1;
+	}
+	int8_t free_regs[7];
+	int num_free = 0;
+	for (int i = 0; i < 15; i++)
+	{
+		if (!chosen[i] && *regs[i] >= 0) {
+			free_regs[num_free++] = *regs[i];
+			*regs[i] = -1;
+		}
+	}
+	for (int i = 0; i < 15; i++)
+	{
+		if (chosen[i] && *regs[i] < 0) {
+			*regs[i] = free_regs[--num_free];
+		}
+	}
+}
+#endif
+
+void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chunks, uint32_t clock_divider, uint32_t flags)
 {
 	memset(opts, 0, sizeof(*opts));
+	opts->gen.flags = flags;
+	opts->gen.split_cold = (flags & M68K_OPT_COLD_CODE) != 0;
 	opts->gen.memmap = memmap;
 	opts->gen.memmap_chunks = num_chunks;
 	opts->gen.address_size = SZ_D;
@@ -2576,6 +3062,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	opts->gen.mem_ptr_off = offsetof(m68k_context, mem_pointers);
 	opts->gen.ram_flags_off = offsetof(m68k_context, ram_code_flags);
 	opts->gen.ram_flags_shift = 11;
+	opts->gen.ram_dirty_off = opts->gen.ram_flags_off + ram_size(&opts->gen) / (1 << opts->gen.ram_flags_shift) / 8;
 	for (int i = 0; i < 8; i++)
 	{
 		opts->dregs[i] = opts->aregs[i] = -1;
@@ -2589,6 +3076,9 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	opts->aregs[1] = R14;
 	opts->aregs[2] = R9;
 	opts->aregs[7] = R15;
+	if (flags & M68K_OPT_ALLOC_REGS) {
+		allocate_m68k_regs(opts);
+	}
 
 	opts->flag_regs[0] = -1;
 	opts->flag_regs[1] = RBX;
@@ -2621,6 +3111,8 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	uint32_t inst_size_size = sizeof(uint8_t *) * ram_size(&opts->gen) / 1024;
 	opts->gen.ram_inst_sizes = malloc(inst_size_size);
 	memset(opts->gen.ram_inst_sizes, 0, inst_size_size);
+	code_pages_init(&opts->gen);
+	m68k_clear_target_cache(opts);
 
 	code_info *code = &opts->gen.code;
 	init_code_info(code);
@@ -2682,9 +3174,21 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	retn(code);
 
 	opts->native_addr = code->cur;
+	//check the target cache entry for the address in scratch1 first, entries are 16 bytes
+	mov_rr(code, opts->gen.scratch1, opts->gen.scratch2, SZ_D);
+	and_ir(code, (TARGET_CACHE_SIZE - 1) << 1, opts->gen.scratch2, SZ_D);
+	shl_ir(code, 3, opts->gen.scratch2, SZ_D);
+	add_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, options), opts->gen.scratch2, SZ_PTR);
+	cmp_rdispr(code, opts->gen.scratch2, offsetof(m68k_options, target_cache) + offsetof(target_cache_entry, address), opts->gen.scratch1, SZ_D);
+	code_ptr target_miss = code->cur + 1;
+	jcc(code, CC_NZ, code->cur + 2);
+	add_irdisp(code, 1, opts->gen.scratch2, offsetof(m68k_options, target_cache) + offsetof(target_cache_entry, hits), SZ_D);
+	mov_rdispr(code, opts->gen.scratch2, offsetof(m68k_options, target_cache) + offsetof(target_cache_entry, native), opts->gen.scratch1, SZ_PTR);
+	retn(code);
+	*code_writable(target_miss) = code->cur - (target_miss + 1);
 	call(code, opts->gen.save_context);
 	push_r(code, opts->gen.context_reg);
-	call_args(code, (code_ptr)get_native_address_trans, 2, opts->gen.context_reg, opts->gen.scratch1);
+	call_args(code, (code_ptr)get_native_address_cached, 2, opts->gen.context_reg, opts->gen.scratch1);
 	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR); //move result to scratch reg
 	pop_r(code, opts->gen.context_reg);
 	call(code, opts->gen.load_context);
@@ -2718,7 +3222,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	call(code, opts->gen.load_context);
 	pop_r(code, opts->gen.scratch2);
 	pop_r(code, opts->gen.scratch1);
-	*skip_sync = code->cur - (skip_sync+1);
+	*code_writable(skip_sync) = code->cur - (skip_sync+1);
 	retn(code);
 
 	opts->gen.handle_code_write = (code_ptr)m68k_handle_code_write;
@@ -2730,6 +3234,9 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	opts->gen.handle_align_error_read = code->cur;
 	code->cur += 256;
 	
+	if (flags & M68K_OPT_DIRECT_MEM) {
+		find_direct_chunks(opts, memmap, num_chunks);
+	}
 	opts->read_16 = gen_mem_fun(&opts->gen, memmap, num_chunks, READ_16, NULL);
 	opts->read_8 = gen_mem_fun(&opts->gen, memmap, num_chunks, READ_8, NULL);
 	opts->write_16 = gen_mem_fun(&opts->gen, memmap, num_chunks, WRITE_16, NULL);
@@ -2971,7 +3478,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	code_ptr no_trace = code->cur + 1;
 	jcc(code, CC_NC, no_trace);
 	mov_irdisp(code, 1, opts->gen.context_reg, offsetof(m68k_context, trace_pending), SZ_B);
-	*no_trace = code->cur - (no_trace + 1);
+	*code_writable(no_trace) = code->cur - (no_trace + 1);
 	//handle interrupts
 	cmp_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, int_cycle), opts->gen.cycles, SZ_D);
 	code_ptr do_int = code->cur + 2; 
@@ -2984,13 +3491,15 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	call_args_abi(code, (code_ptr)sync_components, 2, opts->gen.context_reg, opts->gen.scratch1);
 	mov_rr(code, RAX, opts->gen.context_reg, SZ_PTR);
 	jmp(code, opts->gen.load_context);
-	*skip_sync = code->cur - (skip_sync+1);
+	*code_writable(skip_sync) = code->cur - (skip_sync+1);
 	cmp_irdisp(code, 0, opts->gen.context_reg, offsetof(m68k_context, should_return), SZ_B);
 	code_ptr do_ret = code->cur + 1;
 	jcc(code, CC_NZ, do_ret);
 	retn(code);
-	*do_ret = code->cur - (do_ret+1);
+	*code_writable(do_ret) = code->cur - (do_ret+1);
 	uint32_t tmp_stack_off = code->stack_off;
+	//scratch1 still holds the address of the instruction that called us
+	mov_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, offsetof(m68k_context, resume_address), SZ_D);
 	//fetch return address and adjust RSP
 	pop_r(code, opts->gen.scratch1);
 	add_ir(code, 16-sizeof(void *), RSP, SZ_PTR);
@@ -2999,7 +3508,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	mov_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, offsetof(m68k_context, resume_pc), SZ_PTR);
 	retn(code);
 	code->stack_off = tmp_stack_off;
-	*do_trace = code->cur - (do_trace + 1);
+	*code_writable(do_trace) = code->cur - (do_trace + 1);
 	//clear out trace pending flag
 	mov_irdisp(code, 0, opts->gen.context_reg, offsetof(m68k_context, trace_pending), SZ_B);
 	//save PC as stored in scratch1 for later
@@ -3034,7 +3543,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	
 	code->stack_off = tmp_stack_off;
 	
-	*((uint32_t *)do_int) = code->cur - (do_int+4);
+	*((uint32_t *)code_writable(do_int)) = code->cur - (do_int+4);
 	//implement 1 instruction latency
 	cmp_irdisp(code, INT_PENDING_NONE, opts->gen.context_reg, offsetof(m68k_context, int_pending), SZ_B);
 	do_int = code->cur + 1;
@@ -3043,7 +3552,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	mov_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, int_num), opts->gen.scratch1, SZ_B);
 	mov_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, offsetof(m68k_context, int_pending), SZ_B);
 	retn(code);
-	*do_int = code->cur - (do_int + 1);
+	*code_writable(do_int) = code->cur - (do_int + 1);
 	//Check if int_pending has an actual interrupt priority in it
 	cmp_irdisp(code, INT_PENDING_SR_CHANGE, opts->gen.context_reg, offsetof(m68k_context, int_pending), SZ_B);
 	code_ptr already_int_num = code->cur + 1;
@@ -3052,7 +3561,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	mov_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, int_num), opts->gen.scratch2, SZ_B);
 	mov_rrdisp(code, opts->gen.scratch2, opts->gen.context_reg, offsetof(m68k_context, int_pending), SZ_B);
 	
-	*already_int_num = code->cur - (already_int_num + 1);
+	*code_writable(already_int_num) = code->cur - (already_int_num + 1);
 	//save PC as stored in scratch1 for later
 	push_r(code, opts->gen.scratch1);
 	//set target cycle to sync cycle
@@ -3139,12 +3648,12 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	code_ptr do_latch = code->cur + 1; 
 	jcc(code, CC_NC, do_latch);
 	retn(code);
-	*do_latch = code->cur - (do_latch + 1);
+	*code_writable(do_latch) = code->cur - (do_latch + 1);
 	cmp_irdisp(code, INT_PENDING_NONE, opts->gen.context_reg, offsetof(m68k_context, int_pending), SZ_B);
 	do_latch = code->cur + 1;
 	jcc(code, CC_Z, do_latch);
 	retn(code);
-	*do_latch = code->cur - (do_latch + 1);
+	*code_writable(do_latch) = code->cur - (do_latch + 1);
 	//store current interrupt number so it doesn't change before we start processing the vector
 	push_r(code, opts->gen.scratch1);
 	mov_rdispr(code, opts->gen.context_reg, offsetof(m68k_context, int_num), opts->gen.scratch1, SZ_B);
@@ -3218,12 +3727,18 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	code_ptr jmp_off = code->cur + 1;
 	jcc(code, CC_NC, code->cur + 7);
 	call(code, opts->gen.handle_cycle_limit_int);
-	*jmp_off = code->cur - (jmp_off+1);
-	//jump back to body of translated instruction
-	pop_r(code, opts->gen.scratch1);
-	add_ir(code, check_int_size - patch_size, opts->gen.scratch1, SZ_PTR);
-	jmp_r(code, opts->gen.scratch1);
+	*code_writable(jmp_off) = code->cur - (jmp_off+1);
+	if (opts->gen.split_cold) {
+		//the patch in cold_code jumps back to the body itself
+		retn(code);
+	} else {
+		//jump back to body of translated instruction
+		pop_r(code, opts->gen.scratch1);
+		add_ir(code, check_int_size - patch_size, opts->gen.scratch1, SZ_PTR);
+		jmp_r(code, opts->gen.scratch1);
+	}
 	code->stack_off = tmp_stack_off;
 	
 	retranslate_calc(&opts->gen);
+	code_cache_init(&opts->gen);
 }
@@ -8,6 +8,14 @@
 
 #include "68kinst.h"
 
+//locations in the check emitted by m68k_batch_check that are filled in by m68k_batch_patch
+typedef struct {
+	code_ptr cycles;
+	code_ptr bp_jump;
+	code_ptr limit_jump;
+	uint32_t last_start; //cycles from the start of the batch to the start of its last instruction
+} batch_check;
+
 //functions implemented in host CPU specfic file
 void translate_out_of_bounds(m68k_options *opts, uint32_t address);
 void areg_to_native(m68k_options *opts, uint8_t reg, uint8_t native_reg);
@@ -37,7 +45,11 @@ void translate_m68k_odd(m68k_options *opts, m68kinst *inst);
 void m68k_trap_if_not_supervisor(m68k_options *opts, m68kinst *inst);
 void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_handler bp_handler, code_ptr native_addr);
 void m68k_check_cycles_int_latch(m68k_options *opts);
+void m68k_batch_check(m68k_options *opts, batch_check *check);
+void m68k_batch_patch(m68k_options *opts, batch_check *check, code_ptr slow);
 uint8_t translate_m68k_op(m68kinst * inst, host_ea * ea, m68k_options * opts, uint8_t dst);
+uint8_t m68k_direct_read(m68k_options *opts, uint8_t size);
+uint8_t m68k_direct_write(m68k_options *opts, uint8_t size, uint8_t lowfirst);
 
 //functions implemented in m68k_core.c
 int8_t native_reg(m68k_op_info * op, m68k_options * opts);
@@ -48,12 +60,16 @@ void m68k_read_size(m68k_options *opts, uint8_t size);
 void m68k_write_size(m68k_options *opts, uint8_t size, uint8_t lowfirst);
 void m68k_save_result(m68kinst * inst, m68k_options * opts);
 void jump_m68k_abs(m68k_options * opts, uint32_t address);
+void jump_m68k_chain(m68k_options * opts, uint32_t address);
 void swap_ssp_usp(m68k_options * opts);
 code_ptr get_native_address(m68k_options *opts, uint32_t address);
 uint8_t m68k_is_terminal(m68kinst * inst);
 code_ptr get_native_address_trans(m68k_context * context, uint32_t address);
+code_ptr get_native_address_cached(m68k_context * context, uint32_t address);
+void m68k_clear_target_cache(m68k_options *opts);
 void * m68k_retranslate_inst(uint32_t address, m68k_context * context);
 m68k_context *m68k_bp_dispatcher(m68k_context *context, uint32_t address);
+void m68k_rank_registers(m68k_options *opts, uint32_t *weights);
 
 //individual instructions
 void translate_m68k_bcc(m68k_options * opts, m68kinst * inst);
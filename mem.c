@@ -3,6 +3,12 @@
  This file is part of BlastEm.
  BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
 */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#endif
 #include <sys/mman.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,6 +16,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "mem.h"
 #include "arena.h"
@@ -21,11 +28,178 @@
 #define MAP_32BIT 0
 #endif
 
+//start at the 1GB mark to allow plenty of room for sbrk based malloc implementations
+//while still keeping well within 32-bit displacement range for calling code compiled into the executable
+#define CODE_START ((uint8_t *)0x40000000)
+
+uint8_t *code_region;
+size_t code_region_size;
+ptrdiff_t code_write_offset;
+
+//protects everything below, shared by all threads that translate code
+static pthread_mutex_t code_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef __linux__
+#define CODE_REGION_SIZE (512 * 1024 * 1024)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct free_range free_range;
+struct free_range {
+	uint8_t    *start;
+	size_t     size;
+	free_range *next;
+};
+
+static int code_fd = -1;
+static size_t region_used;
+static free_range *free_ranges;
+
+//maps a memfd once executable and once writable, code_region is left NULL if any step fails
+//each view is followed by a reserved guard page so that nothing else can be mapped at the address
+//one past its end, which code_writable and code_executable treat as belonging to the view
+static void init_code_region(void)
+{
+	code_fd = memfd_create("blastem code", MFD_CLOEXEC);
+	if (code_fd < 0) {
+		return;
+	}
+	if (ftruncate(code_fd, CODE_REGION_SIZE)) {
+		goto fail;
+	}
+	uint8_t *exec = mmap(CODE_START, CODE_REGION_SIZE + PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_32BIT, -1, 0);
+	if (exec == MAP_FAILED) {
+		goto fail;
+	}
+	if (mmap(exec, CODE_REGION_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, code_fd, 0) == MAP_FAILED) {
+		munmap(exec, CODE_REGION_SIZE + PAGE_SIZE);
+		goto fail;
+	}
+	//the writable view gets the same huge page alignment as the executable one
+	size_t reserved_size = CODE_REGION_SIZE + HUGE_PAGE_SIZE + PAGE_SIZE;
+	uint8_t *reserved = mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserved == MAP_FAILED) {
+		munmap(exec, CODE_REGION_SIZE + PAGE_SIZE);
+		goto fail;
+	}
+	uint8_t *aligned = (uint8_t *)(((uintptr_t)reserved + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	uint8_t *write = mmap(aligned, CODE_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, code_fd, 0);
+	if (write == MAP_FAILED) {
+		munmap(reserved, reserved_size);
+		munmap(exec, CODE_REGION_SIZE + PAGE_SIZE);
+		goto fail;
+	}
+	if (aligned > reserved) {
+		munmap(reserved, aligned - reserved);
+	}
+	uint8_t *guard_end = aligned + CODE_REGION_SIZE + PAGE_SIZE;
+	if (guard_end < reserved + reserved_size) {
+		munmap(guard_end, reserved + reserved_size - guard_end);
+	}
+#ifdef MADV_HUGEPAGE
+	//translated code is spread all over the cache, huge pages cut down on iTLB misses when the
+	//kernel is configured to back shared memory with them
+	madvise(exec, CODE_REGION_SIZE, MADV_HUGEPAGE);
+	madvise(write, CODE_REGION_SIZE, MADV_HUGEPAGE);
+#endif
+	code_write_offset = write - exec;
+	code_region_size = CODE_REGION_SIZE;
+	code_region = exec;
+	return;
+fail:
+	close(code_fd);
+	code_fd = -1;
+}
+
+static uint8_t *alloc_region(size_t size)
+{
+	static uint8_t tried;
+	if (!tried) {
+		tried = 1;
+		init_code_region();
+	}
+	if (!code_region) {
+		return NULL;
+	}
+	for (free_range **cur = &free_ranges; *cur; cur = &(*cur)->next)
+	{
+		free_range *range = *cur;
+		if (range->size >= size) {
+			uint8_t *ret = range->start;
+			range->start += size;
+			range->size -= size;
+			if (!range->size) {
+				*cur = range->next;
+				free(range);
+			}
+			return ret;
+		}
+	}
+	if (code_region_size - region_used < size) {
+		return NULL;
+	}
+	uint8_t *ret = code_region + region_used;
+	region_used += size;
+	return ret;
+}
+
+static uint8_t free_region(uint8_t *code, size_t size)
+{
+	if (!code_region || code < code_region || code >= code_region + code_region_size) {
+		return 0;
+	}
+	//give the memory back, the range reads as zeros until it is allocated again
+	fallocate(code_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, code - code_region, size);
+	//the ranges are kept sorted and merged with their neighbours so that repeated cache flushes
+	//don't leave the region in pieces too small for a full size allocation
+	free_range **link = &free_ranges, **prev_link = NULL;
+	while (*link && (*link)->start < code)
+	{
+		prev_link = link;
+		link = &(*link)->next;
+	}
+	free_range *prev = prev_link ? *prev_link : NULL;
+	uint8_t after_prev = prev && prev->start + prev->size == code;
+	if (code + size == code_region + region_used) {
+		//the used part of the region shrinks instead, along with a free range right before it
+		region_used -= size;
+		if (after_prev) {
+			region_used -= prev->size;
+			*prev_link = prev->next;
+			free(prev);
+		}
+		return 1;
+	}
+	if (after_prev) {
+		prev->size += size;
+	} else {
+		prev = malloc(sizeof(free_range));
+		prev->start = code;
+		prev->size = size;
+		prev->next = *link;
+		*link = prev;
+	}
+	free_range *next = prev->next;
+	if (next && prev->start + prev->size == next->start) {
+		prev->size += next->size;
+		prev->next = next->next;
+		free(next);
+	}
+	return 1;
+}
+#else
+static uint8_t *alloc_region(size_t size)
+{
+	return NULL;
+}
+
+static uint8_t free_region(uint8_t *code, size_t size)
+{
+	return 0;
+}
+#endif
+
 void * alloc_code(size_t *size)
 {
-	//start at the 1GB mark to allow plenty of room for sbrk based malloc implementations
-	//while still keeping well within 32-bit displacement range for calling code compiled into the executable
-	static uint8_t *next = (uint8_t *)0x40000000;
 	uint8_t *ret = try_alloc_arena();
 	if (ret) {
 		return ret;
@@ -33,13 +207,42 @@ void * alloc_code(size_t *size)
 	if (*size & (PAGE_SIZE -1)) {
 		*size += PAGE_SIZE - (*size & (PAGE_SIZE - 1));
 	}
-	ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
-	if (ret == MAP_FAILED) {
-		perror("alloc_code");
+	pthread_mutex_lock(&code_lock);
+	ret = alloc_region(*size);
+	if (!ret) {
+#if defined(__linux__) && !defined(ALLOW_RWX_CODE)
+		pthread_mutex_unlock(&code_lock);
+		fputs("alloc_code: the code region is unavailable or full and this build doesn't allow memory that is writable and executable at once\n", stderr);
 		return NULL;
+#else
+		static uint8_t *next = CODE_START;
+#ifdef __linux__
+		static uint8_t warned;
+		if (!warned) {
+			warned = 1;
+			fputs("alloc_code: the code region is unavailable or full, falling back to memory that is writable and executable at once\n", stderr);
+		}
+#endif
+		ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+		if (ret == MAP_FAILED) {
+			pthread_mutex_unlock(&code_lock);
+			perror("alloc_code");
+			return NULL;
+		}
+		next = ret + *size;
+#endif
 	}
+	pthread_mutex_unlock(&code_lock);
 	track_block(ret);
-	next = ret + *size;
 	return ret;
 }
 
+void free_code(void *code, size_t size)
+{
+	pthread_mutex_lock(&code_lock);
+	uint8_t in_region = free_region(code, size);
+	pthread_mutex_unlock(&code_lock);
+	if (!in_region) {
+		munmap(code, size);
+	}
+}
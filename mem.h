@@ -7,10 +7,39 @@
 #define MEM_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define PAGE_SIZE 4096
 
 void * alloc_code(size_t *size);
+void free_code(void *code, size_t size);
+
+//Where the host supports it, code buffers are mapped twice: translated code runs from a read-only
+//executable view and is written through a separate writable view of the same memory. Pointers to
+//code always refer to the executable view, anything that stores into code has to go through
+//code_writable first. Outside of code_region both functions return their argument unchanged.
+//The address one past the end of a view maps to one past the end of the other view, so a
+//pointer left at the end of an emission that filled the region still lands in the right view.
+//Nothing else can live at those addresses since each view is followed by a reserved guard page
+extern uint8_t *code_region;
+extern size_t code_region_size;
+extern ptrdiff_t code_write_offset;
+
+static inline uint8_t *code_writable(void *code)
+{
+	if ((uintptr_t)code - (uintptr_t)code_region <= code_region_size) {
+		return (uint8_t *)code + code_write_offset;
+	}
+	return code;
+}
+
+static inline uint8_t *code_executable(void *code)
+{
+	if ((uintptr_t)code - (uintptr_t)(code_region + code_write_offset) <= code_region_size) {
+		return (uint8_t *)code - code_write_offset;
+	}
+	return code;
+}
 
 #endif //MEM_H_
 
@@ -7,9 +7,19 @@
 #include "mem.h"
 #include <windows.h>
 
+//code is always mapped writable and executable at once here
+uint8_t *code_region;
+size_t code_region_size;
+ptrdiff_t code_write_offset;
+
 void * alloc_code(size_t *size)
 {
 	*size += PAGE_SIZE - (*size & (PAGE_SIZE - 1));
 
 	return VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
 }
+
+void free_code(void *code, size_t size)
+{
+	VirtualFree(code, 0, MEM_RELEASE);
+}
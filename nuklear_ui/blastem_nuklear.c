@@ -1802,16 +1802,27 @@ void view_audio_settings(struct nk_context *context)
 		"Zero Offset",
 		"Linear"
 	};
+	const char *resamplers[] = {
+		"linear",
+		"polyphase"
+	};
+	const char *resampler_desc[] = {
+		"Linear",
+		"Polyphase"
+	};
 	const uint32_t num_rates = sizeof(rates)/sizeof(*rates);
 	const uint32_t num_sizes = sizeof(sizes)/sizeof(*sizes);
 	const uint32_t num_dacs = sizeof(dac)/sizeof(*dac);
+	const uint32_t num_resamplers = sizeof(resamplers)/sizeof(*resamplers);
 	static int32_t selected_rate = -1;
 	static int32_t selected_size = -1;
 	static int32_t selected_dac = -1;
-	if (selected_rate < 0 || selected_size < 0 || selected_dac < 0) {
+	static int32_t selected_resampler = -1;
+	if (selected_rate < 0 || selected_size < 0 || selected_dac < 0 || selected_resampler < 0) {
 		selected_rate = find_match(rates, num_rates, "autio\0rate\0", "48000");
 		selected_size = find_match(sizes, num_sizes, "audio\0buffer\0", "512");
 		selected_dac = find_match(dac, num_dacs, "audio\0fm_dac\0", "zero_offset");
+		selected_resampler = find_match(resamplers, num_resamplers, "audio\0resampler\0", "linear");
 	}
 	uint32_t width = render_width();
 	uint32_t height = render_height();
@@ -1824,6 +1835,7 @@ void view_audio_settings(struct nk_context *context)
 		selected_rate = settings_dropdown(context, "Rate in Hz", rates, num_rates, selected_rate, "audio\0rate\0");
 		selected_size = settings_dropdown(context, "Buffer Samples", sizes, num_sizes, selected_size, "audio\0buffer\0");
 		settings_int_input(context, "Lowpass Cutoff Hz", "audio\0lowpass_cutoff\0", "3390");
+		selected_resampler = settings_dropdown_ex(context, "Resampler", resamplers, resampler_desc, num_resamplers, selected_resampler, "audio\0resampler\0");
 		settings_float_property(context, "Gain (dB)", "Overall", "audio\0gain\0", 0, -30.0f, 30.0f, 0.5f);
 		settings_float_property(context, "", "FM", "audio\0fm_gain\0", 0, -30.0f, 30.0f, 0.5f);
 		settings_float_property(context, "", "PSG", "audio\0psg_gain\0", 0, -30.0f, 30.0f, 0.5f);
@@ -183,3 +183,12 @@ void psg_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->latch = load_int8(buf);
 	context->cycles = load_int32(buf);
 }
+
+void psg_restore(psg_context *context, psg_context const *snapshot)
+{
+	audio_source *audio = context->audio;
+	vgm_writer *vgm = context->vgm;
+	*context = *snapshot;
+	context->audio = audio;
+	context->vgm = vgm;
+}
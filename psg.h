@@ -36,6 +36,7 @@ void psg_run(psg_context * context, uint32_t cycles);
 void psg_vgm_log(psg_context *context, uint32_t master_clock, vgm_writer *vgm);
 void psg_serialize(psg_context *context, serialize_buffer *buf);
 void psg_deserialize(deserialize_buffer *buf, void *vcontext);
+void psg_restore(psg_context *context, psg_context const *snapshot);
 
 #endif //PSG_CONTEXT_H_
 
@@ -7,22 +7,67 @@
 #include "config.h"
 #include "blastem.h"
 
-static uint8_t output_channels;
-static uint32_t buffer_samples, sample_rate;
+typedef void (*conv_func)(float *samples, void *vstream, int sample_count);
 
-static audio_source *audio_sources[8];
-static audio_source *inactive_audio_sources[8];
-static uint8_t num_audio_sources;
-static uint8_t num_inactive_audio_sources;
+struct render_audio_context {
+	audio_source *audio_sources[8];
+	audio_source *inactive_audio_sources[8];
+	float        *mix_buf;
+	void         *userdata;
+	conv_func    convert;
+	float        overall_gain_mult;
+	int          sample_size;
+	uint32_t     buffer_samples;
+	uint32_t     sample_rate;
+	uint32_t     sync_samples;
+	uint8_t      output_channels;
+	uint8_t      num_audio_sources;
+	uint8_t      num_inactive_audio_sources;
+	uint8_t      old_audio_sync;
+};
 
-static float overall_gain_mult, *mix_buf;
-static int sample_size;
+//the default context is used unless a frontend hosting multiple systems selects another one
+static render_audio_context default_context;
+static __thread render_audio_context *ctx = &default_context;
 
-typedef void (*conv_func)(float *samples, void *vstream, int sample_count);
+render_audio_context *render_audio_context_new(void)
+{
+	return calloc(1, sizeof(render_audio_context));
+}
+
+void render_audio_context_free(render_audio_context *context)
+{
+	if (context) {
+		free(context->mix_buf);
+		free(context);
+	}
+}
+
+render_audio_context *render_audio_set_context(render_audio_context *context)
+{
+	render_audio_context *old = ctx == &default_context ? NULL : ctx;
+	ctx = context ? context : &default_context;
+	return old;
+}
+
+render_audio_context *render_audio_get_context(void)
+{
+	return ctx == &default_context ? NULL : ctx;
+}
+
+void render_audio_set_userdata(void *userdata)
+{
+	ctx->userdata = userdata;
+}
+
+void *render_audio_get_userdata(void)
+{
+	return ctx->userdata;
+}
 
 static void convert_null(float *samples, void *vstream, int sample_count)
 {
-	memset(vstream, 0, sample_count * sample_size);
+	memset(vstream, 0, sample_count * ctx->sample_size);
 }
 
 static void convert_s16(float *samples, void *vstream, int sample_count)
@@ -64,8 +109,8 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 	uint32_t i = audio->read_start;
 	uint32_t i_end = audio->read_end;
 	float *cur = stream;
-	float gain_mult = audio->gain_mult * overall_gain_mult;
-	size_t first_add = output_channels > 1 ? 1 : 0, second_add = output_channels > 1 ? output_channels - 1 : 1;
+	float gain_mult = audio->gain_mult * ctx->overall_gain_mult;
+	size_t first_add = ctx->output_channels > 1 ? 1 : 0, second_add = ctx->output_channels > 1 ? ctx->output_channels - 1 : 1;
 	if (audio->num_channels == 1) {
 		while (cur < end && i != i_end)
 		{
@@ -96,26 +141,24 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 	}
 }
 
-static conv_func convert;
-
 
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out)
 {
-	int samples = len / sample_size;
-	float *mix_dest = mix_buf ? mix_buf : (float *)byte_stream;
+	int samples = len / ctx->sample_size;
+	float *mix_dest = ctx->mix_buf ? ctx->mix_buf : (float *)byte_stream;
 	memset(mix_dest, 0, samples * sizeof(float));
 	int min_buffered = INT_MAX;
 	int min_remaining_buffer = INT_MAX;
-	for (uint8_t i = 0; i < num_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_audio_sources; i++)
 	{
-		int buffered = mix_f32(audio_sources[i], mix_dest, samples);
-		int remaining = (audio_sources[i]->mask + 1) / audio_sources[i]->num_channels - buffered;
+		int buffered = mix_f32(ctx->audio_sources[i], mix_dest, samples);
+		int remaining = (ctx->audio_sources[i]->mask + 1) / ctx->audio_sources[i]->num_channels - buffered;
 		min_buffered = buffered < min_buffered ? buffered : min_buffered;
 		min_remaining_buffer = remaining < min_remaining_buffer ? remaining : min_remaining_buffer;
-		audio_sources[i]->front_populated = 0;
-		render_buffer_consumed(audio_sources[i]);
+		ctx->audio_sources[i]->front_populated = 0;
+		render_buffer_consumed(ctx->audio_sources[i]);
 	}
-	convert(mix_dest, byte_stream, samples);
+	ctx->convert(mix_dest, byte_stream, samples);
 	if (min_remaining_out) {
 		*min_remaining_out = min_remaining_buffer;
 	}
@@ -126,43 +169,119 @@ uint8_t all_sources_ready(void)
 {
 	uint8_t num_populated = 0;
 	num_populated = 0;
-	for (uint8_t i = 0; i < num_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_audio_sources; i++)
 	{
-		if (audio_sources[i]->front_populated) {
+		if (ctx->audio_sources[i]->front_populated) {
 			num_populated++;
 		}
 	}
-	return num_populated == num_audio_sources;
+	return num_populated == ctx->num_audio_sources;
 }
 
 #define BUFFER_INC_RES 0x40000000UL
 
+#define RESAMPLE_PHASE_BITS 8
+#define RESAMPLE_PHASES (1 << RESAMPLE_PHASE_BITS)
+//filter length when the output rate is at least the input rate, scaled up by the decimation ratio otherwise
+#define RESAMPLE_BASE_TAPS 16
+#define RESAMPLE_MAX_TAPS 256
+#define RESAMPLE_HISTORY 1024
+//number of input frames collected before they are resampled
+#define RESAMPLE_BLOCK 64
+
+static uint8_t get_resampler(void)
+{
+	char *resampler = tern_find_path(config, "audio\0resampler\0", TVAL_PTR).ptrval;
+	return resampler && !strcmp(resampler, "polyphase") ? RESAMPLER_POLYPHASE : RESAMPLER_LINEAR;
+}
+
+static void resample_update_step(audio_source *src)
+{
+	//buffer_inc is the output rate over the input rate, scaled by BUFFER_INC_RES
+	src->resample_step = (BUFFER_INC_RES << 32) / src->buffer_inc;
+}
+
+//builds a windowed sinc filter for the current rates and clears the input history
+static void resample_init(audio_source *src)
+{
+	src->resampler = get_resampler();
+	if (src->resampler != RESAMPLER_POLYPHASE || !src->buffer_inc) {
+		src->resampler = RESAMPLER_LINEAR;
+		return;
+	}
+	double ratio = (double)BUFFER_INC_RES / src->buffer_inc;
+	double scale = ratio > 1.0 ? ratio : 1.0;
+	//cutoff relative to the input rate, a bit below the lower of the two Nyquist frequencies
+	double cutoff = 0.45 / scale;
+	uint32_t taps = ((uint32_t)(RESAMPLE_BASE_TAPS * scale) + 3) & ~3;
+	if (taps > RESAMPLE_MAX_TAPS) {
+		taps = RESAMPLE_MAX_TAPS;
+	}
+	src->resample_taps = taps;
+	src->resample_filter = realloc(src->resample_filter, RESAMPLE_PHASES * taps * sizeof(float));
+	for (uint32_t phase = 0; phase < RESAMPLE_PHASES; phase++)
+	{
+		float *coefs = src->resample_filter + phase * taps;
+		double sum = 0.0;
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			//distance of this input sample from the output sample
+			double t = (double)i - (taps / 2 - 1) - (double)phase / RESAMPLE_PHASES;
+			double sinc = t == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+			double x = (t + taps / 2) / taps;
+			double window = 0.42 - 0.5 * cos(2.0 * M_PI * x) + 0.08 * cos(4.0 * M_PI * x);
+			coefs[i] = sinc * window;
+			sum += coefs[i];
+		}
+		//normalize each phase to unity gain so that the phases don't add ripple of their own
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			coefs[i] /= sum;
+		}
+	}
+	if (!src->resample_history) {
+		src->resample_history = malloc(src->num_channels * 2 * RESAMPLE_HISTORY * sizeof(float));
+	}
+	memset(src->resample_history, 0, src->num_channels * 2 * RESAMPLE_HISTORY * sizeof(float));
+	src->resample_count = 0;
+	src->resample_block = 0;
+	src->resample_pos = 0;
+	resample_update_step(src);
+}
+
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
 {
-	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)ctx->sample_rate) / master_clock) * sample_divider;
+	if (src->resampler == RESAMPLER_POLYPHASE) {
+		resample_init(src);
+	}
 }
 
 void render_audio_adjust_speed(float adjust_ratio)
 {
-	for (uint8_t i = 0; i < num_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_audio_sources; i++)
 	{
-		audio_sources[i]->buffer_inc = ((double)audio_sources[i]->buffer_inc) + ((double)audio_sources[i]->buffer_inc) * adjust_ratio + 0.5;
+		ctx->audio_sources[i]->buffer_inc = ((double)ctx->audio_sources[i]->buffer_inc) + ((double)ctx->audio_sources[i]->buffer_inc) * adjust_ratio + 0.5;
+		if (ctx->audio_sources[i]->resampler == RESAMPLER_POLYPHASE) {
+			//speed adjustments are small enough that the filter doesn't need to be rebuilt
+			resample_update_step(ctx->audio_sources[i]);
+		}
 	}
 }
 
 audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
 {
 	audio_source *ret = NULL;
-	uint32_t alloc_size = render_is_audio_sync() ? channels * buffer_samples : nearest_pow2(render_min_buffered() * 4 * channels);
+	uint32_t alloc_size = render_is_audio_sync() ? channels * ctx->buffer_samples : nearest_pow2(render_min_buffered() * 4 * channels);
 	render_lock_audio();
-		if (num_audio_sources < 8) {
+		if (ctx->num_audio_sources < 8) {
 			ret = calloc(1, sizeof(audio_source));
 			ret->back = malloc(alloc_size * sizeof(int16_t));
 			ret->front = render_is_audio_sync() ? malloc(alloc_size * sizeof(int16_t)) : ret->back;
 			ret->front_populated = 0;
 			ret->opaque = render_new_audio_opaque();
 			ret->num_channels = channels;
-			audio_sources[num_audio_sources++] = ret;
+			ctx->audio_sources[ctx->num_audio_sources++] = ret;
 		}
 	render_unlock_audio();
 	if (!ret) {
@@ -178,9 +297,10 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 		ret->buffer_fraction = 0;
 		ret->last_left = ret->last_right = 0;
 		ret->read_start = 0;
-		ret->read_end = render_is_audio_sync() ? buffer_samples * channels : 0;
+		ret->read_end = render_is_audio_sync() ? ctx->buffer_samples * channels : 0;
 		ret->mask = render_is_audio_sync() ? 0xFFFFFFFF : alloc_size-1;
 		ret->gain_mult = 1.0f;
+		resample_init(ret);
 	}
 	render_audio_created(ret);
 	
@@ -202,12 +322,12 @@ void render_pause_source(audio_source *src)
 {
 	uint8_t found = 0, remaining_sources;
 	render_lock_audio();
-		for (uint8_t i = 0; i < num_audio_sources; i++)
+		for (uint8_t i = 0; i < ctx->num_audio_sources; i++)
 		{
-			if (audio_sources[i] == src) {
-				audio_sources[i] = audio_sources[--num_audio_sources];
+			if (ctx->audio_sources[i] == src) {
+				ctx->audio_sources[i] = ctx->audio_sources[--ctx->num_audio_sources];
 				found = 1;
-				remaining_sources = num_audio_sources;
+				remaining_sources = ctx->num_audio_sources;
 				break;
 			}
 		}
@@ -216,20 +336,20 @@ void render_pause_source(audio_source *src)
 	if (found) {
 		render_source_paused(src, remaining_sources);
 	}
-	inactive_audio_sources[num_inactive_audio_sources++] = src;
+	ctx->inactive_audio_sources[ctx->num_inactive_audio_sources++] = src;
 }
 
 void render_resume_source(audio_source *src)
 {
 	render_lock_audio();
-		if (num_audio_sources < 8) {
-			audio_sources[num_audio_sources++] = src;
+		if (ctx->num_audio_sources < 8) {
+			ctx->audio_sources[ctx->num_audio_sources++] = src;
 		}
 	render_unlock_audio();
-	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_inactive_audio_sources; i++)
 	{
-		if (inactive_audio_sources[i] == src) {
-			inactive_audio_sources[i] = inactive_audio_sources[--num_inactive_audio_sources];
+		if (ctx->inactive_audio_sources[i] == src) {
+			ctx->inactive_audio_sources[i] = ctx->inactive_audio_sources[--ctx->num_inactive_audio_sources];
 		}
 	}
 	render_source_resumed(src);
@@ -238,17 +358,17 @@ void render_resume_source(audio_source *src)
 void render_free_source(audio_source *src)
 {
 	uint8_t found = 0;
-	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_inactive_audio_sources; i++)
 	{
-		if (inactive_audio_sources[i] == src) {
-			inactive_audio_sources[i] = inactive_audio_sources[--num_inactive_audio_sources];
+		if (ctx->inactive_audio_sources[i] == src) {
+			ctx->inactive_audio_sources[i] = ctx->inactive_audio_sources[--ctx->num_inactive_audio_sources];
 			found = 1;
 			break;
 		}
 	}
 	if (!found) {
 		render_pause_source(src);
-		num_inactive_audio_sources--;
+		ctx->num_inactive_audio_sources--;
 	}
 	
 	free(src->front);
@@ -256,6 +376,8 @@ void render_free_source(audio_source *src)
 		free(src->back);
 		render_free_audio_opaque(src->opaque);
 	}
+	free(src->resample_filter);
+	free(src->resample_history);
 	free(src);
 }
 
@@ -273,10 +395,159 @@ static void interp_sample(audio_source *src, int16_t last, int16_t current)
 	src->back[src->buffer_pos++] = tmp >> 16;
 }
 
-static uint32_t sync_samples;
+#if !defined(DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+
+//filters left and right at the same time so that each coefficient is only loaded once
+static void resample_dot(float const *coefs, float const *left, float const *right, uint32_t taps, float *out)
+{
+	__m128 sum_left = _mm_setzero_ps(), sum_right = _mm_setzero_ps();
+	for (uint32_t i = 0; i < taps; i += 4)
+	{
+		__m128 c = _mm_loadu_ps(coefs + i);
+		sum_left = _mm_add_ps(sum_left, _mm_mul_ps(c, _mm_loadu_ps(left + i)));
+		sum_right = _mm_add_ps(sum_right, _mm_mul_ps(c, _mm_loadu_ps(right + i)));
+	}
+	//transpose the partial sums so that one more add leaves the left and right totals in lanes 0 and 1
+	__m128 low = _mm_unpacklo_ps(sum_left, sum_right), high = _mm_unpackhi_ps(sum_left, sum_right);
+	__m128 sum = _mm_add_ps(low, high);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	_mm_storel_pi((__m64 *)out, sum);
+}
+
+static float resample_dot_mono(float const *coefs, float const *samples, uint32_t taps)
+{
+	__m128 sum = _mm_setzero_ps();
+	for (uint32_t i = 0; i < taps; i += 4)
+	{
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(coefs + i), _mm_loadu_ps(samples + i)));
+	}
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+#elif !defined(DISABLE_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+//filters left and right at the same time so that each coefficient is only loaded once
+static void resample_dot(float const *coefs, float const *left, float const *right, uint32_t taps, float *out)
+{
+	float32x4_t sum_left = vdupq_n_f32(0.0f), sum_right = vdupq_n_f32(0.0f);
+	for (uint32_t i = 0; i < taps; i += 4)
+	{
+		float32x4_t c = vld1q_f32(coefs + i);
+		sum_left = vmlaq_f32(sum_left, c, vld1q_f32(left + i));
+		sum_right = vmlaq_f32(sum_right, c, vld1q_f32(right + i));
+	}
+	float32x2_t half_left = vadd_f32(vget_low_f32(sum_left), vget_high_f32(sum_left));
+	float32x2_t half_right = vadd_f32(vget_low_f32(sum_right), vget_high_f32(sum_right));
+	vst1_f32(out, vpadd_f32(half_left, half_right));
+}
+
+static float resample_dot_mono(float const *coefs, float const *samples, uint32_t taps)
+{
+	float32x4_t sum = vdupq_n_f32(0.0f);
+	for (uint32_t i = 0; i < taps; i += 4)
+	{
+		sum = vmlaq_f32(sum, vld1q_f32(coefs + i), vld1q_f32(samples + i));
+	}
+	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	return vget_lane_f32(vpadd_f32(half, half), 0);
+}
+#else
+static void resample_dot(float const *coefs, float const *left, float const *right, uint32_t taps, float *out)
+{
+	float sum_left = 0.0f, sum_right = 0.0f;
+	for (uint32_t i = 0; i < taps; i++)
+	{
+		sum_left += coefs[i] * left[i];
+		sum_right += coefs[i] * right[i];
+	}
+	out[0] = sum_left;
+	out[1] = sum_right;
+}
+
+static float resample_dot_mono(float const *coefs, float const *samples, uint32_t taps)
+{
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < taps; i++)
+	{
+		sum += coefs[i] * samples[i];
+	}
+	return sum;
+}
+#endif
+
+static int16_t resample_clamp(float sample)
+{
+	if (sample >= 32767.0f) {
+		return 32767;
+	} else if (sample <= -32768.0f) {
+		return -32768;
+	}
+	return sample + (sample >= 0.0f ? 0.5f : -0.5f);
+}
+
+//produces every output sample whose filter window is covered by the input history
+static void resample_block(audio_source *src)
+{
+	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
+	uint32_t taps = src->resample_taps;
+	uint8_t stereo = src->num_channels == 2;
+	float const *left = src->resample_history;
+	float const *right = left + 2 * RESAMPLE_HISTORY;
+	//the window of an output sample between inputs n and n + 1 runs from n - taps/2 + 1 to n + taps/2
+	while ((src->resample_pos >> 32) + taps / 2 < src->resample_count)
+	{
+		uint32_t start = ((uint32_t)(src->resample_pos >> 32) - taps / 2 + 1) & (RESAMPLE_HISTORY - 1);
+		uint32_t phase = src->resample_pos >> (32 - RESAMPLE_PHASE_BITS) & (RESAMPLE_PHASES - 1);
+		float const *coefs = src->resample_filter + phase * taps;
+		if (stereo) {
+			float out[2];
+			resample_dot(coefs, left + start, right + start, taps, out);
+			src->back[src->buffer_pos++] = resample_clamp(out[0]);
+			src->back[src->buffer_pos++] = resample_clamp(out[1]);
+		} else {
+			src->back[src->buffer_pos++] = resample_clamp(resample_dot_mono(coefs, left + start, taps));
+		}
+		if (((src->buffer_pos - base) & src->mask) >> stereo >= ctx->sync_samples) {
+			render_do_audio_ready(src);
+		}
+		src->buffer_pos &= src->mask;
+		src->resample_pos += src->resample_step;
+	}
+	//rebase by a multiple of the history size so that positions in the history don't change
+	if (src->resample_count >= 2 * RESAMPLE_HISTORY) {
+		src->resample_count -= RESAMPLE_HISTORY;
+		src->resample_pos -= (uint64_t)RESAMPLE_HISTORY << 32;
+	}
+	src->resample_block = 0;
+}
+
+static void resample_put(audio_source *src, uint8_t channel, int16_t value)
+{
+	float *history = src->resample_history + channel * 2 * RESAMPLE_HISTORY;
+	uint32_t index = src->resample_count & (RESAMPLE_HISTORY - 1);
+	history[index] = history[index + RESAMPLE_HISTORY] = value;
+}
+
+static void resample_next(audio_source *src)
+{
+	src->resample_count++;
+	if (++src->resample_block == RESAMPLE_BLOCK) {
+		resample_block(src);
+	}
+}
+
 void render_put_mono_sample(audio_source *src, int16_t value)
 {
 	value = lowpass_sample(src, src->last_left, value);
+	if (src->resampler == RESAMPLER_POLYPHASE) {
+		resample_put(src, 0, value);
+		resample_next(src);
+		src->last_left = value;
+		return;
+	}
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
 	while (src->buffer_fraction > BUFFER_INC_RES)
@@ -284,7 +555,7 @@ void render_put_mono_sample(audio_source *src, int16_t value)
 		src->buffer_fraction -= BUFFER_INC_RES;
 		interp_sample(src, src->last_left, value);
 		
-		if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
+		if (((src->buffer_pos - base) & src->mask) >= ctx->sync_samples) {
 			render_do_audio_ready(src);
 		}
 		src->buffer_pos &= src->mask;
@@ -296,6 +567,14 @@ void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 {
 	left = lowpass_sample(src, src->last_left, left);
 	right = lowpass_sample(src, src->last_right, right);
+	if (src->resampler == RESAMPLER_POLYPHASE) {
+		resample_put(src, 0, left);
+		resample_put(src, 1, right);
+		resample_next(src);
+		src->last_left = left;
+		src->last_right = right;
+		return;
+	}
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
 	while (src->buffer_fraction > BUFFER_INC_RES)
@@ -305,7 +584,7 @@ void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 		interp_sample(src, src->last_left, left);
 		interp_sample(src, src->last_right, right);
 		
-		if (((src->buffer_pos - base) & src->mask)/2 >= sync_samples) {
+		if (((src->buffer_pos - base) & src->mask)/2 >= ctx->sync_samples) {
 			render_do_audio_ready(src);
 		}
 		src->buffer_pos &= src->mask;
@@ -320,7 +599,7 @@ static void update_source(audio_source *src, double rc, uint8_t sync_changed)
 	int32_t lowpass_alpha = (int32_t)(((double)0x10000) * alpha);
 	src->lowpass_alpha = lowpass_alpha;
 	if (sync_changed) {
-		uint32_t alloc_size = render_is_audio_sync() ? src->num_channels * buffer_samples : nearest_pow2(render_min_buffered() * 4 * src->num_channels);
+		uint32_t alloc_size = render_is_audio_sync() ? src->num_channels * ctx->buffer_samples : nearest_pow2(render_min_buffered() * 4 * src->num_channels);
 		src->back = realloc(src->back, alloc_size * sizeof(int16_t));
 		if (render_is_audio_sync()) {
 			src->front = malloc(alloc_size * sizeof(int16_t));
@@ -330,56 +609,56 @@ static void update_source(audio_source *src, double rc, uint8_t sync_changed)
 		}
 		src->mask = render_is_audio_sync() ? 0xFFFFFFFF : alloc_size-1;
 		src->read_start = 0;
-		src->read_end = render_is_audio_sync() ? buffer_samples * src->num_channels : 0;
+		src->read_end = render_is_audio_sync() ? ctx->buffer_samples * src->num_channels : 0;
 		src->buffer_pos = 0;
 	}
+	resample_init(src);
 }
 
-uint8_t old_audio_sync;
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size_in)
 {
-	sample_rate = rate;
-	output_channels = channels;
-	buffer_samples = buffer_size;
-	sample_size = sample_size_in;
-	if (mix_buf) {
-		free(mix_buf);
-		mix_buf = NULL;
+	ctx->sample_rate = rate;
+	ctx->output_channels = channels;
+	ctx->buffer_samples = buffer_size;
+	ctx->sample_size = sample_size_in;
+	if (ctx->mix_buf) {
+		free(ctx->mix_buf);
+		ctx->mix_buf = NULL;
 	}
 	switch(format)
 	{
 	case RENDER_AUDIO_S16:
-		convert = convert_s16;
-		mix_buf = calloc(output_channels * buffer_samples, sizeof(float));
+		ctx->convert = convert_s16;
+		ctx->mix_buf = calloc(ctx->output_channels * ctx->buffer_samples, sizeof(float));
 		break;
 	case RENDER_AUDIO_FLOAT:
-		convert = clamp_f32;
+		ctx->convert = clamp_f32;
 		break;
 	case RENDER_AUDIO_UNKNOWN:
-		convert = convert_null;
-		mix_buf = calloc(output_channels * buffer_samples, sizeof(float));
+		ctx->convert = convert_null;
+		ctx->mix_buf = calloc(ctx->output_channels * ctx->buffer_samples, sizeof(float));
 		break;
 	}
 	uint32_t syncs = render_audio_syncs_per_sec();
 	if (syncs) {
-		sync_samples = rate / syncs;
+		ctx->sync_samples = rate / syncs;
 	} else {
-		sync_samples = buffer_samples;
+		ctx->sync_samples = ctx->buffer_samples;
 	}
 	char * gain_str = tern_find_path(config, "audio\0gain\0", TVAL_PTR).ptrval;
-	overall_gain_mult = db_to_mult(gain_str ? atof(gain_str) : 0.0f);
-	uint8_t sync_changed = old_audio_sync != render_is_audio_sync();
-	old_audio_sync = render_is_audio_sync();
+	ctx->overall_gain_mult = db_to_mult(gain_str ? atof(gain_str) : 0.0f);
+	uint8_t sync_changed = ctx->old_audio_sync != render_is_audio_sync();
+	ctx->old_audio_sync = render_is_audio_sync();
 	double lowpass_cutoff = get_lowpass_cutoff(config);
 	double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
 	render_lock_audio();
-		for (uint8_t i = 0; i < num_audio_sources; i++)
+		for (uint8_t i = 0; i < ctx->num_audio_sources; i++)
 		{
-			update_source(audio_sources[i], rc, sync_changed);
+			update_source(ctx->audio_sources[i], rc, sync_changed);
 		}
 	render_unlock_audio();
-	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	for (uint8_t i = 0; i < ctx->num_inactive_audio_sources; i++)
 	{
-		update_source(inactive_audio_sources[i], rc, sync_changed);
+		update_source(ctx->inactive_audio_sources[i], rc, sync_changed);
 	}
 }
\ No newline at end of file
@@ -8,25 +8,43 @@ typedef enum {
 	RENDER_AUDIO_UNKNOWN
 } render_audio_format;
 
+typedef enum {
+	RESAMPLER_LINEAR,
+	RESAMPLER_POLYPHASE
+} resampler_type;
+
 typedef struct {
 	void     *opaque;
 	int16_t  *front;
 	int16_t  *back;
+	//polyphase filter coefficients, RESAMPLE_PHASES rows of resample_taps each
+	float    *resample_filter;
+	//RESAMPLE_HISTORY input frames per channel, stored twice so that a window never wraps
+	float    *resample_history;
 	double   dt;
 	uint64_t buffer_fraction;
 	uint64_t buffer_inc;
+	//position of the next output sample in input samples as 32.32 fixed point
+	uint64_t resample_pos;
+	uint64_t resample_step;
 	float    gain_mult;
 	uint32_t buffer_pos;
 	uint32_t read_start;
 	uint32_t read_end;
 	uint32_t lowpass_alpha;
 	uint32_t mask;
+	uint32_t resample_taps;
+	uint32_t resample_count;
+	uint32_t resample_block;
 	int16_t  last_left;
 	int16_t  last_right;
 	uint8_t  num_channels;
 	uint8_t  front_populated;
+	uint8_t  resampler;
 } audio_source;
 
+typedef struct render_audio_context render_audio_context;
+
 //public interface
 audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels);
 void render_audio_source_gaindb(audio_source *src, float gain);
@@ -37,6 +55,14 @@ void render_pause_source(audio_source *src);
 void render_resume_source(audio_source *src);
 void render_free_source(audio_source *src);
 //interface for render backends
+render_audio_context *render_audio_context_new(void);
+void render_audio_context_free(render_audio_context *context);
+//selects the context used by the calling thread, NULL selects the default context
+render_audio_context *render_audio_set_context(render_audio_context *context);
+render_audio_context *render_audio_get_context(void);
+//lets the backend find its own state from any thread that renders into the current context
+void render_audio_set_userdata(void *userdata);
+void *render_audio_get_userdata(void);
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size);
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out);
 uint8_t all_sources_ready(void);
@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#ifndef DISABLE_ZLIB
+#include "zlib/zlib.h"
+#endif
+
+enum {
+	CODEC_RLE,
+	CODEC_ZLIB
+};
+
+typedef struct {
+	uint8_t  *data;
+	uint32_t size;
+	uint32_t state_size;
+	uint8_t  keyframe;
+	uint8_t  codec;
+} rewind_entry;
+
+struct rewind_buffer {
+	rewind_entry *entries;
+	uint8_t      *current;
+	uint8_t      *popped;
+	uint8_t      *pack;
+	size_t       state_storage;
+	size_t       pack_storage;
+	size_t       current_size;
+	size_t       budget;
+	size_t       used;
+	uint64_t     pushes;
+	uint64_t     raw_bytes;
+	uint64_t     packed_bytes;
+	uint32_t     capacity;
+	uint32_t     first;
+	uint32_t     count;
+	uint32_t     keyframe_interval;
+	uint32_t     since_keyframe;
+};
+
+//literal runs are only split by at least this many unchanged bytes, which bounds the worst case size
+#define RLE_MIN_ZEROS 4
+#define RLE_OVERHEAD 32
+
+rewind_buffer *rewind_new(size_t budget, uint32_t keyframe_interval)
+{
+	rewind_buffer *rw = calloc(1, sizeof(rewind_buffer));
+	rw->budget = budget;
+	rw->keyframe_interval = keyframe_interval ? keyframe_interval : REWIND_DEFAULT_KEYFRAME_INTERVAL;
+	return rw;
+}
+
+static rewind_entry *get_entry(rewind_buffer *rw, uint32_t index)
+{
+	return rw->entries + (rw->first + index) % rw->capacity;
+}
+
+void rewind_free(rewind_buffer *rw)
+{
+	if (!rw) {
+		return;
+	}
+	for (uint32_t i = 0; i < rw->count; i++)
+	{
+		free(get_entry(rw, i)->data);
+	}
+	free(rw->entries);
+	free(rw->current);
+	free(rw->popped);
+	free(rw->pack);
+	free(rw);
+}
+
+static size_t put_varint(uint8_t *out, size_t value)
+{
+	size_t bytes = 0;
+	while (value >= 0x80)
+	{
+		out[bytes++] = value | 0x80;
+		value >>= 7;
+	}
+	out[bytes++] = value;
+	return bytes;
+}
+
+static size_t get_varint(uint8_t const **in)
+{
+	size_t value = 0;
+	uint8_t shift = 0;
+	uint8_t byte;
+	do {
+		byte = *((*in)++);
+		value |= (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return value;
+}
+
+static uint64_t load64(uint8_t const *src)
+{
+	uint64_t value;
+	memcpy(&value, src, sizeof(value));
+	return value;
+}
+
+//encodes state XOR prev as alternating runs of zero bytes and literal bytes, prev may be NULL
+static size_t rle_encode(uint8_t const *state, uint8_t const *prev, size_t size, uint8_t *out)
+{
+	uint8_t *cur = out;
+	size_t pos = 0;
+	while (pos < size)
+	{
+		size_t lit_start = pos;
+		if (prev) {
+			while (lit_start + sizeof(uint64_t) <= size && load64(state + lit_start) == load64(prev + lit_start))
+			{
+				lit_start += sizeof(uint64_t);
+			}
+			while (lit_start < size && state[lit_start] == prev[lit_start])
+			{
+				lit_start++;
+			}
+		} else {
+			while (lit_start + sizeof(uint64_t) <= size && !load64(state + lit_start))
+			{
+				lit_start += sizeof(uint64_t);
+			}
+			while (lit_start < size && !state[lit_start])
+			{
+				lit_start++;
+			}
+		}
+		size_t lit_end = lit_start, run = 0;
+		while (lit_end + run < size && run < RLE_MIN_ZEROS)
+		{
+			uint8_t same = prev ? state[lit_end + run] == prev[lit_end + run] : !state[lit_end + run];
+			if (same) {
+				run++;
+			} else {
+				lit_end += run + 1;
+				run = 0;
+			}
+		}
+		cur += put_varint(cur, lit_start - pos);
+		cur += put_varint(cur, lit_end - lit_start);
+		if (prev) {
+			for (size_t i = lit_start; i < lit_end; i++)
+			{
+				*(cur++) = state[i] ^ prev[i];
+			}
+		} else {
+			memcpy(cur, state + lit_start, lit_end - lit_start);
+			cur += lit_end - lit_start;
+		}
+		pos = lit_end;
+	}
+	return cur - out;
+}
+
+//XORs the literal runs of an encoded entry into dst
+static void rle_apply(uint8_t *dst, uint8_t const *in, size_t in_size)
+{
+	uint8_t const *end = in + in_size;
+	size_t pos = 0;
+	while (in < end)
+	{
+		pos += get_varint(&in);
+		size_t literals = get_varint(&in);
+		for (size_t i = 0; i < literals; i++)
+		{
+			dst[pos++] ^= *(in++);
+		}
+	}
+}
+
+static size_t pack_keyframe(rewind_buffer *rw, uint8_t const *state, size_t size, uint8_t *codec)
+{
+#ifndef DISABLE_ZLIB
+	uLongf packed = rw->pack_storage;
+	if (Z_OK == compress2(rw->pack, &packed, state, size, Z_BEST_SPEED)) {
+		*codec = CODEC_ZLIB;
+		return packed;
+	}
+#endif
+	*codec = CODEC_RLE;
+	return rle_encode(state, NULL, size, rw->pack);
+}
+
+static void unpack_keyframe(rewind_entry *entry, uint8_t *dst)
+{
+#ifndef DISABLE_ZLIB
+	if (entry->codec == CODEC_ZLIB) {
+		uLongf size = entry->state_size;
+		uncompress(dst, &size, entry->data, entry->size);
+		return;
+	}
+#endif
+	memset(dst, 0, entry->state_size);
+	rle_apply(dst, entry->data, entry->size);
+}
+
+static size_t memory_used(rewind_buffer *rw)
+{
+	return rw->used + 2 * rw->state_storage + rw->pack_storage + rw->capacity * sizeof(rewind_entry);
+}
+
+static void drop_oldest(rewind_buffer *rw)
+{
+	rewind_entry *entry = get_entry(rw, 0);
+	rw->used -= entry->size;
+	free(entry->data);
+	rw->first = (rw->first + 1) % rw->capacity;
+	rw->count--;
+}
+
+static void drop_newest(rewind_buffer *rw)
+{
+	rewind_entry *entry = get_entry(rw, rw->count - 1);
+	rw->used -= entry->size;
+	free(entry->data);
+	rw->count--;
+}
+
+static void reserve_states(rewind_buffer *rw, size_t size)
+{
+	if (size > rw->state_storage) {
+		rw->state_storage = size;
+		rw->current = realloc(rw->current, size);
+		rw->popped = realloc(rw->popped, size);
+	}
+}
+
+uint8_t *rewind_scratch(rewind_buffer *rw, size_t size)
+{
+	reserve_states(rw, size);
+	return rw->popped;
+}
+
+static void reserve_pack(rewind_buffer *rw, size_t size, uint32_t ranges)
+{
+	size_t pack_size = size + RLE_OVERHEAD * (ranges + 1);
+#ifndef DISABLE_ZLIB
+	if (compressBound(size) > pack_size) {
+		pack_size = compressBound(size);
+	}
+#endif
+	if (pack_size > rw->pack_storage) {
+		rw->pack_storage = pack_size;
+		rw->pack = realloc(rw->pack, pack_size);
+	}
+}
+
+//stores the entry packed in rw->pack and drops old runs that no longer fit in the budget
+static void add_entry(rewind_buffer *rw, rewind_entry entry)
+{
+	entry.data = malloc(entry.size);
+	memcpy(entry.data, rw->pack, entry.size);
+	if (rw->count == rw->capacity) {
+		uint32_t old_capacity = rw->capacity;
+		rw->capacity = rw->capacity ? rw->capacity * 2 : 256;
+		rw->entries = realloc(rw->entries, rw->capacity * sizeof(rewind_entry));
+		//unwrap the entries that were at the start of the old ring
+		for (uint32_t i = 0; i < rw->first; i++)
+		{
+			rw->entries[old_capacity + i] = rw->entries[i];
+		}
+	}
+	*get_entry(rw, rw->count++) = entry;
+	rw->current_size = entry.state_size;
+	rw->used += entry.size;
+	rw->pushes++;
+	rw->raw_bytes += entry.state_size;
+	rw->packed_bytes += entry.size;
+
+	while (memory_used(rw) > rw->budget)
+	{
+		//only whole runs can be dropped, the newest one is always kept
+		uint32_t run_end = 1;
+		while (run_end < rw->count && !get_entry(rw, run_end)->keyframe)
+		{
+			run_end++;
+		}
+		if (run_end == rw->count) {
+			break;
+		}
+		for (uint32_t i = 0; i < run_end; i++)
+		{
+			drop_oldest(rw);
+		}
+	}
+}
+
+void rewind_push(rewind_buffer *rw, uint8_t const *state, size_t size)
+{
+	if (state != rw->popped) {
+		reserve_states(rw, size);
+	}
+	reserve_pack(rw, size, 0);
+	rewind_entry entry = {
+		.state_size = size,
+		.keyframe = !rw->count || size != rw->current_size || rw->since_keyframe >= rw->keyframe_interval
+	};
+	if (entry.keyframe) {
+		entry.size = pack_keyframe(rw, state, size, &entry.codec);
+		rw->since_keyframe = 0;
+	} else {
+		entry.size = rle_encode(state, rw->current, size, rw->pack);
+		entry.codec = CODEC_RLE;
+	}
+	rw->since_keyframe++;
+	if (state == rw->popped) {
+		rw->popped = rw->current;
+		rw->current = (uint8_t *)state;
+	} else {
+		memcpy(rw->current, state, size);
+	}
+	add_entry(rw, entry);
+}
+
+uint8_t rewind_push_ranges(rewind_buffer *rw, size_t size, rewind_range const *ranges, uint32_t count)
+{
+	if (!rw->count || size != rw->current_size) {
+		return 0;
+	}
+	reserve_pack(rw, size, count);
+	rewind_entry entry = {
+		.state_size = size,
+		.keyframe = rw->since_keyframe >= rw->keyframe_interval,
+		.codec = CODEC_RLE
+	};
+	size_t pos = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t *dst = rw->current + ranges[i].offset;
+		if (!entry.keyframe) {
+			//an empty literal run skips the unchanged bytes before the range
+			entry.size += put_varint(rw->pack + entry.size, ranges[i].offset - pos);
+			entry.size += put_varint(rw->pack + entry.size, 0);
+			entry.size += rle_encode(ranges[i].data, dst, ranges[i].size, rw->pack + entry.size);
+			pos = ranges[i].offset + ranges[i].size;
+		}
+		memcpy(dst, ranges[i].data, ranges[i].size);
+	}
+	if (entry.keyframe) {
+		entry.size = pack_keyframe(rw, rw->current, size, &entry.codec);
+		rw->since_keyframe = 0;
+	}
+	rw->since_keyframe++;
+	add_entry(rw, entry);
+	return 1;
+}
+
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out)
+{
+	if (!rw->count) {
+		return NULL;
+	}
+	*size_out = rw->current_size;
+	if (rw->count == 1) {
+		return rw->current;
+	}
+	uint8_t *tmp = rw->popped;
+	rw->popped = rw->current;
+	rw->current = tmp;
+	rewind_entry *entry = get_entry(rw, rw->count - 1);
+	if (entry->keyframe) {
+		drop_newest(rw);
+		//rebuild the newest state of the previous run from its keyframe
+		uint32_t keyframe = rw->count - 1;
+		while (!get_entry(rw, keyframe)->keyframe)
+		{
+			keyframe--;
+		}
+		entry = get_entry(rw, keyframe);
+		unpack_keyframe(entry, rw->current);
+		rw->current_size = entry->state_size;
+		for (uint32_t i = keyframe + 1; i < rw->count; i++)
+		{
+			entry = get_entry(rw, i);
+			rle_apply(rw->current, entry->data, entry->size);
+		}
+		rw->since_keyframe = rw->count - keyframe;
+	} else {
+		memcpy(rw->current, rw->popped, rw->current_size);
+		rle_apply(rw->current, entry->data, entry->size);
+		drop_newest(rw);
+		rw->since_keyframe--;
+	}
+	return rw->popped;
+}
+
+uint8_t const *rewind_newest(rewind_buffer *rw, size_t *size_out)
+{
+	if (!rw->count) {
+		return NULL;
+	}
+	*size_out = rw->current_size;
+	return rw->current;
+}
+
+uint32_t rewind_frames(rewind_buffer *rw)
+{
+	return rw->count;
+}
+
+void rewind_get_stats(rewind_buffer *rw, rewind_stats *stats)
+{
+	stats->pushes = rw->pushes;
+	stats->raw_bytes = rw->raw_bytes;
+	stats->packed_bytes = rw->packed_bytes;
+	stats->frames = rw->count;
+	stats->memory = memory_used(rw);
+}
@@ -0,0 +1,48 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Bounded history of snapshot states used for rewinding. Every keyframe_interval states a
+//compressed keyframe is stored, the states in between are stored as compressed XOR deltas
+//against the state before them. Stepping back within a run of deltas only needs the newest
+//state and one delta, stepping back over a keyframe replays the deltas of the previous run.
+//Once the compressed entries exceed the memory budget the oldest run is dropped as a whole.
+typedef struct rewind_buffer rewind_buffer;
+
+typedef struct {
+	uint64_t pushes;
+	uint64_t raw_bytes;
+	uint64_t packed_bytes;
+	uint32_t frames;
+	size_t   memory;
+} rewind_stats;
+
+typedef struct {
+	uint8_t const *data;
+	size_t        offset;
+	size_t        size;
+} rewind_range;
+
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL 60
+
+rewind_buffer *rewind_new(size_t budget, uint32_t keyframe_interval);
+void rewind_free(rewind_buffer *rw);
+//returns a buffer of at least size bytes that a state can be built in before it is pushed
+uint8_t *rewind_scratch(rewind_buffer *rw, size_t size);
+void rewind_push(rewind_buffer *rw, uint8_t const *state, size_t size);
+//pushes a state of size bytes that only differs from the newest one inside ranges, which must be
+//sorted by offset and must not overlap, so the cost follows what changed rather than the state size
+//returns 0 without pushing anything if there is no newest state of the same size to build on
+uint8_t rewind_push_ranges(rewind_buffer *rw, size_t size, rewind_range const *ranges, uint32_t count);
+//removes the newest state and returns it, the pointer stays valid until the next call
+//the oldest state is returned without being removed so stepping back stops there
+//returns NULL if nothing was pushed
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out);
+//returns the newest state without removing it or NULL if nothing was pushed
+uint8_t const *rewind_newest(rewind_buffer *rw, size_t *size_out);
+uint32_t rewind_frames(rewind_buffer *rw);
+void rewind_get_stats(rewind_buffer *rw, rewind_stats *stats);
+
+#endif //REWIND_H_
@@ -911,17 +911,20 @@ rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *l
 	if (!entry) {
 		entry = tern_find_node(rom_db, product_id);
 	}
+	rom_info info;
 	if (!entry) {
 		debug_message("Not found in ROM DB, examining header\n\n");
 		if (xband_detect(rom, rom_size)) {
-			return xband_configure_rom(rom_db, rom, rom_size, lock_on, lock_on_size, base_map, base_chunks);
-		}
-		if (realtec_detect(rom, rom_size)) {
-			return realtec_configure_rom(rom, rom_size, base_map, base_chunks);
+			info = xband_configure_rom(rom_db, rom, rom_size, lock_on, lock_on_size, base_map, base_chunks);
+		} else if (realtec_detect(rom, rom_size)) {
+			info = realtec_configure_rom(rom, rom_size, base_map, base_chunks);
+		} else {
+			info = configure_rom_heuristics(rom, rom_size, base_map, base_chunks);
 		}
-		return configure_rom_heuristics(rom, rom_size, base_map, base_chunks);
+		memcpy(info.hash, raw_hash, sizeof(info.hash));
+		return info;
 	}
-	rom_info info;
+	memcpy(info.hash, raw_hash, sizeof(info.hash));
 	info.mapper_type = MAPPER_NONE;
 	info.name = tern_find_ptr(entry, "name");
 	if (info.name) {
@@ -72,6 +72,7 @@ struct rom_info {
 	uint32_t      rom_size;
 	uint32_t      save_size;
 	uint32_t      save_mask;
+	uint8_t       hash[20]; //SHA-1 of the ROM, only set by configure_rom
 	uint16_t      mapper_start_index;
 	uint8_t       save_type;
 	uint8_t       save_bus; //only used for NOR currently
@@ -404,6 +404,10 @@ static void run_sms(system_header *system)
 			system->enter_debugger = 0;
 			zdebugger(sms->z80, sms->z80->pc);
 		}
+		if (code_cache_full(&sms->z80->Z80_OPTS->gen)) {
+			//retried on the next pass if the Z80 stopped in the middle of an instruction
+			z80_flush_code_cache(sms->z80);
+		}
 		if (sms->z80->nmi_start == CYCLE_NEVER) {
 #else
 		if (sms->z80->nmi_cycle == CYCLE_NEVER) {
@@ -627,6 +631,10 @@ sms_context *alloc_configure_sms(system_media *media, uint32_t opts, uint8_t for
 	sms->z80 = init_z80_context(zopts);
 	sms->z80->system = sms;
 	sms->z80->Z80_OPTS->gen.debug_cmd_handler = debug_commands;
+#ifndef NEW_CORE
+	uint32_t code_cache_budget = atoi(tern_find_path_default(config, "system\0code_cache_budget\0", (tern_val){.ptrval = "64"}, TVAL_PTR).ptrval);
+	zopts->gen.cache.budget = code_cache_budget * 1024 * 1024;
+#endif
 	
 	sms->rom = media->buffer;
 	sms->rom_size = rom_size;
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sound_thread.h"
+
+//must be a power of two
+#define QUEUE_SIZE (1 << 13)
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+//a sleeping sound thread is only woken once this many records are waiting or someone waits for it
+#define WAKE_RECORDS 32
+#define NO_TARGET 0xFFFFFFFF
+
+struct sound_thread {
+	sound_record         records[QUEUE_SIZE];
+	ym2612_context       ym;
+	ym2612_context       *cpu_ym;
+	psg_context          *psg;
+	render_audio_context *audio;
+	pthread_t            thread;
+	pthread_mutex_t      lock;
+	pthread_cond_t       work;
+	pthread_cond_t       idle;
+	uint32_t             max_cycles;
+	//target of the last run queued, runs to the same cycle don't do anything and are left out
+	uint32_t             last_target;
+	//only written by the emulation thread
+	uint32_t             head __attribute__((aligned(64)));
+	//only written by the sound thread, records are rendered before this moves past them
+	uint32_t             tail __attribute__((aligned(64)));
+	uint8_t              sleeping;
+	uint8_t              exit;
+};
+
+static void run_chips(sound_thread *thread, uint32_t target)
+{
+	psg_context *psg = thread->psg;
+	while (target > psg->cycles && target - psg->cycles > thread->max_cycles) {
+		uint32_t cur_target = psg->cycles + thread->max_cycles;
+		psg_run(psg, cur_target);
+		ym_run(&thread->ym, cur_target);
+	}
+	psg_run(psg, target);
+	ym_run(&thread->ym, target);
+}
+
+static void apply(sound_thread *thread, sound_record const *rec)
+{
+	switch (rec->port)
+	{
+	case SOUND_RUN:
+		run_chips(thread, rec->cycle);
+		break;
+	case SOUND_YM_ADDRESS1:
+		ym_address_write_part1(&thread->ym, rec->value);
+		break;
+	case SOUND_YM_ADDRESS2:
+		ym_address_write_part2(&thread->ym, rec->value);
+		break;
+	case SOUND_YM_DATA:
+		ym_data_write(&thread->ym, rec->value);
+		break;
+	case SOUND_PSG:
+		psg_write(thread->psg, rec->value);
+		break;
+	case SOUND_YM_RESET:
+		ym_reset(&thread->ym);
+		break;
+	case SOUND_ADJUST:
+		ym_adjust_cycles(&thread->ym, rec->cycle);
+		thread->psg->cycles -= rec->cycle;
+		break;
+	}
+}
+
+static void *sound_thread_main(void *data)
+{
+	sound_thread *thread = data;
+	render_audio_set_context(thread->audio);
+	uint32_t tail = thread->tail;
+	for (;;)
+	{
+		if (tail == __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_lock(&thread->lock);
+				__atomic_store_n(&thread->sleeping, 1, __ATOMIC_SEQ_CST);
+				pthread_cond_broadcast(&thread->idle);
+				while (tail == __atomic_load_n(&thread->head, __ATOMIC_SEQ_CST) && !thread->exit)
+				{
+					pthread_cond_wait(&thread->work, &thread->lock);
+				}
+				__atomic_store_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST);
+				uint8_t exit = thread->exit && tail == __atomic_load_n(&thread->head, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&thread->lock);
+			if (exit) {
+				break;
+			}
+			continue;
+		}
+		apply(thread, thread->records + (tail & QUEUE_MASK));
+		__atomic_store_n(&thread->tail, ++tail, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void wake(sound_thread *thread)
+{
+	pthread_mutex_lock(&thread->lock);
+		pthread_cond_signal(&thread->work);
+	pthread_mutex_unlock(&thread->lock);
+}
+
+static void push(sound_thread *thread, uint32_t cycle, uint8_t port, uint8_t value)
+{
+	uint32_t head = thread->head;
+	if (head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+		sound_thread_wait(thread);
+	}
+	thread->records[head & QUEUE_MASK] = (sound_record){
+		.cycle = cycle,
+		.port = port,
+		.value = value
+	};
+	__atomic_store_n(&thread->head, ++head, __ATOMIC_SEQ_CST);
+	if (
+		__atomic_load_n(&thread->sleeping, __ATOMIC_SEQ_CST)
+		&& head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) >= WAKE_RECORDS
+	) {
+		wake(thread);
+	}
+}
+
+sound_thread *sound_thread_start(ym2612_context *ym, psg_context *psg, uint32_t max_cycles)
+{
+	sound_thread *thread = calloc(1, sizeof(sound_thread));
+	thread->cpu_ym = ym;
+	thread->psg = psg;
+	thread->max_cycles = max_cycles;
+	thread->last_target = NO_TARGET;
+	thread->audio = render_audio_get_context();
+	//the rendering copy writes to the same audio source and WAVE logs but never to the VGM log
+	thread->ym.audio = ym->audio;
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		thread->ym.channels[i].logfile = ym->channels[i].logfile;
+	}
+	ym_copy_state(&thread->ym, ym);
+	pthread_mutex_init(&thread->lock, NULL);
+	pthread_cond_init(&thread->work, NULL);
+	pthread_cond_init(&thread->idle, NULL);
+	if (pthread_create(&thread->thread, NULL, sound_thread_main, thread)) {
+		pthread_cond_destroy(&thread->idle);
+		pthread_cond_destroy(&thread->work);
+		pthread_mutex_destroy(&thread->lock);
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+void sound_thread_stop(sound_thread *thread)
+{
+	sound_thread_sync(thread);
+	pthread_mutex_lock(&thread->lock);
+		thread->exit = 1;
+		pthread_cond_signal(&thread->work);
+	pthread_mutex_unlock(&thread->lock);
+	pthread_join(thread->thread, NULL);
+	pthread_cond_destroy(&thread->idle);
+	pthread_cond_destroy(&thread->work);
+	pthread_mutex_destroy(&thread->lock);
+	free(thread);
+}
+
+void sound_thread_run(sound_thread *thread, uint32_t cycle)
+{
+	if (cycle != thread->last_target) {
+		thread->last_target = cycle;
+		push(thread, cycle, SOUND_RUN, 0);
+	}
+}
+
+void sound_thread_write(sound_thread *thread, uint32_t cycle, uint8_t port, uint8_t value)
+{
+	push(thread, cycle, port, value);
+}
+
+void sound_thread_ym_reset(sound_thread *thread)
+{
+	push(thread, thread->last_target, SOUND_YM_RESET, 0);
+}
+
+void sound_thread_adjust_cycles(sound_thread *thread, uint32_t deduction)
+{
+	if (thread->last_target != NO_TARGET) {
+		thread->last_target -= deduction;
+	}
+	push(thread, deduction, SOUND_ADJUST, 0);
+}
+
+void sound_thread_wait(sound_thread *thread)
+{
+	if (thread->head == __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	pthread_mutex_lock(&thread->lock);
+		pthread_cond_signal(&thread->work);
+		while (thread->head != __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE))
+		{
+			pthread_cond_wait(&thread->idle, &thread->lock);
+		}
+	pthread_mutex_unlock(&thread->lock);
+}
+
+void sound_thread_sync(sound_thread *thread)
+{
+	sound_thread_wait(thread);
+	//status reads only happen on the emulation thread
+	ym2612_context *ym = thread->cpu_ym;
+	uint32_t last_status_cycle = ym->last_status_cycle;
+	uint8_t last_status = ym->last_status;
+	ym_copy_state(ym, &thread->ym);
+	ym->last_status_cycle = last_status_cycle;
+	ym->last_status = last_status;
+}
+
+void sound_thread_reload(sound_thread *thread)
+{
+	ym_copy_state(&thread->ym, thread->cpu_ym);
+	thread->last_target = NO_TARGET;
+}
@@ -0,0 +1,50 @@
+#ifndef SOUND_THREAD_H_
+#define SOUND_THREAD_H_
+
+#include <stdint.h>
+#include "ym2612.h"
+#include "psg.h"
+
+//Renders the YM2612 and the PSG on a thread of their own. The emulation thread keeps its YM2612
+//context, applies the register writes to it and only runs its timers, which is all that status reads
+//depend on. The writes are also queued for the sound thread, which renders from its own copy of the
+//chip and owns the PSG. Every sync of the emulation thread is queued as a run record so the chips are
+//moved in the same steps sync_sound would have taken and the samples come out the same
+
+enum {
+	SOUND_RUN,
+	SOUND_YM_ADDRESS1,
+	SOUND_YM_ADDRESS2,
+	SOUND_YM_DATA,
+	SOUND_PSG,
+	SOUND_YM_RESET,
+	SOUND_ADJUST
+};
+
+typedef struct {
+	//target of a run, the cycle of a write or the deduction of an adjustment
+	uint32_t cycle;
+	uint8_t  port;
+	uint8_t  value;
+} sound_record;
+
+typedef struct sound_thread sound_thread;
+
+//samples are rendered into the audio context of the calling thread, max_cycles is the largest step
+//the chips are run in, returns NULL if the thread could not be started
+sound_thread *sound_thread_start(ym2612_context *ym, psg_context *psg, uint32_t max_cycles);
+//waits for the queue to drain and leaves the rendered state in ym
+void sound_thread_stop(sound_thread *thread);
+void sound_thread_run(sound_thread *thread, uint32_t cycle);
+void sound_thread_write(sound_thread *thread, uint32_t cycle, uint8_t port, uint8_t value);
+void sound_thread_ym_reset(sound_thread *thread);
+void sound_thread_adjust_cycles(sound_thread *thread, uint32_t deduction);
+//returns once everything queued has been rendered, the PSG can be used on the calling thread until
+//the next record is queued
+void sound_thread_wait(sound_thread *thread);
+//waits and copies the rendered state to the YM2612 context of the emulation thread
+void sound_thread_sync(sound_thread *thread);
+//hands state that was changed on the emulation thread after sound_thread_sync back to the sound thread
+void sound_thread_reload(sound_thread *thread);
+
+#endif //SOUND_THREAD_H_
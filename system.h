@@ -32,10 +32,16 @@ typedef void (*system_mabs_fun)(system_header *, uint8_t, uint16_t, uint16_t);
 typedef void (*system_mrel_fun)(system_header *, uint8_t, int32_t, int32_t);
 typedef uint8_t *(*system_ptrszt_fun_rptr8)(system_header *, size_t *);
 typedef void (*system_ptr8_sizet_fun)(system_header *, uint8_t *, size_t);
+typedef size_t (*system_fun_rsizet)(system_header *);
+typedef uint8_t (*system_ptr_fun_r8)(system_header *, void *);
+typedef uint8_t (*system_cptr_fun_r8)(system_header *, void const *);
+typedef size_t (*system_ptr_fun_rsizet)(system_header *, void *);
+typedef uint8_t (*system_cptr_cptr_fun_r8)(system_header *, void const *, void const *);
 
 #include "arena.h"
 #include "romdb.h"
 #include "event_log.h"
+#include "rewind.h"
 
 struct system_header {
 	system_header           *next_context;
@@ -61,16 +67,24 @@ struct system_header {
 	system_fun              config_updated;
 	system_ptrszt_fun_rptr8 serialize;
 	system_ptr8_sizet_fun   deserialize;
+	system_fun_rsizet       snapshot_size;
+	system_ptr_fun_r8       snapshot;
+	system_cptr_fun_r8      restore;
+	system_ptr_fun_rsizet   snapshot_delta;
+	system_cptr_cptr_fun_r8 restore_delta;
+	system_ptr8_sizet_fun   rewind_record;
 	system_str_fun          start_vgm_log;
 	system_fun              stop_vgm_log;
 	rom_info                info;
 	arena                   *arena;
+	rewind_buffer           *rewind;
 	char                    *next_rom;
 	char                    *save_dir;
 	uint8_t                 enter_debugger;
 	uint8_t                 should_exit;
 	uint8_t                 save_state;
 	uint8_t                 delayed_load_slot;
+	uint8_t                 rewinding;
 	uint8_t                 has_keyboard;
 	uint8_t                 vgm_logging;
 	uint8_t                 force_release;
@@ -88,6 +102,14 @@ struct system_media {
 };
 
 #define OPT_ADDRESS_LOG (1U << 31U)
+#define OPT_FIXED_REGISTERS (1U << 30U)
+#define OPT_NO_DIRECT_MEMORY (1U << 29U)
+#define OPT_NO_COLD_CODE (1U << 28U)
+#define OPT_SOUND_THREAD (1U << 27U)
+#define OPT_RENDER_THREAD (1U << 26U)
+#define OPT_NO_IDLE_SKIP (1U << 25U)
+#define OPT_DEAD_FLAGS (1U << 24U)
+#define OPT_BATCH_CYCLES (1U << 23U)
 
 system_type detect_system_type(system_media *media);
 system_header *alloc_config_system(system_type stype, system_media *media, uint32_t opts, uint8_t force_region);
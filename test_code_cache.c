@@ -0,0 +1,89 @@
+/*
+ Checks that flushing the translated code caches doesn't change what is emulated. The test ROM is
+ run once without a limit on the code caches and once with a budget so small that they are flushed
+ at nearly every frame, and snapshots taken before a flush are restored after it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 120
+#define ROLLBACK_FRAMES 8
+//anything translated goes over this, so the caches are flushed whenever the CPUs allow it
+#define TINY_BUDGET 1
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	int failures = 0;
+	uint32_t expected[NUM_FRAMES];
+	test_run run = {
+		.limit_code_cache = 1,
+		.frames = NUM_FRAMES,
+		.hashes = expected
+	};
+	test_result result;
+	run_test_rom(rom, &run, &result);
+	if (result.m68k.flushes || result.z80.flushes) {
+		puts("FAIL: code cache was flushed without a budget");
+		failures++;
+	}
+
+	run.code_cache_budget = TINY_BUDGET;
+	blastem_instance *inst = setup_test_instance(rom, &run);
+	size_t slot_size = blastem_instance_snapshot_size(inst);
+	uint8_t *slot = malloc(slot_size);
+	int snapshot_frame = -1, rollbacks = 0;
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		if (frame > 8 && snapshot_frame < 0 && blastem_instance_snapshot(inst, slot)) {
+			snapshot_frame = frame;
+		}
+		blastem_instance_run(inst);
+		if (state_hash(inst) != expected[frame]) {
+			printf("FAIL: frame %d differs with a tiny code cache\n", frame);
+			failures++;
+		}
+		if (snapshot_frame >= 0 && frame - snapshot_frame == ROLLBACK_FRAMES) {
+			//a failed restore leaves the state alone, the snapshot was taken while a CPU couldn't be
+			//resumed in retranslated code so just try again with a new one
+			if (blastem_instance_restore(inst, slot)) {
+				for (int resim = snapshot_frame; resim <= frame; resim++)
+				{
+					blastem_instance_run(inst);
+					if (state_hash(inst) != expected[resim]) {
+						printf("FAIL: frame %d differs after restoring a snapshot from before a flush\n", resim);
+						failures++;
+					}
+				}
+				rollbacks++;
+			}
+			snapshot_frame = -1;
+		}
+	}
+	blastem_code_cache_stats m68k, z80;
+	blastem_instance_get_code_cache_stats(inst, &m68k, &z80);
+	printf("68K: %llu bytes translated, %u flushes\n", (unsigned long long)m68k.translated_bytes, m68k.flushes);
+	printf("Z80: %llu bytes translated, %u flushes\n", (unsigned long long)z80.translated_bytes, z80.flushes);
+	printf("%d snapshots restored across flushes\n", rollbacks);
+	if (m68k.flushes < NUM_FRAMES / 2) {
+		puts("FAIL: 68K code cache was not flushed often enough");
+		failures++;
+	}
+	if (!rollbacks) {
+		puts("FAIL: no snapshot could be restored after a flush");
+		failures++;
+	}
+	blastem_instance_destroy(inst);
+	free(slot);
+	free(rom);
+	if (failures) {
+		printf("%d code cache checks failed\n", failures);
+	} else {
+		puts("All frames matched with flushed code caches");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,94 @@
+/*
+ Checks that translated code never runs from memory that is writable at the same time. The test ROM
+ is run in a few instances one after the other, with flushed code caches in every other one so that
+ freed code buffers are handed out again, and the frames of every run have to match. Afterwards no
+ mapping of the process may be both writable and executable and the code has to come from the
+ executable view of the shared code memory, and the ends of both views have to map to each other.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "mem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 60
+#define NUM_RUNS 4
+#define TINY_BUDGET 1
+
+//returns the number of mappings that are writable and executable, sets *code_views to the number
+//of executable and writable views of the code memory
+static int check_mappings(int *code_views)
+{
+	FILE *f = fopen("/proc/self/maps", "r");
+	if (!f) {
+		puts("FAIL: could not read the mappings of the process");
+		exit(1);
+	}
+	char line[1024];
+	int wx = 0;
+	*code_views = 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		char perms[5];
+		if (sscanf(line, "%*x-%*x %4s", perms) != 1) {
+			continue;
+		}
+		if (perms[1] == 'w' && perms[2] == 'x') {
+			printf("FAIL: mapping is writable and executable: %s", line);
+			wx++;
+		}
+		if (strstr(line, "blastem code")) {
+			(*code_views)++;
+		}
+	}
+	fclose(f);
+	return wx;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	int failures = 0;
+	uint32_t expected[NUM_FRAMES], hashes[NUM_FRAMES];
+	test_run setup = {
+		.limit_code_cache = 1,
+		.frames = NUM_FRAMES,
+		.hashes = expected
+	};
+	run_test_rom(rom, &setup, NULL);
+	setup.hashes = hashes;
+	for (int run = 1; run < NUM_RUNS; run++)
+	{
+		setup.code_cache_budget = run & 1 ? TINY_BUDGET : 0;
+		run_test_rom(rom, &setup, NULL);
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			if (hashes[frame] != expected[frame]) {
+				printf("FAIL: frame %d differs in run %d\n", frame, run);
+				failures++;
+				break;
+			}
+		}
+	}
+	free(rom);
+	int code_views;
+	failures += check_mappings(&code_views);
+	if (code_views != 2) {
+		printf("FAIL: found %d views of the code memory instead of 2\n", code_views);
+		failures++;
+	}
+	//an emission that ends flush with the region end leaves its pointer one past the end of a view
+	uint8_t *end = code_region + code_region_size;
+	if (code_writable(end) != end + code_write_offset || code_executable(end + code_write_offset) != end) {
+		puts("FAIL: the ends of the two code views don't map to each other");
+		failures++;
+	}
+	if (failures) {
+		printf("%d code mapping checks failed\n", failures);
+	} else {
+		puts("Translated code ran from memory that was never writable and executable at once");
+	}
+	return failures != 0;
+}
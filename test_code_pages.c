@@ -0,0 +1,172 @@
+/*
+ Checks that pages of RAM whose code keeps being written switch to checked mode and back without
+ changing what is emulated. In the first ROM the 68K copies the same subroutine to work RAM before
+ every call for a while and then only calls it, which has to put its page in checked mode with few
+ retranslations and take it out again once it stops changing. In the second ROM the Z80 keeps
+ incrementing the immediate operand of an instruction it runs right after, and the 68K samples both
+ from Z80 RAM at every pass of its loop.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 150
+//frame by which the 68K is still copying its subroutine
+#define STORM_FRAME 3
+#define COPIES 20000
+#define Z80_FRAMES 30
+
+static const uint8_t m68k_copy_code[] = {
+	0x4D, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$200 lea $FF0000, a6
+	0x7C, 0x00,                                     //$206 moveq #0, d6
+	0x7E, 0x00,                                     //$208 moveq #0, d7
+	0x23, 0xFC, 0x78, 0x05, 0x4E, 0x75,             //$20A copy: move.l #$78054E75, $FF1000
+	0x00, 0xFF, 0x10, 0x00,
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$214 jsr $FF1000
+	0xDC, 0x84,                                     //$21A add.l d4, d6
+	0x52, 0x87,                                     //$21C addq.l #1, d7
+	0x0C, 0x87, 0x00, 0x00, COPIES >> 8, COPIES & 0xFF, //$21E cmpi.l #COPIES, d7
+	0x66, 0xE4,                                     //$224 bne.s copy
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$226 call: jsr $FF1000
+	0xDC, 0x84,                                     //$22C add.l d4, d6
+	0x52, 0x87,                                     //$22E addq.l #1, d7
+	0x2D, 0x46, 0x00, 0x00,                         //$230 move.l d6, 0(a6)
+	0x2D, 0x47, 0x00, 0x04,                         //$234 move.l d7, 4(a6)
+	0x60, 0xEC                                      //$238 bra.s call
+};
+
+static const uint8_t m68k_sample_code[] = {
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$200 move.w #$100, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$208 move.w #$100, $A11200
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$210 btst #0, $A11100
+	0x66, 0xF6,                                     //$218 bne.s $210
+	0x45, 0xF9, 0x00, 0xA0, 0x00, 0x00,             //$21A lea $A00000, a2
+	0x47, 0xF9, 0x00, 0x00, 0x04, 0x00,             //$220 lea z80_code, a3
+	0x72, 0x0D,                                     //$226 moveq #13, d1
+	0x14, 0xDB,                                     //$228 move.b (a3)+, (a2)+
+	0x51, 0xC9, 0xFF, 0xFC,                         //$22A dbra d1, $228
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x12, 0x00, //$22E move.w #0, $A11200
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$236 move.w #0, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$23E move.w #$100, $A11200
+	0x4D, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$246 lea $FF0000, a6
+	0x30, 0x3C, 0x07, 0xFF,                         //$24C loop: move.w #$7FF, d0
+	0x51, 0xC8, 0xFF, 0xFE,                         //$250 dbra d0, $250
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$254 move.w #$100, $A11100
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$25C btst #0, $A11100
+	0x66, 0xF6,                                     //$264 bne.s $25C
+	0x1D, 0x79, 0x00, 0xA0, 0x00, 0x08, 0x00, 0x00, //$266 move.b $A00008, 0(a6)
+	0x1D, 0x79, 0x00, 0xA0, 0x10, 0x00, 0x00, 0x01, //$26E move.b $A01000, 1(a6)
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$276 move.w #0, $A11100
+	0x52, 0x6E, 0x00, 0x02,                         //$27E addq.w #1, 2(a6)
+	0x60, 0xC8                                      //$282 bra.s loop
+};
+
+static const uint8_t z80_code[] = {
+	0x21, 0x08, 0x00, //$00 ld hl, $0008
+	0x34,             //$03 loop: inc (hl)
+	0x00, 0x00, 0x00, //$04 nop
+	0x3E, 0x00,       //$07 ld a, 0
+	0x32, 0x00, 0x10, //$09 ld ($1000), a
+	0x18, 0xF5        //$0C jr loop
+};
+
+static int run_copy_rom(void)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_copy_code, sizeof(m68k_copy_code));
+	blastem_instance *inst = start_test_instance(rom, TEST_ROM_SIZE);
+	int failures = 0;
+	blastem_code_cache_stats m68k, z80;
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		blastem_instance_run(inst);
+		if (frame == STORM_FRAME) {
+			blastem_instance_get_code_cache_stats(inst, &m68k, &z80);
+			if (!m68k.checked_pages) {
+				puts("FAIL: page of a subroutine copied over and over is not in checked mode");
+				failures++;
+			}
+		}
+	}
+	uint16_t *ram = blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM);
+	uint32_t sum = read_long(ram, 0), calls = read_long(ram, 4);
+	blastem_instance_get_code_cache_stats(inst, &m68k, &z80);
+	blastem_instance_destroy(inst);
+	free(rom);
+	printf("68K: %u calls, %llu instructions retranslated, %u pages checked at the end\n", calls,
+		(unsigned long long)m68k.retranslations, m68k.checked_pages);
+	if (calls <= COPIES) {
+		puts("FAIL: 68K did not get through the copies");
+		failures++;
+	}
+	if (sum != calls * 5) {
+		printf("FAIL: sum is %u instead of %u\n", sum, calls * 5);
+		failures++;
+	}
+	if (m68k.retranslations > COPIES / 10) {
+		puts("FAIL: too many retranslations of a subroutine copied over and over");
+		failures++;
+	}
+	if (m68k.checked_pages) {
+		puts("FAIL: page is still in checked mode after its code stopped changing");
+		failures++;
+	}
+	return failures;
+}
+
+static int run_sample_rom(void)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_sample_code, sizeof(m68k_sample_code));
+	memcpy(rom + Z80_CODE_START, z80_code, sizeof(z80_code));
+	blastem_instance *inst = start_test_instance(rom, TEST_ROM_SIZE);
+	int failures = 0;
+	uint8_t first = 0, last = 0;
+	uint16_t *ram = blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM);
+	for (int frame = 0; frame < Z80_FRAMES; frame++)
+	{
+		blastem_instance_run(inst);
+		//the Z80 can be stopped between the increment and the store
+		uint8_t immediate = ram[0] >> 8, stored = ram[0];
+		if (stored != immediate && stored != (uint8_t)(immediate - 1)) {
+			printf("FAIL: Z80 stored %X after changing its code to load %X at frame %d\n", stored, immediate, frame);
+			failures++;
+			break;
+		}
+		if (!frame) {
+			first = immediate;
+		}
+		last = immediate;
+	}
+	blastem_code_cache_stats m68k, z80;
+	blastem_instance_get_code_cache_stats(inst, &m68k, &z80);
+	uint16_t samples = ram[1];
+	blastem_instance_destroy(inst);
+	free(rom);
+	printf("Z80: %u samples, %llu instructions retranslated, %u pages checked\n", samples,
+		(unsigned long long)z80.retranslations, z80.checked_pages);
+	if (!samples || first == last) {
+		puts("FAIL: Z80 code did not keep changing");
+		failures++;
+	}
+	if (!z80.checked_pages) {
+		puts("FAIL: page of Z80 code that keeps changing is not in checked mode");
+		failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = run_copy_rom();
+	failures += run_sample_rom();
+	if (failures) {
+		printf("%d code page checks failed\n", failures);
+	} else {
+		puts("Code that kept being written ran correctly in and out of checked mode");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,165 @@
+/*
+ Checks that 68K code loaded from a code store runs exactly like freshly translated code and that
+ stores which don't match are ignored. The test ROM is run once to create a store, then again with
+ the store loaded, then with a corrupted store, a truncated store and the store of a different ROM.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 120
+//somewhere in the cartridge header that the test ROM doesn't look at
+#define UNUSED_ROM_BYTE 0x1C8
+
+//runs NUM_FRAMES frames of rom with a code store in dir and returns the 68K cache stats
+static blastem_code_cache_stats run_rom(uint8_t *rom, char *dir, uint32_t *hashes)
+{
+	test_run run = {
+		.code_store = dir,
+		.frames = NUM_FRAMES,
+		.hashes = hashes
+	};
+	test_result result;
+	run_test_rom(rom, &run, &result);
+	return result.m68k;
+}
+
+static int compare_run(char *name, uint32_t *expected, uint32_t *hashes)
+{
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		if (hashes[frame] != expected[frame]) {
+			printf("FAIL: frame %d differs %s\n", frame, name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//returns the path of the only store file in dir
+static char *find_store(char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	char *path = NULL;
+	while ((entry = readdir(d)))
+	{
+		if (entry->d_name[0] != '.') {
+			path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+			sprintf(path, "%s/%s", dir, entry->d_name);
+			break;
+		}
+	}
+	closedir(d);
+	return path;
+}
+
+static long read_file(char *path, uint8_t **data)
+{
+	FILE *f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*data = malloc(size);
+	if (fread(*data, 1, size, f) != size) {
+		size = 0;
+	}
+	fclose(f);
+	return size;
+}
+
+static void write_file(char *path, uint8_t *data, long size)
+{
+	FILE *f = fopen(path, "wb");
+	fwrite(data, 1, size, f);
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	char dir[] = "/tmp/test_code_store.XXXXXX";
+	if (!mkdtemp(dir)) {
+		puts("FAIL: could not create a directory for the code store");
+		return 1;
+	}
+	int failures = 0;
+	uint32_t expected[NUM_FRAMES], hashes[NUM_FRAMES];
+	blastem_code_cache_stats first = run_rom(rom, dir, expected);
+	char *path = find_store(dir);
+	if (!path) {
+		puts("FAIL: no code store was saved");
+		return 1;
+	}
+	if (first.loaded_bytes) {
+		puts("FAIL: code was loaded from an empty directory");
+		failures++;
+	}
+
+	blastem_code_cache_stats second = run_rom(rom, dir, hashes);
+	failures += compare_run("with stored code", expected, hashes);
+	printf("68K: %llu bytes translated without a store, %llu translated and %llu loaded with one\n",
+		(unsigned long long)first.translated_bytes, (unsigned long long)second.translated_bytes,
+		(unsigned long long)second.loaded_bytes);
+	if (!second.loaded_bytes || second.translated_bytes >= first.translated_bytes) {
+		puts("FAIL: stored code was not used");
+		failures++;
+	}
+
+	uint8_t *data;
+	long size = read_file(path, &data);
+	//the code is at the end of the file
+	data[size - 1] ^= 0xFF;
+	write_file(path, data, size);
+	free(data);
+	blastem_code_cache_stats stats = run_rom(rom, dir, hashes);
+	failures += compare_run("with a corrupted store", expected, hashes);
+	if (stats.loaded_bytes) {
+		puts("FAIL: corrupted store was loaded");
+		failures++;
+	}
+
+	//the previous run saved a good store again
+	size = read_file(path, &data);
+	write_file(path, data, size / 2);
+	free(data);
+	stats = run_rom(rom, dir, hashes);
+	failures += compare_run("with a truncated store", expected, hashes);
+	if (stats.loaded_bytes) {
+		puts("FAIL: truncated store was loaded");
+		failures++;
+	}
+
+	//the store of this ROM under the name of a slightly different one
+	size = read_file(path, &data);
+	unlink(path);
+	rom[UNUSED_ROM_BYTE] ^= 0xFF;
+	uint32_t other_expected[NUM_FRAMES];
+	run_rom(rom, dir, other_expected);
+	char *other_path = find_store(dir);
+	write_file(other_path, data, size);
+	free(data);
+	stats = run_rom(rom, dir, hashes);
+	failures += compare_run("with the store of another ROM", other_expected, hashes);
+	if (stats.loaded_bytes) {
+		puts("FAIL: store of another ROM was loaded");
+		failures++;
+	}
+
+	unlink(other_path);
+	rmdir(dir);
+	free(other_path);
+	free(path);
+	free(rom);
+	if (failures) {
+		printf("%d code store checks failed\n", failures);
+	} else {
+		puts("Stored code matched and mismatched stores were rejected");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,143 @@
+/*
+ Checks that placing interrupt checks and traps in cold code doesn't change what is emulated. The test
+ ROM's 68K program is replaced with a loop that takes the CHK and divide by zero traps in some of its
+ iterations. It is run with cold code turned off and on, the trap count and sum it leaves in work RAM
+ have to match the same loop written in C both times, and the code that normally runs has to take
+ fewer host bytes per instruction once the cold paths are moved out of it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 30
+#define ITERATIONS 5000
+
+static const uint8_t m68k_code[] = {
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00, //$200 lea $FF0000, a5
+	0x70, 0x00,                         //$206 moveq #0, d0
+	0x74, 0x00,                         //$208 moveq #0, d2
+	0x76, 0x00,                         //$20A moveq #0, d3
+	0x32, 0x00,                         //$20C loop: move.w d0, d1
+	0x02, 0x41, 0x00, 0x07,             //$20E andi.w #7, d1
+	0x55, 0x41,                         //$212 subq.w #2, d1
+	0x43, 0xBC, 0x00, 0x03,             //$214 chk.w #3, d1
+	0xD6, 0x41,                         //$218 add.w d1, d3
+	0x38, 0x00,                         //$21A move.w d0, d4
+	0x02, 0x44, 0x00, 0x03,             //$21C andi.w #3, d4
+	0x2A, 0x3C, 0x00, 0x00, 0x00, 0x64, //$220 move.l #100, d5
+	0x8A, 0xC4,                         //$226 divu.w d4, d5
+	0xD6, 0x45,                         //$228 add.w d5, d3
+	0x52, 0x80,                         //$22A addq.l #1, d0
+	0x0C, 0x80, 0x00, 0x00, 0x13, 0x88, //$22C cmpi.l #ITERATIONS, d0
+	0x66, 0xD8,                         //$232 bne.s loop
+	0x2A, 0x83,                         //$234 move.l d3, (a5)
+	0x2B, 0x42, 0x00, 0x04,             //$236 move.l d2, 4(a5)
+	0x1B, 0x7C, 0x00, 0x01, 0x00, 0x08, //$23A move.b #1, 8(a5)
+	0x60, 0xFE,                         //$240 bra.s *
+	0x52, 0x82,                         //$242 trap: addq.l #1, d2
+	0x4E, 0x73                          //$244 rte
+};
+#define TRAP_HANDLER 0x242
+#define VECTOR_DIV_ZERO 5
+#define VECTOR_CHK 6
+
+//what the 68K program leaves in d3 and d2
+static uint32_t expected_sum(uint32_t *traps)
+{
+	uint16_t d3 = 0;
+	*traps = 0;
+	for (uint32_t d0 = 0; d0 < ITERATIONS; d0++)
+	{
+		int16_t d1 = (d0 & 7) - 2;
+		if (d1 < 0 || d1 > 3) {
+			(*traps)++;
+		}
+		d3 += d1;
+		uint16_t d4 = d0 & 3;
+		if (d4) {
+			d3 += 100 / d4;
+		} else {
+			//the destination is left alone when the trap is taken
+			(*traps)++;
+			d3 += 100;
+		}
+	}
+	return d3;
+}
+
+static void set_vector(uint8_t *rom, uint32_t vector, uint32_t address)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		rom[vector * 4 + i] = address >> (24 - 8 * i);
+	}
+}
+
+static int run_rom(uint8_t *rom, bool cold, char *name, blastem_code_cache_stats *m68k)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_cold_code,
+		.option_name = "cold code",
+		.option = cold,
+		.frames = NUM_FRAMES
+	};
+	test_result state;
+	run_test_rom(rom, &run, &state);
+	uint32_t sum = read_long(state.ram, 0), traps = read_long(state.ram, 4);
+	uint8_t done = state.ram[4] >> 8;
+	*m68k = state.m68k;
+	printf("%s: %llu instructions translated to %llu bytes, %llu of them cold\n", name,
+		(unsigned long long)m68k->translated_insts, (unsigned long long)m68k->translated_bytes,
+		(unsigned long long)m68k->cold_bytes);
+	if (!done) {
+		printf("FAIL: loop did not finish %s\n", name);
+		return 1;
+	}
+	uint32_t expected_traps;
+	uint32_t expected = expected_sum(&expected_traps);
+	if (sum != expected || traps != expected_traps) {
+		printf("FAIL: sum is %X after %u traps instead of %X after %u %s\n", sum, traps, expected, expected_traps, name);
+		return 1;
+	}
+	return 0;
+}
+
+//host bytes per instruction of the code that normally runs
+static double hot_density(blastem_code_cache_stats *stats)
+{
+	return (double)(stats->translated_bytes - stats->cold_bytes) / stats->translated_insts;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	set_vector(rom, VECTOR_DIV_ZERO, TRAP_HANDLER);
+	set_vector(rom, VECTOR_CHK, TRAP_HANDLER);
+	int failures = 0;
+	blastem_code_cache_stats inline_stats, cold_stats;
+	failures += run_rom(rom, 0, "with inline cold paths", &inline_stats);
+	failures += run_rom(rom, 1, "with cold code", &cold_stats);
+	if (inline_stats.cold_bytes) {
+		puts("FAIL: code was placed in cold code while it was turned off");
+		failures++;
+	}
+	if (!cold_stats.cold_bytes || !cold_stats.translated_insts || !inline_stats.translated_insts) {
+		puts("FAIL: cold code or translated instructions were not counted");
+		failures++;
+	} else if (hot_density(&cold_stats) >= hot_density(&inline_stats)) {
+		printf("FAIL: %.2f bytes per instruction with cold code, %.2f without\n", hot_density(&cold_stats),
+			hot_density(&inline_stats));
+		failures++;
+	}
+	free(rom);
+	if (failures) {
+		printf("%d cold code checks failed\n", failures);
+	} else {
+		puts("Traps and interrupt checks matched with cold code");
+	}
+	return failures != 0;
+}
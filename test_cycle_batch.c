@@ -0,0 +1,115 @@
+/*
+ Checks that translating 68K instructions in batches that share a single cycle check doesn't change
+ when interrupts are taken. The test ROM's 68K program is replaced with a loop of register
+ instructions that is interrupted on every line, and the interrupt handler folds the registers it
+ interrupted into a hash in work RAM. Every frame has to match a run with batching turned off.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 60
+
+static const uint8_t m68k_code[] = {
+	0x41, 0xF9, 0x00, 0xC0, 0x00, 0x04, //$200 lea $C00004, a0
+	0x30, 0xBC, 0x80, 0x14,             //$206 move.w #$8014, (a0)
+	0x30, 0xBC, 0x8A, 0x00,             //$20A move.w #$8A00, (a0)
+	0x30, 0xBC, 0x81, 0x64,             //$20E move.w #$8164, (a0)
+	0x70, 0x00,                         //$212 moveq #0, d0
+	0x72, 0x00,                         //$214 moveq #0, d1
+	0x7C, 0x00,                         //$216 moveq #0, d6
+	0x7E, 0x00,                         //$218 moveq #0, d7
+	0x46, 0xFC, 0x20, 0x00,             //$21A move #$2000, sr
+	0x52, 0x80,                         //$21E loop: addq.l #1, d0
+	0xD2, 0x80,                         //$220 add.l d0, d1
+	0x56, 0x80,                         //$222 addq.l #3, d0
+	0xE3, 0x89,                         //$224 lsl.l #1, d1
+	0x5A, 0x80,                         //$226 addq.l #5, d0
+	0x48, 0x41,                         //$228 swap d1
+	0x5E, 0x80,                         //$22A addq.l #7, d0
+	0x46, 0x81,                         //$22C not.l d1
+	0x60, 0xEE                          //$22E bra.s loop
+};
+
+static const uint8_t hint_code[] = {
+	0xDC, 0x80,                         //add.l d0, d6
+	0xB3, 0x86,                         //eor.l d1, d6
+	0xE7, 0x9E,                         //rol.l #3, d6
+	0x52, 0x87,                         //addq.l #1, d7
+	0x4E, 0x73                          //rte
+};
+#define HINT_START 0x240
+
+static const uint8_t vint_code[] = {
+	0x23, 0xC6, 0x00, 0xFF, 0x00, 0x00, //move.l d6, $FF0000
+	0x23, 0xC7, 0x00, 0xFF, 0x00, 0x04, //move.l d7, $FF0004
+	0x4E, 0x73                          //rte
+};
+#define VINT_START 0x260
+
+#define HINT_VECTOR 0x70
+#define VINT_VECTOR 0x78
+
+static void set_vector(uint8_t *rom, uint32_t vector, uint32_t address)
+{
+	rom[vector] = address >> 24;
+	rom[vector + 1] = address >> 16;
+	rom[vector + 2] = address >> 8;
+	rom[vector + 3] = address;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	memcpy(rom + HINT_START, hint_code, sizeof(hint_code));
+	memcpy(rom + VINT_START, vint_code, sizeof(vint_code));
+	set_vector(rom, HINT_VECTOR, HINT_START);
+	set_vector(rom, VINT_VECTOR, VINT_START);
+	int failures = 0;
+	uint32_t expected[NUM_FRAMES], hashes[NUM_FRAMES];
+	test_run run = {
+		.set_option = blastem_instance_set_cycle_batching,
+		.option_name = "cycle batching",
+		.frames = NUM_FRAMES,
+		.hashes = expected
+	};
+	test_result result;
+	run_test_rom(rom, &run, &result);
+	if (result.m68k.batched_checks) {
+		puts("FAIL: checks were batched with batching turned off");
+		failures++;
+	}
+	run.option = true;
+	run.hashes = hashes;
+	run_test_rom(rom, &run, &result);
+	blastem_code_cache_stats m68k = result.m68k;
+	uint32_t interrupts = read_long(result.ram, 4);
+	printf("%llu cycle checks batched, %u line interrupts taken\n", (unsigned long long)m68k.batched_checks, interrupts);
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		if (hashes[frame] != expected[frame]) {
+			printf("FAIL: frame %d differs with batched cycle checks\n", frame);
+			failures++;
+			break;
+		}
+	}
+	if (!m68k.batched_checks) {
+		puts("FAIL: no cycle checks were batched");
+		failures++;
+	}
+	if (interrupts < NUM_FRAMES * 100) {
+		puts("FAIL: line interrupts were not taken");
+		failures++;
+	}
+	free(rom);
+	if (failures) {
+		printf("%d cycle batching checks failed\n", failures);
+	} else {
+		puts("All frames matched with batched cycle checks");
+	}
+	return failures != 0;
+}
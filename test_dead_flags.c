@@ -0,0 +1,144 @@
+/*
+ Checks the 68K translator's flag liveness pass. The test ROM's 68K program is replaced with a loop
+ of register arithmetic, shifts and rotates where most flags are overwritten before anything reads
+ them, but X is carried from one instruction to a later ADDX or ROXx. The result it leaves in work
+ RAM is compared with the same loop written in C, once with an unlimited code cache and once with
+ the cache flushed at nearly every frame, and some flag updates have to be left out of the code.
+ A last run with the pass turned off must leave every flag update in.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 30
+#define ITERATIONS 5000
+#define TINY_BUDGET 1
+
+static const uint8_t m68k_code[] = {
+	0x44, 0xFC, 0x00, 0x00,             //$200 move #0, ccr
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00, //$204 lea $FF0000, a5
+	0x70, 0x00,                         //$20A moveq #0, d0
+	0x72, 0x01,                         //$20C moveq #1, d1
+	0x24, 0x3C, 0x12, 0x34, 0x56, 0x78, //$20E move.l #$12345678, d2
+	0x7A, 0x05,                         //$214 moveq #5, d5
+	0x3E, 0x3C, 0x13, 0x88,             //$216 move.w #ITERATIONS, d7
+	0xD2, 0x82,                         //$21A loop: add.l d2, d1
+	0x26, 0x01,                         //$21C move.l d1, d3
+	0xD1, 0x83,                         //$21E addx.l d3, d0
+	0xE7, 0x8A,                         //$220 lsl.l #3, d2
+	0xE3, 0x93,                         //$222 roxl.l #1, d3
+	0xB7, 0x82,                         //$224 eor.l d3, d2
+	0xEA, 0xB9,                         //$226 ror.l d5, d1
+	0xE4, 0x90,                         //$228 roxr.l #2, d0
+	0xD4, 0x83,                         //$22A add.l d3, d2
+	0x53, 0x47,                         //$22C subq.w #1, d7
+	0x66, 0xEA,                         //$22E bne.s loop
+	0x2A, 0x80,                         //$230 move.l d0, (a5)
+	0x2B, 0x41, 0x00, 0x04,             //$232 move.l d1, 4(a5)
+	0x2B, 0x42, 0x00, 0x08,             //$236 move.l d2, 8(a5)
+	0x1B, 0x7C, 0x00, 0x01, 0x00, 0x0C, //$23A move.b #1, 12(a5)
+	0x60, 0xFE                          //$240 bra.s *
+};
+
+//what the 68K program leaves in d0-d2
+static void expected_result(uint32_t *d)
+{
+	uint32_t d0 = 0, d1 = 1, d2 = 0x12345678, d3, x = 0;
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		uint64_t sum = (uint64_t)d1 + d2;
+		d1 = sum;
+		x = sum >> 32;
+		d3 = d1;
+		sum = (uint64_t)d0 + d3 + x;
+		d0 = sum;
+		x = sum >> 32;
+		x = d2 >> 29 & 1;
+		d2 <<= 3;
+		uint32_t out = d3 >> 31;
+		d3 = d3 << 1 | x;
+		x = out;
+		d2 ^= d3;
+		d1 = d1 >> 5 | d1 << 27;
+		for (int bit = 0; bit < 2; bit++)
+		{
+			out = d0 & 1;
+			d0 = d0 >> 1 | x << 31;
+			x = out;
+		}
+		d2 += d3;
+		//subq.w leaves X clear since the counter never goes below 0
+	}
+	d[0] = d0;
+	d[1] = d1;
+	d[2] = d2;
+}
+
+static int run_rom(uint8_t *rom, size_t budget, bool dead_flags, char *name, blastem_code_cache_stats *m68k)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_dead_flags,
+		.option_name = "flag liveness",
+		.option = dead_flags,
+		.limit_code_cache = 1,
+		.code_cache_budget = budget,
+		.frames = NUM_FRAMES
+	};
+	test_result state;
+	run_test_rom(rom, &run, &state);
+	uint32_t result[3], expected[3];
+	for (int i = 0; i < 3; i++)
+	{
+		result[i] = read_long(state.ram, i * 4);
+	}
+	uint8_t done = state.ram[6] >> 8;
+	*m68k = state.m68k;
+	printf("%s: %llu flag updates skipped, %u flushes\n", name,
+		(unsigned long long)m68k->skipped_flags, m68k->flushes);
+	if (!done) {
+		printf("FAIL: loop did not finish %s\n", name);
+		return 1;
+	}
+	expected_result(expected);
+	for (int i = 0; i < 3; i++)
+	{
+		if (result[i] != expected[i]) {
+			printf("FAIL: d%d is %X instead of %X %s\n", i, result[i], expected[i], name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	int failures = 0;
+	blastem_code_cache_stats m68k;
+	failures += run_rom(rom, 0, 1, "without flushes", &m68k);
+	if (!m68k.skipped_flags) {
+		puts("FAIL: no flag updates were skipped");
+		failures++;
+	}
+	failures += run_rom(rom, TINY_BUDGET, 1, "with flushes", &m68k);
+	if (m68k.flushes < NUM_FRAMES / 2) {
+		puts("FAIL: code cache was not flushed often enough");
+		failures++;
+	}
+	failures += run_rom(rom, 0, 0, "with flag liveness off", &m68k);
+	if (m68k.skipped_flags) {
+		puts("FAIL: flag updates were skipped with flag liveness off");
+		failures++;
+	}
+	free(rom);
+	if (failures) {
+		printf("%d flag liveness checks failed\n", failures);
+	} else {
+		puts("Results matched with unneeded flag updates left out");
+	}
+	return failures != 0;
+}
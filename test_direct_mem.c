@@ -0,0 +1,141 @@
+/*
+ Checks that 68K code reading and writing ROM and work RAM without the memory handlers behaves like
+ code that calls them. The test ROM's 68K program is replaced with one that sums a table in ROM with
+ long and byte reads, writes bytes and words to work RAM through its mirror, reads longs that wrap
+ around the end of work RAM and its mirror and keeps patching a subroutine it has copied to work
+ RAM. What it leaves in work RAM is compared with the values worked out in C and between runs with
+ direct accesses turned off and on, frame by frame.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 30
+
+static const uint8_t m68k_code[] = {
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$200 lea $FF0000, a5
+	0x3A, 0xBC, 0x5A, 0x5A,                         //$206 move.w #$5A5A, (a5)
+	0x41, 0xF9, 0x00, 0x00, 0x03, 0x00,             //$20A lea table, a0
+	0x70, 0x00,                                     //$210 moveq #0, d0
+	0x72, 0x07,                                     //$212 moveq #7, d1
+	0xD0, 0x98,                                     //$214 add.l (a0)+, d0
+	0x51, 0xC9, 0xFF, 0xFC,                         //$216 dbra d1, $214
+	0x2B, 0x40, 0x00, 0x10,                         //$21A move.l d0, $10(a5)
+	0x41, 0xF9, 0x00, 0x00, 0x03, 0x00,             //$21E lea table, a0
+	0x74, 0x00,                                     //$224 moveq #0, d2
+	0x72, 0x1F,                                     //$226 moveq #31, d1
+	0xD4, 0x18,                                     //$228 add.b (a0)+, d2
+	0x51, 0xC9, 0xFF, 0xFC,                         //$22A dbra d1, $228
+	0x1B, 0x42, 0x00, 0x14,                         //$22E move.b d2, $14(a5)
+	0x3B, 0x7C, 0x12, 0x34, 0x00, 0x20,             //$232 move.w #$1234, $20(a5)
+	0x1B, 0x7C, 0x00, 0x56, 0x00, 0x23,             //$238 move.b #$56, $23(a5)
+	0x1B, 0x7C, 0x00, 0x78, 0x00, 0x22,             //$23E move.b #$78, $22(a5)
+	0x26, 0x39, 0x00, 0xE0, 0x00, 0x20,             //$244 move.l $E00020, d3
+	0x2B, 0x43, 0x00, 0x24,                         //$24A move.l d3, $24(a5)
+	0x13, 0xFC, 0x00, 0x9A, 0x00, 0xE0, 0x00, 0x25, //$24E move.b #$9A, $E00025
+	0x33, 0xFC, 0xAB, 0xCD, 0x00, 0xFF, 0xFF, 0xFE, //$256 move.w #$ABCD, $FFFFFE
+	0x26, 0x39, 0x00, 0xFF, 0xFF, 0xFE,             //$25E move.l $FFFFFE, d3
+	0x2B, 0x43, 0x00, 0x28,                         //$264 move.l d3, $28(a5)
+	0x26, 0x39, 0x00, 0xE0, 0xFF, 0xFE,             //$268 move.l $E0FFFE, d3
+	0x2B, 0x43, 0x00, 0x2C,                         //$26E move.l d3, $2C(a5)
+	0x23, 0xFC, 0x78, 0x05, 0x4E, 0x75,             //$272 move.l #$78054E75, $FF1000
+	0x00, 0xFF, 0x10, 0x00,
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$27C jsr $FF1000
+	0x2A, 0x04,                                     //$282 move.l d4, d5
+	0x13, 0xFC, 0x00, 0x09, 0x00, 0xFF, 0x10, 0x01, //$284 move.b #9, $FF1001
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$28C jsr $FF1000
+	0x1B, 0x45, 0x00, 0x30,                         //$292 move.b d5, $30(a5)
+	0x1B, 0x44, 0x00, 0x31,                         //$296 move.b d4, $31(a5)
+	0x23, 0xFC, 0x78, 0x0C, 0x4E, 0x75,             //$29A move.l #$780C4E75, $FF1000
+	0x00, 0xFF, 0x10, 0x00,
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$2A4 jsr $FF1000
+	0x1B, 0x44, 0x00, 0x32,                         //$2AA move.b d4, $32(a5)
+	0x33, 0xFC, 0x78, 0x11, 0x00, 0xFF, 0x10, 0x00, //$2AE move.w #$7811, $FF1000
+	0x4E, 0xB9, 0x00, 0xFF, 0x10, 0x00,             //$2B6 jsr $FF1000
+	0x1B, 0x44, 0x00, 0x33,                         //$2BC move.b d4, $33(a5)
+	0x52, 0x6D, 0x00, 0x36,                         //$2C0 addq.w #1, $36(a5)
+	0x60, 0x00, 0xFF, 0x3A                          //$2C4 bra.w $200
+};
+#define TABLE_START 0x300
+#define TABLE_SIZE 32
+
+static int check_long(uint16_t *ram, uint32_t offset, uint32_t expected, char *what, char *name)
+{
+	uint32_t value = read_long(ram, offset);
+	if (value != expected) {
+		printf("FAIL: %s is %X instead of %X %s\n", what, value, expected, name);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_rom(uint8_t *rom, bool direct, char *name, uint32_t *hashes)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_direct_memory,
+		.option_name = "direct memory access",
+		.option = direct,
+		.frames = NUM_FRAMES,
+		.hashes = hashes
+	};
+	test_result state;
+	run_test_rom(rom, &run, &state);
+	uint16_t *ram = state.ram;
+	uint32_t sum = 0;
+	uint8_t byte_sum = 0;
+	for (int i = 0; i < TABLE_SIZE; i++)
+	{
+		byte_sum += rom[TABLE_START + i];
+	}
+	for (int i = 0; i < TABLE_SIZE; i += 4)
+	{
+		sum += rom[TABLE_START + i] << 24 | rom[TABLE_START + i + 1] << 16 | rom[TABLE_START + i + 2] << 8 | rom[TABLE_START + i + 3];
+	}
+	int failures = 0;
+	failures += check_long(ram, 0x10, sum, "long sum of the ROM table", name);
+	failures += check_long(ram, 0x14, byte_sum << 24, "byte sum of the ROM table", name);
+	failures += check_long(ram, 0x20, 0x12347856, "long read through the work RAM mirror", name);
+	failures += check_long(ram, 0x24, 0x129A7856, "byte written through the work RAM mirror", name);
+	failures += check_long(ram, 0x28, 0xABCD0000 | rom[0] << 8 | rom[1], "long read wrapping around to ROM", name);
+	failures += check_long(ram, 0x2C, 0xABCD5A5A, "long read wrapping around the mirror", name);
+	failures += check_long(ram, 0x30, 0x05090C11, "patched subroutine results", name);
+	uint16_t passes = ram[0x36 / 2];
+	printf("%s: %u passes\n", name, passes);
+	if (!passes) {
+		printf("FAIL: loop did not finish %s\n", name);
+		failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	for (int i = 0; i < TABLE_SIZE; i++)
+	{
+		rom[TABLE_START + i] = i * 37 + 0x81;
+	}
+	int failures = 0;
+	uint32_t expected[NUM_FRAMES], hashes[NUM_FRAMES];
+	failures += run_rom(rom, 0, "through the memory handlers", expected);
+	failures += run_rom(rom, 1, "with direct accesses", hashes);
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		if (hashes[frame] != expected[frame]) {
+			printf("FAIL: frame %d differs with direct accesses\n", frame);
+			failures++;
+			break;
+		}
+	}
+	free(rom);
+	if (failures) {
+		printf("%d direct memory checks failed\n", failures);
+	} else {
+		puts("Work RAM and ROM accesses matched with and without the memory handlers");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,142 @@
+/*
+ Checks that skipping passes through Z80 idle loops doesn't change what is emulated. Two ROMs are run
+ with the skipping turned off and on and their save states have to match after every frame. The Z80
+ test ROM's driver waits in an idle loop for the tick counted by its vertical interrupt handler. In
+ the second ROM the Z80 keeps interrupts off and waits for a byte the 68K writes to Z80 RAM after
+ delays of varying length, counting every change it sees for the 68K to copy to work RAM.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 60
+
+static const uint8_t m68k_code[] = {
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$200 move.w #$100, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$208 move.w #$100, $A11200
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$210 btst #0, $A11100
+	0x66, 0xF6,                                     //$218 bne.s *-8
+	0x45, 0xF9, 0x00, 0xA0, 0x00, 0x00,             //$21A lea $A00000, a2
+	0x47, 0xF9, 0x00, 0x00, Z80_CODE_START >> 8, Z80_CODE_START & 0xFF, //$220 lea Z80_CODE_START, a3
+	0x32, 0x3C, 0x00, 0x12,                         //$226 move.w #size-1, d1
+	0x14, 0xDB,                                     //$22A move.b (a3)+, (a2)+
+	0x51, 0xC9, 0xFF, 0xFC,                         //$22C dbra d1, *-2
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x12, 0x00, //$230 move.w #0, $A11200
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$238 move.w #0, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$240 move.w #$100, $A11200
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$248 lea $FF0000, a5
+	0x70, 0x00,                                     //$24E moveq #0, d0
+	0x34, 0x00,                                     //$250 loop: move.w d0, d2
+	0xC4, 0xFC, 0x00, 0x25,                         //$252 mulu.w #37, d2
+	0x02, 0x42, 0x00, 0xFF,                         //$256 andi.w #$FF, d2
+	0x51, 0xCA, 0xFF, 0xFE,                         //$25A dbra d2, *
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$25E move.w #$100, $A11100
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$266 btst #0, $A11100
+	0x66, 0xF6,                                     //$26E bne.s *-8
+	0x52, 0x00,                                     //$270 addq.b #1, d0
+	0x13, 0xC0, 0x00, 0xA0, 0x10, 0x00,             //$272 move.b d0, $A01000
+	0x1A, 0xB9, 0x00, 0xA0, 0x10, 0x01,             //$278 move.b $A01001, (a5)
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$27E move.w #0, $A11100
+	0x60, 0xC8                                      //$286 bra.s loop
+};
+
+static const uint8_t z80_code[] = {
+	0xF3,             //$00 di
+	0x06, 0x00,       //$01 ld b, 0
+	0x3A, 0x00, 0x10, //$03 idle: ld a, ($1000)
+	0xB8,             //$06 cp b
+	0x28, 0xFA,       //$07 jr z, idle
+	0x47,             //$09 ld b, a
+	0x3A, 0x01, 0x10, //$0A ld a, ($1001)
+	0x3C,             //$0D inc a
+	0x32, 0x01, 0x10, //$0E ld ($1001), a
+	0x18, 0xF0        //$11 jr idle
+};
+
+static uint64_t idle_loops(blastem_instance *inst)
+{
+	blastem_code_cache_stats m68k, z80;
+	if (!blastem_instance_get_code_cache_stats(inst, &m68k, &z80)) {
+		return 0;
+	}
+	return z80.idle_loops;
+}
+
+//runs rom with and without skipping, returns the number of failures
+static int compare_runs(uint8_t *rom, char *name, uint8_t *changes)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_idle_skip,
+		.option_name = "idle loop skipping"
+	};
+	blastem_instance *full = setup_test_instance(rom, &run);
+	run.option = 1;
+	blastem_instance *skip = setup_test_instance(rom, &run);
+	size_t size = blastem_instance_serialize_size(full);
+	if (size != blastem_instance_serialize_size(skip)) {
+		printf("FAIL: save states of %s have different sizes\n", name);
+		return 1;
+	}
+	uint8_t *full_state = malloc(size), *skip_state = malloc(size);
+	int failures = 0;
+	for (int frame = 0; frame < NUM_FRAMES && !failures; frame++)
+	{
+		blastem_instance_run(full);
+		blastem_instance_run(skip);
+		if (!blastem_instance_serialize(full, full_state, size) || !blastem_instance_serialize(skip, skip_state, size)) {
+			printf("FAIL: could not save the state of %s\n", name);
+			failures++;
+		} else if (memcmp(full_state, skip_state, size)) {
+			printf("FAIL: %s differs with idle loops skipped after frame %d\n", name, frame);
+			failures++;
+		}
+	}
+	uint64_t full_loops = idle_loops(full), skip_loops = idle_loops(skip);
+	if (changes) {
+		uint16_t *ram = blastem_instance_get_memory_data(skip, RETRO_MEMORY_SYSTEM_RAM);
+		*changes = ram[0] >> 8;
+	}
+	printf("%s: %llu idle loops\n", name, (unsigned long long)skip_loops);
+	if (full_loops) {
+		printf("FAIL: idle loops of %s were skipped while it was turned off\n", name);
+		failures++;
+	}
+	if (!skip_loops) {
+		printf("FAIL: no idle loop was found in %s\n", name);
+		failures++;
+	}
+	free(full_state);
+	free(skip_state);
+	blastem_instance_destroy(full);
+	blastem_instance_destroy(skip);
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+	uint8_t *rom = build_z80_test_rom();
+	failures += compare_runs(rom, "Z80 test ROM", NULL);
+	free(rom);
+
+	rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	memcpy(rom + Z80_CODE_START, z80_code, sizeof(z80_code));
+	uint8_t changes;
+	failures += compare_runs(rom, "68K writes", &changes);
+	free(rom);
+	if (!changes) {
+		puts("FAIL: the Z80 never saw a write from the 68K");
+		failures++;
+	}
+
+	if (failures) {
+		printf("%d idle loop checks failed\n", failures);
+	} else {
+		puts("States matched with Z80 idle loops skipped");
+	}
+	return failures != 0;
+}
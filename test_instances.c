@@ -0,0 +1,96 @@
+/*
+ Stress test for the libblastem instance API. Runs many independent Genesis instances
+ concurrently on separate threads and checks that every one of them produces exactly the
+ same video, audio and RAM contents as a single instance run in isolation.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_INSTANCES 64
+#define NUM_FRAMES 120
+
+typedef struct {
+	blastem_instance *inst;
+	uint8_t          *rom;
+	uint32_t         video_hash;
+	uint32_t         audio_hash;
+	uint32_t         ram_hash;
+	uint32_t         frames;
+	pthread_t        thread;
+} session;
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	session *s = blastem_instance_get_userdata(blastem_instance_active());
+	for (unsigned y = 0; y < height; y++)
+	{
+		s->video_hash = hash(s->video_hash, (const uint8_t *)data + y * pitch, width * sizeof(uint32_t));
+	}
+	s->frames++;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	session *s = blastem_instance_get_userdata(blastem_instance_active());
+	s->audio_hash = hash(s->audio_hash, (const uint8_t *)data, frames * 2 * sizeof(int16_t));
+	return frames;
+}
+
+static void *run_session(void *data)
+{
+	session *s = data;
+	s->video_hash = s->audio_hash = HASH_START;
+	s->inst = create_test_instance();
+	blastem_instance_set_userdata(s->inst, s);
+	blastem_instance_set_video_refresh(s->inst, video_refresh);
+	blastem_instance_set_audio_sample_batch(s->inst, audio_sample_batch);
+	load_test_rom(s->inst, s->rom, TEST_ROM_SIZE);
+	for (int i = 0; i < NUM_FRAMES; i++)
+	{
+		blastem_instance_run(s->inst);
+	}
+	s->ram_hash = hash(HASH_START, blastem_instance_get_memory_data(s->inst, RETRO_MEMORY_SYSTEM_RAM),
+		blastem_instance_get_memory_size(s->inst, RETRO_MEMORY_SYSTEM_RAM));
+	blastem_instance_destroy(s->inst);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	session reference = {.rom = rom};
+	run_session(&reference);
+	printf("Reference: %d frames, video %08X, audio %08X, RAM %08X\n", reference.frames, reference.video_hash, reference.audio_hash, reference.ram_hash);
+	if (reference.frames != NUM_FRAMES) {
+		puts("FAIL: reference instance did not produce the expected number of frames");
+		return 1;
+	}
+
+	session *sessions = calloc(NUM_INSTANCES, sizeof(session));
+	for (int i = 0; i < NUM_INSTANCES; i++)
+	{
+		sessions[i].rom = rom;
+		pthread_create(&sessions[i].thread, NULL, run_session, sessions + i);
+	}
+	int failures = 0;
+	for (int i = 0; i < NUM_INSTANCES; i++)
+	{
+		pthread_join(sessions[i].thread, NULL);
+		if (sessions[i].frames != reference.frames || sessions[i].video_hash != reference.video_hash
+			|| sessions[i].audio_hash != reference.audio_hash || sessions[i].ram_hash != reference.ram_hash
+		) {
+			printf("FAIL: instance %d: %d frames, video %08X, audio %08X, RAM %08X\n", i, sessions[i].frames,
+				sessions[i].video_hash, sessions[i].audio_hash, sessions[i].ram_hash);
+			failures++;
+		}
+	}
+	printf("%d of %d concurrent instances matched the reference\n", NUM_INSTANCES - failures, NUM_INSTANCES);
+	free(sessions);
+	free(rom);
+	return failures != 0;
+}
@@ -4,7 +4,11 @@
  BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include "vdp.h"
+#include "render.h"
+#include "event_log.h"
+#include "util.h"
 
 int headless = 1;
 
@@ -13,7 +17,7 @@ uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
 	return 0;
 }
 
-uint16_t read_dma_value(uint32_t address)
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
 	return 0;
 }
@@ -32,66 +36,115 @@ void warning(char *format, ...)
 {
 }
 
+long file_size(FILE *f)
+{
+	return 0;
+}
+
+void fatal_error(char *format, ...)
+{
+	exit(1);
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return 0;
+}
+
+void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
+{
+}
+
+void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
+{
+}
+
+void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc)
+{
+}
+
+void reader_ensure_data(event_reader *reader, size_t bytes)
+{
+}
+
 
 int main(int argc, char **argv)
 {
-	vdp_context context;
 	int ret = 0;
-	init_vdp_context(&context, 0);
-	vdp_control_port_write(&context, 0x8000 | BIT_PAL_SEL);
-	vdp_control_port_write(&context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN | BIT_MODE_5);
+	vdp_context *context = init_vdp_context(0, 0);
+	vdp_control_port_write(context, 0x8000 | BIT_PAL_SEL);
+	vdp_control_port_write(context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN | BIT_MODE_5);
 	puts("Testing H32 Mode");
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context_full(context, context->cycles + 1);
 	}
-	vdp_int_ack(&context);
-	uint32_t vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_int_ack(context);
+	uint32_t vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context_full(context, context->cycles + 1);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
 	}
-	vdp_int_ack(&context);
+	vdp_int_ack(context);
 	puts("Testing H40 Mode");
-	vdp_control_port_write(&context, 0x8C81);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_control_port_write(context, 0x8C81);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context_full(context, context->cycles + 1);
 	}
-	vdp_int_ack(&context);
-	vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_int_ack(context);
+	vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context_full(context, context->cycles + 1);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
 	}
-	vdp_int_ack(&context);
+	vdp_int_ack(context);
 	puts("Testing Mode 4");
-	vdp_control_port_write(&context, 0x8C00);
-	vdp_control_port_write(&context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_control_port_write(context, 0x8C00);
+	vdp_control_port_write(context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context_full(context, context->cycles + 1);
 	}
-	context.flags2 &= ~FLAG2_VINT_PENDING;
-	vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	context->flags2 &= ~FLAG2_VINT_PENDING;
+	vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context_full(context, context->cycles + 1);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
@@ -0,0 +1,138 @@
+/*
+ Checks the 68K translator's handling of jumps. The test ROM's 68K program is replaced with a loop
+ that calls a subroutine, dispatches through a jump table with JSR (An), leaves through JMP (An)
+ and comes back with a BRA that ends up chained to the code after it. The result it leaves in work
+ RAM is compared with the same loop written in C, once with an unlimited code cache and once with
+ the cache flushed at nearly every frame, and the target cache has to resolve most of the jumps.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 30
+#define ITERATIONS 5000
+#define TINY_BUDGET 1
+
+static const uint8_t m68k_code[] = {
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00, //$200 lea $FF0000, a5
+	0x70, 0x00,                         //$206 moveq #0, d0
+	0x74, 0x00,                         //$208 moveq #0, d2
+	0x49, 0xFA, 0x00, 0x68,             //$20A lea far(pc), a4
+	0x60, 0x00, 0x00, 0x10,             //$20E bra.w loop
+	0x4E, 0x71, 0x4E, 0x71, 0x4E, 0x71, //$212 nop
+	0x4E, 0x71, 0x4E, 0x71, 0x4E, 0x71,
+	0x4E, 0x71,
+	0x61, 0x00, 0x00, 0x2E,             //$220 loop: bsr.w sub
+	0x41, 0xFA, 0x00, 0x3E,             //$224 lea table(pc), a0
+	0x32, 0x00,                         //$228 move.w d0, d1
+	0x02, 0x41, 0x00, 0x03,             //$22A andi.w #3, d1
+	0xE5, 0x49,                         //$22E lsl.w #2, d1
+	0x22, 0x70, 0x10, 0x00,             //$230 movea.l (0, a0, d1.w), a1
+	0x4E, 0x91,                         //$234 jsr (a1)
+	0x52, 0x80,                         //$236 addq.l #1, d0
+	0x4E, 0xD4,                         //$238 jmp (a4)
+	0x0C, 0x80, 0x00, 0x00, 0x13, 0x88, //$23A back: cmpi.l #ITERATIONS, d0
+	0x66, 0xDE,                         //$240 bne.s loop
+	0x2B, 0x42, 0x00, 0x04,             //$242 move.l d2, 4(a5)
+	0x2A, 0x80,                         //$246 move.l d0, (a5)
+	0x1B, 0x7C, 0x00, 0x01, 0x00, 0x08, //$248 move.b #1, 8(a5)
+	0x60, 0xFE,                         //$24E bra.s *
+	0xD4, 0x80,                         //$250 sub: add.l d0, d2
+	0x4E, 0x75,                         //$252 rts
+	0x52, 0x82,                         //$254 addq.l #1, d2
+	0x4E, 0x75,                         //$256 rts
+	0x54, 0x82,                         //$258 addq.l #2, d2
+	0x4E, 0x75,                         //$25A rts
+	0xB1, 0x82,                         //$25C eor.l d0, d2
+	0x4E, 0x75,                         //$25E rts
+	0x46, 0x82,                         //$260 not.l d2
+	0x4E, 0x75,                         //$262 rts
+	0x00, 0x00, 0x02, 0x54,             //$264 table
+	0x00, 0x00, 0x02, 0x58,
+	0x00, 0x00, 0x02, 0x5C,
+	0x00, 0x00, 0x02, 0x60,
+	0xE3, 0x9A,                         //$274 far: rol.l #1, d2
+	0x60, 0x00, 0xFF, 0xC2              //$276 bra.w back
+};
+
+//what the 68K program leaves in d2
+static uint32_t expected_result(void)
+{
+	uint32_t d2 = 0;
+	for (uint32_t d0 = 0; d0 < ITERATIONS; d0++)
+	{
+		d2 += d0;
+		switch (d0 & 3)
+		{
+		case 0: d2 += 1; break;
+		case 1: d2 += 2; break;
+		case 2: d2 ^= d0; break;
+		case 3: d2 = ~d2; break;
+		}
+		d2 = d2 << 1 | d2 >> 31;
+	}
+	return d2;
+}
+
+static int run_rom(uint8_t *rom, size_t budget, char *name, blastem_code_cache_stats *m68k)
+{
+	test_run run = {
+		.limit_code_cache = 1,
+		.code_cache_budget = budget,
+		.frames = NUM_FRAMES
+	};
+	test_result state;
+	run_test_rom(rom, &run, &state);
+	uint32_t count = read_long(state.ram, 0), result = read_long(state.ram, 4);
+	uint8_t done = state.ram[4] >> 8;
+	*m68k = state.m68k;
+	printf("%s: %llu indirect jumps hit the target cache, %llu missed, %llu jumps chained, %u flushes\n", name,
+		(unsigned long long)m68k->indirect_hits, (unsigned long long)m68k->indirect_misses,
+		(unsigned long long)m68k->chained_jumps, m68k->flushes);
+	if (!done || count != ITERATIONS) {
+		printf("FAIL: loop did not finish %s\n", name);
+		return 1;
+	}
+	if (result != expected_result()) {
+		printf("FAIL: result is %X instead of %X %s\n", result, expected_result(), name);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	int failures = 0;
+	blastem_code_cache_stats m68k;
+	failures += run_rom(rom, 0, "without flushes", &m68k);
+	//a subroutine call, a table dispatch and a JMP (An) per iteration
+	if (m68k.indirect_hits + m68k.indirect_misses < ITERATIONS * 3) {
+		puts("FAIL: jumps to computed addresses were not counted");
+		failures++;
+	}
+	if (m68k.indirect_hits < m68k.indirect_misses * 100) {
+		puts("FAIL: target cache hit rate is too low");
+		failures++;
+	}
+	if (!m68k.chained_jumps) {
+		puts("FAIL: no jumps were chained");
+		failures++;
+	}
+	failures += run_rom(rom, TINY_BUDGET, "with flushes", &m68k);
+	if (m68k.flushes < NUM_FRAMES / 2) {
+		puts("FAIL: code cache was not flushed often enough");
+		failures++;
+	}
+	free(rom);
+	if (failures) {
+		printf("%d jump checks failed\n", failures);
+	} else {
+		puts("Jumps through the target cache and chained jumps matched");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,74 @@
+/*
+ Checks that the 68K registers picked for host registers from the code in ROM don't change what is
+ emulated. The built-in CPU test ROM, whose loop only uses registers outside the default mapping,
+ is run with register allocation turned off and on. The sum it leaves in work RAM has to match the
+ same loop written in C both times, and the loop has to translate to less code once its registers
+ are in host registers.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 30
+
+//what the 68K program leaves in d5 after each pass
+static uint32_t expected_result(uint8_t *rom)
+{
+	uint32_t d5 = 0, d6 = 0x12345678, offset = 0;
+	for (int i = 0; i < CPU_TEST_ITERATIONS; i++)
+	{
+		d6 ^= d6 << 7;
+		d6 ^= d6 >> 8;
+		d5 += d6;
+		d5 += rom[offset] << 24 | rom[offset + 1] << 16 | rom[offset + 2] << 8 | rom[offset + 3];
+		offset = (offset + 4) % 0x100;
+	}
+	return d5;
+}
+
+static int run_rom(uint8_t *rom, bool allocate, char *name, blastem_code_cache_stats *m68k)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_register_allocation,
+		.option_name = "register allocation",
+		.option = allocate,
+		.frames = NUM_FRAMES
+	};
+	test_result state;
+	run_test_rom(rom, &run, &state);
+	uint32_t result = read_long(state.ram, 0), passes = read_long(state.ram, 4);
+	*m68k = state.m68k;
+	printf("%s: %u passes, %llu bytes translated\n", name, passes, (unsigned long long)m68k->translated_bytes);
+	if (!passes) {
+		printf("FAIL: loop did not finish %s\n", name);
+		return 1;
+	}
+	if (result != expected_result(rom)) {
+		printf("FAIL: result is %X instead of %X %s\n", result, expected_result(rom), name);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_cpu_test_rom();
+	int failures = 0;
+	blastem_code_cache_stats fixed, allocated;
+	failures += run_rom(rom, 0, "with the default registers", &fixed);
+	failures += run_rom(rom, 1, "with allocated registers", &allocated);
+	if (allocated.translated_bytes >= fixed.translated_bytes) {
+		puts("FAIL: registers used by the loop were not moved to host registers");
+		failures++;
+	}
+	free(rom);
+	if (failures) {
+		printf("%d register allocation checks failed\n", failures);
+	} else {
+		puts("Results matched with registers allocated from the ROM");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,202 @@
+/*
+ Checks that drawing the VDP output on a separate thread doesn't change what is emulated or shown. The
+ test ROM's 68K program is replaced with one that loads VRAM, CRAM and VSRAM with DMA, fills a plane,
+ then keeps polling the status and HV counter to change the background color and CRAM every few lines,
+ reads VRAM back and starts a new CRAM DMA and scroll update in each vertical blank, with the vertical
+ interrupt counting frames. Every status and VRAM read is summed in work RAM. The same sequence of runs,
+ rollback snapshots and save states is done with the render thread turned off and on, and the frames and
+ work RAM of every run have to match.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_RUNS 60
+#define SNAPSHOT_RUN 10
+#define SERIALIZE_RUN 20
+#define RESTORE_RUN 25
+#define UNSERIALIZE_RUN 35
+
+static const uint8_t m68k_code[] = {
+	0x41, 0xF9, 0x00, 0xC0, 0x00, 0x04,             //$200 lea $C00004, a0
+	0x43, 0xF9, 0x00, 0xC0, 0x00, 0x00,             //$206 lea $C00000, a1
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$20C lea $FF0000, a5
+	0x45, 0xFA, 0x00, 0xB4,                         //$212 lea regs(pc), a2
+	0x72, 0x24,                                     //$216 moveq #NUM_REGS-1, d1
+	0x30, 0x9A,                                     //$218 regloop: move.w (a2)+, (a0)
+	0x51, 0xC9, 0xFF, 0xFC,                         //$21A dbra d1, regloop
+	0x32, 0xBC, 0x11, 0x11,                         //$21E move.w #$1111, (a1)
+	0x30, 0x10,                                     //$222 dmawait: move.w (a0), d0
+	0x08, 0x00, 0x00, 0x01,                         //$224 btst #1, d0
+	0x66, 0xF8,                                     //$228 bne.s dmawait
+	0x30, 0xBC, 0x8F, 0x02,                         //$22A move.w #$8F02, (a0)
+	0x20, 0xBC, 0x40, 0x00, 0x00, 0x03,             //$22E move.l #$40000003, (a0)
+	0x32, 0x3C, 0x07, 0xFF,                         //$234 move.w #$7FF, d1
+	0x70, 0x00,                                     //$238 moveq #0, d0
+	0x32, 0x80,                                     //$23A nametable: move.w d0, (a1)
+	0x52, 0x40,                                     //$23C addq.w #1, d0
+	0x51, 0xC9, 0xFF, 0xFA,                         //$23E dbra d1, nametable
+	0x78, 0x00,                                     //$242 moveq #0, d4
+	0x7C, 0x00,                                     //$244 moveq #0, d6
+	0x46, 0xFC, 0x25, 0x00,                         //$246 move #$2500, sr
+	0x30, 0x10,                                     //$24A loop: move.w (a0), d0
+	0xD8, 0x40,                                     //$24C add.w d0, d4
+	0x2B, 0x44, 0x00, 0x04,                         //$24E move.l d4, 4(a5)
+	0x34, 0x28, 0x00, 0x04,                         //$252 move.w 4(a0), d2
+	0x36, 0x02,                                     //$256 move.w d2, d3
+	0xE0, 0x4B,                                     //$258 lsr.w #8, d3
+	0x3A, 0x03,                                     //$25A move.w d3, d5
+	0x02, 0x45, 0x00, 0x3F,                         //$25C andi.w #$3F, d5
+	0x00, 0x45, 0x87, 0x00,                         //$260 ori.w #$8700, d5
+	0x30, 0x85,                                     //$264 move.w d5, (a0)
+	0x08, 0x00, 0x00, 0x03,                         //$266 btst #3, d0
+	0x67, 0x40,                                     //$26A beq.s active
+	0x4A, 0x06,                                     //$26C tst.b d6
+	0x66, 0xDA,                                     //$26E bne.s loop
+	0x7C, 0x01,                                     //$270 moveq #1, d6
+	0x52, 0x95,                                     //$272 addq.l #1, (a5)
+	0x22, 0x15,                                     //$274 move.l (a5), d1
+	0x02, 0x41, 0x00, 0x1F,                         //$276 andi.w #$1F, d1
+	0x00, 0x41, 0x95, 0x00,                         //$27A ori.w #$9500, d1
+	0x30, 0xBC, 0x93, 0x40,                         //$27E move.w #$9340, (a0)
+	0x30, 0xBC, 0x94, 0x00,                         //$282 move.w #$9400, (a0)
+	0x30, 0x81,                                     //$286 move.w d1, (a0)
+	0x30, 0xBC, 0x96, 0x01,                         //$288 move.w #$9601, (a0)
+	0x30, 0xBC, 0x97, 0x00,                         //$28C move.w #$9700, (a0)
+	0x20, 0xBC, 0xC0, 0x00, 0x00, 0x80,             //$290 move.l #$C0000080, (a0)
+	0x20, 0xBC, 0x40, 0x00, 0x00, 0x10,             //$296 move.l #$40000010, (a0)
+	0x32, 0xAD, 0x00, 0x02,                         //$29C move.w 2(a5), (a1)
+	0x20, 0xBC, 0x7C, 0x00, 0x00, 0x03,             //$2A0 move.l #$7C000003, (a0)
+	0x32, 0xAD, 0x00, 0x02,                         //$2A6 move.w 2(a5), (a1)
+	0x60, 0x9E,                                     //$2AA bra.s loop
+	0x7C, 0x00,                                     //$2AC active: moveq #0, d6
+	0x20, 0xBC, 0xC0, 0x02, 0x00, 0x00,             //$2AE move.l #$C0020000, (a0)
+	0x32, 0x82,                                     //$2B4 move.w d2, (a1)
+	0x20, 0xBC, 0x00, 0x00, 0x00, 0x00,             //$2B6 move.l #$00000000, (a0)
+	0x32, 0x11,                                     //$2BC move.w (a1), d1
+	0xD8, 0x41,                                     //$2BE add.w d1, d4
+	0x60, 0x88,                                     //$2C0 bra.s loop
+	0x52, 0xAD, 0x00, 0x08,                         //$2C2 vint: addq.l #1, 8(a5)
+	0x4E, 0x73,                                     //$2C6 rte
+	//$2C8 regs: register writes and control words
+	0x80, 0x04, //no HINT
+	0x81, 0x74, //display, VINT and DMA on
+	0x82, 0x30, //plane A at $C000
+	0x84, 0x07, //plane B at $E000
+	0x85, 0x78, //sprites at $F000
+	0x87, 0x00,
+	0x8C, 0x81, //H40
+	0x8D, 0x3F, //horizontal scroll at $FC00
+	0x8F, 0x02,
+	0x90, 0x01, //64x32 planes
+	0x93, 0x00, 0x94, 0x10, 0x95, 0x00, 0x96, 0x00, 0x97, 0x00, 0x40, 0x00, 0x00, 0x80, //68K DMA of $1000 words from $0 to VRAM $0
+	0x93, 0x40, 0x94, 0x00, 0x95, 0x00, 0x96, 0x01, 0x97, 0x00, 0xC0, 0x00, 0x00, 0x80, //68K DMA of 64 words from $200 to CRAM
+	0x93, 0x28, 0x94, 0x00, 0x95, 0x40, 0x96, 0x01, 0x97, 0x00, 0x40, 0x00, 0x00, 0x90, //68K DMA of 40 words from $280 to VSRAM
+	0x8F, 0x01, 0x93, 0x00, 0x94, 0x10, 0x97, 0x80, 0x60, 0x00, 0x00, 0x83, //fill of $1000 bytes at $E000, started by the data port write
+};
+#define VINT_HANDLER 0x2C2
+
+static uint32_t frame_hash, last_frame;
+static uint64_t frames, changed_frames;
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	uint32_t h = HASH_START;
+	for (unsigned y = 0; y < height; y++)
+	{
+		h = hash(h, (const uint8_t *)data + y * pitch, width * sizeof(uint32_t));
+	}
+	if (frames && h != last_frame) {
+		changed_frames++;
+	}
+	last_frame = h;
+	frame_hash = hash(frame_hash, (const uint8_t *)&h, sizeof(h));
+	frames++;
+}
+
+//fills hashes with the frames and work RAM of each run, returns the number of vertical interrupts
+static uint32_t run_script(uint8_t *rom, bool render_thread, uint32_t *hashes)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_render_thread,
+		.option_name = "the render thread",
+		.option = render_thread,
+		.video_refresh = video_refresh
+	};
+	blastem_instance *inst = setup_test_instance(rom, &run);
+	uint8_t *slot = malloc(blastem_instance_snapshot_size(inst));
+	size_t state_size = blastem_instance_serialize_size(inst);
+	uint8_t *state = malloc(state_size);
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		if (run == SNAPSHOT_RUN && !blastem_instance_snapshot(inst, slot)) {
+			puts("FAIL: snapshot failed");
+			exit(1);
+		}
+		if (run == SERIALIZE_RUN && !blastem_instance_serialize(inst, state, state_size)) {
+			puts("FAIL: could not save state");
+			exit(1);
+		}
+		if (run == RESTORE_RUN && !blastem_instance_restore(inst, slot)) {
+			puts("FAIL: restore failed");
+			exit(1);
+		}
+		if (run == UNSERIALIZE_RUN && !blastem_instance_unserialize(inst, state, state_size)) {
+			puts("FAIL: could not load state");
+			exit(1);
+		}
+		frame_hash = HASH_START;
+		blastem_instance_run(inst);
+		hashes[run] = hash(frame_hash, blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM),
+			blastem_instance_get_memory_size(inst, RETRO_MEMORY_SYSTEM_RAM));
+	}
+	uint32_t interrupts = read_long(blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM), 8);
+	free(state);
+	free(slot);
+	blastem_instance_destroy(inst);
+	return interrupts;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	//level 6 autovector
+	rom[0x7A] = VINT_HANDLER >> 8;
+	rom[0x7B] = VINT_HANDLER & 0xFF;
+	int failures = 0;
+	uint32_t expected[NUM_RUNS], hashes[NUM_RUNS];
+	uint32_t interrupts = run_script(rom, 0, expected);
+	uint64_t expected_frames = frames;
+	printf("without the render thread: %u vertical interrupts, %llu frames, %llu changed\n", interrupts,
+		(unsigned long long)frames, (unsigned long long)changed_frames);
+	if (!interrupts || !changed_frames) {
+		puts("FAIL: the program did not draw anything");
+		failures++;
+	}
+	frames = changed_frames = 0;
+	uint32_t thread_interrupts = run_script(rom, 1, hashes);
+	printf("with the render thread: %u vertical interrupts, %llu frames\n", thread_interrupts, (unsigned long long)frames);
+	if (thread_interrupts != interrupts || frames != expected_frames) {
+		puts("FAIL: vertical interrupts or frame count differ with the render thread");
+		failures++;
+	}
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		if (hashes[run] != expected[run]) {
+			printf("FAIL: run %d differs with the render thread\n", run);
+			failures++;
+			break;
+		}
+	}
+	free(rom);
+	if (failures) {
+		printf("%d render thread checks failed\n", failures);
+	} else {
+		puts("Frames and status reads matched with the render thread");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,229 @@
+/*
+ Checks the quality of the audio resamplers. A tone in the passband is resampled from the YM2612
+ rate and compared with a fitted sine of the same frequency, and a tone above the output Nyquist
+ frequency is resampled from the PSG rate and should come out as close to silence as possible.
+ The polyphase resampler has to meet fixed limits for both, the linear one is only reported.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "render_audio.h"
+#include "tern.h"
+#include "util.h"
+
+#define OUTPUT_RATE 48000
+#define MASTER_CLOCK 53693175
+#define YM_DIVIDER (7 * 6 * 24)
+#define PSG_DIVIDER 240
+#define MAX_OUTPUT (OUTPUT_RATE * 2)
+//skip the start of the output so the filters have settled
+#define SETTLE_SAMPLES 1000
+#define MIN_PASSBAND_SNR 60.0
+#define MIN_ALIAS_REJECTION 50.0
+#define TIMING_RUNS 5
+
+tern_node *config;
+int headless = 1;
+static char *resampler_name;
+static int16_t output[MAX_OUTPUT];
+static uint32_t output_count;
+//actual output rate, which differs slightly from OUTPUT_RATE as the rate ratio is fixed point
+static double output_rate;
+
+tern_val tern_find_path(tern_node *head, char const *key, uint8_t valtype)
+{
+	tern_val ret = {.ptrval = NULL};
+	if (!memcmp(key, "audio\0resampler\0", sizeof("audio\0resampler"))) {
+		ret.ptrval = resampler_name;
+	}
+	return ret;
+}
+
+void *tern_find_ptr(tern_node *head, char const *key)
+{
+	return NULL;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+uint32_t get_lowpass_cutoff(tern_node *config)
+{
+	//high enough that the RC filter hardly affects the tones being checked
+	return 1000000;
+}
+
+uint8_t render_is_audio_sync(void)
+{
+	return 0;
+}
+
+void render_do_audio_ready(audio_source *src)
+{
+	//only the left channel of stereo sources is kept, buffer_pos has not been wrapped yet when this is called
+	uint32_t end = src->buffer_pos & src->mask;
+	for (uint32_t i = src->read_end; i != end; i = (i + src->num_channels) & src->mask)
+	{
+		if (output_count < MAX_OUTPUT) {
+			output[output_count++] = src->back[i];
+		}
+	}
+	src->read_end = end;
+}
+
+void render_buffer_consumed(audio_source *src)
+{
+}
+
+void *render_new_audio_opaque(void)
+{
+	return NULL;
+}
+
+void render_free_audio_opaque(void *opaque)
+{
+}
+
+void render_lock_audio(void)
+{
+}
+
+void render_unlock_audio(void)
+{
+}
+
+uint32_t render_min_buffered(void)
+{
+	return 1024;
+}
+
+uint32_t render_audio_syncs_per_sec(void)
+{
+	return 0;
+}
+
+void render_audio_created(audio_source *src)
+{
+}
+
+void render_source_paused(audio_source *src, uint8_t remaining_sources)
+{
+}
+
+void render_source_resumed(audio_source *src)
+{
+}
+
+//resamples one second of a sine wave, returns the time taken in nanoseconds
+static uint64_t run_tone(uint32_t divider, uint8_t channels, double frequency, double amplitude)
+{
+	audio_source *src = render_audio_source(MASTER_CLOCK, divider, channels);
+	double rate = (double)MASTER_CLOCK / divider;
+	output_rate = rate * src->buffer_inc / 0x40000000;
+	uint32_t count = rate;
+	int16_t *input = malloc(count * sizeof(int16_t));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		input[i] = lrint(amplitude * sin(2.0 * M_PI * frequency * i / rate));
+	}
+	output_count = 0;
+	uint64_t start = get_time_ns();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (channels == 2) {
+			render_put_stereo_sample(src, input[i], input[i]);
+		} else {
+			render_put_mono_sample(src, input[i]);
+		}
+	}
+	uint64_t elapsed = get_time_ns() - start;
+	free(input);
+	render_do_audio_ready(src);
+	render_free_source(src);
+	return elapsed;
+}
+
+//ratio in dB of the power of the best fitting sine at frequency to the power of everything else
+static double tone_snr(double frequency)
+{
+	double sin_sum = 0.0, cos_sum = 0.0;
+	uint32_t count = output_count - SETTLE_SAMPLES;
+	for (uint32_t i = SETTLE_SAMPLES; i < output_count; i++)
+	{
+		double angle = 2.0 * M_PI * frequency * i / output_rate;
+		sin_sum += output[i] * sin(angle);
+		cos_sum += output[i] * cos(angle);
+	}
+	double sin_amp = 2.0 * sin_sum / count, cos_amp = 2.0 * cos_sum / count;
+	double signal = 0.0, noise = 0.0;
+	for (uint32_t i = SETTLE_SAMPLES; i < output_count; i++)
+	{
+		double angle = 2.0 * M_PI * frequency * i / output_rate;
+		double fitted = sin_amp * sin(angle) + cos_amp * cos(angle);
+		signal += fitted * fitted;
+		noise += (output[i] - fitted) * (output[i] - fitted);
+	}
+	return 10.0 * log10(signal / noise);
+}
+
+//attenuation in dB of the output relative to a full sine of amplitude
+static double rejection(double amplitude)
+{
+	double total = 0.0;
+	for (uint32_t i = SETTLE_SAMPLES; i < output_count; i++)
+	{
+		total += (double)output[i] * output[i];
+	}
+	double rms = sqrt(total / (output_count - SETTLE_SAMPLES));
+	return 20.0 * log10((amplitude / sqrt(2.0)) / (rms > 0.5 ? rms : 0.5));
+}
+
+int main(int argc, char **argv)
+{
+	static char *names[] = {"linear", "polyphase"};
+	disable_stdout_messages();
+	render_audio_initialized(RENDER_AUDIO_S16, OUTPUT_RATE, 2, 512, sizeof(int16_t));
+	int failures = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		resampler_name = names[i];
+		//one second of audio is quick to resample, so take the fastest of a few runs
+		uint64_t elapsed = UINT64_MAX;
+		for (int run = 0; run < TIMING_RUNS; run++)
+		{
+			uint64_t run_time = run_tone(YM_DIVIDER, 2, 1000.0, 16000.0);
+			elapsed = run_time < elapsed ? run_time : elapsed;
+		}
+		double snr = tone_snr(1000.0);
+		uint32_t passband_outputs = output_count;
+		uint64_t psg_elapsed = UINT64_MAX;
+		for (int run = 0; run < TIMING_RUNS; run++)
+		{
+			uint64_t run_time = run_tone(PSG_DIVIDER, 1, 30000.0, 16000.0);
+			psg_elapsed = run_time < psg_elapsed ? run_time : psg_elapsed;
+		}
+		double alias = rejection(16000.0);
+		printf("%s: %u samples, 1 kHz SNR %.1f dB, 30 kHz rejection %.1f dB, %.1f ns per FM sample, %.1f ns per PSG sample\n",
+			names[i], passband_outputs, snr, alias, (double)elapsed / (MASTER_CLOCK / YM_DIVIDER),
+			(double)psg_elapsed / (MASTER_CLOCK / PSG_DIVIDER));
+		if (i && (snr < MIN_PASSBAND_SNR || alias < MIN_ALIAS_REJECTION)) {
+			printf("FAIL: polyphase resampler needs at least %.0f dB SNR and %.0f dB alias rejection\n",
+				MIN_PASSBAND_SNR, MIN_ALIAS_REJECTION);
+			failures++;
+		}
+		if (output_count < OUTPUT_RATE * 99 / 100 || passband_outputs < OUTPUT_RATE * 99 / 100) {
+			printf("FAIL: %s resampler produced too few samples\n", names[i]);
+			failures++;
+		}
+	}
+	if (!failures) {
+		puts("Polyphase resampler meets the quality limits");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,106 @@
+/*
+ Checks that the rewind history recorded through the libblastem instance API steps back through
+ exactly the frames that were played and reports what recording costs per frame. A ROM can be
+ passed on the command line to measure with real game code instead of the built-in test ROM.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_FRAMES 600
+#define REWIND_FRAMES 300
+#define REWIND_BUDGET (16*1024*1024)
+
+static double run_frames(blastem_instance *inst, uint32_t *hashes)
+{
+	double start = now();
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		blastem_instance_run(inst);
+		if (hashes) {
+			hashes[frame] = state_hash(inst);
+		}
+	}
+	return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom;
+	size_t rom_size;
+	if (argc > 1) {
+		FILE *f = fopen(argv[1], "rb");
+		if (!f) {
+			printf("FAIL: could not open %s\n", argv[1]);
+			return 1;
+		}
+		fseek(f, 0, SEEK_END);
+		rom_size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		rom = malloc(rom_size);
+		if (fread(rom, 1, rom_size, f) != rom_size) {
+			printf("FAIL: could not read %s\n", argv[1]);
+			return 1;
+		}
+		fclose(f);
+	} else {
+		rom = build_test_rom();
+		rom_size = TEST_ROM_SIZE;
+	}
+
+	blastem_instance *plain = start_test_instance(rom, rom_size);
+	double plain_time = run_frames(plain, NULL);
+	blastem_instance_destroy(plain);
+
+	blastem_instance *inst = start_test_instance(rom, rom_size);
+	//rewind can only be set up once a game is loaded
+	blastem_instance_set_rewind_budget(inst, REWIND_BUDGET);
+	uint32_t expected[NUM_FRAMES];
+	double rewind_time = run_frames(inst, expected);
+	unsigned frames = blastem_instance_rewind_frames(inst);
+	size_t memory = blastem_instance_rewind_memory(inst);
+	printf("Recorded %u frames in %zu bytes, %zu bytes per frame\n", frames, memory, frames ? memory / frames : 0);
+	printf("Frame time: %.1f us without rewind, %.1f us with rewind\n", plain_time * 1000000.0 / NUM_FRAMES,
+		rewind_time * 1000000.0 / NUM_FRAMES);
+
+	int failures = 0;
+	if (frames < REWIND_FRAMES) {
+		puts("FAIL: rewind history is shorter than expected");
+		failures++;
+	}
+	blastem_instance_set_rewinding(inst, 1);
+	double start = now();
+	for (int step = 0; step < REWIND_FRAMES && step < frames; step++)
+	{
+		//each run while rewinding replays the newest recorded frame, starting with the last one shown
+		blastem_instance_run(inst);
+		if (state_hash(inst) != expected[NUM_FRAMES - 1 - step]) {
+			printf("FAIL: rewinding %d frames did not reproduce frame %d\n", step + 1, NUM_FRAMES - 1 - step);
+			failures++;
+		}
+	}
+	printf("Rewind step: %.1f us per frame, including emulating it again\n", (now() - start) * 1000000.0 / REWIND_FRAMES);
+	blastem_instance_set_rewinding(inst, 0);
+	//recording resumes from the point rewinding stopped
+	int resume = NUM_FRAMES - REWIND_FRAMES + 1;
+	for (int frame = resume; frame < resume + 10; frame++)
+	{
+		blastem_instance_run(inst);
+		if (state_hash(inst) != expected[frame]) {
+			printf("FAIL: frame %d differs after rewinding\n", frame);
+			failures++;
+		}
+	}
+
+	blastem_instance_destroy(inst);
+	free(rom);
+	if (failures) {
+		printf("%d rewind checks failed\n", failures);
+	} else {
+		puts("All rewound frames matched");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,336 @@
+/*
+ Small synthetic Genesis program used by the libblastem tests so they don't depend on external ROMs,
+ and the frontend callbacks and instance setup the tests share
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test_rom.h"
+
+uint32_t video_hash;
+
+//68K program that loads a small Z80 program which hammers the YM2612 and Z80 RAM,
+//then loops forever updating CRAM and a counter in work RAM
+static const uint8_t m68k_code[] = {
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //move.w #$100, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //move.w #$100, $A11200
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //btst #0, $A11100
+	0x66, 0xF6,                                     //bne.s *-8
+	0x45, 0xF9, 0x00, 0xA0, 0x00, 0x00,             //lea $A00000, a2
+	0x47, 0xFA, 0x01, 0xDE,                         //lea z80_code(pc), a3
+	0x72, 0x0D,                                     //moveq #13, d1
+	0x14, 0xDB,                                     //move.b (a3)+, (a2)+
+	0x51, 0xC9, 0xFF, 0xFC,                         //dbra d1, *-2
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x12, 0x00, //move.w #0, $A11200
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //move.w #0, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //move.w #$100, $A11200
+	0x41, 0xF9, 0x00, 0xC0, 0x00, 0x04,             //lea $C00004, a0
+	0x43, 0xF9, 0x00, 0xC0, 0x00, 0x00,             //lea $C00000, a1
+	0x30, 0xBC, 0x81, 0x44,                         //move.w #$8144, (a0)
+	0x30, 0xBC, 0x8F, 0x02,                         //move.w #$8F02, (a0)
+	0x70, 0x00,                                     //moveq #0, d0
+	0x20, 0xBC, 0xC0, 0x00, 0x00, 0x00,             //move.l #$C0000000, (a0)
+	0x32, 0x80,                                     //move.w d0, (a1)
+	0x52, 0x40,                                     //addq.w #1, d0
+	0x33, 0xC0, 0x00, 0xFF, 0x00, 0x00,             //move.w d0, $FF0000
+	0x60, 0xEE                                      //bra.s *-16
+};
+
+//68K program that never waits for anything, it runs a xorshift generator and sums it with the longs of
+//the vector table CPU_TEST_ITERATIONS times using registers outside d0-d3/a0-a2, then stores the sum
+//and counts the passes in work RAM and starts over
+static const uint8_t cpu_code[] = {
+	0x4D, 0xF9, 0x00, 0xFF, 0x00, 0x00, //$200 lea $FF0000, a6
+	0x7A, 0x00,                         //$206 loop: moveq #0, d5
+	0x2C, 0x3C, 0x12, 0x34, 0x56, 0x78, //$208 move.l #$12345678, d6
+	0x2A, 0x7C, 0x00, 0x00, 0x00, 0x00, //$20E movea.l #0, a5
+	0x28, 0x7C, 0x00, 0x00, 0x01, 0x00, //$214 movea.l #$100, a4
+	0x26, 0x4D,                         //$21A movea.l a5, a3
+	0x3E, 0x3C, (CPU_TEST_ITERATIONS - 1) >> 8, (CPU_TEST_ITERATIONS - 1) & 0xFF, //$21C move.w #CPU_TEST_ITERATIONS-1, d7
+	0x28, 0x06,                         //$220 inner: move.l d6, d4
+	0xEF, 0x8C,                         //$222 lsl.l #7, d4
+	0xB9, 0x86,                         //$224 eor.l d4, d6
+	0x28, 0x06,                         //$226 move.l d6, d4
+	0xE0, 0x8C,                         //$228 lsr.l #8, d4
+	0xB9, 0x86,                         //$22A eor.l d4, d6
+	0xDA, 0x86,                         //$22C add.l d6, d5
+	0x28, 0x1B,                         //$22E move.l (a3)+, d4
+	0xDA, 0x84,                         //$230 add.l d4, d5
+	0xB7, 0xCC,                         //$232 cmpa.l a4, a3
+	0x66, 0x02,                         //$234 bne.s skip
+	0x26, 0x4D,                         //$236 movea.l a5, a3
+	0x51, 0xCF, 0xFF, 0xE6,             //$238 skip: dbra d7, inner
+	0x2C, 0x85,                         //$23C move.l d5, (a6)
+	0x52, 0xAE, 0x00, 0x04,             //$23E addq.l #1, 4(a6)
+	0x60, 0x00, 0xFF, 0xC2              //$242 bra.w loop
+};
+
+//Z80 program shaped like a sound driver, it waits for the vertical interrupt to bump a tick counter, then
+//steps six channels whose state is kept in Z80 RAM and accessed through ix, polls the YM2612 busy flag
+//through iy before every register write, keys the channels on, sums the frequencies and copies the
+//channel state with ldir before waiting for the next tick
+static const uint8_t z80_driver_code[] = {
+	0xF3,                   //$00 di
+	0x31, 0x00, 0x20,       //$01 ld sp, $2000
+	0xED, 0x56,             //$04 im 1
+	0xC3, 0x50, 0x00,       //$06 jp start
+	[0x38] =
+	0xF5,                   //$38 push af
+	0x3A, 0x00, 0x1F,       //$39 ld a, (tick)
+	0x3C,                   //$3C inc a
+	0x32, 0x00, 0x1F,       //$3D ld (tick), a
+	0xF1,                   //$40 pop af
+	0xFB,                   //$41 ei
+	0xC9,                   //$42 ret
+	[0x50] =
+	0x21, 0xC0, 0x00,       //$50 start: ld hl, channels
+	0x11, 0x10, 0x1F,       //$53 ld de, $1F10
+	0x01, 0x18, 0x00,       //$56 ld bc, 24
+	0xED, 0xB0,             //$59 ldir
+	0xFD, 0x21, 0x00, 0x40, //$5B ld iy, $4000
+	0xFB,                   //$5F ei
+	0x3A, 0x00, 0x1F,       //$60 wait: ld a, (tick)
+	0x47,                   //$63 ld b, a
+	0x3A, 0x00, 0x1F,       //$64 idle: ld a, (tick)
+	0xB8,                   //$67 cp b
+	0x28, 0xFA,             //$68 jr z, idle
+	0xDD, 0x21, 0x10, 0x1F, //$6A ld ix, $1F10
+	0x0E, 0x06,             //$6E ld c, 6
+	0xDD, 0x7E, 0x00,       //$70 channel: ld a, (ix+0)
+	0xDD, 0x86, 0x01,       //$73 add a, (ix+1)
+	0xDD, 0x77, 0x00,       //$76 ld (ix+0), a
+	0x5F,                   //$79 ld e, a
+	0xFD, 0xCB, 0x00, 0x7E, //$7A busy1: bit 7, (iy+0)
+	0x20, 0xFA,             //$7E jr nz, busy1
+	0x3E, 0xA0,             //$80 ld a, $A0
+	0xDD, 0x86, 0x02,       //$82 add a, (ix+2)
+	0xFD, 0x77, 0x00,       //$85 ld (iy+0), a
+	0xFD, 0x73, 0x01,       //$88 ld (iy+1), e
+	0xDD, 0x7E, 0x03,       //$8B ld a, (ix+3)
+	0xFD, 0xCB, 0x00, 0x7E, //$8E busy2: bit 7, (iy+0)
+	0x20, 0xFA,             //$92 jr nz, busy2
+	0xFD, 0x36, 0x00, 0x28, //$94 ld (iy+0), $28
+	0xFD, 0x77, 0x01,       //$98 ld (iy+1), a
+	0x2A, 0x02, 0x1F,       //$9B ld hl, (sum)
+	0x16, 0x00,             //$9E ld d, 0
+	0x19,                   //$A0 add hl, de
+	0x22, 0x02, 0x1F,       //$A1 ld (sum), hl
+	0x11, 0x04, 0x00,       //$A4 ld de, 4
+	0xDD, 0x19,             //$A7 add ix, de
+	0x0D,                   //$A9 dec c
+	0x20, 0xC4,             //$AA jr nz, channel
+	0x21, 0x10, 0x1F,       //$AC ld hl, $1F10
+	0x11, 0x00, 0x1E,       //$AF ld de, $1E00
+	0x01, 0x18, 0x00,       //$B2 ld bc, 24
+	0xED, 0xB0,             //$B5 ldir
+	0x18, 0xA7,             //$B7 jr wait
+	//$C0 channels: frequency, step, channel register offset and key on value of each channel
+	[0xC0] =
+	0x00, 0x11, 0x00, 0xF0,
+	0x40, 0x13, 0x01, 0xF1,
+	0x80, 0x17, 0x02, 0xF2,
+	0x20, 0x1D, 0x00, 0xF4,
+	0x60, 0x1F, 0x01, 0xF5,
+	0xA0, 0x25, 0x02, 0xF6
+};
+
+//68K program that loads the Z80 driver from Z80_CODE_START, turns on mode 5 so the Z80 gets its vertical
+//interrupts and then loops forever without touching the bus again
+static const uint8_t z80_loader_code[] = {
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$200 move.w #$100, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$208 move.w #$100, $A11200
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$210 btst #0, $A11100
+	0x66, 0xF6,                                     //$218 bne.s *-8
+	0x45, 0xF9, 0x00, 0xA0, 0x00, 0x00,             //$21A lea $A00000, a2
+	0x47, 0xF9, 0x00, 0x00, Z80_CODE_START >> 8, Z80_CODE_START & 0xFF, //$220 lea Z80_CODE_START, a3
+	0x32, 0x3C, (sizeof(z80_driver_code) - 1) >> 8, (sizeof(z80_driver_code) - 1) & 0xFF, //$226 move.w #size-1, d1
+	0x14, 0xDB,                                     //$22A move.b (a3)+, (a2)+
+	0x51, 0xC9, 0xFF, 0xFC,                         //$22C dbra d1, *-2
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x12, 0x00, //$230 move.w #0, $A11200
+	0x33, 0xFC, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$238 move.w #0, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$240 move.w #$100, $A11200
+	0x33, 0xFC, 0x81, 0x04, 0x00, 0xC0, 0x00, 0x04, //$248 move.w #$8104, $C00004
+	0x60, 0xFE                                      //$250 bra.s *
+};
+
+static const uint8_t z80_code[] = {
+	0x3E, 0x2B,       //ld a, $2B
+	0x32, 0x00, 0x40, //ld ($4000), a
+	0x3C,             //inc a
+	0x32, 0x01, 0x40, //ld ($4001), a
+	0x32, 0x00, 0x10, //ld ($1000), a
+	0x18, 0xF4        //jr *-10
+};
+
+static uint8_t *build_header(void)
+{
+	uint8_t *rom = calloc(1, TEST_ROM_SIZE);
+	//initial SSP and PC
+	rom[1] = 0xFF; rom[2] = 0xFE;
+	rom[6] = M68K_CODE_START >> 8;
+	memcpy(rom + 0x100, "SEGA MEGA DRIVE ", 16);
+	//ROM end address
+	rom[0x1A5] = (TEST_ROM_SIZE - 1) >> 16; rom[0x1A6] = (TEST_ROM_SIZE - 1) >> 8 & 0xFF; rom[0x1A7] = (TEST_ROM_SIZE - 1) & 0xFF;
+	memcpy(rom + 0x1F0, "JUE", 3);
+	return rom;
+}
+
+uint8_t *build_test_rom(void)
+{
+	uint8_t *rom = build_header();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	memcpy(rom + Z80_CODE_START, z80_code, sizeof(z80_code));
+	return rom;
+}
+
+uint8_t *build_cpu_test_rom(void)
+{
+	uint8_t *rom = build_header();
+	memcpy(rom + M68K_CODE_START, cpu_code, sizeof(cpu_code));
+	return rom;
+}
+
+uint8_t *build_z80_test_rom(void)
+{
+	uint8_t *rom = build_header();
+	memcpy(rom + M68K_CODE_START, z80_loader_code, sizeof(z80_loader_code));
+	memcpy(rom + Z80_CODE_START, z80_driver_code, sizeof(z80_driver_code));
+	return rom;
+}
+
+uint32_t hash(uint32_t h, const uint8_t *data, size_t size)
+{
+	//FNV-1a
+	for (size_t i = 0; i < size; i++)
+	{
+		h = (h ^ data[i]) * 16777619;
+	}
+	return h;
+}
+
+uint32_t state_hash(blastem_instance *inst)
+{
+	return hash(video_hash, blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM),
+		blastem_instance_get_memory_size(inst, RETRO_MEMORY_SYSTEM_RAM));
+}
+
+uint32_t read_long(uint16_t *ram, uint32_t offset)
+{
+	return ram[offset / 2] << 16 | ram[offset / 2 + 1];
+}
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	video_hash = HASH_START;
+	for (unsigned y = 0; y < height; y++)
+	{
+		video_hash = hash(video_hash, (const uint8_t *)data + y * pitch, width * sizeof(uint32_t));
+	}
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	return frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	return 0;
+}
+
+blastem_instance *create_test_instance(void)
+{
+	blastem_instance *inst = blastem_instance_create();
+	blastem_instance_set_environment(inst, environment);
+	blastem_instance_set_video_refresh(inst, video_refresh);
+	blastem_instance_set_audio_sample_batch(inst, audio_sample_batch);
+	blastem_instance_set_input_poll(inst, input_poll);
+	blastem_instance_set_input_state(inst, input_state);
+	return inst;
+}
+
+void load_test_rom(blastem_instance *inst, uint8_t *rom, size_t rom_size)
+{
+	struct retro_game_info info = {
+		.data = rom,
+		.size = rom_size
+	};
+	if (!blastem_instance_load_game(inst, &info)) {
+		puts("FAIL: could not load ROM");
+		exit(1);
+	}
+	struct retro_system_av_info av;
+	blastem_instance_get_system_av_info(inst, &av);
+}
+
+blastem_instance *start_test_instance(uint8_t *rom, size_t rom_size)
+{
+	blastem_instance *inst = create_test_instance();
+	load_test_rom(inst, rom, rom_size);
+	return inst;
+}
+
+blastem_instance *setup_test_instance(uint8_t *rom, const test_run *run)
+{
+	blastem_instance *inst = create_test_instance();
+	if (run->video_refresh) {
+		blastem_instance_set_video_refresh(inst, run->video_refresh);
+	}
+	if (run->audio_sample_batch) {
+		blastem_instance_set_audio_sample_batch(inst, run->audio_sample_batch);
+	}
+	if (run->set_option && !run->set_option(inst, run->option)) {
+		printf("FAIL: could not change %s before loading a game\n", run->option_name);
+		exit(1);
+	}
+	load_test_rom(inst, rom, TEST_ROM_SIZE);
+	if (run->set_option && run->set_option(inst, !run->option)) {
+		printf("FAIL: %s changed after loading a game\n", run->option_name);
+		exit(1);
+	}
+	if (run->limit_code_cache && !blastem_instance_set_code_cache_budget(inst, run->code_cache_budget)) {
+		puts("FAIL: could not set the code cache budget");
+		exit(1);
+	}
+	if (run->code_store && !blastem_instance_set_code_store(inst, run->code_store)) {
+		puts("FAIL: code store is not supported");
+		exit(1);
+	}
+	return inst;
+}
+
+void run_test_rom(uint8_t *rom, const test_run *run, test_result *result)
+{
+	blastem_instance *inst = setup_test_instance(rom, run);
+	for (int frame = 0; frame < run->frames; frame++)
+	{
+		blastem_instance_run(inst);
+		if (run->hashes) {
+			run->hashes[frame] = state_hash(inst);
+		}
+	}
+	if (result) {
+		size_t ram_size = blastem_instance_get_memory_size(inst, RETRO_MEMORY_SYSTEM_RAM);
+		memcpy(result->ram, blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM),
+			ram_size < sizeof(result->ram) ? ram_size : sizeof(result->ram));
+		blastem_instance_get_code_cache_stats(inst, &result->m68k, &result->z80);
+	}
+	blastem_instance_destroy(inst);
+}
@@ -0,0 +1,70 @@
+#ifndef TEST_ROM_H_
+#define TEST_ROM_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "libblastem.h"
+
+#define TEST_ROM_SIZE (128*1024)
+#define M68K_CODE_START 0x200
+#define Z80_CODE_START 0x400
+
+//number of iterations of the inner loop of the program in build_cpu_test_rom
+#define CPU_TEST_ITERATIONS 0x1000
+
+uint8_t *build_test_rom(void);
+//a ROM whose 68K program does nothing but keep the CPU busy
+uint8_t *build_cpu_test_rom(void);
+//a ROM whose Z80 runs a program shaped like a sound driver while the 68K idles
+uint8_t *build_z80_test_rom(void);
+
+//FNV-1a hash of data continuing from h, which is HASH_START for a new hash
+#define HASH_START 2166136261U
+uint32_t hash(uint32_t h, const uint8_t *data, size_t size);
+//hash of the last frame passed to the video callback of instances from create_test_instance
+extern uint32_t video_hash;
+//video_hash combined with the work RAM of inst
+uint32_t state_hash(blastem_instance *inst);
+//work RAM is stored as big endian words that are byte swapped on little endian hosts
+uint32_t read_long(uint16_t *ram, uint32_t offset);
+//monotonic time in seconds
+double now(void);
+//an instance with callbacks that ignore input and audio and hash the video into video_hash, tests
+//that need something else from a callback set their own before loading the ROM
+blastem_instance *create_test_instance(void);
+//loads rom into inst, exits if that fails
+void load_test_rom(blastem_instance *inst, uint8_t *rom, size_t rom_size);
+blastem_instance *start_test_instance(uint8_t *rom, size_t rom_size);
+
+//how setup_test_instance and run_test_rom treat a test ROM, fields left zero keep the defaults
+typedef struct {
+	//setter of an option that can only be changed before loading a game, setup_test_instance also
+	//checks that changing it fails once the game is loaded
+	bool                       (*set_option)(blastem_instance *inst, bool enabled);
+	const char                 *option_name;
+	bool                       option;
+	//code_cache_budget is set after loading when limit_code_cache is, 0 lifts the limit
+	bool                       limit_code_cache;
+	size_t                     code_cache_budget;
+	const char                 *code_store;
+	//callbacks used in place of the ones from create_test_instance
+	retro_video_refresh_t      video_refresh;
+	retro_audio_sample_batch_t audio_sample_batch;
+	int                        frames;
+	//receives the state_hash of each frame when not NULL
+	uint32_t                   *hashes;
+} test_run;
+
+#define TEST_RAM_SIZE (64*1024)
+typedef struct {
+	blastem_code_cache_stats m68k;
+	blastem_code_cache_stats z80;
+	//work RAM after the last frame, in the layout read_long expects
+	uint16_t                 ram[TEST_RAM_SIZE/2];
+} test_result;
+
+//creates an instance and loads rom into it as described by run, exits if any of that fails
+blastem_instance *setup_test_instance(uint8_t *rom, const test_run *run);
+//runs rom for run->frames frames in a new instance and fills result with its final state if not NULL
+void run_test_rom(uint8_t *rom, const test_run *run, test_result *result);
+
+#endif //TEST_ROM_H_
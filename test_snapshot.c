@@ -0,0 +1,128 @@
+/*
+ Checks that rollback snapshots and delta snapshots taken through the libblastem instance API
+ restore the emulated state exactly and measures how long saving and restoring them takes.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_SLOTS 8
+#define NUM_FRAMES 64
+#define BENCH_ITERATIONS 2000
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	blastem_instance *inst = start_test_instance(rom, TEST_ROM_SIZE);
+	//let the program get past its Z80 setup before taking snapshots
+	for (int i = 0; i < 8; i++)
+	{
+		blastem_instance_run(inst);
+	}
+
+	size_t slot_size = blastem_instance_snapshot_size(inst);
+	printf("Snapshot size: %zu bytes\n", slot_size);
+	uint8_t *ring = malloc(slot_size * NUM_SLOTS);
+	uint32_t expected[NUM_FRAMES];
+	int failures = 0;
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		if (!blastem_instance_snapshot(inst, ring + (frame % NUM_SLOTS) * slot_size)) {
+			printf("FAIL: snapshot failed on frame %d\n", frame);
+			return 1;
+		}
+		blastem_instance_run(inst);
+		expected[frame] = state_hash(inst);
+		if (frame >= NUM_SLOTS - 1 && frame % 3 == 0) {
+			//roll back to the oldest slot in the ring and re-simulate up to the current frame
+			int start = frame - (NUM_SLOTS - 1);
+			if (!blastem_instance_restore(inst, ring + (start % NUM_SLOTS) * slot_size)) {
+				printf("FAIL: restore failed on frame %d\n", frame);
+				return 1;
+			}
+			for (int resim = start; resim <= frame; resim++)
+			{
+				blastem_instance_run(inst);
+				if (state_hash(inst) != expected[resim]) {
+					printf("FAIL: frame %d differs after rolling back from frame %d to %d\n", resim, frame, start);
+					failures++;
+				}
+			}
+		}
+	}
+
+	//deltas against a single base, restored out of order to make sure each one stands on its own
+	uint8_t *base = malloc(slot_size);
+	uint8_t *scratch = malloc(slot_size);
+	uint8_t *deltas[NUM_FRAMES];
+	size_t delta_total = 0;
+	if (!blastem_instance_snapshot(inst, base)) {
+		puts("FAIL: base snapshot failed");
+		return 1;
+	}
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		blastem_instance_run(inst);
+		expected[frame] = state_hash(inst);
+		size_t size = blastem_instance_snapshot_delta(inst, scratch);
+		if (!size) {
+			printf("FAIL: delta snapshot failed on frame %d\n", frame);
+			return 1;
+		}
+		deltas[frame] = malloc(size);
+		memcpy(deltas[frame], scratch, size);
+		delta_total += size;
+		if (frame % 5 == 4) {
+			//deltas keep working after restoring an earlier one
+			int target = frame / 2;
+			if (!blastem_instance_restore_delta(inst, base, deltas[target])) {
+				printf("FAIL: delta restore failed on frame %d\n", frame);
+				return 1;
+			}
+			for (int resim = target + 1; resim <= frame; resim++)
+			{
+				blastem_instance_run(inst);
+				if (state_hash(inst) != expected[resim]) {
+					printf("FAIL: frame %d differs after restoring the delta from frame %d\n", resim, target);
+					failures++;
+				}
+			}
+		}
+	}
+	printf("Average delta size: %zu bytes\n", delta_total / NUM_FRAMES);
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		free(deltas[frame]);
+	}
+	free(scratch);
+	free(base);
+
+	double save_time = 0, load_time = 0;
+	for (int i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		uint8_t *slot = ring + (i % NUM_SLOTS) * slot_size;
+		double start = now();
+		blastem_instance_snapshot(inst, slot);
+		double mid = now();
+		blastem_instance_restore(inst, slot);
+		load_time += now() - mid;
+		save_time += mid - start;
+		if (!(i % NUM_SLOTS)) {
+			blastem_instance_run(inst);
+		}
+	}
+	printf("Snapshot: %.2f us, restore: %.2f us per frame\n", save_time * 1000000.0 / BENCH_ITERATIONS, load_time * 1000000.0 / BENCH_ITERATIONS);
+
+	blastem_instance_destroy(inst);
+	free(ring);
+	free(rom);
+	if (failures) {
+		printf("%d frames did not match after rollback\n", failures);
+	} else {
+		puts("All rolled back frames matched");
+	}
+	return failures != 0;
+}
@@ -0,0 +1,168 @@
+/*
+ Checks that rendering sound on a separate thread doesn't change what is emulated or heard. The test
+ ROM's 68K program is replaced with one that plays a note on the YM2612, polls its status for timer A
+ overflows and answers each one by changing the PSG tone and keying the note off or on, summing every
+ status read in work RAM. The same sequence of runs, rollback snapshots and save states is done with
+ the sound thread turned off and on, and the samples and work RAM of every run have to match.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libblastem.h"
+#include "test_rom.h"
+
+#define NUM_RUNS 60
+#define SNAPSHOT_RUN 10
+#define SERIALIZE_RUN 20
+#define RESTORE_RUN 25
+#define UNSERIALIZE_RUN 35
+
+static const uint8_t m68k_code[] = {
+	0x41, 0xF9, 0x00, 0xA0, 0x40, 0x00,             //$200 lea $A04000, a0
+	0x43, 0xF9, 0x00, 0xC0, 0x00, 0x11,             //$206 lea $C00011, a1
+	0x4B, 0xF9, 0x00, 0xFF, 0x00, 0x00,             //$20C lea $FF0000, a5
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x11, 0x00, //$212 move.w #$100, $A11100
+	0x33, 0xFC, 0x01, 0x00, 0x00, 0xA1, 0x12, 0x00, //$21A move.w #$100, $A11200
+	0x08, 0x39, 0x00, 0x00, 0x00, 0xA1, 0x11, 0x00, //$222 btst #0, $A11100
+	0x66, 0xF6,                                     //$22A bne.s *-8
+	0x45, 0xFA, 0x00, 0x58,                         //$22C lea regs(pc), a2
+	0x72, 0x1D,                                     //$230 moveq #29, d1
+	0x10, 0x9A,                                     //$232 regloop: move.b (a2)+, (a0)
+	0x11, 0x5A, 0x00, 0x01,                         //$234 move.b (a2)+, 1(a0)
+	0x51, 0xC9, 0xFF, 0xF8,                         //$238 dbra d1, regloop
+	0x74, 0x00,                                     //$23C moveq #0, d2
+	0x78, 0x00,                                     //$23E moveq #0, d4
+	0x70, 0x00,                                     //$240 loop: moveq #0, d0
+	0x10, 0x10,                                     //$242 move.b (a0), d0
+	0xD8, 0x80,                                     //$244 add.l d0, d4
+	0x2B, 0x44, 0x00, 0x04,                         //$246 move.l d4, 4(a5)
+	0x08, 0x00, 0x00, 0x00,                         //$24A btst #0, d0
+	0x67, 0x34,                                     //$24E beq.s next
+	0x52, 0x95,                                     //$250 addq.l #1, (a5)
+	0x10, 0xBC, 0x00, 0x27,                         //$252 move.b #$27, (a0)
+	0x11, 0x7C, 0x00, 0x15, 0x00, 0x01,             //$256 move.b #$15, 1(a0)
+	0x52, 0x02,                                     //$25C addq.b #1, d2
+	0x16, 0x02,                                     //$25E move.b d2, d3
+	0x02, 0x03, 0x00, 0x0F,                         //$260 andi.b #$F, d3
+	0x00, 0x03, 0x00, 0x80,                         //$264 ori.b #$80, d3
+	0x12, 0x83,                                     //$268 move.b d3, (a1)
+	0x12, 0xBC, 0x00, 0x10,                         //$26A move.b #$10, (a1)
+	0x12, 0xBC, 0x00, 0x90,                         //$26E move.b #$90, (a1)
+	0x76, 0x00,                                     //$272 moveq #0, d3
+	0x08, 0x02, 0x00, 0x00,                         //$274 btst #0, d2
+	0x67, 0x02,                                     //$278 beq.s keyoff
+	0x76, 0xF0,                                     //$27A moveq #-$10, d3
+	0x10, 0xBC, 0x00, 0x28,                         //$27C keyoff: move.b #$28, (a0)
+	0x11, 0x43, 0x00, 0x01,                         //$280 move.b d3, 1(a0)
+	0x60, 0xBA,                                     //$284 next: bra.s loop
+	//$286 regs: register and value pairs
+	0x22, 0x08, 0x27, 0x00, 0xB0, 0x3C, 0xB4, 0xD3,
+	0x30, 0x01, 0x34, 0x02, 0x38, 0x04, 0x3C, 0x01,
+	0x40, 0x20, 0x44, 0x10, 0x48, 0x20, 0x4C, 0x08,
+	0x50, 0x1F, 0x54, 0x1F, 0x58, 0x1F, 0x5C, 0x1F,
+	0x60, 0x85, 0x64, 0x05, 0x68, 0x05, 0x6C, 0x05,
+	0x80, 0x2F, 0x84, 0x2F, 0x88, 0x2F, 0x8C, 0x2F,
+	0xA4, 0x22, 0xA0, 0x69,
+	//timer A reloads every 64 samples and sets its flag
+	0x24, 0xF0, 0x25, 0x00, 0x27, 0x05,
+	0x28, 0xF0
+};
+
+static uint32_t audio_hash;
+static uint64_t audio_frames, loud_runs;
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	audio_hash = hash(audio_hash, (const uint8_t *)data, frames * 2 * sizeof(int16_t));
+	audio_frames += frames;
+	for (size_t i = 0; i < frames * 2; i++)
+	{
+		if (data[i] > 1000 || data[i] < -1000) {
+			loud_runs++;
+			break;
+		}
+	}
+	return frames;
+}
+
+//fills hashes with the samples and work RAM of each run, returns the number of timer A overflows
+static uint32_t run_script(uint8_t *rom, bool sound_thread, uint32_t *hashes)
+{
+	test_run run = {
+		.set_option = blastem_instance_set_sound_thread,
+		.option_name = "the sound thread",
+		.option = sound_thread,
+		.audio_sample_batch = audio_sample_batch
+	};
+	blastem_instance *inst = setup_test_instance(rom, &run);
+	uint8_t *slot = malloc(blastem_instance_snapshot_size(inst));
+	size_t state_size = blastem_instance_serialize_size(inst);
+	uint8_t *state = malloc(state_size);
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		if (run == SNAPSHOT_RUN && !blastem_instance_snapshot(inst, slot)) {
+			puts("FAIL: snapshot failed");
+			exit(1);
+		}
+		if (run == SERIALIZE_RUN && !blastem_instance_serialize(inst, state, state_size)) {
+			puts("FAIL: could not save state");
+			exit(1);
+		}
+		if (run == RESTORE_RUN && !blastem_instance_restore(inst, slot)) {
+			puts("FAIL: restore failed");
+			exit(1);
+		}
+		if (run == UNSERIALIZE_RUN && !blastem_instance_unserialize(inst, state, state_size)) {
+			puts("FAIL: could not load state");
+			exit(1);
+		}
+		audio_hash = HASH_START;
+		blastem_instance_run(inst);
+		hashes[run] = hash(audio_hash, blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM),
+			blastem_instance_get_memory_size(inst, RETRO_MEMORY_SYSTEM_RAM));
+	}
+	uint32_t overflows = read_long(blastem_instance_get_memory_data(inst, RETRO_MEMORY_SYSTEM_RAM), 0);
+	free(state);
+	free(slot);
+	blastem_instance_destroy(inst);
+	return overflows;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *rom = build_test_rom();
+	memcpy(rom + M68K_CODE_START, m68k_code, sizeof(m68k_code));
+	int failures = 0;
+	uint32_t expected[NUM_RUNS], hashes[NUM_RUNS];
+	uint32_t overflows = run_script(rom, 0, expected);
+	uint64_t expected_frames = audio_frames;
+	printf("without the sound thread: %u timer overflows, %llu sample frames, %llu runs with sound\n", overflows,
+		(unsigned long long)audio_frames, (unsigned long long)loud_runs);
+	if (!overflows || !loud_runs) {
+		puts("FAIL: the program did not play anything");
+		failures++;
+	}
+	audio_frames = loud_runs = 0;
+	uint32_t thread_overflows = run_script(rom, 1, hashes);
+	printf("with the sound thread: %u timer overflows, %llu sample frames\n", thread_overflows, (unsigned long long)audio_frames);
+	if (thread_overflows != overflows || audio_frames != expected_frames) {
+		puts("FAIL: timer overflows or sample count differ with the sound thread");
+		failures++;
+	}
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		if (hashes[run] != expected[run]) {
+			printf("FAIL: run %d differs with the sound thread\n", run);
+			failures++;
+			break;
+		}
+	}
+	free(rom);
+	if (failures) {
+		printf("%d sound thread checks failed\n", failures);
+	} else {
+		puts("Samples and status reads matched with the sound thread");
+	}
+	return failures != 0;
+}
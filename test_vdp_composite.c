@@ -0,0 +1,98 @@
+/*
+ Checks that the vectorized VDP compositing kernels produce exactly the same framebuffers as the
+ scalar reference. Random line buffer contents are composited with and without shadow/highlight
+ mode, converted to colors and compared line by line along with the layer debug output.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "vdp_composite.h"
+
+#define NUM_FRAMES 64
+#define NUM_LINES 240
+#define COLUMNS (320 / COMPOSITE_PIXELS)
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void)
+{
+	//xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static uint8_t random_pixel(void)
+{
+	uint32_t r = rng();
+	switch (r & 7)
+	{
+	case 0:
+		//transparent pixel, possibly with the priority bit set
+		return r >> 8 & 0xF0;
+	case 1:
+		//shadow/highlight operator colors
+		return (r >> 8 & 0xC0) | 0x3E | (r >> 16 & 1);
+	default:
+		return r >> 8;
+	}
+}
+
+typedef void (*composite_fun)(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index);
+typedef void (*lookup_fun)(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index);
+
+static void render_line(composite_fun composite, lookup_fun lookup, uint8_t *layers, uint32_t const *colors,
+	uint8_t bg_index, uint32_t *out, uint8_t *debug_out)
+{
+	uint8_t indices[LINEBUF_SIZE];
+	memset(indices, 0, sizeof(indices));
+	memset(debug_out, DBG_SRC_BG, LINEBUF_SIZE);
+	for (int col = 0; col < COLUMNS; col++)
+	{
+		int offset = BORDER_LEFT + col * COMPOSITE_PIXELS;
+		composite(indices + offset, debug_out + offset, layers + offset, layers + LINEBUF_SIZE + offset,
+			layers + 2 * LINEBUF_SIZE + offset, bg_index);
+	}
+	lookup(out, indices, colors, LINEBUF_SIZE, bg_index);
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t layers[3 * LINEBUF_SIZE];
+	static uint32_t colors[CRAM_SIZE * 4];
+	static uint32_t expected[LINEBUF_SIZE], actual[LINEBUF_SIZE];
+	static uint8_t expected_debug[LINEBUF_SIZE], actual_debug[LINEBUF_SIZE];
+	int failures = 0;
+	for (int frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		for (int i = 0; i < CRAM_SIZE * 4; i++)
+		{
+			colors[i] = rng();
+		}
+		uint8_t highlight = frame & 1;
+		composite_fun reference = highlight ? composite_pixels_highlight_scalar : composite_pixels_scalar;
+		composite_fun vector = highlight ? composite_pixels_highlight : composite_pixels;
+		for (int line = 0; line < NUM_LINES; line++)
+		{
+			for (int i = 0; i < sizeof(layers); i++)
+			{
+				layers[i] = random_pixel();
+			}
+			//the background color register can have bits set outside of the palette index
+			uint8_t bg_index = line & 1 ? rng() : rng() & 0x3F;
+			render_line(reference, composite_lookup_scalar, layers, colors, bg_index, expected, expected_debug);
+			render_line(vector, composite_lookup, layers, colors, bg_index, actual, actual_debug);
+			if (memcmp(expected, actual, sizeof(expected)) || memcmp(expected_debug, actual_debug, sizeof(expected_debug))) {
+				printf("FAIL: line %d of frame %d differs%s\n", line, frame, highlight ? " with shadow/highlight" : "");
+				failures++;
+			}
+		}
+	}
+	if (failures) {
+		printf("%d lines did not match the scalar compositor\n", failures);
+	} else {
+		printf("All %d lines matched the scalar compositor\n", NUM_FRAMES * NUM_LINES);
+	}
+	return failures != 0;
+}
@@ -0,0 +1,248 @@
+/*
+ Checks that the line at a time VDP renderers produce the same output as stepping through the
+ slot by slot renderers. Random scenes are run once in large steps, which lets vdp_h40/vdp_h32
+ hand whole lines to the line renderers, and once a slot at a time, which never does. Port writes
+ land at the same cycles in both runs so the fallback to the slot renderers is covered as well.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vdp.h"
+
+#define NUM_SCENES 16
+#define NUM_FRAMES 3
+#define MAX_FRAMES 8
+//deliberately not a multiple of the line length so steps end at varying points of a line
+#define STEP_CYCLES (6 * MCLKS_LINE + 1234)
+#define FB_LINES 512
+
+int headless = 0;
+
+static uint32_t framebuffers[2][FB_LINES * LINEBUF_SIZE];
+static uint32_t frame_hashes[MAX_FRAMES];
+static int frames_pushed;
+
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return r << 16 | g << 8 | b;
+}
+
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffers[which];
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+	//FNV-1a
+	uint32_t hash = 2166136261U;
+	uint8_t *data = (uint8_t *)framebuffers[which];
+	for (size_t i = 0; i < sizeof(framebuffers[which]); i++)
+	{
+		hash = (hash ^ data[i]) * 16777619;
+	}
+	if (frames_pushed < MAX_FRAMES) {
+		frame_hashes[frames_pushed] = hash;
+	}
+	frames_pushed++;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_overscan_top()
+{
+	return 11;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 8;
+}
+
+uint16_t read_dma_value(system_header *system, uint32_t address)
+{
+	return 0;
+}
+
+void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
+{
+}
+
+void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
+{
+}
+
+void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc)
+{
+}
+
+void reader_ensure_data(event_reader *reader, size_t bytes)
+{
+}
+
+long file_size(FILE * f)
+{
+	return 0;
+}
+
+void fatal_error(char *format, ...)
+{
+	puts("FAIL: fatal error");
+	exit(1);
+}
+
+void warning(char *format, ...)
+{
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+	//xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void set_reg(vdp_context *context, uint8_t reg, uint8_t value)
+{
+	vdp_control_port_write(context, 0x8000 | reg << 8 | value);
+}
+
+static void set_address(vdp_context *context, uint32_t command)
+{
+	vdp_control_port_write(context, command >> 16);
+	vdp_control_port_write(context, command);
+}
+
+static void wait_fifo(vdp_context *context)
+{
+	while (context->fifo_read >= 0)
+	{
+		vdp_run_context_full(context, context->cycles + 1);
+	}
+}
+
+static vdp_context *build_scene(int scene)
+{
+	vdp_context *context = init_vdp_context(0, 0);
+	rng_state = 0x9E3779B9 * (scene + 1);
+	set_reg(context, REG_MODE_1, 0x04);
+	set_reg(context, REG_MODE_2, BIT_MODE_5);
+	set_reg(context, REG_SCROLL_A, 0xC000 >> 10);
+	set_reg(context, REG_WINDOW, 0xD000 >> 10);
+	set_reg(context, REG_SCROLL_B, 0xE000 >> 13);
+	set_reg(context, REG_SAT, 0xF000 >> 9);
+	set_reg(context, REG_BG_COLOR, rng() & 0x3F);
+	//full screen, per cell or per line horizontal scroll and full or 2-cell vertical scroll
+	set_reg(context, REG_MODE_3, rng() & 7);
+	set_reg(context, REG_MODE_4, (scene & 1 ? BIT_H40 : 0) | (scene & 2 ? BIT_HILIGHT : 0));
+	set_reg(context, REG_HSCROLL, 0xFC00 >> 10);
+	set_reg(context, REG_AUTOINC, 2);
+	set_reg(context, REG_SCROLL, 0x01);
+	set_reg(context, REG_WINDOW_H, scene & 4 ? (rng() & 0x9F) : 0);
+	set_reg(context, REG_WINDOW_V, scene & 4 ? (rng() & 0x9F) : 0);
+	set_address(context, 0x40000000);
+	for (int i = 0; i < VRAM_SIZE / 2; i++)
+	{
+		vdp_data_port_write(context, rng());
+	}
+	set_address(context, 0xC0000000);
+	for (int i = 0; i < CRAM_SIZE; i++)
+	{
+		vdp_data_port_write(context, rng());
+	}
+	set_address(context, 0x40000010);
+	for (int i = 0; i < MIN_VSRAM_SIZE; i++)
+	{
+		vdp_data_port_write(context, rng());
+	}
+	wait_fifo(context);
+	set_reg(context, REG_MODE_2, BIT_MODE_5 | BIT_DISP_EN);
+	return context;
+}
+
+//runs a scene for NUM_FRAMES frames with CRAM, VSRAM and background color writes between some of the steps
+static void run_scene(vdp_context *context, int scene, uint8_t single_slots)
+{
+	memset(framebuffers, 0, sizeof(framebuffers));
+	frames_pushed = 0;
+	rng_state = 0x7F4A7C15 * (scene + 1);
+	uint32_t target = context->cycles;
+	while (frames_pushed < NUM_FRAMES)
+	{
+		target += STEP_CYCLES;
+		if (single_slots) {
+			while (context->cycles < target)
+			{
+				vdp_run_context_full(context, context->cycles + 1);
+			}
+		} else {
+			vdp_run_context_full(context, target);
+		}
+		uint32_t r = rng();
+		if (r & 1) {
+			set_address(context, 0xC0000000 | (r >> 1 & 0x7E) << 16);
+			vdp_data_port_write(context, r >> 8);
+			set_address(context, 0x40000010 | (r >> 16 & 0x3E) << 16);
+			vdp_data_port_write(context, r >> 20);
+		}
+		if (r & 2) {
+			//register writes don't go through the FIFO so the next step can still use the line renderers
+			set_reg(context, REG_BG_COLOR, r >> 24 & 0x3F);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+	for (int scene = 0; scene < NUM_SCENES; scene++)
+	{
+		uint32_t expected[MAX_FRAMES];
+		vdp_context *context = build_scene(scene);
+		run_scene(context, scene, 1);
+		memcpy(expected, frame_hashes, sizeof(expected));
+		uint32_t expected_cycles = context->cycles;
+		uint16_t expected_vcounter = context->vcounter;
+		vdp_free(context);
+
+		context = build_scene(scene);
+		run_scene(context, scene, 0);
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			if (frame_hashes[frame] != expected[frame]) {
+				printf("FAIL: frame %d of scene %d (H%d%s) differs from the slot renderer\n", frame, scene,
+					scene & 1 ? 40 : 32, scene & 2 ? ", shadow/highlight" : "");
+				failures++;
+			}
+		}
+		if (context->cycles != expected_cycles || context->vcounter != expected_vcounter) {
+			printf("FAIL: scene %d ended at cycle %u line %u instead of cycle %u line %u\n", scene,
+				context->cycles, context->vcounter, expected_cycles, expected_vcounter);
+			failures++;
+		}
+		vdp_free(context);
+	}
+	if (failures) {
+		printf("%d line renderer checks failed\n", failures);
+	} else {
+		printf("All %d frames matched the slot renderer\n", NUM_SCENES * NUM_FRAMES);
+	}
+	return failures != 0;
+}
@@ -0,0 +1,345 @@
+/*
+ Checks that running the YM2612 a whole output period at a time produces exactly the same samples
+ as stepping through the operators one at a time. A VGM stream is played through two contexts, one
+ of them created with YM_OPT_SINGLE_STEP, and the samples are compared after every wait. Without
+ an argument a random VGM stream covering the LFO, timers, CSM, SSG-EG, DAC and all algorithms is
+ generated, a VGM file can be given to check real music as well.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "ym2612.h"
+
+#define MASTER_CLOCK 53693175
+#define CLOCK_DIV 7
+#define VGM_RATE 44100
+#define NUM_STREAMS 8
+#define STREAM_WRITES 4000
+#define MAX_SAMPLES 0x10000
+
+typedef struct {
+	int16_t  samples[MAX_SAMPLES * 2];
+	uint32_t count;
+} sample_capture;
+
+static sample_capture captures[2];
+static int next_capture;
+
+audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
+{
+	return (audio_source *)(captures + (next_capture++ & 1));
+}
+
+void render_free_source(audio_source *src)
+{
+}
+
+void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
+{
+}
+
+void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
+{
+	sample_capture *capture = (sample_capture *)src;
+	if (capture->count < MAX_SAMPLES) {
+		capture->samples[capture->count * 2] = left;
+		capture->samples[capture->count * 2 + 1] = right;
+	}
+	capture->count++;
+}
+
+long file_size(FILE * f)
+{
+	long current = ftell(f);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, current, SEEK_SET);
+	return size;
+}
+
+void warning(char *format, ...)
+{
+}
+
+void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
+{
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+	//xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static uint8_t *add_write(uint8_t *cur, uint8_t part, uint8_t reg, uint8_t value)
+{
+	*(cur++) = part ? CMD_YM2612_1 : CMD_YM2612_0;
+	*(cur++) = reg;
+	*(cur++) = value;
+	return cur;
+}
+
+//generates the command data of a VGM file with random register writes, returns the size
+static uint32_t generate_stream(uint8_t *data, int stream)
+{
+	rng_state = 0x9E3779B9 * (stream + 1);
+	uint8_t *cur = data;
+	//start every channel with a random patch so there is sound from the start
+	for (uint8_t reg = REG_DETUNE_MULT; reg < REG_FNUM_LOW; reg++)
+	{
+		if ((reg & 3) != 3) {
+			uint8_t value = rng();
+			if (reg >= REG_TOTAL_LEVEL && reg < REG_ATTACK_KS) {
+				value &= 0x3F;
+			}
+			cur = add_write(cur, 0, reg, value);
+			cur = add_write(cur, 1, reg, value);
+		}
+	}
+	for (int i = 0; i < STREAM_WRITES; i++)
+	{
+		uint32_t r = rng();
+		uint8_t part = r >> 8 & 1;
+		uint8_t value = r >> 16;
+		switch (r & 0xF)
+		{
+		case 0:
+		case 1:
+		case 2:
+			//key on/off for a random channel and operator mask
+			cur = add_write(cur, 0, REG_KEY_ONOFF, (value & 0xF0) | (r >> 24) % 6 + ((r >> 24) % 6 > 2));
+			break;
+		case 3:
+			cur = add_write(cur, 0, REG_LFO, value & 0xF);
+			break;
+		case 4:
+			cur = add_write(cur, 0, REG_TIMERA_HIGH + (r >> 9 & 1), value);
+			cur = add_write(cur, 0, REG_TIMERB, r >> 24);
+			break;
+		case 5:
+			//timer control, including channel 3 special and CSM modes
+			cur = add_write(cur, 0, REG_TIME_CTRL, value);
+			break;
+		case 6:
+			cur = add_write(cur, 0, REG_DAC_ENABLE, value & 0x80);
+			cur = add_write(cur, 0, REG_DAC, r >> 24);
+			break;
+		case 7:
+		case 8:
+			cur = add_write(cur, part, REG_BLOCK_FNUM_H + (r >> 24) % 3 + (r >> 10 & 1) * 8, value & 0x3F);
+			cur = add_write(cur, part, REG_FNUM_LOW + (r >> 24) % 3 + (r >> 10 & 1) * 8, r >> 24);
+			break;
+		case 9:
+			cur = add_write(cur, part, REG_ALG_FEEDBACK + (r >> 24) % 3, value & 0x3F);
+			break;
+		case 10:
+			cur = add_write(cur, part, REG_LR_AMS_PMS + (r >> 24) % 3, value);
+			break;
+		case 11:
+			cur = add_write(cur, part, REG_SSG_EG + (r >> 24) % 16, value & 0xF);
+			break;
+		default: {
+			//any operator register
+			uint8_t reg = REG_DETUNE_MULT + (r >> 24) % (REG_FNUM_LOW - REG_DETUNE_MULT);
+			cur = add_write(cur, part, reg, reg >= REG_TOTAL_LEVEL && reg < REG_ATTACK_KS ? value & 0x3F : value);
+			break;
+		}
+		}
+		uint32_t wait = rng();
+		switch (wait & 3)
+		{
+		case 0:
+			//no wait, several writes in the same sample
+			break;
+		case 1:
+			*(cur++) = CMD_WAIT_SHORT + (wait >> 8 & 0xF);
+			break;
+		default:
+			*(cur++) = CMD_WAIT;
+			*(cur++) = wait >> 8;
+			*(cur++) = 0;
+			break;
+		}
+	}
+	*(cur++) = CMD_END;
+	return cur - data;
+}
+
+static int compare_captures(void)
+{
+	uint32_t count = captures[0].count < MAX_SAMPLES ? captures[0].count : MAX_SAMPLES;
+	int mismatch = captures[0].count != captures[1].count
+		|| memcmp(captures[0].samples, captures[1].samples, count * 2 * sizeof(int16_t));
+	captures[0].count = captures[1].count = 0;
+	return mismatch;
+}
+
+//plays a VGM command stream through a single stepped context and a batched one, returns the
+//number of waits after which the samples differed
+static int play_stream(uint8_t *cur, uint8_t *end, uint32_t *total_samples)
+{
+	ym2612_context *contexts[2];
+	for (int i = 0; i < 2; i++)
+	{
+		contexts[i] = calloc(1, sizeof(ym2612_context));
+		next_capture = i;
+		ym_init(contexts[i], MASTER_CLOCK, CLOCK_DIV, i ? 0 : YM_OPT_SINGLE_STEP);
+	}
+	captures[0].count = captures[1].count = 0;
+	int failures = 0;
+	uint64_t sample_num = 0, deducted = 0;
+	while (cur < end)
+	{
+		uint8_t cmd = *(cur++);
+		uint32_t wait = 0;
+		switch (cmd)
+		{
+		case CMD_PSG_STEREO:
+		case CMD_PSG:
+			cur++;
+			break;
+		case CMD_YM2612_0:
+		case CMD_YM2612_1:
+			if (cur + 2 > end) {
+				cur = end;
+				break;
+			}
+			for (int i = 0; i < 2; i++)
+			{
+				if (cmd == CMD_YM2612_0) {
+					ym_address_write_part1(contexts[i], cur[0]);
+				} else {
+					ym_address_write_part2(contexts[i], cur[0]);
+				}
+				ym_data_write(contexts[i], cur[1]);
+			}
+			cur += 2;
+			break;
+		case CMD_WAIT:
+			if (cur + 2 > end) {
+				cur = end;
+				break;
+			}
+			wait = cur[0] | cur[1] << 8;
+			cur += 2;
+			break;
+		case CMD_WAIT_60:
+			wait = 735;
+			break;
+		case CMD_WAIT_50:
+			wait = 882;
+			break;
+		case CMD_END:
+			cur = end;
+			break;
+		case CMD_DATA:
+			//data blocks are only used for DAC samples, which don't go through the part of the chip
+			//that is being checked here
+			if (cur + 6 > end) {
+				cur = end;
+			} else {
+				cur += 6 + (cur[2] | cur[3] << 8 | cur[4] << 16 | (uint32_t)cur[5] << 24);
+			}
+			break;
+		case CMD_DATA_SEEK:
+			cur += 4;
+			break;
+		default:
+			if (cmd >= CMD_WAIT_SHORT && cmd < CMD_WAIT_SHORT + 0x10) {
+				wait = (cmd & 0xF) + 1;
+			} else if (cmd >= CMD_YM2612_DAC && cmd < CMD_DAC_STREAM_SETUP) {
+				wait = cmd & 0xF;
+			} else if (cmd >= 0x30 && cmd < 0x40) {
+				cur++;
+			} else if (cmd >= 0x40 && cmd < 0x4F || cmd >= 0x54 && cmd < 0x60 || cmd >= 0xA0 && cmd < 0xC0) {
+				cur += 2;
+			} else if (cmd >= 0xC0 && cmd < 0xE0) {
+				cur += 3;
+			} else if (cmd >= 0xE0) {
+				cur += 4;
+			} else {
+				printf("FAIL: unsupported VGM command %X\n", cmd);
+				failures++;
+				cur = end;
+			}
+		}
+		if (wait) {
+			sample_num += wait;
+			//convert to master clock cycles without accumulating rounding errors
+			uint32_t target = sample_num * MASTER_CLOCK / VGM_RATE - deducted;
+			for (int i = 0; i < 2; i++)
+			{
+				ym_run(contexts[i], target);
+			}
+			*total_samples += captures[0].count;
+			failures += compare_captures();
+			if (contexts[0]->status != contexts[1]->status) {
+				failures++;
+			}
+			if (target > 0x80000000) {
+				for (int i = 0; i < 2; i++)
+				{
+					ym_adjust_cycles(contexts[i], 0x40000000);
+				}
+				deducted += 0x40000000;
+			}
+		}
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		ym_free(contexts[i]);
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+	uint32_t total_samples = 0;
+	if (argc > 1) {
+		FILE *f = fopen(argv[1], "rb");
+		if (!f) {
+			fprintf(stderr, "Failed to open %s\n", argv[1]);
+			return 1;
+		}
+		long size = file_size(f);
+		uint8_t *data = malloc(size);
+		if (size < sizeof(vgm_header) || fread(data, 1, size, f) != size) {
+			fprintf(stderr, "Failed to read %s\n", argv[1]);
+			return 1;
+		}
+		fclose(f);
+		vgm_header *header = (vgm_header *)data;
+		uint32_t data_start = header->version < 0x150 || !header->data_offset
+			? 0x40 : header->data_offset + offsetof(vgm_header, data_offset);
+		if (memcmp(header->ident, "Vgm ", 4) || data_start >= size) {
+			fprintf(stderr, "%s is not a VGM file\n", argv[1]);
+			return 1;
+		}
+		failures = play_stream(data + data_start, data + size, &total_samples);
+		free(data);
+	} else {
+		static uint8_t data[STREAM_WRITES * 10 + 0x1000];
+		for (int stream = 0; stream < NUM_STREAMS; stream++)
+		{
+			uint32_t size = generate_stream(data, stream);
+			int stream_failures = play_stream(data, data + size, &total_samples);
+			if (stream_failures) {
+				printf("FAIL: %d mismatches in stream %d\n", stream_failures, stream);
+			}
+			failures += stream_failures;
+		}
+	}
+	if (failures) {
+		printf("Batched YM2612 output differed from the single step output %d times\n", failures);
+	} else {
+		printf("All %u samples matched the single step output\n", total_samples);
+	}
+	return failures != 0;
+}
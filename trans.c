@@ -57,7 +57,16 @@ int main(int argc, char ** argv)
 	char disbuf[1024];
 	unsigned short * cur;
 	m68k_options opts;
-	FILE * f = fopen(argv[1], "rb");
+	uint32_t flags = 0;
+	int arg = 1;
+#ifndef NEW_CORE
+	//-b batches the cycle checks of straight runs of register instructions so tests can be compared with it
+	if (argc > 2 && !strcmp(argv[1], "-b")) {
+		flags |= M68K_OPT_BATCH_CYCLES;
+		arg++;
+	}
+#endif
+	FILE * f = fopen(argv[arg], "rb");
 	fseek(f, 0, SEEK_END);
 	filesize = ftell(f);
 	fseek(f, 0, SEEK_SET);
@@ -82,7 +91,7 @@ int main(int argc, char ** argv)
 	memmap[1].flags = MMAP_READ | MMAP_WRITE | MMAP_CODE;
 	memmap[1].buffer = malloc(64 * 1024);
 	memset(memmap[1].buffer, 0, 64 * 1024);
-	init_m68k_opts(&opts, memmap, 2, 1);
+	init_m68k_opts(&opts, memmap, 2, 1, flags);
 	m68k_context * context = init_68k_context(&opts, reset_handler);
 	context->mem_pointers[0] = memmap[0].buffer;
 	context->mem_pointers[1] = memmap[1].buffer;
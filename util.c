@@ -724,6 +724,18 @@ int socket_error_is_wouldblock(void)
 	return WSAGetLastError() == WSAEWOULDBLOCK;
 }
 
+uint64_t get_time_ns(void)
+{
+	static LARGE_INTEGER freq;
+	if (!freq.QuadPart) {
+		QueryPerformanceFrequency(&freq);
+	}
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (uint64_t)count.QuadPart / freq.QuadPart * 1000000000ULL
+		+ (uint64_t)count.QuadPart % freq.QuadPart * 1000000000ULL / freq.QuadPart;
+}
+
 #else
 #include <fcntl.h>
 #include <signal.h>
@@ -759,6 +771,13 @@ int socket_error_is_wouldblock(void)
 	return errno == EAGAIN || errno == EWOULDBLOCK;
 }
 
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 char * get_home_dir()
 {
 	return getenv("HOME");
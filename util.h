@@ -100,5 +100,7 @@ void socket_close(int sock);
 int socket_last_error(void);
 //Returns if the last socket error was EAGAIN/EWOULDBLOCK
 int socket_error_is_wouldblock(void);
+//Returns a monotonic timestamp in nanoseconds for measuring elapsed host time
+uint64_t get_time_ns(void);
 
 #endif //UTIL_H_
@@ -4,6 +4,8 @@
  BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
 */
 #include "vdp.h"
+#include "vdp_thread.h"
+#include "vdp_composite.h"
 #include "blastem.h"
 #include <stdlib.h>
 #include <string.h>
@@ -14,7 +16,6 @@
 #define NTSC_INACTIVE_START 224
 #define PAL_INACTIVE_START 240
 #define MODE4_INACTIVE_START 192
-#define BUF_BIT_PRIORITY 0x40
 #define MAP_BIT_PRIORITY 0x8000
 #define MAP_BIT_H_FLIP 0x800
 #define MAP_BIT_V_FLIP 0x1000
@@ -78,8 +79,13 @@ static uint32_t calc_crop(uint32_t crop, uint32_t border)
 
 static void update_video_params(vdp_context *context)
 {
-	uint32_t top_crop = render_overscan_top();
-	uint32_t bot_crop = render_overscan_bot();
+	uint32_t top_crop, bot_crop;
+	if (context->replay_thread) {
+		vdp_thread_overscan(context->replay_thread, &top_crop, &bot_crop);
+	} else {
+		top_crop = render_overscan_top();
+		bot_crop = render_overscan_bot();
+	}
 	uint32_t border_top;
 	if (context->regs[REG_MODE_2] & BIT_MODE_5) {
 		if (context->regs[REG_MODE_2] & BIT_PAL) {
@@ -878,6 +884,7 @@ static void write_vram_word(vdp_context *context, uint32_t address, uint16_t val
 	address ^= 1;
 	//TODO: Support an option to actually have 128KB of VRAM
 	context->vdpmem[address] = value;
+	context->vram_dirty[address >> (VRAM_DIRTY_SHIFT + 3)] |= 1 << (address >> VRAM_DIRTY_SHIFT & 7);
 }
 
 static void write_vram_byte(vdp_context *context, uint32_t address, uint8_t value)
@@ -888,6 +895,7 @@ static void write_vram_byte(vdp_context *context, uint32_t address, uint8_t valu
 		address = mode4_address_map[address & 0x3FFF];
 	}
 	context->vdpmem[address] = value;
+	context->vram_dirty[address >> (VRAM_DIRTY_SHIFT + 3)] |= 1 << (address >> VRAM_DIRTY_SHIFT & 7);
 }
 
 #define DMA_FILL 0x80
@@ -909,13 +917,17 @@ static void external_slot(vdp_context * context)
 		{
 		case VRAM_WRITE:
 			if ((context->regs[REG_MODE_2] & (BIT_128K_VRAM|BIT_MODE_5)) == (BIT_128K_VRAM|BIT_MODE_5)) {
-				event_vram_word(context->cycles, start->address, start->value);
+				if (!context->replay_thread) {
+					event_vram_word(context->cycles, start->address, start->value);
+				}
 				vdp_check_update_sat(context, start->address, start->value);
 				write_vram_word(context, start->address, start->value);
 			} else {
 				uint8_t byte = start->partial == 1 ? start->value >> 8 : start->value;
 				uint32_t address = start->address ^ 1;
-				event_vram_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC]);
+				if (!context->replay_thread) {
+					event_vram_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC]);
+				}
 				vdp_check_update_sat_byte(context, address, byte);
 				write_vram_byte(context, address, byte);
 				if (!start->partial) {
@@ -939,8 +951,10 @@ static void external_slot(vdp_context * context)
 			} else {
 				val = start->partial ? context->fifo[context->fifo_write].value : start->value;
 			}
-			uint8_t buffer[3] = {start->address & 127, val >> 8, val};
-			event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+			if (!context->replay_thread) {
+				uint8_t buffer[3] = {start->address & 127, val >> 8, val};
+				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+			}
 			write_cram(context, start->address, val);
 			break;
 		}
@@ -958,8 +972,10 @@ static void external_slot(vdp_context * context)
 				} else {
 					context->vsram[(start->address/2) & 63] = start->partial ? context->fifo[context->fifo_write].value : start->value;
 				}
-				uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
-				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+				if (!context->replay_thread) {
+					uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
+					event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+				}
 			}
 
 			break;
@@ -1050,7 +1066,14 @@ static void run_dma_src(vdp_context * context, int32_t slot)
 			cur = context->fifo + context->fifo_write;
 			cur->cycle = context->cycles + ((context->regs[REG_MODE_4] & BIT_H40) ? 16 : 20)*FIFO_LATENCY;
 			cur->address = context->address;
-			cur->value = read_dma_value((context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
+			if (context->replay_thread) {
+				cur->value = vdp_thread_pop_dma(context->replay_thread);
+			} else {
+				cur->value = read_dma_value(context->system, (context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
+				if (context->render_thread) {
+					vdp_thread_push_dma(context->render_thread, cur->value);
+				}
+			}
 			cur->cd = context->cd;
 			cur->partial = 0;
 			if (context->fifo_read < 0) {
@@ -1281,122 +1304,44 @@ static void fetch_map_mode4(uint16_t col, uint32_t line, vdp_context *context)
 	context->fetch_tmp[1] = context->vdpmem[address+1];
 }
 
-static uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+//returns a pointer to COMPOSITE_PIXELS contiguous pixels of a plane's scroll buffer starting at offset
+static uint8_t const *plane_pixels(uint8_t const *buf, int offset, uint8_t *tmp)
 {
-	uint8_t pixel = bg_index;
-	uint8_t src = DBG_SRC_BG;
-	if (plane_b & 0xF) {
-		pixel = plane_b;
-		src = DBG_SRC_B;
-	}
-	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = plane_a;
-		src = DBG_SRC_A;
-	}
-	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = sprite;
-		src = DBG_SRC_S;
-	}
-	*debug_dst = src;
-	return pixel;
-}
-typedef struct {
-	uint8_t index, intensity;
-} sh_pixel;
-
-static sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
-{
-	uint8_t pixel = bg_index;
-	uint8_t src = DBG_SRC_BG;
-	uint8_t intensity = 0;
-	if (plane_b & 0xF) {
-		pixel = plane_b;
-		src = DBG_SRC_B;
-	}
-	intensity = plane_b & BUF_BIT_PRIORITY;
-	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = plane_a;
-		src = DBG_SRC_A;
-	}
-	intensity |= plane_a & BUF_BIT_PRIORITY;
-	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		if ((sprite & 0x3F) == 0x3E) {
-			intensity += BUF_BIT_PRIORITY;
-		} else if ((sprite & 0x3F) == 0x3F) {
-			intensity = 0;
-		} else {
-			pixel = sprite;
-			src = DBG_SRC_S;
-			if ((pixel & 0xF) == 0xE) {
-				intensity = BUF_BIT_PRIORITY;
-			} else {
-				intensity |= pixel & BUF_BIT_PRIORITY;
-			}
-		}
-	}
-	*debug_dst = src;
-	return (sh_pixel){.index = pixel, .intensity = intensity};
+	offset &= SCROLL_BUFFER_MASK;
+	if (offset + COMPOSITE_PIXELS <= SCROLL_BUFFER_SIZE) {
+		return buf + offset;
+	}
+	int first = SCROLL_BUFFER_SIZE - offset;
+	memcpy(tmp, buf + offset, first);
+	memcpy(tmp + first, buf, COMPOSITE_PIXELS - first);
+	return tmp;
 }
 
 static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
 {
-	uint8_t *sprite_buf = context->linebuf + col * 8;
+	uint8_t tmp_a[COMPOSITE_PIXELS], tmp_b[COMPOSITE_PIXELS];
+	composite_pixels(dst, debug_dst, context->linebuf + col * 8,
+		plane_pixels(context->tmp_buf_a, plane_a_off, tmp_a),
+		plane_pixels(context->tmp_buf_b, plane_b_off, tmp_b),
+		context->regs[REG_BG_COLOR]
+	);
 	if (!col && (context->regs[REG_MODE_1] & BIT_COL0_MASK)) {
 		memset(dst, 0, 8);
 		memset(debug_dst, DBG_SRC_BG, 8);
-		dst += 8;
-		debug_dst += 8;
-		sprite_buf += 8;
-		plane_a_off += 8;
-		plane_b_off += 8;
-		for (int i = 0; i < 8; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
-		{
-			uint8_t sprite, plane_a, plane_b;
-			plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
-			plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
-			*(dst++) = composite_normal(context, debug_dst, *sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]) & 0x3F;
-			debug_dst++;
-		}
-	} else {
-		for (int i = 0; i < 16; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
-		{
-			uint8_t sprite, plane_a, plane_b;
-			plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
-			plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
-			*(dst++) = composite_normal(context, debug_dst, *sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]) & 0x3F;
-			debug_dst++;
-		}
 	}
 }
 
 static void render_highlight(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
 {
-	int start = 0;
+	uint8_t tmp_a[COMPOSITE_PIXELS], tmp_b[COMPOSITE_PIXELS];
+	composite_pixels_highlight(dst, debug_dst, context->linebuf + col * 8,
+		plane_pixels(context->tmp_buf_a, plane_a_off, tmp_a),
+		plane_pixels(context->tmp_buf_b, plane_b_off, tmp_b),
+		context->regs[REG_BG_COLOR]
+	);
 	if (!col && (context->regs[REG_MODE_1] & BIT_COL0_MASK)) {
 		memset(dst, SHADOW_OFFSET + (context->regs[REG_BG_COLOR] & 0x3F), 8);
 		memset(debug_dst, DBG_SRC_BG | DBG_SHADOW, 8);
-		dst += 8;
-		debug_dst += 8;
-		start = 8;
-	}
-	uint8_t *sprite_buf = context->linebuf + col * 8 + start;
-	for (int i = start; i < 16; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
-	{
-		uint8_t sprite, plane_a, plane_b;
-		plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
-		plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
-		sprite = *sprite_buf;
-		sh_pixel pixel = composite_highlight(context, debug_dst, sprite, plane_a, plane_b, context->regs[REG_BG_COLOR]);
-		uint8_t final_pixel;
-		if (pixel.intensity == BUF_BIT_PRIORITY << 1) {
-			final_pixel = (pixel.index & 0x3F) + HIGHLIGHT_OFFSET;
-		} else if (pixel.intensity) {
-			final_pixel = pixel.index & 0x3F;
-		} else {
-			final_pixel = (pixel.index & 0x3F) + SHADOW_OFFSET;
-		}
-		debug_dst++;
-		*(dst++) = final_pixel;
 	}
 }
 
@@ -1481,7 +1426,7 @@ static void render_testreg(vdp_context *context, int32_t col, uint8_t *dst, uint
 			plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
 			plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
 			sprite = *sprite_buf;
-			uint8_t pixel = composite_normal(context, debug_dst, sprite, plane_a, plane_b, 0x3F) & 0x3F;
+			uint8_t pixel = composite_normal(debug_dst, sprite, plane_a, plane_b, 0x3F) & 0x3F;
 			switch (test_layer)
 			{
 			case 1:
@@ -1555,7 +1500,7 @@ static void render_testreg_highlight(vdp_context *context, int32_t col, uint8_t
 		plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
 		plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
 		sprite = *sprite_buf;
-		sh_pixel pixel = composite_highlight(context, debug_dst, sprite, plane_a, plane_b, 0x3F);
+		sh_pixel pixel = composite_highlight(debug_dst, sprite, plane_a, plane_b, 0x3F);
 		if (output_disabled) {
 			pixel.index = 0x3F;
 		} else {
@@ -1784,6 +1729,9 @@ static uint32_t const h40_hsync_cycles[] = {19, 20, 20, 20, 18, 20, 20, 20, 18,
 
 static void vdp_advance_line(vdp_context *context)
 {
+	if (context->render_thread) {
+		vdp_thread_line(context->render_thread);
+	}
 #ifdef TIMING_DEBUG
 	static uint32_t last_line = 0xFFFFFFFF;
 	if (last_line != 0xFFFFFFFF) {
@@ -2078,8 +2026,27 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 	}		
 }
 
+static uint32_t dummy_buffer[LINEBUF_SIZE];
+
+//framebuffers can only be presented and looked up on the emulation thread, so this is done for the copy
+//of the render thread once it has caught up, the context of the emulation thread only gets the dummy buffer
+static void on_render_copy(vdp_context *context, void (*fun)(vdp_context *))
+{
+	vdp_thread_wait(context->render_thread);
+	vdp_context *copy = vdp_thread_context(context->render_thread);
+	fun(copy);
+	context->fb = copy->fb ? dummy_buffer : NULL;
+	context->output = copy->output ? dummy_buffer : NULL;
+	vdp_thread_update_framebuffers(context->render_thread);
+}
+
 void vdp_force_update_framebuffer(vdp_context *context)
 {
+	if (context->render_thread) {
+		on_render_copy(context, vdp_force_update_framebuffer);
+		vdp_update_per_frame_debug(context);
+		return;
+	}
 	if (!context->fb) {
 		return;
 	}
@@ -2109,7 +2076,18 @@ static void advance_output_line(vdp_context *context)
 	if (context->output_lines >= lines_max || (!context->pushed_frame && output_line == context->inactive_start + context->border_top)) {
 		//we've either filled up a full frame or we're at the bottom of screen in the current defined mode + border crop
 		if (!headless) {
-			render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+			if (context->replay_thread) {
+				//the frame is presented by the emulation thread once its context gets here too
+				vdp_thread_frame_done(context->replay_thread);
+			} else {
+				if (context->render_thread) {
+					vdp_thread_wait_frame(context->render_thread);
+				}
+				render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+				if (context->render_thread) {
+					vdp_thread_frame_presented(context->render_thread);
+				}
+			}
 			uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
 			if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
 				is_even = !is_even;
@@ -2147,11 +2125,20 @@ static void advance_output_line(vdp_context *context)
 		context->output = NULL;
 		return;
 	}
-	if (!context->fb) {
-		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+	if (context->render_thread) {
+		//lines are drawn by the render thread
+		context->output = context->fb = dummy_buffer;
+	} else {
+		if (!context->fb) {
+			if (context->replay_thread) {
+				context->fb = vdp_thread_framebuffer(context->replay_thread, context->cur_buffer, &context->output_pitch);
+			} else {
+				context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+			}
+		}
+		output_line += context->top_offset;
+		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
 	}
-	output_line += context->top_offset;
-	context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
 #ifdef DEBUG_FB_FILL
 	for (int i = 0; i < LINEBUF_SIZE; i++)
 	{
@@ -2165,7 +2152,9 @@ static void advance_output_line(vdp_context *context)
 
 void vdp_release_framebuffer(vdp_context *context)
 {
-	if (context->fb) {
+	if (context->render_thread) {
+		on_render_copy(context, vdp_release_framebuffer);
+	} else if (context->fb) {
 		render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 		context->output = context->fb = NULL;
 	}
@@ -2173,6 +2162,10 @@ void vdp_release_framebuffer(vdp_context *context)
 
 void vdp_reacquire_framebuffer(vdp_context *context)
 {
+	if (context->render_thread) {
+		on_render_copy(context, vdp_reacquire_framebuffer);
+		return;
+	}
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 	if (context->output_lines <= lines_max && context->output_lines > 0) {
 		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
@@ -2547,7 +2540,6 @@ static void draw_right_border(vdp_context *context)
 		render_sprite_cells_mode4(context);\
 		MODE4_CHECK_SLOT_LINE(CALC_SLOT(slot, 5))
 
-static uint32_t dummy_buffer[LINEBUF_SIZE];
 static void vdp_h40_line(vdp_context * context)
 {
 	uint16_t address;
@@ -2555,6 +2547,8 @@ static void vdp_h40_line(vdp_context * context)
 	uint32_t const slot_cycles = MCLKS_SLOT_H40;
 	uint8_t bgindex = context->regs[REG_BG_COLOR] & 0x3F;
 	uint8_t test_layer = context->test_port >> 7 & 3;
+	//the planes are drawn and looked up by the render thread when there is one
+	uint8_t draw = !context->render_thread;
 	
 	//165
 	if (!(context->regs[REG_MODE_3] & BIT_VSCROLL)) {
@@ -2587,22 +2581,19 @@ static void vdp_h40_line(vdp_context * context)
 		context->buf_b_off + 8,
 		context->col_2
 	);
+	//169
+	draw_right_border(context);
 	//Do palette lookup for end of previous line
 	uint8_t *src = context->compositebuf + (LINE_CHANGE_H40 - BG_START_SLOT) *2;
 	uint32_t *dst = context->output + (LINE_CHANGE_H40 - BG_START_SLOT) *2;
-	if (test_layer) {
-		for (int i = 0; i < LINEBUF_SIZE - (LINE_CHANGE_H40 - BG_START_SLOT) * 2; i++)
-		{
-			*(dst++) = context->colors[*(src++)];
-		}
-	} else {
-		for (int i = 0; i < LINEBUF_SIZE - (LINE_CHANGE_H40 - BG_START_SLOT) * 2; i++)
-		{
-			if (*src & 0x3F) {
+	if (draw) {
+		if (test_layer) {
+			for (int i = 0; i < LINEBUF_SIZE - (LINE_CHANGE_H40 - BG_START_SLOT) * 2; i++)
+			{
 				*(dst++) = context->colors[*(src++)];
-			} else {
-				*(dst++) = context->colors[(*(src++) & 0xC0) | bgindex];
 			}
+		} else {
+			composite_lookup(dst, src, context->colors, LINEBUF_SIZE - (LINE_CHANGE_H40 - BG_START_SLOT) * 2, bgindex);
 		}
 	}
 	advance_output_line(context);
@@ -2692,11 +2683,15 @@ static void vdp_h40_line(vdp_context * context)
 	for (int col = 0; col < 42; col+=2)
 	{
 		read_map_scroll_a(col, context->vcounter, context);
-		render_map_1(context);
-		render_map_2(context);
+		if (draw) {
+			render_map_1(context);
+			render_map_2(context);
+		}
 		read_map_scroll_b(col, context->vcounter, context);
-		render_map_3(context);
-		render_map_output(context->vcounter, col, context);
+		if (draw) {
+			render_map_3(context);
+			render_map_output(context->vcounter, col, context);
+		}
 	}
 	//sprite rendering phase 2
 	for (int i = 0; i < MAX_SPRITES_LINE; i++)
@@ -2724,6 +2719,9 @@ static void vdp_h40_line(vdp_context * context)
 	render_sprite_cells(context);
 	context->cycles += MCLKS_LINE;
 	vdp_advance_line(context);
+	if (!draw) {
+		return;
+	}
 	src = context->compositebuf;
 	dst = context->output;
 	if (test_layer) {
@@ -2732,14 +2730,7 @@ static void vdp_h40_line(vdp_context * context)
 			*(dst++) = context->colors[*(src++)];
 		}
 	} else {
-		for (int i = 0; i < (LINE_CHANGE_H40 - BG_START_SLOT) * 2; i++)
-		{
-			if (*src & 0x3F) {
-				*(dst++) = context->colors[*(src++)];
-			} else {
-				*(dst++) = context->colors[(*(src++) & 0xC0) | bgindex];
-			}
-		}
+		composite_lookup(dst, src, context->colors, (LINE_CHANGE_H40 - BG_START_SLOT) * 2, bgindex);
 	}
 }
 static void vdp_h40(vdp_context * context, uint32_t target_cycles)
@@ -2966,6 +2957,213 @@ static void vdp_h40(vdp_context * context, uint32_t target_cycles)
 	}
 }
 
+static void vdp_h32_line(vdp_context * context)
+{
+	uint16_t address;
+	uint32_t mask;
+	uint8_t bgindex = context->regs[REG_BG_COLOR] & 0x3F;
+	uint8_t test_layer = context->test_port >> 7 & 3;
+	//the planes are drawn and looked up by the render thread when there is one
+	uint8_t draw = !context->render_thread;
+	
+	//133
+	render_sprite_cells(context);
+	//134
+	render_sprite_cells(context);
+	//135
+	context->sprite_index = 0x80;
+	context->slot_counter = 0;
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b, context->buf_b_off,
+		context->col_1
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//136
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off + 8,
+		context->col_2
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//137
+	draw_right_border(context);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//138-144 inclusive, 145 is an external slot
+	for (int i = 0; i < 7; i++)
+	{
+		render_sprite_cells(context);
+		scan_sprite_table(context->vcounter, context);
+	}
+	//146-147
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//Do palette lookup for end of previous line
+	uint8_t *src = context->compositebuf + (LINE_CHANGE_H32 - BG_START_SLOT) *2;
+	uint32_t *dst = context->output + (LINE_CHANGE_H32 - BG_START_SLOT) *2;
+	if (draw) {
+		if (test_layer) {
+			for (int i = 0; i < (256+HORIZ_BORDER) - (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+			{
+				*(dst++) = context->colors[*(src++)];
+			}
+		} else {
+			composite_lookup(dst, src, context->colors, (256+HORIZ_BORDER) - (LINE_CHANGE_H32 - BG_START_SLOT) * 2, bgindex);
+		}
+	}
+	advance_output_line(context);
+	if (!context->output) {
+		context->output = dummy_buffer;
+	}
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//233-242 inclusive
+	for (int i = 0; i < 10; i++)
+	{
+		render_sprite_cells(context);
+		scan_sprite_table(context->vcounter, context);
+	}
+	//243
+	if (!(context->regs[REG_MODE_3] & BIT_VSCROLL)) {
+		//See note in vdp_h32 about when the vscroll latch happens
+		context->vscroll_latch[0] = context->vsram[0];
+		context->vscroll_latch[1] = context->vsram[1];
+	}
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a,
+		context->buf_a_off,
+		context->col_1
+	);
+	//244
+	address = (context->regs[REG_HSCROLL] & 0x3F) << 10;
+	mask = 0;
+	if (context->regs[REG_MODE_3] & 0x2) {
+		mask |= 0xF8;
+	}
+	if (context->regs[REG_MODE_3] & 0x1) {
+		mask |= 0x7;
+	}
+	render_border_garbage(context, address, context->tmp_buf_a, context->buf_a_off+8, context->col_2);
+	address += (context->vcounter & mask) * 4;
+	context->hscroll_a = context->vdpmem[address] << 8 | context->vdpmem[address+1];
+	context->hscroll_a_fine = context->hscroll_a & 0xF;
+	context->hscroll_b = context->vdpmem[address+2] << 8 | context->vdpmem[address+3];
+	context->hscroll_b_fine = context->hscroll_b & 0xF;
+	//245-246 inclusive
+	for (int i = 0; i < 2; i++)
+	{
+		render_sprite_cells(context);
+		scan_sprite_table(context->vcounter, context);
+	}
+	//247
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off,
+		context->col_1
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//248
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off + 8,
+		context->col_2
+	);
+	context->buf_a_off = (context->buf_a_off + SCROLL_BUFFER_DRAW) & SCROLL_BUFFER_MASK;
+	context->buf_b_off = (context->buf_b_off + SCROLL_BUFFER_DRAW) & SCROLL_BUFFER_MASK;
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//249
+	read_map_scroll_a(0, context->vcounter, context);
+	//250
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//251
+	if (context->cur_slot >= 0 && context->sprite_draw_list[context->cur_slot].x_pos) {
+		context->flags |= FLAG_DOT_OFLOW;
+	}
+	render_map_1(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//252
+	render_map_2(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//253
+	read_map_scroll_b(0, context->vcounter, context);
+	//254
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//255
+	render_map_3(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//0
+	render_map_output(context->vcounter, 0, context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	context->cur_slot = context->slot_counter;
+	context->sprite_x_offset = 0;
+	context->sprite_draws = MAX_SPRITES_LINE_H32;
+	//background planes, layer compositing and sprite rendering phase 2
+	for (int col = 2; col < 34; col+=2)
+	{
+		read_map_scroll_a(col, context->vcounter, context);
+		if (draw) {
+			render_map_1(context);
+			render_map_2(context);
+		}
+		read_map_scroll_b(col, context->vcounter, context);
+		read_sprite_x(context->vcounter, context);
+		if (draw) {
+			render_map_3(context);
+			render_map_output(context->vcounter, col, context);
+		}
+	}
+	//131
+	context->cur_slot = MAX_SPRITES_LINE_H32-1;
+	memset(context->linebuf, 0, LINEBUF_SIZE);
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a, context->buf_a_off,
+		context->col_1
+	);
+	context->flags &= ~FLAG_MASKED;
+	render_sprite_cells(context);
+	//132
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a, context->buf_a_off + 8,
+		context->col_2
+	);
+	render_sprite_cells(context);
+	context->cycles += MCLKS_LINE;
+	vdp_advance_line(context);
+	if (!draw) {
+		return;
+	}
+	src = context->compositebuf;
+	dst = context->output;
+	if (test_layer) {
+		for (int i = 0; i < (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+		{
+			*(dst++) = context->colors[*(src++)];
+		}
+	} else {
+		composite_lookup(dst, src, context->colors, (LINE_CHANGE_H32 - BG_START_SLOT) * 2, bgindex);
+	}
+}
+
 static void vdp_h32(vdp_context * context, uint32_t target_cycles)
 {
 	uint16_t address;
@@ -2983,6 +3181,13 @@ static void vdp_h32(vdp_context * context, uint32_t target_cycles)
 	for (;;)
 	{
 	case 133:
+		//only consider doing a line at a time if the FIFO is empty, there are no pending reads and there is no DMA running
+		if (context->fifo_read == -1 && !(context->flags & FLAG_DMA_RUN) && ((context->cd & 1) || (context->flags & FLAG_READ_FETCHED))) {
+			while (target_cycles - context->cycles >= MCLKS_LINE && context->state != PREPARING && context->vcounter != context->inactive_start) {
+				vdp_h32_line(context);
+			}
+			CHECK_ONLY
+		}
 		OUTPUT_PIXEL(133)
 		if (context->state == PREPARING) {
 			external_slot(context);
@@ -3591,6 +3796,9 @@ static void vdp_inactive(vdp_context *context, uint32_t target_cycles, uint8_t i
 
 void vdp_run_context_full(vdp_context * context, uint32_t target_cycles)
 {
+	if (context->render_thread && target_cycles > context->cycles) {
+		vdp_thread_push(context->render_thread, VDP_RUN, target_cycles, 0);
+	}
 	uint8_t is_h40 = context->regs[REG_MODE_4] & BIT_H40;
 	uint8_t mode_5 = context->regs[REG_MODE_2] & BIT_MODE_5;
 	while(context->cycles < target_cycles)
@@ -3712,8 +3920,21 @@ static void clear_pending(vdp_context *context)
 	}
 }
 
+//accesses that change the state of the context are replayed on the copy of the render thread
+static void record_access(vdp_context *context, uint8_t type, uint16_t value)
+{
+	if (context->render_thread) {
+		if (type == VDP_CONTROL_WRITE) {
+			//register writes can update the borders
+			vdp_thread_check_overscan(context->render_thread);
+		}
+		vdp_thread_push(context->render_thread, type, 0, value);
+	}
+}
+
 int vdp_control_port_write(vdp_context * context, uint16_t value)
 {
+	record_access(context, VDP_CONTROL_WRITE, value);
 	//printf("control port write: %X at %d\n", value, context->cycles);
 	if (context->flags & FLAG_DMA_RUN) {
 		return -1;
@@ -3770,8 +3991,10 @@ int vdp_control_port_write(vdp_context * context, uint16_t value)
 				/*if (reg == REG_MODE_4 && ((value ^ context->regs[reg]) & BIT_H40)) {
 					printf("Mode changed from H%d to H%d @ %d, frame: %d\n", context->regs[reg] & BIT_H40 ? 40 : 32, value & BIT_H40 ? 40 : 32, context->cycles, context->frame);
 				}*/
-				uint8_t buffer[2] = {reg, value};
-				event_log(EVENT_VDP_REG, context->cycles, sizeof(buffer), buffer);
+				if (!context->replay_thread) {
+					uint8_t buffer[2] = {reg, value};
+					event_log(EVENT_VDP_REG, context->cycles, sizeof(buffer), buffer);
+				}
 				context->regs[reg] = value;
 				if (reg == REG_MODE_4) {
 					context->double_res = (value & (BIT_INTERLACE | BIT_DOUBLE_RES)) == (BIT_INTERLACE | BIT_DOUBLE_RES);
@@ -3815,6 +4038,7 @@ void vdp_control_port_write_pbc(vdp_context *context, uint8_t value)
 
 int vdp_data_port_write(vdp_context * context, uint16_t value)
 {
+	record_access(context, VDP_DATA_WRITE, value);
 	//printf("data port write: %X at %d\n", value, context->cycles);
 	if (context->flags & FLAG_DMA_RUN && (context->regs[REG_DMASRC_H] & DMA_TYPE_MASK) != DMA_FILL) {
 		return -1;
@@ -3889,11 +4113,13 @@ void vdp_data_port_write_pbc(vdp_context * context, uint8_t value)
 
 void vdp_test_port_write(vdp_context * context, uint16_t value)
 {
+	record_access(context, VDP_TEST_WRITE, value);
 	context->test_port = value;
 }
 
 uint16_t vdp_control_port_read(vdp_context * context)
 {
+	record_access(context, VDP_CONTROL_READ, 0);
 	if (context->flags & FLAG_PENDING) {
 		clear_pending(context);
 	}
@@ -3945,6 +4171,7 @@ uint16_t vdp_control_port_read(vdp_context * context)
 
 uint16_t vdp_data_port_read(vdp_context * context)
 {
+	record_access(context, VDP_DATA_READ, 0);
 	if (context->flags & FLAG_PENDING) {
 		clear_pending(context);
 		//Should these be cleared here?
@@ -3989,6 +4216,9 @@ uint8_t vdp_data_port_read_pbc(vdp_context * context)
 
 void vdp_adjust_cycles(vdp_context * context, uint32_t deduction)
 {
+	if (context->render_thread) {
+		vdp_thread_push(context->render_thread, VDP_ADJUST, deduction, 0);
+	}
 	context->cycles -= deduction;
 	if (context->pending_vint_start >= deduction) {
 		context->pending_vint_start -= deduction;
@@ -4262,6 +4492,7 @@ void vdp_pbc_pause(vdp_context *context)
 
 void vdp_int_ack(vdp_context * context)
 {
+	record_access(context, VDP_INT_ACK, 0);
 	//CPU interrupt acknowledge is only used in Mode 5
 	if (context->regs[REG_MODE_2] & BIT_MODE_5) {
 		//Apparently the VDP interrupt controller is not very smart
@@ -4505,6 +4736,117 @@ void vdp_deserialize(deserialize_buffer *buf, void *vcontext)
 	update_video_params(context);
 }
 
+//only restores the context itself, VRAM is left to the caller so it can be restored incrementally
+void vdp_restore(vdp_context *context, vdp_context const *snapshot)
+{
+	//debug views belong to the frontend rather than the emulated VDP so they survive a restore
+	uint32_t *debug_fbs[VDP_NUM_DEBUG_TYPES];
+	uint32_t debug_fb_pitch[VDP_NUM_DEBUG_TYPES];
+	uint8_t debug_fb_indices[VDP_NUM_DEBUG_TYPES];
+	uint8_t debug_modes[VDP_NUM_DEBUG_TYPES];
+	uint8_t enabled_debuggers = context->enabled_debuggers;
+	//so does the render thread
+	vdp_thread *render_thread = context->render_thread;
+	vdp_thread *replay_thread = context->replay_thread;
+	memcpy(debug_fbs, context->debug_fbs, sizeof(debug_fbs));
+	memcpy(debug_fb_pitch, context->debug_fb_pitch, sizeof(debug_fb_pitch));
+	memcpy(debug_fb_indices, context->debug_fb_indices, sizeof(debug_fb_indices));
+	memcpy(debug_modes, context->debug_modes, sizeof(debug_modes));
+	memcpy(context, snapshot, sizeof(vdp_context));
+	context->render_thread = render_thread;
+	context->replay_thread = replay_thread;
+	context->enabled_debuggers = enabled_debuggers;
+	memcpy(context->debug_fbs, debug_fbs, sizeof(debug_fbs));
+	memcpy(context->debug_fb_pitch, debug_fb_pitch, sizeof(debug_fb_pitch));
+	memcpy(context->debug_fb_indices, debug_fb_indices, sizeof(debug_fb_indices));
+	memcpy(context->debug_modes, debug_modes, sizeof(debug_modes));
+}
+
+static uint8_t *relocate_composite(vdp_context *context, vdp_context const *from)
+{
+	return from->done_composite ? context->compositebuf + (from->done_composite - from->compositebuf) : NULL;
+}
+
+uint8_t vdp_start_render_thread(vdp_context *context)
+{
+	vdp_context *copy = malloc(sizeof(vdp_context) + VRAM_SIZE);
+	memcpy(copy, context, sizeof(vdp_context) + VRAM_SIZE);
+	copy->done_composite = relocate_composite(copy, context);
+	//debug views are still drawn from the context of the emulation thread
+	copy->enabled_debuggers = 0;
+	vdp_thread *thread = vdp_thread_start(copy);
+	if (!thread) {
+		free(copy);
+		return 0;
+	}
+	context->render_thread = thread;
+	context->fb = context->fb ? dummy_buffer : NULL;
+	context->output = context->output ? dummy_buffer : NULL;
+	return 1;
+}
+
+void vdp_stop_render_thread(vdp_context *context)
+{
+	if (!context->render_thread) {
+		return;
+	}
+	vdp_context *copy = vdp_thread_context(context->render_thread);
+	vdp_sync_render_thread(context);
+	vdp_thread_stop(context->render_thread);
+	context->render_thread = NULL;
+	context->fb = copy->fb;
+	context->output = copy->output;
+	context->output_pitch = copy->output_pitch;
+	free(copy);
+}
+
+void vdp_sync_render_thread(vdp_context *context)
+{
+	if (!context->render_thread) {
+		return;
+	}
+	vdp_thread_wait(context->render_thread);
+	vdp_context *copy = vdp_thread_context(context->render_thread);
+	//the copy has the same timing state and is the only one with the drawing state, everything that
+	//belongs to the emulation thread is kept
+	system_header *system = context->system;
+	uint32_t *fb = context->fb, *output = context->output;
+	uint8_t vram_dirty[sizeof(context->vram_dirty)];
+	memcpy(vram_dirty, context->vram_dirty, sizeof(vram_dirty));
+	vdp_restore(context, copy);
+	context->system = system;
+	context->fb = fb;
+	context->output = output;
+	context->done_composite = relocate_composite(context, copy);
+	memcpy(context->vram_dirty, vram_dirty, sizeof(vram_dirty));
+}
+
+void vdp_reload_render_thread(vdp_context *context)
+{
+	if (!context->render_thread) {
+		return;
+	}
+	vdp_thread_wait(context->render_thread);
+	vdp_context *copy = vdp_thread_context(context->render_thread);
+	system_header *system = copy->system;
+	uint32_t *fb = copy->fb, *output = copy->output;
+	uint32_t output_pitch = copy->output_pitch;
+	vdp_restore(copy, context);
+	memcpy(copy->vdpmem, context->vdpmem, VRAM_SIZE);
+	copy->system = system;
+	copy->done_composite = relocate_composite(copy, context);
+	if (context->fb) {
+		copy->fb = fb;
+		copy->output = output;
+		copy->output_pitch = output_pitch;
+	} else {
+		//without a framebuffer the line pointer can only be NULL or the dummy buffer
+		copy->fb = NULL;
+		copy->output = context->output;
+	}
+	vdp_thread_reset_dma(context->render_thread);
+}
+
 static vdp_context *current_vdp;
 static void vdp_debug_window_close(uint8_t which)
 {
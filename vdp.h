@@ -19,6 +19,7 @@
 #define MIN_VSRAM_SIZE 40
 #define MAX_VSRAM_SIZE 64
 #define VRAM_SIZE (64*1024)
+#define VRAM_DIRTY_SHIFT 8
 #define BORDER_LEFT 13
 #define BORDER_RIGHT 14
 #define HORIZ_BORDER (BORDER_LEFT+BORDER_RIGHT)
@@ -160,8 +161,14 @@ enum {
 	VDP_NUM_DEBUG_TYPES
 };
 
+typedef struct vdp_thread vdp_thread;
+
 typedef struct {
 	system_header  *system;
+	//set on the context of the emulation thread while a render thread draws its output
+	vdp_thread     *render_thread;
+	//set on the copy of the context that the render thread replays accesses on
+	vdp_thread     *replay_thread;
 	//pointer to current line in framebuffer
 	uint32_t       *output;
 	//pointer to current framebuffer
@@ -238,6 +245,8 @@ typedef struct {
 	uint8_t        debug_fb_indices[VDP_NUM_DEBUG_TYPES];
 	uint8_t        debug_modes[VDP_NUM_DEBUG_TYPES];
 	uint8_t        pushed_frame;
+	//one bit per VRAM page written since the bits were last cleared, used for incremental snapshots
+	uint8_t        vram_dirty[VRAM_SIZE >> (VRAM_DIRTY_SHIFT + 3)];
 	uint8_t        vdpmem[];
 } vdp_context;
 
@@ -280,11 +289,19 @@ void vdp_release_framebuffer(vdp_context *context);
 void vdp_reacquire_framebuffer(vdp_context *context);
 void vdp_serialize(vdp_context *context, serialize_buffer *buf);
 void vdp_deserialize(deserialize_buffer *buf, void *vcontext);
+void vdp_restore(vdp_context *context, vdp_context const *snapshot);
 void vdp_force_update_framebuffer(vdp_context *context);
+//moves drawing to a thread of its own, see vdp_thread.h, returns 0 if it could not be started
+uint8_t vdp_start_render_thread(vdp_context *context);
+void vdp_stop_render_thread(vdp_context *context);
+//copies the state of the render thread back so the context can be saved or inspected
+void vdp_sync_render_thread(vdp_context *context);
+//hands state that was changed after vdp_sync_render_thread to the render thread
+void vdp_reload_render_thread(vdp_context *context);
 void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type);
 void vdp_inc_debug_mode(vdp_context *context);
 //to be implemented by the host system
-uint16_t read_dma_value(uint32_t address);
+uint16_t read_dma_value(system_header *system, uint32_t address);
 void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader);
 
 #endif //VDP_H_
@@ -0,0 +1,164 @@
+#include "vdp_composite.h"
+
+#if !defined(DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define COMPOSITE_SIMD
+typedef __m128i vec8;
+#define v_load(p) _mm_loadu_si128((__m128i const *)(p))
+#define v_store(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define v_set1(x) _mm_set1_epi8((char)(x))
+#define v_and _mm_and_si128
+#define v_or _mm_or_si128
+//~a & b
+#define v_andnot _mm_andnot_si128
+#define v_add _mm_add_epi8
+#define v_eq _mm_cmpeq_epi8
+//lanes of b where mask is set, lanes of a elsewhere
+#define v_select(mask, a, b) _mm_or_si128(_mm_andnot_si128(mask, a), _mm_and_si128(mask, b))
+#elif !defined(DISABLE_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define COMPOSITE_SIMD
+typedef uint8x16_t vec8;
+#define v_load(p) vld1q_u8(p)
+#define v_store(p, v) vst1q_u8(p, v)
+#define v_set1(x) vdupq_n_u8(x)
+#define v_and vandq_u8
+#define v_or vorrq_u8
+#define v_andnot(a, b) vbicq_u8(b, a)
+#define v_add vaddq_u8
+#define v_eq vceqq_u8
+#define v_select(mask, a, b) vbslq_u8(mask, b, a)
+#endif
+
+void composite_pixels_scalar(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	for (int i = 0; i < COMPOSITE_PIXELS; i++)
+	{
+		dst[i] = composite_normal(debug_dst + i, sprite[i], plane_a[i], plane_b[i], bg_index) & 0x3F;
+	}
+}
+
+void composite_pixels_highlight_scalar(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	for (int i = 0; i < COMPOSITE_PIXELS; i++)
+	{
+		sh_pixel pixel = composite_highlight(debug_dst + i, sprite[i], plane_a[i], plane_b[i], bg_index);
+		if (pixel.intensity == BUF_BIT_PRIORITY << 1) {
+			dst[i] = (pixel.index & 0x3F) + HIGHLIGHT_OFFSET;
+		} else if (pixel.intensity) {
+			dst[i] = pixel.index & 0x3F;
+		} else {
+			dst[i] = (pixel.index & 0x3F) + SHADOW_OFFSET;
+		}
+	}
+}
+
+void composite_lookup_scalar(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (src[i] & 0x3F) {
+			dst[i] = colors[src[i]];
+		} else {
+			dst[i] = colors[(src[i] & 0xC0) | bg_index];
+		}
+	}
+}
+
+#ifdef COMPOSITE_SIMD
+//mask of the lanes where a layer pixel does not cover pixel, either because it is transparent
+//or because it has lower priority
+static inline vec8 layer_hidden(vec8 layer, vec8 pixel)
+{
+	vec8 priority = v_set1(BUF_BIT_PRIORITY);
+	vec8 transparent = v_eq(v_and(layer, v_set1(0xF)), v_set1(0));
+	vec8 layer_high = v_eq(v_and(layer, priority), priority);
+	vec8 pixel_high = v_eq(v_and(pixel, priority), priority);
+	return v_or(transparent, v_andnot(layer_high, pixel_high));
+}
+
+void composite_pixels(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	vec8 b = v_load(plane_b), a = v_load(plane_a), s = v_load(sprite);
+	vec8 hidden = v_eq(v_and(b, v_set1(0xF)), v_set1(0));
+	vec8 pixel = v_select(hidden, b, v_set1(bg_index));
+	vec8 src = v_select(hidden, v_set1(DBG_SRC_B), v_set1(DBG_SRC_BG));
+	hidden = layer_hidden(a, pixel);
+	pixel = v_select(hidden, a, pixel);
+	src = v_select(hidden, v_set1(DBG_SRC_A), src);
+	hidden = layer_hidden(s, pixel);
+	pixel = v_select(hidden, s, pixel);
+	src = v_select(hidden, v_set1(DBG_SRC_S), src);
+	v_store(dst, v_and(pixel, v_set1(0x3F)));
+	v_store(debug_dst, src);
+}
+
+void composite_pixels_highlight(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	vec8 b = v_load(plane_b), a = v_load(plane_a), s = v_load(sprite);
+	vec8 zero = v_set1(0), priority = v_set1(BUF_BIT_PRIORITY);
+	vec8 hidden = v_eq(v_and(b, v_set1(0xF)), zero);
+	vec8 pixel = v_select(hidden, b, v_set1(bg_index));
+	vec8 src = v_select(hidden, v_set1(DBG_SRC_B), v_set1(DBG_SRC_BG));
+	vec8 intensity = v_and(b, priority);
+	hidden = layer_hidden(a, pixel);
+	pixel = v_select(hidden, a, pixel);
+	src = v_select(hidden, v_set1(DBG_SRC_A), src);
+	intensity = v_or(intensity, v_and(a, priority));
+
+	//sprite colors 0x3E and 0x3F are operators that change the intensity instead of being drawn
+	hidden = layer_hidden(s, pixel);
+	vec8 color = v_and(s, v_set1(0x3F));
+	vec8 highlight = v_andnot(hidden, v_eq(color, v_set1(0x3E)));
+	vec8 shadow = v_andnot(hidden, v_eq(color, v_set1(0x3F)));
+	vec8 skip = v_or(hidden, v_or(highlight, shadow));
+	pixel = v_select(skip, s, pixel);
+	src = v_select(skip, v_set1(DBG_SRC_S), src);
+	vec8 sprite_intensity = v_select(
+		v_eq(v_and(s, v_set1(0xF)), v_set1(0xE)),
+		v_or(intensity, v_and(s, priority)),
+		priority
+	);
+	intensity = v_select(skip, sprite_intensity, intensity);
+	intensity = v_select(highlight, intensity, v_add(intensity, priority));
+	intensity = v_select(shadow, intensity, zero);
+
+	vec8 offset = v_select(v_eq(intensity, zero), zero, v_set1(SHADOW_OFFSET));
+	offset = v_select(v_eq(intensity, v_set1(BUF_BIT_PRIORITY << 1)), offset, v_set1(HIGHLIGHT_OFFSET));
+	v_store(dst, v_add(v_and(pixel, v_set1(0x3F)), offset));
+	v_store(debug_dst, src);
+}
+
+void composite_lookup(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index)
+{
+	//neither SSE2 nor NEON can gather 32-bit colors, so only the index selection is vectorized
+	uint8_t index[16];
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		vec8 pixels = v_load(src + i);
+		vec8 transparent = v_eq(v_and(pixels, v_set1(0x3F)), v_set1(0));
+		v_store(index, v_select(transparent, pixels, v_or(v_and(pixels, v_set1(0xC0)), v_set1(bg_index))));
+		for (int j = 0; j < 16; j++)
+		{
+			dst[i + j] = colors[index[j]];
+		}
+	}
+	composite_lookup_scalar(dst + i, src + i, colors, count - i, bg_index);
+}
+#else
+void composite_pixels(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	composite_pixels_scalar(dst, debug_dst, sprite, plane_a, plane_b, bg_index);
+}
+
+void composite_pixels_highlight(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index)
+{
+	composite_pixels_highlight_scalar(dst, debug_dst, sprite, plane_a, plane_b, bg_index);
+}
+
+void composite_lookup(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index)
+{
+	composite_lookup_scalar(dst, src, colors, count, bg_index);
+}
+#endif
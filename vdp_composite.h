@@ -0,0 +1,84 @@
+#ifndef VDP_COMPOSITE_H_
+#define VDP_COMPOSITE_H_
+
+#include <stdint.h>
+#include "vdp.h"
+
+#define BUF_BIT_PRIORITY 0x40
+//number of pixels composited per call, one 16-pixel cell pair of plane data
+#define COMPOSITE_PIXELS 16
+
+static inline uint8_t composite_normal(uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+{
+	uint8_t pixel = bg_index;
+	uint8_t src = DBG_SRC_BG;
+	if (plane_b & 0xF) {
+		pixel = plane_b;
+		src = DBG_SRC_B;
+	}
+	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = plane_a;
+		src = DBG_SRC_A;
+	}
+	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = sprite;
+		src = DBG_SRC_S;
+	}
+	*debug_dst = src;
+	return pixel;
+}
+
+typedef struct {
+	uint8_t index, intensity;
+} sh_pixel;
+
+static inline sh_pixel composite_highlight(uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+{
+	uint8_t pixel = bg_index;
+	uint8_t src = DBG_SRC_BG;
+	uint8_t intensity = 0;
+	if (plane_b & 0xF) {
+		pixel = plane_b;
+		src = DBG_SRC_B;
+	}
+	intensity = plane_b & BUF_BIT_PRIORITY;
+	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = plane_a;
+		src = DBG_SRC_A;
+	}
+	intensity |= plane_a & BUF_BIT_PRIORITY;
+	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		if ((sprite & 0x3F) == 0x3E) {
+			intensity += BUF_BIT_PRIORITY;
+		} else if ((sprite & 0x3F) == 0x3F) {
+			intensity = 0;
+		} else {
+			pixel = sprite;
+			src = DBG_SRC_S;
+			if ((pixel & 0xF) == 0xE) {
+				intensity = BUF_BIT_PRIORITY;
+			} else {
+				intensity |= pixel & BUF_BIT_PRIORITY;
+			}
+		}
+	}
+	*debug_dst = src;
+	return (sh_pixel){.index = pixel, .intensity = intensity};
+}
+
+//Composites COMPOSITE_PIXELS pixels of sprite, plane A and plane B line buffer data into palette
+//indices in dst and layer sources in debug_dst. The plane pointers must already be adjusted for fine
+//scrolling. These use SSE2 or NEON when the target has them and fall back to the scalar versions
+//otherwise or when built with DISABLE_SIMD
+void composite_pixels(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index);
+//same as composite_pixels, but with shadow/highlight applied to the resulting indices
+void composite_pixels_highlight(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index);
+//converts count composited palette indices to colors, transparent indices show the background color
+void composite_lookup(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index);
+
+//reference implementations the vector versions need to match bit for bit
+void composite_pixels_scalar(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index);
+void composite_pixels_highlight_scalar(uint8_t *dst, uint8_t *debug_dst, uint8_t const *sprite, uint8_t const *plane_a, uint8_t const *plane_b, uint8_t bg_index);
+void composite_lookup_scalar(uint32_t *dst, uint8_t const *src, uint32_t const *colors, uint32_t count, uint8_t bg_index);
+
+#endif //VDP_COMPOSITE_H_
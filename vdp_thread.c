@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "vdp_thread.h"
+#include "render.h"
+#include "blastem.h"
+
+//must be powers of two
+#define QUEUE_SIZE (1 << 13)
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+#define DMA_QUEUE_SIZE (1 << 12)
+#define DMA_QUEUE_MASK (DMA_QUEUE_SIZE - 1)
+//a sleeping render thread is woken at the next line, or once this many records are waiting
+#define WAKE_RECORDS 256
+
+struct vdp_thread {
+	vdp_record      records[QUEUE_SIZE];
+	uint16_t        dma_values[DMA_QUEUE_SIZE];
+	//stands in for the system of the emulation thread, reads of the copy only have to update its state
+	system_header   system;
+	vdp_context     *copy;
+	uint32_t        *framebuffers[2];
+	uint32_t        pitches[2];
+	//overscan used by the copy, only touched by the render thread once started
+	uint32_t        overscan_top;
+	uint32_t        overscan_bot;
+	//overscan last queued by the emulation thread
+	uint32_t        queued_top;
+	uint32_t        queued_bot;
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  work;
+	pthread_cond_t  idle;
+	pthread_cond_t  presented;
+	pthread_cond_t  dma;
+	//only written by the emulation thread
+	uint32_t        head __attribute__((aligned(64)));
+	uint32_t        dma_head;
+	uint32_t        frames_presented;
+	//only written by the render thread, records are replayed before this moves past them
+	uint32_t        tail __attribute__((aligned(64)));
+	uint32_t        dma_tail;
+	uint32_t        frames_done;
+	uint8_t         sleeping;
+	uint8_t         dma_waiting;
+	uint8_t         exit;
+};
+
+static uint16_t no_open_bus(system_header *system)
+{
+	return 0;
+}
+
+static void apply(vdp_thread *thread, vdp_record const *rec)
+{
+	vdp_context *copy = thread->copy;
+	switch (rec->type)
+	{
+	case VDP_RUN:
+		vdp_run_context_full(copy, rec->cycle);
+		break;
+	case VDP_CONTROL_WRITE:
+		vdp_control_port_write(copy, rec->value);
+		break;
+	case VDP_DATA_WRITE:
+		vdp_data_port_write(copy, rec->value);
+		break;
+	case VDP_TEST_WRITE:
+		vdp_test_port_write(copy, rec->value);
+		break;
+	case VDP_CONTROL_READ:
+		vdp_control_port_read(copy);
+		break;
+	case VDP_DATA_READ:
+		vdp_data_port_read(copy);
+		break;
+	case VDP_INT_ACK:
+		vdp_int_ack(copy);
+		break;
+	case VDP_ADJUST:
+		vdp_adjust_cycles(copy, rec->cycle);
+		break;
+	case VDP_OVERSCAN:
+		thread->overscan_top = rec->cycle;
+		thread->overscan_bot = rec->value;
+		break;
+	}
+}
+
+static void *vdp_thread_main(void *data)
+{
+	vdp_thread *thread = data;
+	uint32_t tail = thread->tail;
+	for (;;)
+	{
+		if (tail == __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_lock(&thread->lock);
+				__atomic_store_n(&thread->sleeping, 1, __ATOMIC_SEQ_CST);
+				pthread_cond_broadcast(&thread->idle);
+				while (tail == __atomic_load_n(&thread->head, __ATOMIC_SEQ_CST) && !thread->exit)
+				{
+					pthread_cond_wait(&thread->work, &thread->lock);
+				}
+				__atomic_store_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST);
+				uint8_t exit = thread->exit && tail == __atomic_load_n(&thread->head, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&thread->lock);
+			if (exit) {
+				break;
+			}
+			continue;
+		}
+		apply(thread, thread->records + (tail & QUEUE_MASK));
+		__atomic_store_n(&thread->tail, ++tail, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void wake(vdp_thread *thread)
+{
+	pthread_mutex_lock(&thread->lock);
+		pthread_cond_signal(&thread->work);
+	pthread_mutex_unlock(&thread->lock);
+}
+
+vdp_thread *vdp_thread_start(vdp_context *copy)
+{
+	vdp_thread *thread = calloc(1, sizeof(vdp_thread));
+	thread->copy = copy;
+	thread->system.get_open_bus_value = no_open_bus;
+	copy->system = &thread->system;
+	copy->replay_thread = thread;
+	thread->overscan_top = thread->queued_top = render_overscan_top();
+	thread->overscan_bot = thread->queued_bot = render_overscan_bot();
+	vdp_thread_update_framebuffers(thread);
+	pthread_mutex_init(&thread->lock, NULL);
+	pthread_cond_init(&thread->work, NULL);
+	pthread_cond_init(&thread->idle, NULL);
+	pthread_cond_init(&thread->presented, NULL);
+	pthread_cond_init(&thread->dma, NULL);
+	if (pthread_create(&thread->thread, NULL, vdp_thread_main, thread)) {
+		pthread_cond_destroy(&thread->dma);
+		pthread_cond_destroy(&thread->presented);
+		pthread_cond_destroy(&thread->idle);
+		pthread_cond_destroy(&thread->work);
+		pthread_mutex_destroy(&thread->lock);
+		copy->replay_thread = NULL;
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+void vdp_thread_stop(vdp_thread *thread)
+{
+	vdp_thread_wait(thread);
+	pthread_mutex_lock(&thread->lock);
+		thread->exit = 1;
+		pthread_cond_signal(&thread->work);
+	pthread_mutex_unlock(&thread->lock);
+	pthread_join(thread->thread, NULL);
+	pthread_cond_destroy(&thread->dma);
+	pthread_cond_destroy(&thread->presented);
+	pthread_cond_destroy(&thread->idle);
+	pthread_cond_destroy(&thread->work);
+	pthread_mutex_destroy(&thread->lock);
+	thread->copy->replay_thread = NULL;
+	free(thread);
+}
+
+vdp_context *vdp_thread_context(vdp_thread *thread)
+{
+	return thread->copy;
+}
+
+void vdp_thread_push(vdp_thread *thread, uint8_t type, uint32_t cycle, uint16_t value)
+{
+	uint32_t head = thread->head;
+	if (head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+		vdp_thread_wait(thread);
+	}
+	thread->records[head & QUEUE_MASK] = (vdp_record){
+		.cycle = cycle,
+		.value = value,
+		.type = type
+	};
+	__atomic_store_n(&thread->head, ++head, __ATOMIC_SEQ_CST);
+	if (
+		__atomic_load_n(&thread->sleeping, __ATOMIC_SEQ_CST)
+		&& head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) >= WAKE_RECORDS
+	) {
+		wake(thread);
+	}
+}
+
+void vdp_thread_line(vdp_thread *thread)
+{
+	if (
+		__atomic_load_n(&thread->sleeping, __ATOMIC_SEQ_CST)
+		&& thread->head != __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE)
+	) {
+		wake(thread);
+	}
+}
+
+void vdp_thread_wait(vdp_thread *thread)
+{
+	if (thread->head == __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	pthread_mutex_lock(&thread->lock);
+		pthread_cond_signal(&thread->work);
+		while (thread->head != __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE))
+		{
+			pthread_cond_wait(&thread->idle, &thread->lock);
+		}
+	pthread_mutex_unlock(&thread->lock);
+}
+
+//the render thread replays runs while the emulation thread is still doing them, so either side can
+//end up waiting for the other one here
+void vdp_thread_push_dma(vdp_thread *thread, uint16_t value)
+{
+	uint32_t head = thread->dma_head;
+	if (head - __atomic_load_n(&thread->dma_tail, __ATOMIC_SEQ_CST) == DMA_QUEUE_SIZE) {
+		pthread_mutex_lock(&thread->lock);
+			__atomic_store_n(&thread->dma_waiting, 1, __ATOMIC_SEQ_CST);
+			pthread_cond_signal(&thread->work);
+			while (head - __atomic_load_n(&thread->dma_tail, __ATOMIC_SEQ_CST) == DMA_QUEUE_SIZE)
+			{
+				pthread_cond_wait(&thread->dma, &thread->lock);
+			}
+			__atomic_store_n(&thread->dma_waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&thread->lock);
+	}
+	thread->dma_values[head & DMA_QUEUE_MASK] = value;
+	__atomic_store_n(&thread->dma_head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&thread->dma_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&thread->lock);
+			pthread_cond_signal(&thread->dma);
+		pthread_mutex_unlock(&thread->lock);
+	}
+}
+
+uint16_t vdp_thread_pop_dma(vdp_thread *thread)
+{
+	uint32_t tail = thread->dma_tail;
+	if (tail == __atomic_load_n(&thread->dma_head, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&thread->lock);
+			__atomic_store_n(&thread->dma_waiting, 1, __ATOMIC_SEQ_CST);
+			while (tail == __atomic_load_n(&thread->dma_head, __ATOMIC_SEQ_CST))
+			{
+				pthread_cond_wait(&thread->dma, &thread->lock);
+			}
+			__atomic_store_n(&thread->dma_waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&thread->lock);
+	}
+	uint16_t value = thread->dma_values[tail & DMA_QUEUE_MASK];
+	__atomic_store_n(&thread->dma_tail, tail + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&thread->dma_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&thread->lock);
+			pthread_cond_signal(&thread->dma);
+		pthread_mutex_unlock(&thread->lock);
+	}
+	return value;
+}
+
+void vdp_thread_reset_dma(vdp_thread *thread)
+{
+	thread->dma_tail = thread->dma_head;
+}
+
+void vdp_thread_frame_done(vdp_thread *thread)
+{
+	pthread_mutex_lock(&thread->lock);
+		uint32_t frame = ++thread->frames_done;
+		pthread_cond_broadcast(&thread->idle);
+		while (thread->frames_presented != frame)
+		{
+			pthread_cond_wait(&thread->presented, &thread->lock);
+		}
+	pthread_mutex_unlock(&thread->lock);
+}
+
+void vdp_thread_wait_frame(vdp_thread *thread)
+{
+	pthread_mutex_lock(&thread->lock);
+		pthread_cond_signal(&thread->work);
+		while (thread->frames_done == thread->frames_presented)
+		{
+			pthread_cond_wait(&thread->idle, &thread->lock);
+		}
+	pthread_mutex_unlock(&thread->lock);
+}
+
+void vdp_thread_frame_presented(vdp_thread *thread)
+{
+	vdp_thread_update_framebuffers(thread);
+	pthread_mutex_lock(&thread->lock);
+		thread->frames_presented++;
+		pthread_cond_broadcast(&thread->presented);
+	pthread_mutex_unlock(&thread->lock);
+}
+
+uint32_t *vdp_thread_framebuffer(vdp_thread *thread, uint8_t which, uint32_t *pitch)
+{
+	*pitch = thread->pitches[which];
+	return thread->framebuffers[which];
+}
+
+void vdp_thread_check_overscan(vdp_thread *thread)
+{
+	uint32_t top = render_overscan_top(), bot = render_overscan_bot();
+	if (top != thread->queued_top || bot != thread->queued_bot) {
+		thread->queued_top = top;
+		thread->queued_bot = bot;
+		vdp_thread_push(thread, VDP_OVERSCAN, top, bot);
+	}
+}
+
+void vdp_thread_update_framebuffers(vdp_thread *thread)
+{
+	if (headless) {
+		return;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		int pitch;
+		thread->framebuffers[i] = render_get_framebuffer(i, &pitch);
+		thread->pitches[i] = pitch;
+	}
+}
+
+void vdp_thread_overscan(vdp_thread *thread, uint32_t *top, uint32_t *bot)
+{
+	*top = thread->overscan_top;
+	*bot = thread->overscan_bot;
+}
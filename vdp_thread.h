@@ -0,0 +1,64 @@
+#ifndef VDP_THREAD_H_
+#define VDP_THREAD_H_
+
+#include <stdint.h>
+#include "vdp.h"
+
+//Draws the VDP output on a thread of its own. The emulation thread keeps its VDP context and runs all
+//of the timing emulation on it (status, HV counter, interrupts, FIFO and DMA slots), but leaves the
+//framebuffer alone. Every run and port access made on it is recorded and replayed in the same order
+//on a full copy of the context that belongs to the render thread, which draws the lines while the
+//emulation thread moves on. Values read by 68K DMA are handed over in a queue of their own since the
+//copy can't read the bus. A finished frame is presented by the emulation thread once the copy reaches it.
+//Only the accesses a Genesis makes are recorded, the Master System ports are not supported
+
+enum {
+	VDP_RUN,
+	VDP_CONTROL_WRITE,
+	VDP_DATA_WRITE,
+	VDP_TEST_WRITE,
+	VDP_CONTROL_READ,
+	VDP_DATA_READ,
+	VDP_INT_ACK,
+	VDP_ADJUST,
+	VDP_OVERSCAN
+};
+
+typedef struct {
+	//target of a run, the deduction of an adjustment or the top overscan
+	uint32_t cycle;
+	uint16_t value;
+	uint8_t  type;
+} vdp_record;
+
+//starts replaying records on copy, which has to be a full copy of the context of the emulation thread
+//including VRAM, returns NULL if the thread could not be started
+vdp_thread *vdp_thread_start(vdp_context *copy);
+//waits for everything queued to be replayed and frees the thread, copy is left to the caller
+void vdp_thread_stop(vdp_thread *thread);
+vdp_context *vdp_thread_context(vdp_thread *thread);
+void vdp_thread_push(vdp_thread *thread, uint8_t type, uint32_t cycle, uint16_t value);
+//called by the emulation thread once per line, wakes the render thread if it is waiting for work
+void vdp_thread_line(vdp_thread *thread);
+//returns once everything queued has been replayed, the copy can be used on the calling thread until
+//the next record is queued
+void vdp_thread_wait(vdp_thread *thread);
+void vdp_thread_push_dma(vdp_thread *thread, uint16_t value);
+uint16_t vdp_thread_pop_dma(vdp_thread *thread);
+//drops DMA values that will never be read after the state of the copy was replaced
+void vdp_thread_reset_dma(vdp_thread *thread);
+//called by the render thread when the copy finished a frame, returns once it was presented
+void vdp_thread_frame_done(vdp_thread *thread);
+//called by the emulation thread when its context finished a frame, returns once the copy finished it too
+void vdp_thread_wait_frame(vdp_thread *thread);
+//called by the emulation thread after presenting a frame to let the render thread draw the next one
+void vdp_thread_frame_presented(vdp_thread *thread);
+//framebuffers and overscan can only be looked up on the emulation thread, these are the ones it last got
+uint32_t *vdp_thread_framebuffer(vdp_thread *thread, uint8_t which, uint32_t *pitch);
+void vdp_thread_update_framebuffers(vdp_thread *thread);
+//queues the current overscan if it changed since it was last queued, the copy picks it up in order
+//so its borders are computed from the same values as the ones of the emulation thread
+void vdp_thread_check_overscan(vdp_thread *thread);
+void vdp_thread_overscan(vdp_thread *thread, uint32_t *top, uint32_t *bot);
+
+#endif //VDP_THREAD_H_
@@ -39,6 +39,7 @@
 #define BIT_STATUS_TIMERB 0x2
 
 static uint32_t ym_calc_phase_inc(ym2612_context * context, ym_operator * operator, uint32_t op);
+static void ym_update_mix_table(ym2612_context *context);
 
 enum {
 	PHASE_ATTACK,
@@ -198,6 +199,7 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 	//TODO: pick a randomish high initial value and lower it over time
 	context->invalid_status_decay = 225000 * context->clock_inc;
 	context->status_address_mask = (options & YM_OPT_3834) ? 0 : 3;
+	context->single_step = (options & YM_OPT_SINGLE_STEP) != 0;
 	
 	//some games seem to expect that the LR flags start out as 1
 	for (int i = 0; i < NUM_CHANNELS; i++) {
@@ -278,6 +280,8 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 				}
 			}
 		}
+		//tables are shared by all contexts, so only populate them once
+		did_tbl_init = 1;
 	}
 	ym_reset(context);
 	ym_enable_zero_offset(context, 1);
@@ -303,6 +307,7 @@ void ym_enable_zero_offset(ym2612_context *context, uint8_t enabled)
 		context->volume_mult = 2;
 		context->volume_div = 3;
 	}
+	ym_update_mix_table(context);
 }
 #define YM_MOD_SHIFT 1
 
@@ -481,120 +486,142 @@ void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *
 	}
 }
 
-void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
+static inline int16_t ym_operator_mod(ym_channel *chan, ym_operator *operator, uint32_t op)
 {
-	if (channel != 5 || !context->dac_enable) {
-		//printf("updating operator %d of channel %d\n", op, channel);
-		ym_operator * operator = context->operators + op;
-		ym_channel * chan = context->channels + channel;
-		uint16_t phase = operator->phase_counter >> 10 & 0x3FF;
-		operator->phase_counter += operator->phase_inc;//ym_calc_phase_inc(context, operator, op);
-		int16_t mod = 0;
-		if (op & 3) {
-			if (operator->mod_src[0]) {
-				mod = *operator->mod_src[0];
-				if (operator->mod_src[1]) {
-					mod += *operator->mod_src[1];
-				}
-				mod >>= YM_MOD_SHIFT;
-			}
-		} else {
-			if (chan->feedback) {
-				mod = (chan->op1_old + operator->output) >> (10-chan->feedback);
+	int16_t mod = 0;
+	if (op & 3) {
+		if (operator->mod_src[0]) {
+			mod = *operator->mod_src[0];
+			if (operator->mod_src[1]) {
+				mod += *operator->mod_src[1];
 			}
+			mod >>= YM_MOD_SHIFT;
 		}
-		uint16_t env = operator->envelope;
-		if (operator->ssg) {
-			if (env >= SSG_CENTER) {
-				if (operator->ssg & SSG_ALTERNATE) {
-					if (operator->env_phase != PHASE_RELEASE && (
-						!(operator->ssg & SSG_HOLD) || ((operator->ssg ^ operator->inverted) & SSG_INVERT) == 0
-					)) {
-						operator->inverted ^= SSG_INVERT;
-					}
-				} else if (!(operator->ssg & SSG_HOLD)) {
-					phase = operator->phase_counter = 0;
-				}
-				if (
-					(operator->env_phase == PHASE_DECAY || operator->env_phase == PHASE_SUSTAIN) 
-					&& !(operator->ssg & SSG_HOLD)
-				) {
-					start_envelope(operator, chan);
-					env = operator->envelope;
+	} else {
+		if (chan->feedback) {
+			mod = (chan->op1_old + operator->output) >> (10-chan->feedback);
+		}
+	}
+	return mod;
+}
+
+//attenuation added by the LFO to operators of chan that have AM enabled
+static inline uint16_t ym_am_offset(ym2612_context *context, ym_channel *chan)
+{
+	uint16_t base_am = (context->lfo_am_step & 0x80 ? context->lfo_am_step : ~context->lfo_am_step) & 0x7E;
+	if (ams_shift[chan->ams] >= 0) {
+		return (base_am >> ams_shift[chan->ams]) & MAX_ENVELOPE;
+	} else {
+		return base_am << (-ams_shift[chan->ams]);
+	}
+}
+
+static inline void ym_update_operator(ym_channel *chan, ym_operator *operator, uint32_t op, uint16_t am_offset)
+{
+	int16_t mod = ym_operator_mod(chan, operator, op);
+	uint16_t phase = operator->phase_counter >> 10 & 0x3FF;
+	operator->phase_counter += operator->phase_inc;//ym_calc_phase_inc(context, operator, op);
+	uint16_t env = operator->envelope;
+	if (operator->ssg) {
+		if (env >= SSG_CENTER) {
+			if (operator->ssg & SSG_ALTERNATE) {
+				if (operator->env_phase != PHASE_RELEASE && (
+					!(operator->ssg & SSG_HOLD) || ((operator->ssg ^ operator->inverted) & SSG_INVERT) == 0
+				)) {
+					operator->inverted ^= SSG_INVERT;
 				}
+			} else if (!(operator->ssg & SSG_HOLD)) {
+				phase = operator->phase_counter = 0;
 			}
-			if (operator->inverted) {
-				env = (SSG_CENTER - env) & MAX_ENVELOPE;
-			}
-		}
-		env += operator->total_level;
-		if (operator->am) {
-			uint16_t base_am = (context->lfo_am_step & 0x80 ? context->lfo_am_step : ~context->lfo_am_step) & 0x7E;
-			if (ams_shift[chan->ams] >= 0) {
-				env += (base_am >> ams_shift[chan->ams]) & MAX_ENVELOPE;
-			} else {
-				env += base_am << (-ams_shift[chan->ams]);
+			if (
+				(operator->env_phase == PHASE_DECAY || operator->env_phase == PHASE_SUSTAIN) 
+				&& !(operator->ssg & SSG_HOLD)
+			) {
+				start_envelope(operator, chan);
+				env = operator->envelope;
 			}
 		}
-		if (env > MAX_ENVELOPE) {
-			env = MAX_ENVELOPE;
+		if (operator->inverted) {
+			env = (SSG_CENTER - env) & MAX_ENVELOPE;
 		}
-		if (first_key_on) {
-			dfprintf(debug_file, "op %d, base phase: %d, mod: %d, sine: %d, out: %d\n", op, phase, mod, sine_table[(phase+mod) & 0x1FF], pow_table[sine_table[phase & 0x1FF] + env]);
-		}
-		//if ((channel != 0 && channel != 4) || chan->algorithm != 5) {
-			phase += mod;
-		//}
+	}
+	env += operator->total_level;
+	if (operator->am) {
+		env += am_offset;
+	}
+	if (env > MAX_ENVELOPE) {
+		env = MAX_ENVELOPE;
+	}
+	if (first_key_on) {
+		dfprintf(debug_file, "op %d, base phase: %d, mod: %d, sine: %d, out: %d\n", op, phase, mod, sine_table[(phase+mod) & 0x1FF], pow_table[sine_table[phase & 0x1FF] + env]);
+	}
+	//if ((channel != 0 && channel != 4) || chan->algorithm != 5) {
+		phase += mod;
+	//}
 
-		int16_t output = pow_table[sine_table[phase & 0x1FF] + env];
-		if (phase & 0x200) {
-			output = -output;
-		}
-		if (op % 4 == 0) {
-			chan->op1_old = operator->output;
-		} else if (op % 4 == 2) {
-			chan->op2_old = operator->output;
+	int16_t output = pow_table[sine_table[phase & 0x1FF] + env];
+	if (phase & 0x200) {
+		output = -output;
+	}
+	if (op % 4 == 0) {
+		chan->op1_old = operator->output;
+	} else if (op % 4 == 2) {
+		chan->op2_old = operator->output;
+	}
+	operator->output = output;
+}
+
+//Update the channel output once all operators have been updated
+static inline void ym_update_channel_output(ym2612_context *context, uint32_t channel)
+{
+	ym_channel *chan = context->channels + channel;
+	if (chan->algorithm < 4) {
+		chan->output = context->operators[channel * 4 + 3].output;
+	} else if(chan->algorithm == 4) {
+		chan->output = context->operators[channel * 4 + 3].output + context->operators[channel * 4 + 2].output;
+	} else {
+		int16_t output = 0;
+		for (uint32_t op = ((chan->algorithm == 7) ? 0 : 1) + channel*4; op < (channel+1)*4; op++) {
+			output += context->operators[op].output;
 		}
-		operator->output = output;
-		//Update the channel output if we've updated all operators
+		chan->output = output;
+	}
+}
+
+void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
+{
+	if (channel != 5 || !context->dac_enable) {
+		//printf("updating operator %d of channel %d\n", op, channel);
+		ym_channel * chan = context->channels + channel;
+		ym_update_operator(chan, context->operators + op, op, ym_am_offset(context, chan));
 		if (op % 4 == 3) {
-			if (chan->algorithm < 4) {
-				chan->output = operator->output;
-			} else if(chan->algorithm == 4) {
-				chan->output = operator->output + context->operators[channel * 4 + 2].output;
-			} else {
-				output = 0;
-				for (uint32_t op = ((chan->algorithm == 7) ? 0 : 1) + channel*4; op < (channel+1)*4; op++) {
-					output += context->operators[op].output;
-				}
-				chan->output = output;
-			}
-			if (first_key_on) {
-				int16_t value = context->channels[channel].output & 0x3FE0;
-				if (value & 0x2000) {
-					value |= 0xC000;
-				}
-			}
+			ym_update_channel_output(context, channel);
 		}
 		//puts("operator update done");
 	}
 }
 
+static inline int16_t ym_channel_value(ym2612_context *context, int channel)
+{
+	int16_t value = context->channels[channel].output;
+	if (value > 0x1FE0) {
+		value = 0x1FE0;
+	} else if (value < -0x1FF0) {
+		value = -0x1FF0;
+	} else {
+		value &= 0x3FE0;
+		if (value & 0x2000) {
+			value |= 0xC000;
+		}
+	}
+	return value;
+}
+
 void ym_output_sample(ym2612_context *context)
 {
 	int16_t left = 0, right = 0;
 	for (int i = 0; i < NUM_CHANNELS; i++) {
-		int16_t value = context->channels[i].output;
-		if (value > 0x1FE0) {
-			value = 0x1FE0;
-		} else if (value < -0x1FF0) {
-			value = -0x1FF0;
-		} else {
-			value &= 0x3FE0;
-			if (value & 0x2000) {
-				value |= 0xC000;
-			}
-		}
+		int16_t value = ym_channel_value(context, i);
 		if (value >= 0) {
 			value += context->zero_offset;
 		} else {
@@ -625,6 +652,118 @@ void ym_output_sample(ym2612_context *context)
 	render_put_stereo_sample(context->audio, left, right);
 }
 
+#define MIX_INDEX(value) (((value) >> 4) + MIX_TABLE_SIZE / 2)
+
+static void ym_update_mix_table(ym2612_context *context)
+{
+	for (int i = 0; i < MIX_TABLE_SIZE; i++)
+	{
+		int16_t value = (i - MIX_TABLE_SIZE / 2) << 4;
+		if (value >= 0) {
+			value += context->zero_offset;
+		} else {
+			value -= context->zero_offset;
+		}
+		context->mix_table[i] = (value * context->volume_mult) / context->volume_div;
+	}
+	//contribution of a channel that is not enabled on a side
+	context->mix_silent[0] = (context->zero_offset * context->volume_mult) / context->volume_div;
+	context->mix_silent[1] = -context->mix_silent[0];
+}
+
+//same result as ym_output_sample, but with the volume scaling looked up instead of divided out for every channel
+static void ym_mix_sample(ym2612_context *context)
+{
+	int16_t left = 0, right = 0;
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		int16_t value = ym_channel_value(context, i);
+		if (context->channels[i].logfile) {
+			int16_t logged = value >= 0 ? value + context->zero_offset : value - context->zero_offset;
+			fwrite(&logged, sizeof(logged), 1, context->channels[i].logfile);
+		}
+		int16_t scaled = context->mix_table[MIX_INDEX(value)];
+		int16_t silent = context->mix_silent[value < 0];
+		left += context->channels[i].lr & 0x80 ? scaled : silent;
+		right += context->channels[i].lr & 0x40 ? scaled : silent;
+	}
+	render_put_stereo_sample(context->audio, left, right);
+}
+
+static void ym_step(ym2612_context *context)
+{
+	//Update timers at beginning of 144 cycle period
+	if (!context->current_op) {
+		ym_run_timers(context);
+	}
+	//Update Envelope Generator
+	if (!(context->current_op % 3)) {
+		uint32_t op = context->current_env_op;
+		ym_operator * operator = context->operators + op;
+		ym_channel * channel = context->channels + op/4;
+		ym_run_envelope(context, channel, operator);
+		context->current_env_op++;
+		if (context->current_env_op == NUM_OPERATORS) {
+			context->current_env_op = 0;
+			context->env_counter++;
+		}
+	}
+
+	//Update Phase Generator
+	ym_run_phase(context, context->current_op / 4, context->current_op);
+	context->current_op++;
+	if (context->current_op == NUM_OPERATORS) {
+		context->current_op = 0;
+		ym_output_sample(context);
+	}
+}
+
+#define ENV_OPS_PER_SAMPLE (NUM_OPERATORS / 3)
+
+//Runs whole output periods one channel at a time. ym_step updates envelope current_env_op + n on
+//step 3n and the phase of operator n on step n, but an envelope update only affects its own operator
+//so it can be moved to just before or after that operator's phase update, whichever matches the
+//order of the steps. Timers and the LFO only change at the start of a period, so the AM offset is
+//computed once per channel
+static void ym_run_samples(ym2612_context *context, uint32_t samples)
+{
+	for (; samples; samples--)
+	{
+		ym_run_timers(context);
+		uint32_t first_env_op = context->current_env_op;
+		for (uint32_t channel = 0; channel < NUM_CHANNELS; channel++)
+		{
+			ym_channel *chan = context->channels + channel;
+			uint8_t phase_enabled = channel != 5 || !context->dac_enable;
+			uint16_t am_offset = ym_am_offset(context, chan);
+			for (uint32_t op = channel * 4; op < (channel + 1) * 4; op++)
+			{
+				ym_operator *operator = context->operators + op;
+				uint8_t env_update = op - first_env_op < ENV_OPS_PER_SAMPLE;
+				if (env_update && 3 * (op - first_env_op) <= op) {
+					ym_run_envelope(context, chan, operator);
+					env_update = 0;
+				}
+				if (phase_enabled) {
+					ym_update_operator(chan, operator, op, am_offset);
+				}
+				if (env_update) {
+					ym_run_envelope(context, chan, operator);
+				}
+			}
+			if (phase_enabled) {
+				ym_update_channel_output(context, channel);
+			}
+		}
+		context->current_env_op += ENV_OPS_PER_SAMPLE;
+		if (context->current_env_op == NUM_OPERATORS) {
+			context->current_env_op = 0;
+			context->env_counter++;
+		}
+		ym_mix_sample(context);
+		context->current_cycle += context->clock_inc * NUM_OPERATORS;
+	}
+}
+
 void ym_run(ym2612_context * context, uint32_t to_cycle)
 {
 	if (context->current_cycle >= to_cycle) {
@@ -632,34 +771,40 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 	}
 	//printf("Running YM2612 from cycle %d to cycle %d\n", context->current_cycle, to_cycle);
 	//TODO: Fix channel update order OR remap channels in register write
+	//step to the start of the next output period so that whole periods can be run in one go
+	for (; context->current_op && context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
+		ym_step(context);
+	}
+	if (
+		context->current_cycle < to_cycle && !context->single_step
+		&& !(context->current_env_op % ENV_OPS_PER_SAMPLE)
+	) {
+		uint32_t steps = (to_cycle - context->current_cycle + context->clock_inc - 1) / context->clock_inc;
+		ym_run_samples(context, steps / NUM_OPERATORS);
+	}
 	for (; context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
-		//Update timers at beginning of 144 cycle period
+		ym_step(context);
+	}
+	//printf("Done running YM2612 at cycle %d\n", context->current_cycle, to_cycle);
+}
+
+void ym_run_status(ym2612_context * context, uint32_t to_cycle)
+{
+	uint32_t period = context->clock_inc * NUM_OPERATORS;
+	while (context->current_cycle < to_cycle)
+	{
 		if (!context->current_op) {
 			ym_run_timers(context);
-		}
-		//Update Envelope Generator
-		if (!(context->current_op % 3)) {
-			uint32_t op = context->current_env_op;
-			ym_operator * operator = context->operators + op;
-			ym_channel * channel = context->channels + op/4;
-			ym_run_envelope(context, channel, operator);
-			context->current_env_op++;
-			if (context->current_env_op == NUM_OPERATORS) {
-				context->current_env_op = 0;
-				context->env_counter++;
+			if (to_cycle - context->current_cycle >= period) {
+				context->current_cycle += period;
+				continue;
 			}
 		}
-
-		//Update Phase Generator
-		ym_run_phase(context, context->current_op / 4, context->current_op);
-		context->current_op++;
-		if (context->current_op == NUM_OPERATORS) {
+		if (++context->current_op == NUM_OPERATORS) {
 			context->current_op = 0;
-			ym_output_sample(context);
 		}
-		
+		context->current_cycle += context->clock_inc;
 	}
-	//printf("Done running YM2612 at cycle %d\n", context->current_cycle, to_cycle);
 }
 
 void ym_address_write_part1(ym2612_context * context, uint8_t address)
@@ -1374,3 +1519,37 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 		context->last_status_cycle = context->write_cycle;
 	}
 }
+
+void ym_restore(ym2612_context *context, ym2612_context const *snapshot)
+{
+	audio_source *audio = context->audio;
+	vgm_writer *vgm = context->vgm;
+	FILE *logfiles[NUM_CHANNELS];
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		logfiles[i] = context->channels[i].logfile;
+	}
+	memcpy(context, snapshot, sizeof(ym2612_context));
+	context->audio = audio;
+	context->vgm = vgm;
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		context->channels[i].logfile = logfiles[i];
+	}
+}
+
+void ym_copy_state(ym2612_context *context, ym2612_context const *src)
+{
+	ym_restore(context, src);
+	//modulation sources point into the operators and channels of the context they were set up in
+	for (int i = 0; i < NUM_OPERATORS; i++)
+	{
+		for (int j = 0; j < 2; j++)
+		{
+			int16_t *mod_src = context->operators[i].mod_src[j];
+			if (mod_src) {
+				context->operators[i].mod_src[j] = (int16_t *)((uint8_t *)context + ((uint8_t *)mod_src - (uint8_t const *)src));
+			}
+		}
+	}
+}
@@ -18,6 +18,11 @@
 
 #define YM_OPT_WAVE_LOG 1
 #define YM_OPT_3834 2
+//always step through the operators one at a time instead of running whole output periods
+#define YM_OPT_SINGLE_STEP 4
+
+//volume scaled channel outputs indexed by clamped output >> 4
+#define MIX_TABLE_SIZE 0x400
 
 typedef struct {
 	int16_t  *mod_src[2];
@@ -82,6 +87,8 @@ typedef struct {
 	int32_t     volume_div;
 	ym_operator operators[NUM_OPERATORS];
 	ym_channel  channels[NUM_CHANNELS];
+	int16_t     mix_table[MIX_TABLE_SIZE];
+	int16_t     mix_silent[2];
 	int16_t     zero_offset;
 	uint16_t    timer_a;
 	uint16_t    timer_a_load;
@@ -106,6 +113,7 @@ typedef struct {
 	uint8_t     last_status;
 	uint8_t     selected_reg;
 	uint8_t     selected_part;
+	uint8_t     single_step;
 	uint8_t     part1_regs[YM_PART1_REGS];
 	uint8_t     part2_regs[YM_PART2_REGS];
 } ym2612_context;
@@ -143,6 +151,8 @@ void ym_enable_zero_offset(ym2612_context *context, uint8_t enabled);
 void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock);
 void ym_adjust_cycles(ym2612_context *context, uint32_t deduction);
 void ym_run(ym2612_context * context, uint32_t to_cycle);
+//runs only the timers and the LFO, for a copy of the chip whose samples are rendered from another one
+void ym_run_status(ym2612_context * context, uint32_t to_cycle);
 void ym_address_write_part1(ym2612_context * context, uint8_t address);
 void ym_address_write_part2(ym2612_context * context, uint8_t address);
 void ym_data_write(ym2612_context * context, uint8_t value);
@@ -154,6 +164,9 @@ void ym_print_channel_info(ym2612_context *context, int channel);
 void ym_print_timer_info(ym2612_context *context);
 void ym_serialize(ym2612_context *context, serialize_buffer *buf);
 void ym_deserialize(deserialize_buffer *buf, void *vcontext);
+void ym_restore(ym2612_context *context, ym2612_context const *snapshot);
+//like ym_restore, but src is another live context rather than a snapshot of this one
+void ym_copy_state(ym2612_context *context, ym2612_context const *src);
 
 #endif //YM2612_H_
 
@@ -7,6 +7,7 @@
 #include "z80_to_x86.h"
 #include "gen_x86.h"
 #include "mem.h"
+#include "arena.h"
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -323,6 +324,195 @@ void z80_print_regs_exit(z80_context * context)
 	exit(0);
 }
 
+//emits the check of an instruction in a page of RAM that is in checked mode
+static void z80_check_code(z80_context *context, uint16_t address)
+{
+	z80_options *opts = context->options;
+	uint8_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+	if (!encoded || !code_page_at(&opts->gen, address)) {
+		return;
+	}
+	z80inst inst;
+	uint32_t size = z80_decode(encoded, &inst) - encoded;
+	if (code_is_checked(&opts->gen, address, size)) {
+		check_code_unchanged(&opts->gen, address, encoded, size, opts->code_changed_stub);
+	}
+}
+
+//state an idle loop may touch, registers use the bit of their index
+#define IDLE_Z  0x10000
+#define IDLE_C  0x20000
+#define IDLE_PV 0x40000
+#define IDLE_S  0x80000
+#define IDLE_FLAGS (IDLE_Z | IDLE_C | IDLE_PV | IDLE_S)
+#define IDLE_MAX_INSTS 16
+
+static uint32_t z80_idle_reg(uint8_t reg)
+{
+	return reg <= Z80_H || reg == Z80_A ? 1 << reg : 0;
+}
+
+static uint32_t z80_idle_cond(uint8_t cond)
+{
+	static const uint32_t flags[] = {IDLE_Z, IDLE_C, IDLE_PV, IDLE_S};
+	return flags[cond / 2];
+}
+
+//reads from memory without a handler can't have side effects or change while the Z80 runs
+static uint8_t z80_idle_read(z80_options *opts, uint16_t address)
+{
+	memmap_chunk const *chunk = find_map_chunk(address, &opts->gen, 0, NULL);
+	return chunk && chunk->buffer && !chunk->read_8 && (chunk->flags & MMAP_READ)
+		&& !(chunk->flags & (MMAP_PTR_IDX | MMAP_FUNC_NULL | MMAP_ONLY_ODD | MMAP_ONLY_EVEN));
+}
+
+//returns the cycles of an instruction that can be part of an idle loop along with the state it reads
+//and writes, 0 for anything else
+static uint32_t z80_idle_inst(z80_options *opts, z80inst *inst, uint32_t *reads, uint32_t *writes)
+{
+	uint32_t num_cycles = 4 * inst->opcode_bytes;
+	uint32_t reg = z80_idle_reg(inst->reg), ea = z80_idle_reg(inst->ea_reg);
+	switch (inst->op)
+	{
+	case Z80_LD:
+		if (!reg) {
+			return 0;
+		}
+		*writes = reg;
+		*reads = 0;
+		if (inst->addr_mode == Z80_REG && ea) {
+			*reads = ea;
+			return num_cycles;
+		} else if (inst->addr_mode == Z80_IMMED) {
+			return num_cycles + 3;
+		} else if (inst->addr_mode == Z80_IMMED_INDIRECT && inst->reg == Z80_A && z80_idle_read(opts, inst->immed)) {
+			return num_cycles + 6 + opts->gen.bus_cycles;
+		}
+		return 0;
+	case Z80_AND:
+	case Z80_OR:
+	case Z80_XOR:
+	case Z80_CP:
+		if (inst->reg != Z80_A) {
+			return 0;
+		}
+		*reads = reg;
+		*writes = IDLE_FLAGS | (inst->op == Z80_CP ? 0 : reg);
+		if (inst->addr_mode == Z80_REG && ea) {
+			*reads |= ea;
+			return num_cycles;
+		} else if (inst->addr_mode == Z80_IMMED) {
+			return num_cycles + 3;
+		}
+		return 0;
+	case Z80_BIT:
+		if (inst->addr_mode != Z80_REG || !ea) {
+			return 0;
+		}
+		*reads = ea;
+		*writes = IDLE_Z | IDLE_PV | IDLE_S;
+		return num_cycles;
+	}
+	return 0;
+}
+
+//Checks whether the loop from start to the branch back to it at end is an idle loop, i.e. one that
+//reads nothing but plain memory, writes no memory and can only be left by not taking that branch.
+//If every register or flag it changes is written before it is read, a whole pass through the loop
+//leaves the Z80 just like the pass before it until something outside of the loop writes memory,
+//which can't happen before the Z80 hits its cycle limit. Returns the cycles of a pass and the amount
+//added to R by one or 0 if the loop doesn't qualify
+static uint32_t z80_idle_loop(z80_context *context, uint16_t start, uint16_t end, z80inst *branch, uint8_t *r_inc)
+{
+	z80_options *opts = context->options;
+	uint32_t read_first = 0, written = 0, total = 0;
+	uint8_t r = 0;
+	uint16_t address = start;
+	for (int i = 0; i < IDLE_MAX_INSTS; i++)
+	{
+		if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
+			return 0;
+		}
+		z80inst inst, *cur = &inst;
+		uint32_t num_cycles, reads = 0, writes = 0;
+		if (address == end) {
+			cur = branch;
+			if (cur->op == Z80_JRCC || cur->op == Z80_JPCC) {
+				reads = z80_idle_cond(cur->reg);
+			}
+			//cycles of the branch when it's taken
+			num_cycles = 4 * cur->opcode_bytes + (cur->op == Z80_JR || cur->op == Z80_JRCC ? 8 : 6);
+		} else {
+			uint8_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+			if (!encoded) {
+				return 0;
+			}
+			address += z80_decode(encoded, cur) - encoded;
+			num_cycles = z80_idle_inst(opts, cur, &reads, &writes);
+			if (!num_cycles) {
+				return 0;
+			}
+		}
+		read_first |= reads & ~written;
+		written |= writes;
+		total += num_cycles;
+		r += cur->opcode_bytes > 1 ? 2 : 1;
+		if (cur == branch) {
+			if (read_first & written) {
+				return 0;
+			}
+			*r_inc = r;
+			return total;
+		}
+	}
+	return 0;
+}
+
+//Emitted on the branch back to the start of an idle loop, skips whole passes through the loop as long
+//as they end before the cycle limit. Every instruction boundary they contain is before the limit too,
+//so the translated code would have gone through them without doing anything else. The pass that just
+//ended only counts if it started at this branch, otherwise an interrupt or a stop may have let memory
+//change after the loop read it and the Z80 entered the loop part way through
+static void z80_skip_idle(z80_options *opts, uint32_t loop_cycles, uint8_t r_inc)
+{
+	code_info *code = &opts->gen.code;
+	uint32_t native = loop_cycles * opts->gen.clock_divider;
+	check_alloc_code(code, MAX_INST_LEN*6);
+	cmp_irdisp(code, 0, opts->gen.context_reg, offsetof(z80_context, idle_pass), SZ_B);
+	code_ptr first = code->cur + 1;
+	jcc(code, CC_Z, code->cur + 2);
+	cmp_ir(code, native, opts->gen.cycles, SZ_D);
+	code_ptr done = code->cur + 1;
+	jcc(code, CC_L, code->cur + 2);
+	code_ptr loop = code->cur;
+	sub_ir(code, native, opts->gen.cycles, SZ_D);
+	add_ir(code, r_inc, opts->regs[Z80_R], SZ_B);
+	cmp_ir(code, native, opts->gen.cycles, SZ_D);
+	jcc(code, CC_GE, loop);
+	*code_writable(done) = code->cur - (done + 1);
+	*code_writable(first) = code->cur - (first + 1);
+	mov_irdisp(code, 1, opts->gen.context_reg, offsetof(z80_context, idle_pass), SZ_B);
+}
+
+//returns 1 if the branch closes an idle loop, the caller then has to clear idle_pass where it doesn't
+//take the branch
+static uint8_t z80_check_idle(z80_context *context, z80inst *inst, uint16_t address, uint16_t dest)
+{
+	z80_options *opts = context->options;
+	uint8_t r_inc;
+	uint16_t dist = address - dest;
+	if (!(opts->flags & Z80_OPT_IDLE_SKIP) || dist > IDLE_MAX_INSTS * 4) {
+		return 0;
+	}
+	uint32_t loop_cycles = z80_idle_loop(context, dest, address, inst, &r_inc);
+	if (!loop_cycles) {
+		return 0;
+	}
+	z80_skip_idle(opts, loop_cycles, r_inc);
+	opts->gen.cache.idle_loops++;
+	return 1;
+}
+
 void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address, uint8_t interp)
 {
 	uint32_t num_cycles;
@@ -336,6 +526,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
 			zbreakpoint_patch(context, address, start);
 		}
+		z80_check_code(context, address);
 		num_cycles = 4 * inst->opcode_bytes;
 		add_ir(code, inst->opcode_bytes > 1 ? 2 : 1, opts->regs[Z80_R], SZ_B);
 #ifdef Z80_LOG_ADDRESS
@@ -631,7 +822,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		cycles(&opts->gen, 7);
 		mov_irdisp(code, 1, opts->gen.context_reg, zf_off(ZF_PV), SZ_B);
 		jmp(code, start);
-		*cont = code->cur - (cont + 1);
+		*code_writable(cont) = code->cur - (cont + 1);
 		cycles(&opts->gen, 2);
 		mov_irdisp(code, 0, opts->gen.context_reg, zf_off(ZF_PV), SZ_B);
 		break;
@@ -707,7 +898,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		cycles(&opts->gen, 7);
 		mov_irdisp(code, 1, opts->gen.context_reg, zf_off(ZF_PV), SZ_B);
 		jmp(code, start);
-		*cont = code->cur - (cont + 1);
+		*code_writable(cont) = code->cur - (cont + 1);
 		cycles(&opts->gen, 2);
 		mov_irdisp(code, 0, opts->gen.context_reg, zf_off(ZF_PV), SZ_B);
 		break;
@@ -787,8 +978,8 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		//repeat case
 		cycles(&opts->gen, 5);//T-States 5
 		jmp(code, start);
-		*cont = code->cur - (cont + 1);
-		*cont2 = code->cur - (cont2 + 1);
+		*code_writable(cont) = code->cur - (cont + 1);
+		*code_writable(cont2) = code->cur - (cont2 + 1);
 		break;
 	}
 	case Z80_CPD:
@@ -866,8 +1057,8 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		//repeat case
 		cycles(&opts->gen, 5);//T-States 5
 		jmp(code, start);
-		*cont = code->cur - (cont + 1);
-		*cont2 = code->cur - (cont2 + 1);
+		*code_writable(cont) = code->cur - (cont + 1);
+		*code_writable(cont2) = code->cur - (cont2 + 1);
 		break;
 	}
 	case Z80_ADD:
@@ -1338,22 +1529,22 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		code_ptr no_corf_low = code->cur + 1;
 		jmp(code, code->cur + 2);
 		
-		*corf_low_range = code->cur - (corf_low_range + 1);
+		*code_writable(corf_low_range) = code->cur - (corf_low_range + 1);
 		mov_ir(code, 0x90, opts->gen.scratch1, SZ_B);
-		*corf_low = code->cur - (corf_low + 1);
+		*code_writable(corf_low) = code->cur - (corf_low + 1);
 		mov_ir(code, 0x06, opts->gen.scratch2, SZ_B);
 		
-		*no_corf_low = code->cur - (no_corf_low + 1);
+		*code_writable(no_corf_low) = code->cur - (no_corf_low + 1);
 		cmp_irdisp(code, 0, opts->gen.context_reg, zf_off(ZF_C), SZ_B);
 		code_ptr corf_high = code->cur+1;
 		jcc(code, CC_NZ, code->cur+2);
 		cmp_rr(code, opts->gen.scratch1, opts->regs[Z80_A], SZ_B);
 		code_ptr no_corf_high = code->cur+1;
 		jcc(code, CC_C, code->cur+2);
-		*corf_high = code->cur - (corf_high + 1);
+		*code_writable(corf_high) = code->cur - (corf_high + 1);
 		or_ir(code, 0x60, opts->gen.scratch2, SZ_B);
 		mov_irdisp(code, 1, opts->gen.context_reg, zf_off(ZF_C), SZ_B);
-		*no_corf_high = code->cur - (no_corf_high + 1);
+		*code_writable(no_corf_high) = code->cur - (no_corf_high + 1);
 		
 		mov_rr(code, opts->regs[Z80_A], opts->gen.scratch1, SZ_B);
 		xor_rr(code, opts->gen.scratch2, opts->gen.scratch1, SZ_B);
@@ -1362,7 +1553,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		code_ptr not_sub = code->cur+1;
 		jcc(code, CC_Z, code->cur+2);
 		neg_r(code, opts->gen.scratch2, SZ_B);
-		*not_sub = code->cur - (not_sub + 1);
+		*code_writable(not_sub) = code->cur - (not_sub + 1);
 		
 		add_rr(code, opts->gen.scratch2, opts->regs[Z80_A], SZ_B);
 		setcc_rdisp(code, CC_Z, opts->gen.context_reg, zf_off(ZF_Z));
@@ -2062,6 +2253,9 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		}
 		cycles(&opts->gen, num_cycles);
 		if (inst->addr_mode != Z80_REG_INDIRECT) {
+			if (!interp) {
+				z80_check_idle(context, inst, address, inst->immed);
+			}
 			code_ptr call_dst = z80_get_native_address(context, inst->immed);
 			if (!call_dst) {
 				opts->gen.deferred = defer_address(opts->gen.deferred, inst->immed, code->cur + 1);
@@ -2109,6 +2303,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		uint8_t *no_jump_off = code->cur+1;
 		jcc(code, cond, code->cur+2);
 		uint16_t dest_addr = inst->immed;
+		uint8_t idle = !interp && z80_check_idle(context, inst, address, dest_addr);
 		code_ptr call_dst = z80_get_native_address(context, dest_addr);
 			if (!call_dst) {
 			opts->gen.deferred = defer_address(opts->gen.deferred, dest_addr, code->cur + 1);
@@ -2116,12 +2311,18 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 			call_dst = code->cur + 256;
 			}
 		jmp(code, call_dst);
-		*no_jump_off = code->cur - (no_jump_off+1);
+		*code_writable(no_jump_off) = code->cur - (no_jump_off+1);
+		if (idle) {
+			mov_irdisp(code, 0, opts->gen.context_reg, offsetof(z80_context, idle_pass), SZ_B);
+		}
 		break;
 	}
 	case Z80_JR: {
 		cycles(&opts->gen, num_cycles + 8);//T States: 4,3,5
 		uint16_t dest_addr = address + inst->immed + 2;
+		if (!interp) {
+			z80_check_idle(context, inst, address, dest_addr);
+		}
 		code_ptr call_dst = z80_get_native_address(context, dest_addr);
 			if (!call_dst) {
 			opts->gen.deferred = defer_address(opts->gen.deferred, dest_addr, code->cur + 1);
@@ -2151,6 +2352,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		jcc(code, cond, code->cur+2);
 		cycles(&opts->gen, 5);//T States: 5
 		uint16_t dest_addr = address + inst->immed + 2;
+		uint8_t idle = !interp && z80_check_idle(context, inst, address, dest_addr);
 		code_ptr call_dst = z80_get_native_address(context, dest_addr);
 			if (!call_dst) {
 			opts->gen.deferred = defer_address(opts->gen.deferred, dest_addr, code->cur + 1);
@@ -2158,7 +2360,10 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 			call_dst = code->cur + 256;
 			}
 		jmp(code, call_dst);
-		*no_jump_off = code->cur - (no_jump_off+1);
+		*code_writable(no_jump_off) = code->cur - (no_jump_off+1);
+		if (idle) {
+			mov_irdisp(code, 0, opts->gen.context_reg, offsetof(z80_context, idle_pass), SZ_B);
+		}
 		break;
 	}
 	case Z80_DJNZ: {
@@ -2179,7 +2384,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 			call_dst = code->cur + 256;
 			}
 		jmp(code, call_dst);
-		*no_jump_off = code->cur - (no_jump_off+1);
+		*code_writable(no_jump_off) = code->cur - (no_jump_off+1);
 		break;
 		}
 	case Z80_CALL: {
@@ -2237,7 +2442,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 			call_dst = code->cur + 256;
 			}
 		jmp(code, call_dst);
-		*no_call_off = code->cur - (no_call_off+1);
+		*code_writable(no_call_off) = code->cur - (no_call_off+1);
 		break;
 		}
 	case Z80_RET:
@@ -2281,7 +2486,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		add_ir(code, 2, opts->regs[Z80_SP], SZ_W);
 		call(code, opts->native_addr);
 		jmp_r(code, opts->gen.scratch1);
-		*no_call_off = code->cur - (no_call_off+1);
+		*code_writable(no_call_off) = code->cur - (no_call_off+1);
 		break;
 	}
 	case Z80_RETI:
@@ -2470,7 +2675,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		jcc(code, CC_Z, code->cur+2);
 		cycles(&opts->gen, 5);
 		jmp(code, start);
-		*done = code->cur - (done + 1);
+		*code_writable(done) = code->cur - (done + 1);
 		break;
 	}
 	case Z80_IND:
@@ -2595,7 +2800,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		jcc(code, CC_Z, code->cur+2);
 		cycles(&opts->gen, 5);
 		jmp(code, start);
-		*done = code->cur - (done + 1);
+		*code_writable(done) = code->cur - (done + 1);
 		break;
 	}
 	case Z80_OUT:
@@ -2715,7 +2920,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		jcc(code, CC_Z, code->cur+2);
 		cycles(&opts->gen, 5);
 		jmp(code, start);
-		*done = code->cur - (done + 1);
+		*code_writable(done) = code->cur - (done + 1);
 		break;
 	}
 	case Z80_OUTD:
@@ -2814,7 +3019,7 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 		jcc(code, CC_Z, code->cur+2);
 		cycles(&opts->gen, 5);
 		jmp(code, start);
-		*done = code->cur - (done + 1);
+		*code_writable(done) = code->cur - (done + 1);
 		break;
 	}
 	default: {
@@ -2925,7 +3130,10 @@ void z80_map_native_address(z80_context * context, uint32_t address, uint8_t * n
 			uint32_t masked = (address & mem_chunk->mask);
 			uint32_t final_off = masked + meta_off;
 			uint32_t ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			//writes to checked pages don't need to look for translated code
+			if (!opts->gen.code_pages[final_off >> opts->gen.ram_flags_shift].checked) {
+				context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			}
 
 			uint32_t slot = final_off / 1024;
 			if (!opts->gen.ram_inst_sizes[slot]) {
@@ -2937,7 +3145,9 @@ void z80_map_native_address(z80_context * context, uint32_t address, uint8_t * n
 			masked = (address + size - 1) & mem_chunk->mask;
 			final_off = masked + meta_off;
 			ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			if (!opts->gen.code_pages[final_off >> opts->gen.ram_flags_shift].checked) {
+				context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			}
 		}
 		//calculate the lowest alias for this address
 		address = mem_chunk->start + ((address - mem_chunk->start) & mem_chunk->mask);
@@ -3000,8 +3210,53 @@ uint32_t z80_get_instruction_start(z80_context *context, uint32_t address)
 //Technically unbounded due to redundant prefixes, but this is the max useful size
 #define Z80_MAX_INST_SIZE 4
 
+//an instruction that starts this far before a page can still have code in it
+#define Z80_PAGE_OVERLAP (Z80_MAX_INST_SIZE - 1)
+
+static void invalidate_page(z80_context *context, code_page *page)
+{
+	cpu_options *opts = &context->options->gen;
+	uint32_t start = page->address - Z80_PAGE_OVERLAP;
+	if (find_map_chunk(start, opts, 0, NULL) != find_map_chunk(page->address, opts, 0, NULL)) {
+		start = page->address;
+	}
+	z80_invalidate_code_range(context, start, page->address + (1 << opts->ram_flags_shift) - 1);
+}
+
+static void leave_checked_page(void *context, code_page *page)
+{
+	//translated again without checks, which sets the page's ram_code_flags bit again
+	invalidate_page(context, page);
+}
+
+void z80_code_pages_frame(z80_context *context)
+{
+	code_pages_frame(&context->options->gen, context, leave_checked_page);
+}
+
+//checked code jumps here through code_changed_stub when its instruction changed, the instruction is
+//patched to be retranslated like a write to it would and then run again
+static code_ptr z80_code_changed(uint32_t address, z80_context *context)
+{
+	z80_options *opts = context->options;
+	code_ptr native = z80_get_native_address(context, address);
+	code_info code = {native, native + 32, 0};
+	mov_ir(&code, address, opts->gen.scratch1, SZ_D);
+	call(&code, opts->retrans_stub);
+	return native;
+}
+
 z80_context * z80_handle_code_write(uint32_t address, z80_context * context)
 {
+	z80_options *options = context->options;
+	code_page *page = code_page_write(&options->gen, address);
+	if (page) {
+		//the code in the page is translated again with checks, until then writes can go through
+		uint32_t index = page - options->gen.code_pages;
+		context->ram_code_flags[index / 8] &= ~(1 << (index % 8));
+		invalidate_page(context, page);
+		return context;
+	}
 	uint32_t inst_start = z80_get_instruction_start(context, address);
 	while (inst_start != INVALID_INSTRUCTION_START && (address - inst_start) < Z80_MAX_INST_SIZE) {
 		code_ptr dst = z80_get_native_address(context, inst_start);
@@ -3079,6 +3334,11 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 	z80_options * opts = context->options;
 	uint8_t orig_size = z80_get_native_inst_size(opts, address);
 	code_info *code = &opts->gen.code;
+	code_page *page = code_page_at(&opts->gen, address);
+	if (page) {
+		page->retranslations++;
+	}
+	opts->gen.cache.retranslations++;
 	uint8_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 	z80inst instbuf;
 	dprintf("Retranslating code at Z80 address %X, native address %p\n", address, orig_start);
@@ -3114,6 +3374,8 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 			}
 		}*/
 		z80_map_native_address(context, address, start, after-inst, ZMAX_NATIVE_SIZE);
+		code_cache_count(&opts->gen, ZMAX_NATIVE_SIZE);
+		opts->gen.cache.translated_insts++;
 		code_info tmp_code = {orig_start, orig_start + 16};
 		jmp(&tmp_code, start);
 		tmp_code = *code;
@@ -3163,6 +3425,7 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 			if (!encoded) {
 				code_info stub = z80_make_interp_stub(context, address);
 				z80_map_native_address(context, address, stub.cur, 1, stub.last - stub.cur);
+				code_cache_count(&opts->gen, stub.last - stub.cur);
 				break;
 			}
 			//make sure prologue is in a contiguous chunk of code
@@ -3179,6 +3442,8 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 			code_ptr start = opts->gen.code.cur;
 			translate_z80inst(&inst, context, address, 0);
 			z80_map_native_address(context, address, start, next-encoded, opts->gen.code.cur - start);
+			code_cache_count(&opts->gen, opts->gen.code.cur - start);
+			opts->gen.cache.translated_insts++;
 			address += next-encoded;
 				address &= 0xFFFF;
 		} while (!z80_is_terminal(&inst));
@@ -3204,8 +3469,9 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	options->gen.mem_ptr_off = offsetof(z80_context, mem_pointers);
 	options->gen.ram_flags_off = offsetof(z80_context, ram_code_flags);
 	options->gen.ram_flags_shift = 7;
+	options->gen.ram_dirty_off = options->gen.ram_flags_off + ram_size(&options->gen) / (1 << options->gen.ram_flags_shift) / 8;
 
-	options->flags = 0;
+	options->flags = Z80_OPT_IDLE_SKIP;
 #ifdef X86_64
 	options->regs[Z80_B] = BH;
 	options->regs[Z80_C] = RBX;
@@ -3254,6 +3520,7 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	uint32_t inst_size_size = sizeof(uint8_t *) * ram_size(&options->gen) / 1024;
 	options->gen.ram_inst_sizes = malloc(inst_size_size);
 	memset(options->gen.ram_inst_sizes, 0, inst_size_size);
+	code_pages_init(&options->gen);
 
 	code_info *code = &options->gen.code;
 	init_code_info(code);
@@ -3364,7 +3631,7 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	//return to caller of z80_run
 	retn(code);
 	
-	*no_sync = code->cur - (no_sync + 1);
+	*code_writable(no_sync) = code->cur - (no_sync + 1);
 	neg_r(code, options->gen.cycles, SZ_D);
 	add_rdispr(code, options->gen.context_reg, offsetof(z80_context, target_cycle), options->gen.cycles, SZ_D);
 	retn(code);
@@ -3402,7 +3669,7 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	restore_callee_save_regs(code);
 	//return to caller of z80_run
 	retn(code);
-	*skip_sync = code->cur - (skip_sync+1);
+	*code_writable(skip_sync) = code->cur - (skip_sync+1);
 	neg_r(code, options->gen.cycles, SZ_D);
 	add_rdispr(code, options->gen.context_reg, offsetof(z80_context, target_cycle), options->gen.cycles, SZ_D);
 	retn(code);
@@ -3416,6 +3683,8 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	//check that we are not past the end of interrupt pulse
 	cmp_rrdisp(code, options->gen.cycles, options->gen.context_reg, offsetof(z80_context, int_pulse_end), SZ_D);
 	jcc(code, CC_B, skip_int);
+	//the interrupted pass through an idle loop can't be skipped past
+	mov_irdisp(code, 0, options->gen.context_reg, offsetof(z80_context, idle_pass), SZ_B);
 	//set limit to the cycle limit
 	mov_rdispr(code, options->gen.context_reg, offsetof(z80_context, sync_cycle), options->gen.scratch2, SZ_D);
 	mov_rrdisp(code, options->gen.scratch2, options->gen.context_reg, offsetof(z80_context, target_cycle), SZ_D);
@@ -3430,12 +3699,12 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	cycles(&options->gen, 6); //interupt ack cycle
 	code_ptr after_int_disable = code->cur + 1;
 	jmp(code, after_int_disable);
-	*is_nmi = code->cur - (is_nmi + 1);
+	*code_writable(is_nmi) = code->cur - (is_nmi + 1);
 	mov_rdispr(code, options->gen.context_reg, offsetof(z80_context, iff1), options->gen.scratch2, SZ_B);
 	mov_irdisp(code, 0, options->gen.context_reg, offsetof(z80_context, iff1), SZ_B);
 	mov_rrdisp(code, options->gen.scratch2, options->gen.context_reg, offsetof(z80_context, iff2), SZ_B);
 	cycles(&options->gen, 5); //NMI processing cycles
-	*after_int_disable = code->cur - (after_int_disable + 1);
+	*code_writable(after_int_disable) = code->cur - (after_int_disable + 1);
 	//save return address (in scratch1) to Z80 stack
 	sub_ir(code, 2, options->regs[Z80_SP], SZ_W);
 	mov_rr(code, options->regs[Z80_SP], options->gen.scratch2, SZ_W);
@@ -3471,7 +3740,7 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	cycles(&options->gen, 1); //total time for mode 0/1 is 13 t-states
 	code_ptr after_int_dest = code->cur + 1;
 	jmp(code, after_int_dest);
-	*im2 = code->cur - (im2 + 1);
+	*code_writable(im2) = code->cur - (im2 + 1);
 	//read vector address from I << 8 | vector
 	mov_rdispr(code, options->gen.context_reg, offsetof(z80_context, regs) + Z80_I, options->gen.scratch1, SZ_B);
 	shl_ir(code, 8, options->gen.scratch1, SZ_W);
@@ -3492,12 +3761,12 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	or_rr(code, options->gen.scratch2, options->gen.scratch1, SZ_W);
 	code_ptr after_int_dest2 = code->cur + 1;
 	jmp(code, after_int_dest2);
-	*is_nmi = code->cur - (is_nmi + 1);
+	*code_writable(is_nmi) = code->cur - (is_nmi + 1);
 	mov_irdisp(code, 0, options->gen.context_reg, offsetof(z80_context, int_is_nmi), SZ_B);
 	mov_irdisp(code, CYCLE_NEVER, options->gen.context_reg, offsetof(z80_context, nmi_start), SZ_D);
 	mov_ir(code, 0x66, options->gen.scratch1, SZ_W);
-	*after_int_dest = code->cur - (after_int_dest + 1);
-	*after_int_dest2 = code->cur - (after_int_dest2 + 1);
+	*code_writable(after_int_dest) = code->cur - (after_int_dest + 1);
+	*code_writable(after_int_dest2) = code->cur - (after_int_dest2 + 1);
 	call(code, options->native_addr);
 	mov_rrind(code, options->gen.scratch1, options->gen.context_reg, SZ_PTR);
 	tmp_stack_off = code->stack_off;
@@ -3600,6 +3869,15 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	call(code, options->gen.load_context);
 	jmp_r(code, options->gen.scratch1);
 
+	options->code_changed_stub = code->cur;
+	call(code, options->gen.save_context);
+	push_r(code, options->gen.context_reg);
+	call_args(code, (code_ptr)z80_code_changed, 2, options->gen.scratch1, options->gen.context_reg);
+	pop_r(code, options->gen.context_reg);
+	mov_rr(code, RAX, options->gen.scratch1, SZ_PTR);
+	call(code, options->gen.load_context);
+	jmp_r(code, options->gen.scratch1);
+
 	options->run = (z80_ctx_fun)code->cur;
 	tmp_stack_off = code->stack_off;
 	save_callee_save_regs(code);
@@ -3615,14 +3893,17 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	sub_ir(code, 16-sizeof(void *), RSP, SZ_PTR);	
 	push_rdisp(code, options->gen.context_reg, offsetof(z80_context, extra_pc));
 	mov_irdisp(code, 0, options->gen.context_reg, offsetof(z80_context, extra_pc), SZ_PTR);
-	*no_extra = code->cur - (no_extra + 1);
+	*code_writable(no_extra) = code->cur - (no_extra + 1);
 	jmp_rind(code, options->gen.context_reg);
 	code->stack_off = tmp_stack_off;
+
+	code_cache_init(&options->gen);
 }
 
 z80_context *init_z80_context(z80_options * options)
 {
-	size_t ctx_size = sizeof(z80_context) + ram_size(&options->gen) / (1 << options->gen.ram_flags_shift) / 8;
+	size_t ctx_size = sizeof(z80_context) + ram_size(&options->gen) / (1 << options->gen.ram_flags_shift) / 8
+		+ (ram_size(&options->gen) >> (RAM_DIRTY_SHIFT + 3));
 	z80_context *context = calloc(1, ctx_size);
 	context->options = options;
 	context->int_cycle = CYCLE_NEVER;
@@ -3668,6 +3949,7 @@ void z80_run(z80_context * context, uint32_t target_cycle)
 				
 				context->target_cycle = context->sync_cycle < context->int_cycle ? context->sync_cycle : context->int_cycle;
 				dprintf("Running Z80 from cycle %d to cycle %d. Int cycle: %d (%d - %d)\n", context->current_cycle, context->sync_cycle, context->int_cycle, context->int_pulse_start, context->int_pulse_end);
+				context->idle_pass = 0;
 				context->options->run(context);
 				dprintf("Z80 ran to cycle %d\n", context->current_cycle);
 			}
@@ -3695,9 +3977,60 @@ void z80_options_free(z80_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	code_pages_free(&opts->gen);
+	free_arena(opts->gen.code.blocks);
 	free(opts);
 }
 
+//offset of native_pc from the start of the translated instruction at pc, -1 if the CPU was stopped
+//somewhere that can't be found again in a retranslated copy
+int32_t z80_resume_offset(z80_context *context)
+{
+	if (!context->native_pc) {
+		return 0;
+	}
+	if (context->extra_pc) {
+		//stopped in the middle of a memory access
+		return -1;
+	}
+	code_ptr native = z80_get_native_address(context, context->pc);
+	if (context->native_pc == native) {
+		return 0;
+	}
+	if (native && context->native_pc == native + context->options->gen.prologue_size) {
+		return context->options->gen.prologue_size;
+	}
+	return -1;
+}
+
+//points native_pc at the current translation of pc after the code cache was flushed
+void z80_rebase_resume(z80_context *context, int32_t offset)
+{
+	if (context->native_pc) {
+		context->native_pc = z80_get_native_address_trans(context, context->pc) + offset;
+	}
+}
+
+void zcreate_stub(z80_context * context);
+//throws away all translated code, returns 0 without doing anything if the CPU can't be resumed
+//in retranslated code
+uint8_t z80_flush_code_cache(z80_context *context)
+{
+	z80_options *opts = context->options;
+	int32_t offset = z80_resume_offset(context);
+	if (offset < 0) {
+		return 0;
+	}
+	code_cache_flush(&opts->gen, NATIVE_MAP_CHUNKS);
+	memset(context->ram_code_flags, 0, ram_size(&opts->gen) / (1 << opts->gen.ram_flags_shift) / 8);
+	memset(context->interp_code, 0, sizeof(context->interp_code));
+	if (context->bp_stub) {
+		zcreate_stub(context);
+	}
+	z80_rebase_resume(context, offset);
+	return 1;
+}
+
 void z80_assert_reset(z80_context * context, uint32_t cycle)
 {
 	z80_run(context, cycle);
@@ -3841,7 +4174,7 @@ void zcreate_stub(z80_context * context)
 #endif
 	push_r(code, opts->gen.scratch1);
 	jmp(code, opts->gen.handle_cycle_limit_int);
-	*jmp_off = code->cur - (jmp_off+1);
+	*code_writable(jmp_off) = code->cur - (jmp_off+1);
 		//jump back to body of translated instruction
 	pop_r(code, opts->gen.scratch1);
 	add_ir(code, check_int_size - patch_size, opts->gen.scratch1, SZ_PTR);
@@ -3983,3 +4316,16 @@ void z80_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->native_pc = context->extra_pc = NULL;
 }
 
+//breakpoint_flags through next_int_pulse hold debugger and translator state, so they are left out of snapshots
+void z80_snapshot(z80_context *context, void *dst)
+{
+	memcpy(dst, context, offsetof(z80_context, breakpoint_flags));
+	memcpy((uint8_t *)dst + offsetof(z80_context, breakpoint_flags), &context->reset, sizeof(z80_context) - offsetof(z80_context, reset));
+}
+
+void z80_restore(z80_context *context, void const *src)
+{
+	memcpy(context, src, offsetof(z80_context, breakpoint_flags));
+	memcpy(&context->reset, (uint8_t const *)src + offsetof(z80_context, breakpoint_flags), sizeof(z80_context) - offsetof(z80_context, reset));
+}
+
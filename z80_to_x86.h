@@ -15,6 +15,8 @@
 #else
 #define ZMAX_NATIVE_SIZE 160
 #endif
+//branches back to the start of an idle loop skip passes through it up to the cycle limit, see z80_skip_idle
+#define Z80_OPT_IDLE_SKIP 1
 
 enum {
 	ZF_C = 0,
@@ -36,6 +38,7 @@ typedef struct {
 	code_ptr        load_context_scratch;
 	code_ptr        native_addr;
 	code_ptr        retrans_stub;
+	code_ptr        code_changed_stub; //checked code jumps here with its address in scratch1 when it changed
 	code_ptr        do_sync;
 	code_ptr        read_8;
 	code_ptr        write_8;
@@ -47,7 +50,7 @@ typedef struct {
 	code_ptr		read_io;
 	code_ptr		write_io;
 
-	uint32_t        flags;
+	uint32_t        flags;         //Z80_OPT_* flags
 	int8_t          regs[Z80_UNUSED];
 	z80_ctx_fun     run;
 } z80_options;
@@ -88,6 +91,7 @@ struct z80_context {
 	uint8_t           busack;
 	uint8_t           int_is_nmi;
 	uint8_t           im2_vector;
+	uint8_t           idle_pass; //the pass through an idle loop in progress started at its branch back, see z80_skip_idle
 	uint8_t           ram_code_flags[];
 };
 
@@ -97,8 +101,13 @@ void z80_options_free(z80_options *opts);
 z80_context * init_z80_context(z80_options * options);
 code_ptr z80_get_native_address(z80_context * context, uint32_t address);
 code_ptr z80_get_native_address_trans(z80_context * context, uint32_t address);
+int32_t z80_resume_offset(z80_context *context);
+void z80_rebase_resume(z80_context *context, int32_t offset);
+uint8_t z80_flush_code_cache(z80_context *context);
 z80_context * z80_handle_code_write(uint32_t address, z80_context * context);
 void z80_invalidate_code_range(z80_context *context, uint32_t start, uint32_t end);
+//called once per frame to switch pages of RAM code in and out of checked mode, see code_page
+void z80_code_pages_frame(z80_context *context);
 void z80_reset(z80_context * context);
 void zinsert_breakpoint(z80_context * context, uint16_t address, uint8_t * bp_handler);
 void zremove_breakpoint(z80_context * context, uint16_t address);
@@ -112,6 +121,10 @@ uint8_t z80_get_busack(z80_context * context, uint32_t cycle);
 void z80_adjust_cycles(z80_context * context, uint32_t deduction);
 void z80_serialize(z80_context *context, serialize_buffer *buf);
 void z80_deserialize(deserialize_buffer *buf, void *vcontext);
+//size of the raw context image written by z80_snapshot
+#define Z80_SNAPSHOT_SIZE (offsetof(z80_context, breakpoint_flags) + sizeof(z80_context) - offsetof(z80_context, reset))
+void z80_snapshot(z80_context *context, void *dst);
+void z80_restore(z80_context *context, void const *src);
 
 #endif //Z80_TO_X86_H_
 
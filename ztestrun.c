@@ -17,13 +17,13 @@
 #include <stddef.h>
 #include <stdarg.h>
 
-void fatal_error(char *format, ...)
+int headless = 1;
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
 {
-	va_list args;
-	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
-	exit(1);
 }
 
 uint8_t z80_ram[0x2000];
@@ -62,6 +62,8 @@ int main(int argc, char ** argv)
 	z80_context *context;
 	char *fname = NULL;
 	uint8_t retranslate = 0;
+	uint8_t print_cycles = 0;
+	uint8_t no_idle_skip = 0;
 	for (int i = 1; i < argc; i++)
 	{
 		if (argv[i][0] == '-') {
@@ -70,6 +72,13 @@ int main(int argc, char ** argv)
 			case 'r':
 				retranslate = 1;
 				break;
+			case 'c':
+				//fast paths have to stop on the same cycle with the same R as the instructions they skip
+				print_cycles = 1;
+				break;
+			case 'i':
+				no_idle_skip = 1;
+				break;
 			default:
 				fprintf(stderr, "Unrecognized switch -%c\n", argv[i][1]);
 				exit(1);
@@ -97,6 +106,11 @@ int main(int argc, char ** argv)
 	}
 	fclose(f);
 	init_z80_opts(&opts, z80_map, 2, port_map, 1, 1, 0xFF);
+#ifndef NEW_CORE
+	if (no_idle_skip) {
+		opts.flags &= ~Z80_OPT_IDLE_SKIP;
+	}
+#endif
 	context = init_z80_context(&opts);
 #ifdef NEW_CORE
 	z80_execute(context, 1000);
@@ -117,6 +131,9 @@ int main(int argc, char ** argv)
 		context->alt[7], context->alt[0], context->alt[1],
 		context->alt[2], context->alt[3],
 		(context->alt[4] << 8) | context->alt[5]);
+	if (print_cycles) {
+		printf("R: %X\nCycle: %d\n", context->r & 0x7F, context->cycles);
+	}
 #else
 	//Z80 RAM
 	context->mem_pointers[0] = z80_ram;
@@ -149,6 +166,9 @@ int main(int argc, char ** argv)
 		context->alt_regs[Z80_A], context->alt_regs[Z80_B], context->alt_regs[Z80_C],
 		context->alt_regs[Z80_D], context->alt_regs[Z80_E],
 		(context->alt_regs[Z80_H] << 8) | context->alt_regs[Z80_L]);
+	if (print_cycles) {
+		printf("R: %X\nCycle: %d\n", context->regs[Z80_R] & 0x7F, context->current_cycle);
+	}
 #endif
 	return 0;
 }